@@ -16,6 +16,10 @@ if(${WITH_NETCDF})
 	endif()
 endif()
 
+# Configure Threads, used by the line cache read ahead and the thread pools
+message(STATUS "\nChecking for Threads")
+find_package(Threads REQUIRED QUIET)
+
 # Configure MPI if opted for
 if(${WITH_MPI})
 	message(STATUS "\nChecking for MPI")
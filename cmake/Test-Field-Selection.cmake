@@ -0,0 +1,26 @@
+## Test of -include/-exclude by either the .dfn label or NAME= of a field, run with cmake -P
+## Expects TESTER, CONVERTER and WORKDIR. The synthetic survey's COND field has NAME=conductivity.
+
+function(run_step name)
+	execute_process(COMMAND ${ARGN} WORKING_DIRECTORY ${WORKDIR} RESULT_VARIABLE status)
+	if(NOT status EQUAL 0)
+		message(FATAL_ERROR "${name} failed (${status})")
+	endif()
+endfunction()
+
+file(REMOVE_RECURSE ${WORKDIR})
+file(MAKE_DIRECTORY ${WORKDIR})
+
+run_step("Writing the synthetic ASEG-GDF2 survey" ${TESTER} -nlines 5 -nsamples 20 -writeaseggdf ${WORKDIR}/synthetic.dat)
+
+run_step("Including by variable name" ${CONVERTER} -include conductivity ${WORKDIR}/synthetic.dat ${WORKDIR}/include_name.nc)
+run_step("Checking the include by variable name" ${TESTER} -hasvars ${WORKDIR}/include_name.nc conductivity -novars ${WORKDIR}/include_name.nc height,easting)
+
+run_step("Including by label" ${CONVERTER} -include COND,height ${WORKDIR}/synthetic.dat ${WORKDIR}/include_label.nc)
+run_step("Checking the include by label" ${TESTER} -hasvars ${WORKDIR}/include_label.nc conductivity,height -novars ${WORKDIR}/include_label.nc easting)
+
+run_step("Excluding by variable name" ${CONVERTER} -exclude conductivity ${WORKDIR}/synthetic.dat ${WORKDIR}/exclude_name.nc)
+run_step("Checking the exclude by variable name" ${TESTER} -hasvars ${WORKDIR}/exclude_name.nc height,easting -novars ${WORKDIR}/exclude_name.nc conductivity)
+
+run_step("Excluding by label" ${CONVERTER} -exclude COND ${WORKDIR}/synthetic.dat ${WORKDIR}/exclude_label.nc)
+run_step("Checking the exclude by label" ${TESTER} -hasvars ${WORKDIR}/exclude_label.nc height -novars ${WORKDIR}/exclude_label.nc conductivity)
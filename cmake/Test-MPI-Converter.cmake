@@ -0,0 +1,17 @@
+## Round trip test of a converter run serially and with MPI, run with cmake -P
+## Expects TESTER, CONVERTER, MPIEXEC, NPFLAG, NP and WORKDIR, and optionally PREFLAGS and POSTFLAGS
+
+function(run_step name)
+	execute_process(COMMAND ${ARGN} WORKING_DIRECTORY ${WORKDIR} RESULT_VARIABLE status)
+	if(NOT status EQUAL 0)
+		message(FATAL_ERROR "${name} failed (${status})")
+	endif()
+endfunction()
+
+file(REMOVE_RECURSE ${WORKDIR})
+file(MAKE_DIRECTORY ${WORKDIR})
+
+run_step("Writing the synthetic ASEG-GDF2 survey" ${TESTER} -nlines 23 -nsamples 40 -writeaseggdf ${WORKDIR}/synthetic.dat)
+run_step("Serial conversion" ${CONVERTER} -statistics -histogram 16 -footprint 10 ${WORKDIR}/synthetic.dat ${WORKDIR}/serial.nc)
+run_step("MPI conversion" ${MPIEXEC} ${NPFLAG} ${NP} ${PREFLAGS} ${CONVERTER} ${POSTFLAGS} -statistics -histogram 16 -footprint 10 ${WORKDIR}/synthetic.dat ${WORKDIR}/mpi.nc)
+run_step("Comparing the serial and MPI output" ${TESTER} -compare ${WORKDIR}/serial.nc ${WORKDIR}/mpi.nc)
@@ -7,11 +7,17 @@ Author: Ross C. Brodie, Geoscience Australia.
 */
 
 #include <cstdio>
+#include <cmath>
+#include <climits>
 #include <netcdf>
 #include <vector>
 #include <limits>
 #include <algorithm>
+#include <numeric>
 #include <fstream>
+#include <memory>
+#include <map>
+#include <filesystem>
 
 #define _PROGRAM_ "aseggdf2netcdf"
 #define _VERSION_ "1.0"
@@ -25,6 +31,16 @@ Author: Ross C. Brodie, Geoscience Australia.
 
 #include "csvfile.h"
 #include "geophysics_netcdf.hpp"
+#include "aseggdf_scanner.h"
+#include "mpi_linewriter.h"
+#include "conversion_options.h"
+#include "bandmajor.h"
+#include "ncvar_utils.h"
+#include "line_index.h"
+#include "statistics.h"
+#include "footprint.h"
+#include "overview.h"
+#include "shards.h"
 
 using namespace netCDF;
 using namespace netCDF::exceptions;
@@ -37,20 +53,57 @@ class cASEGGDF2Converter {
 	std::string DatName;
 	std::string DfnPath;
 	std::string NCPath;
+	std::string OutPath;//the file being written, NCPath or one of its shards
+	size_t ShardIndex = 0;
+	cConversionOptions Options;
+	int MPIRank = 0;
+	int MPISize = 1;
+#ifdef ENABLE_MPI
+	std::unique_ptr<cMPILineWriter> Writer;
+#endif
+
+	//Per field conversion settings
+	std::string line_field_name;
+	int line_field_index = -1;
+	std::vector<bool> convertfield;
+	std::vector<nc_type> vartypes;
+	std::vector<std::string> varnames;
+	std::vector<double> missingvalues;
+	std::vector<double> scalefactors;//0 unless the field is packed
+	std::vector<double> addoffsets;
+	std::vector<nc_type> unpackedtypes;
+	std::vector<double> PackMin;//ranges of the fields to be packed, scanned once for all the shards
+	std::vector<double> PackMax;
+	int PackComplete = -1;//-1 until the ranges have been scanned
+	std::map<size_t, sCompressionSetting> AutoCompression;//per field, chosen by -autocompress
+	std::vector<cVariableStats> Stats;//per field, accumulated as the lines are written
+	cLineFootprints Footprints;//per line, from the coordinate fields as the lines are written
+	int footprint_xfield = -1;
+	int footprint_yfield = -1;
+	std::vector<size_t> OutIndex;//output line index of each input line, or SIZE_MAX if it is not in the current shard
+	std::vector<size_t> HilbertOrder;//kept for the other shards
 
 public:
 
 
-	cASEGGDF2Converter(const std::string& datpath, const std::string& ncpath, const std::string& commandline) {
+	cASEGGDF2Converter(const std::string& datpath, const std::string& ncpath, const std::string& commandline, const cConversionOptions& options) {
 		_GSTITEM_
 
 			DatPath = datpath;
+		Options = options;
 		DatName = extractfilename_noextension(DatPath);
 		DfnPath = extractfiledirectory(DatPath) + DatName + ".dfn";
 		NCPath = ncpath;
+		OutPath = ncpath;
 
-		std::string LogPath = NCPath + ".log";
-		std::string WLogPath = NCPath + ".warn.log";
+#ifdef ENABLE_MPI
+		MPI_Comm_rank(MPI_COMM_WORLD, &MPIRank);
+		MPI_Comm_size(MPI_COMM_WORLD, &MPISize);
+#endif
+		//Only the writer rank uses the normal log file names
+		std::string suffix = (MPIRank > 0) ? strprint(".rank%d", MPIRank) : "";
+		std::string LogPath = NCPath + suffix + ".log";
+		std::string WLogPath = NCPath + suffix + ".warn.log";
 
 		std::ofstream wlog(WLogPath, std::ios::ate);
 		cStreamRedirecter R(wlog, std::cerr);
@@ -61,7 +114,15 @@ public:
 		glog.logmsg("Version %s Compiled at %s on %s\n", _VERSION_, __TIME__, __DATE__);
 		glog.logmsg("%s\n", commandline.c_str());
 		glog.logmsg("Working directory: %s\n", getcurrentdirectory().c_str());
-		convert_aseggdf2_file();
+		if (Options.Shards > 0) {
+			convert_aseggdf2_file_sharded();
+		}
+		else if (MPISize > 1) {
+			convert_aseggdf2_file_mpi();
+		}
+		else {
+			convert_aseggdf2_file();
+		}
 		double t2 = gettime();
 		glog.logmsg("Elapsed time = %.2lf\n", t2 - t1);
 		glog.close();
@@ -72,40 +133,22 @@ public:
 		glog.close();
 	};
 
-	bool convert_aseggdf2_file() {
-		_GSTPUSH_
-
-			if (exists(DatPath) == false) {
-				glog.logmsg("Error 1: Data file %s does not exist\n", DatPath.c_str());
-				return false;
-			}
-
+	bool check_input_files() {
 		if (exists(DatPath) == false) {
-			glog.logmsg("Error 2: DFN file %s does not exist\n", DfnPath.c_str());
+			glog.logmsg("Error 1: Data file %s does not exist\n", DatPath.c_str());
 			return false;
 		}
 
-		glog.logmsg("Opening data file %s\n", DatPath.c_str());
-		cAsciiColumnFile AF(DatPath);
-
-		glog.logmsg("Parsing ASEGGDF2 header\n");
-		AF.parse_dfn_header(DfnPath);
-
-		//Force change attribute name "desc" or "DESC" to "description"
-		//for (size_t i = 0; i < AF.fields.size(); i++) {
-		//	for (size_t j = 0; j < AF.fields[i].atts.size(); j++) {
-		//		if (tolower(AF.fields[i].atts[j].first) == "desc") {
-		//			AF.fields[i].atts[j].first = "description";
-		//		}
-		//	}
-		//}
-
-		std::vector<unsigned int> line_number;
-		std::vector<unsigned int> line_index_start;
-		std::vector<unsigned int> line_index_count;
+		if (exists(DfnPath) == false) {
+			glog.logmsg("Error 2: DFN file %s does not exist\n", DfnPath.c_str());
+			return false;
+		}
+		return true;
+	}
 
-		int line_field_index = -1;
-		std::string line_field_name = "";
+	bool determine_line_field(cAsciiColumnFile& AF) {
+		line_field_index = -1;
+		line_field_name = "";
 		std::vector<std::string> cand = { "line", "linenumber", "line_number", "flightline", "fltline" };
 		glog.logmsg("Determining line field name\n");
 		for (size_t i = 0; i < cand.size(); i++) {
@@ -121,34 +164,21 @@ public:
 			std::string msg;
 			msg += strprint("Could not determin the line number field'\n");
 			glog.errormsg(_SRC_ + msg);
+			return false;
 		}
-		else {
-			glog.logmsg("Using %s as the 'line number' field\n", line_field_name.c_str());
-		}
-
-		glog.logmsg("Scanning for line index\n");
-		size_t npoints = AF.scan_for_line_index(line_field_index, line_index_start, line_index_count, line_number);
-		glog.logmsg("Total number of points is %d\n", (int)npoints);
-		glog.logmsg("Total number of lines is %d\n", (int)line_index_start.size());
-
-		glog.logmsg("Scanning for groupby fields\n");
-		std::vector<bool> isgroupby = AF.scan_for_groupby_fields(line_index_count);
-
-		bool status = exists(extractfiledirectory(NCPath));
-		if (status == false) {
-			makedirectorydeep(extractfiledirectory(NCPath));
-		}
-
-		glog.logmsg("Creating NetCDF file %s\n", NCPath.c_str());
-		GFile ncFile(NCPath, NcFile::replace);
-
-		glog.logmsg("Adding line index variables\n");
-		ncFile.InitialiseNew(line_number, line_index_count);
+		glog.logmsg("Using %s as the 'line number' field\n", line_field_name.c_str());
+		return true;
+	}
 
-		//Pre process the fields
+	//Determine which fields are converted, their variable names and datatypes, without touching the NetCDF file
+	void prepare_fields(cAsciiColumnFile& AF) {
 		glog.logmsg("Pre processing fields\n");
-		std::vector<nc_type> vartypes(AF.fields.size());
-		std::vector<std::string> varnames(AF.fields.size());
+		convertfield.assign(AF.fields.size(), false);
+		vartypes.assign(AF.fields.size(), NC_NAT);
+		varnames.assign(AF.fields.size(), std::string());
+		missingvalues.assign(AF.fields.size(), 0.0);
+		Stats.clear();
+		for (size_t fi = 0; fi < AF.fields.size(); fi++) Stats.push_back(cVariableStats(AF.fields[fi].nbands));
 		bool reported_nameswap = false;
 		for (size_t fi = 0; fi < AF.fields.size(); fi++) {
 			cAsciiColumnField& f = AF.fields[fi];
@@ -161,7 +191,7 @@ public:
 				continue;
 			}
 
-			if (tolower(f.name) == "rt") {
+			if (tolower(f.name) == "rt" && Options.isnamedinclude(f.name) == false) {
 				std::string msg;
 				msg += strprint("Skip processing field %3zu - %s (is a RECORD_TYPR field)\n", fi, f.name.c_str());
 				std::cout << msg << std::endl;
@@ -169,7 +199,7 @@ public:
 				continue;
 			}
 
-			if (tolower(f.name) == "fltline") {
+			if (tolower(f.name) == "fltline" && Options.isnamedinclude(f.name) == false) {
 				std::string msg;
 				msg += strprint("Skip processing field %3zu - %s (is the GEOSOFT fltline field)\n", fi, f.name.c_str());
 				std::cout << msg << std::endl;
@@ -192,6 +222,11 @@ public:
 				}
 			}
 
+			if (Options.isincluded(f.name, varnames[fi]) == false) {
+				glog.logmsg("Skip processing field %3zu - %s (not selected by -include/-exclude)\n", fi, f.name.c_str());
+				continue;
+			}
+
 			static const char space = ' ';
 			size_t found = varnames[fi].find_first_of(space);
 			if (found != std::string::npos) {
@@ -203,6 +238,191 @@ public:
 				glog.errormsg(_SRC_ + msg);
 			}
 
+			if (f.isinteger()) {
+				vartypes[fi] = NC_INT;
+			}
+			else if (f.isreal()) {
+				if (f.width > 8) {
+					vartypes[fi] = NC_DOUBLE;
+				}
+				else {
+					vartypes[fi] = NC_FLOAT;
+				}
+			}
+			else {
+				std::string msg = strprint("Error unknown field datatype for %s\n", varnames[fi].c_str());
+				std::cerr << msg << std::endl;
+				glog.errormsg(_SRC_ + msg);
+			}
+			convertfield[fi] = true;
+		}
+	}
+
+	//Choose short (or for double fields int) storage with scale_factor/add_offset for the real fields selected by -pack.
+	//The scale is the field's .dfn decimals, so the packing is lossless at the declared precision, and the offset centres the
+	//observed range of values in [begin, end) of the .dat file (reduced over all ranks) so as many fields as possible fit a short.
+	void determine_packing(cAsciiColumnFile& AF, const cRecordLayout& layout, const unsigned long long begin, const unsigned long long end) {
+		const size_t nf = AF.fields.size();
+		scalefactors.assign(nf, 0.0);
+		addoffsets.assign(nf, 0.0);
+		unpackedtypes = vartypes;
+
+		std::vector<bool> wanted(nf, false);
+		bool any = false;
+		for (size_t fi = 0; fi < nf; fi++) {
+			const cAsciiColumnField& f = AF.fields[fi];
+			if (convertfield[fi] == false || f.isreal() == false) continue;
+			if (Options.ispacked(varnames[fi]) == false) continue;
+			if (toupper(f.fmtchar) != 'F') {
+				glog.logmsg("Not packing %s as its format is not fixed point\n", varnames[fi].c_str());
+				continue;
+			}
+			wanted[fi] = true;
+			any = true;
+		}
+		if (any == false) return;
+
+		if (PackComplete < 0) {
+			glog.logmsg("Scanning the ranges of the fields to be packed\n");
+			PackComplete = scan_field_ranges(DatPath, AF, layout, wanted, begin, end, PackMin, PackMax) ? 1 : 0;
+#ifdef ENABLE_MPI
+			//Shards are converted independently by each rank, so the ranges are not reduced
+			if (MPISize > 1 && Options.Shards == 0) {
+				MPI_Allreduce(MPI_IN_PLACE, PackMin.data(), (int)nf, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+				MPI_Allreduce(MPI_IN_PLACE, PackMax.data(), (int)nf, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+				MPI_Allreduce(MPI_IN_PLACE, &PackComplete, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+			}
+#endif
+		}
+		std::vector<double> minvalues = PackMin;
+		std::vector<double> maxvalues = PackMax;
+		const int complete = PackComplete;
+		if (complete == 0) {
+			glog.logmsg("Warning: could not tokenise every record of the data file, no fields will be packed\n");
+			return;
+		}
+
+		for (size_t fi = 0; fi < nf; fi++) {
+			if (wanted[fi] == false) continue;
+			if (minvalues[fi] > maxvalues[fi]) minvalues[fi] = maxvalues[fi] = 0.0;//all null
+			const double scale = std::pow(10.0, -(double)AF.fields[fi].decimals);
+			const double lo = std::round(minvalues[fi] / scale);
+			const double hi = std::round(maxvalues[fi] / scale);
+			const double mid = std::round((lo + hi) / 2.0);
+			const double halfspan = std::max(hi - mid, mid - lo);
+
+			//The extremes of each packed type are left free for the missing value
+			nc_type t = NC_NAT;
+			if (halfspan <= 32766.0) t = NC_SHORT;
+			else if (halfspan <= 2147483645.0 && vartypes[fi] == NC_DOUBLE) t = NC_INT;
+			if (t == NC_NAT) {
+				glog.logmsg("Not packing %s as its range %lf to %lf is too large at %zu decimals\n", varnames[fi].c_str(), minvalues[fi], maxvalues[fi], AF.fields[fi].decimals);
+				continue;
+			}
+			scalefactors[fi] = scale;
+			addoffsets[fi] = mid * scale;
+			vartypes[fi] = t;
+			glog.logmsg("Packing %s range %lf to %lf as %s with scale_factor %g add_offset %lf\n", varnames[fi].c_str(), minvalues[fi], maxvalues[fi], NcType(t).getName().c_str(), scalefactors[fi], addoffsets[fi]);
+		}
+	}
+
+	void set_compression(GVar& gv, const size_t fi, const bool islinevar, const size_t nbands) {
+		const sCompressionSetting* c = Options.Compression.get(gv.getName(), islinevar, nbands);
+		auto it = AutoCompression.find(fi);
+		if (it != AutoCompression.end()) c = &it->second;
+		if (c == nullptr) return;
+		if (c->apply(gv)) glog.logmsg("Compressing %s with %s\n", gv.getName().c_str(), c->str().c_str());
+		else glog.logmsg("Warning: could not compress %s with %s, the filter is not available in this NetCDF build\n", gv.getName().c_str(), c->str().c_str());
+	}
+
+	//For -autocompress, store a sample of lines of each sample variable (in its final datatype) with each candidate setting
+	//and keep the one with the best ratio among those that decode at least half as fast as the fastest
+	void choose_compression_by_trial(cAsciiColumnFile& AF, const cRecordLayout& layout, const std::vector<sLineGroup>& groups, const std::vector<bool>& isgroupby) {
+		AutoCompression.clear();
+		if (Options.Compression.Auto == false) return;
+		if (groups.size() == 0) {
+			glog.logmsg("Warning: -autocompress needs the line index, using the -compress settings\n");
+			return;
+		}
+
+		const size_t nf = AF.fields.size();
+		const size_t nsample = std::min(groups.size(), (size_t)8);
+		glog.logmsg("Trying compression settings on %zu sample lines\n", nsample);
+		std::vector<std::vector<int>> ints(nf);
+		std::vector<std::vector<double>> dbls(nf);
+		std::vector<std::vector<int>> intfields;
+		std::vector<std::vector<double>> dblfields;
+		FILE* fp = fopen(DatPath.c_str(), "rb");
+		for (size_t k = 0; k < nsample; k++) {
+			const sLineGroup& g = groups[k * groups.size() / nsample];
+			const size_t n = parse_line_group(fp, g, AF, layout, convertfield, intfields, dblfields);
+			for (size_t fi = 0; fi < nf; fi++) {
+				if (convertfield[fi] == false || isgroupby[fi]) continue;
+				const size_t nv = n * AF.fields[fi].nbands;
+				if (AF.fields[fi].isinteger()) ints[fi].insert(ints[fi].end(), intfields[fi].begin(), intfields[fi].begin() + nv);
+				else if (AF.fields[fi].isreal()) dbls[fi].insert(dbls[fi].end(), dblfields[fi].begin(), dblfields[fi].begin() + nv);
+			}
+		}
+		fclose(fp);
+
+		const std::vector<sCompressionSetting> candidates = sCompressionSetting::candidates();
+		const std::string scratchpath = OutPath + ".trial.nc";
+		for (size_t fi = 0; fi < nf; fi++) {
+			const cAsciiColumnField& f = AF.fields[fi];
+			if (convertfield[fi] == false || isgroupby[fi] || f.ischar()) continue;
+			const size_t nb = f.nbands;
+			std::vector<sCompressionTrial> trials;
+			if (scalefactors[fi] > 0.0 && vartypes[fi] == NC_SHORT) trials = trial_compression(pack<short>(fi, f, dbls[fi], dbls[fi].size()), nb, NC_SHORT, candidates, scratchpath);
+			else if (scalefactors[fi] > 0.0) trials = trial_compression(pack<int>(fi, f, dbls[fi], dbls[fi].size()), nb, NC_INT, candidates, scratchpath);
+			else if (vartypes[fi] == NC_INT) trials = trial_compression(ints[fi], nb, NC_INT, candidates, scratchpath);
+			else if (vartypes[fi] == NC_FLOAT) trials = trial_compression(std::vector<float>(dbls[fi].begin(), dbls[fi].end()), nb, NC_FLOAT, candidates, scratchpath);
+			else trials = trial_compression(dbls[fi], nb, NC_DOUBLE, candidates, scratchpath);
+
+			for (const auto& t : trials) {
+				if (t.available) glog.logmsg("\t%s %-20s ratio %6.2lf decode %.4lf s\n", varnames[fi].c_str(), t.setting.str().c_str(), t.ratio, t.decodeseconds);
+			}
+			if (trials.size() > 0) AutoCompression[fi] = choose_compression(trials);
+		}
+	}
+
+	//Apply the -quantize option, by default to the significant digits implied by the .dfn format,
+	//i.e. the mantissa digits of an E format or all but the sign and decimal point of an F format
+	void quantize_variable(GVar& gv, const cAsciiColumnField& f, const nc_type t) {
+		if (t != NC_FLOAT && t != NC_DOUBLE) return;
+		const sQuantizeSpec* q = Options.quantizespec(gv.getName());
+		if (q == nullptr) return;
+		int nsd = q->nsd;
+		if (nsd <= 0) {
+			if (toupper(f.fmtchar) == 'E') nsd = (int)f.decimals + 1;
+			else nsd = std::max(1, (int)f.width - 2);
+		}
+		if (q->mode != "bitround") nsd = std::min(nsd, t == NC_FLOAT ? 7 : 15);
+		if (set_quantize(gv, q->mode, nsd)) {
+			glog.logmsg("Quantizing %s with %s to %d significant digits\n", gv.getName().c_str(), q->mode.c_str(), nsd);
+		}
+		else {
+			glog.logmsg("Warning: could not quantize %s, requires NetCDF 4.9 or later\n", gv.getName().c_str());
+		}
+	}
+
+	template<typename T>
+	std::vector<T> pack(const size_t fi, const cAsciiColumnField& f, const std::vector<double>& values, const size_t n) const {
+		const T mv = (T)missingvalues[fi];
+		const double nv = f.nullvalue<double>();
+		std::vector<T> data(n);
+		for (size_t i = 0; i < n; i++) {
+			const double v = values[i];
+			if (!isdefined(v) || v == nv) data[i] = mv;
+			else data[i] = (T)std::llround((v - addoffsets[fi]) / scalefactors[fi]);
+		}
+		return data;
+	}
+
+	//Add the variables and their attributes to the NetCDF file (writer rank only)
+	void define_variables(GFile& ncFile, cAsciiColumnFile& AF, const std::vector<bool>& isgroupby) {
+		for (size_t fi = 0; fi < AF.fields.size(); fi++) {
+			if (convertfield[fi] == false) continue;
+			cAsciiColumnField& f = AF.fields[fi];
 			std::string& fieldname = varnames[fi];
 			size_t nbands = f.nbands;
 			std::vector<NcDim> vardims;
@@ -221,23 +441,6 @@ public:
 				vardims.push_back(dimband);
 			}
 
-			if (f.isinteger()) {
-				vartypes[fi] = NC_INT;
-			}
-			else if (f.isreal()) {
-				if (f.width > 8) {
-					vartypes[fi] = NC_DOUBLE;
-				}
-				else {
-					vartypes[fi] = NC_FLOAT;
-				}
-			}
-			else {
-				std::string msg = strprint("Error unknown field datatype for %s\n", fieldname.c_str());
-				std::cerr << msg << std::endl;
-				glog.errormsg(_SRC_ + msg);
-			}
-
 			if (isgroupby[fi]) {
 				bool status = ncFile.addLineVar(varnames[fi], vartypes[fi], vardims);
 			}
@@ -255,115 +458,705 @@ public:
 				}
 			}
 
+			set_compression(gv, fi, isgroupby[fi], nbands);
+			quantize_variable(gv, f, vartypes[fi]);
+
+			if (scalefactors[fi] > 0.0) {
+				gv.putAtt("scale_factor", NcType(unpackedtypes[fi]), scalefactors[fi]);
+				gv.putAtt("add_offset", NcType(unpackedtypes[fi]), addoffsets[fi]);
+			}
+
+			if (vartypes[fi] == NC_SHORT) {
+				short mv;
+				missingvalues[fi] = (double)gv.missingvalue(mv);
+			}
+			else if (vartypes[fi] == NC_INT) {
+				int mv;
+				missingvalues[fi] = (double)gv.missingvalue(mv);
+			}
+			else {
+				double mv;
+				missingvalues[fi] = gv.missingvalue(mv);
+			}
+
 			std::string istr = "point";
 			if (isgroupby[fi]) istr = "line";
 
 			std::string tname = NcType(vartypes[fi]).getTypeClassName();
 			glog.logmsg("field index:%zu name:%s datatype:%s bands:%zu indexing:%s units:%s\n", fi + 1, fieldname.c_str(), tname.c_str(), nbands, istr.c_str(), f.units().c_str());
 		}
+	}
+
+	template<typename T>
+	void put(const std::string& varname, GFile* ncFile, const std::vector<size_t>& startp, const std::vector<size_t>& countp, const T* data) {
+#ifdef ENABLE_MPI
+		if (Writer) {
+			Writer->put(varname, startp, countp, data);
+			return;
+		}
+#endif
+		NcVar var = ncFile->getVar(varname);
+		var.putVar(startp, countp, data);
+	}
+
+	//Write all bands of all converted fields of one line group
+	void write_line(GFile* ncFile, cAsciiColumnFile& AF, const std::vector<bool>& isgroupby, const size_t lineindex, const size_t start, const size_t count, const std::vector<std::vector<int>>& intfields, const std::vector<std::vector<double>>& dblfields) {
+		for (size_t fi = 0; fi < AF.fields.size(); fi++) {
+			if (convertfield[fi] == false) continue;
+			cAsciiColumnField& f = AF.fields[fi];
+			if (f.ischar()) continue;
+
+			const size_t nbands = f.nbands;
+			const size_t nactive = isgroupby[fi] ? 1 : count;
+			std::vector<size_t> startp = { isgroupby[fi] ? lineindex : start };
+			std::vector<size_t> countp = { nactive };
+			if (nbands > 1) {
+				startp.push_back(0);
+				countp.push_back(nbands);
+			}
+
+			if (f.isinteger()) {
+				const int mv = (int)missingvalues[fi];
+				const int nv = f.nullvalue<int>();
+				std::vector<int> data(intfields[fi].begin(), intfields[fi].begin() + nactive * nbands);
+				for (int& val : data) {
+					if (!isdefined(val)) val = mv;
+					else if (val == nv) val = mv;
+				}
+				if (Options.Statistics) Stats[fi].add(data.data(), nactive, mv);
+				put(varnames[fi], ncFile, startp, countp, data.data());
+			}
+			else {
+				//Packed fields keep their unpacked values here, with nan for the nulls
+				const double mv = scalefactors[fi] > 0.0 ? std::numeric_limits<double>::quiet_NaN() : missingvalues[fi];
+				const double nv = f.nullvalue<double>();
+				std::vector<double> data(dblfields[fi].begin(), dblfields[fi].begin() + nactive * nbands);
+				for (double& val : data) {
+					if (!isdefined(val)) val = mv;
+					else if (val == nv) val = mv;
+				}
+				if (Options.Statistics) Stats[fi].add(data.data(), nactive, mv);
+				if (scalefactors[fi] > 0.0 && vartypes[fi] == NC_SHORT) {
+					put(varnames[fi], ncFile, startp, countp, pack<short>(fi, f, dblfields[fi], nactive * nbands).data());
+				}
+				else if (scalefactors[fi] > 0.0) {
+					put(varnames[fi], ncFile, startp, countp, pack<int>(fi, f, dblfields[fi], nactive * nbands).data());
+				}
+				else {
+					put(varnames[fi], ncFile, startp, countp, data.data());
+				}
+			}
+		}
+		if (footprint_xfield >= 0) add_footprint(AF, lineindex, count, dblfields);
+	}
+
+	//The longitude and latitude fields, single band real sample fields, false if there are none
+	bool find_coordinate_fields(cAsciiColumnFile& AF, const std::vector<bool>& isgroupby, int& xi, int& yi) {
+		auto find = [&](const std::vector<std::string>& candidates) {
+			for (const std::string& c : candidates) {
+				for (size_t fi = 0; fi < AF.fields.size(); fi++) {
+					const cAsciiColumnField& f = AF.fields[fi];
+					if (convertfield[fi] == false || isgroupby[fi] || f.ischar() || f.isinteger() || f.nbands != 1) continue;
+					if (tolower(varnames[fi]) == tolower(c)) return (int)fi;
+				}
+			}
+			return -1;
+		};
+		xi = find(cLineFootprints::xcandidates());
+		yi = find(cLineFootprints::ycandidates());
+		return xi >= 0 && yi >= 0;
+	}
+
+	//The coordinates of the samples of a line with nan for the nulls
+	void get_coordinates(cAsciiColumnFile& AF, const int xi, const int yi, const size_t count, const std::vector<std::vector<double>>& dblfields, std::vector<double>& x, std::vector<double>& y) {
+		const double nan = std::numeric_limits<double>::quiet_NaN();
+		const double xnv = AF.fields[xi].nullvalue<double>();
+		const double ynv = AF.fields[yi].nullvalue<double>();
+		x.assign(dblfields[xi].begin(), dblfields[xi].begin() + count);
+		y.assign(dblfields[yi].begin(), dblfields[yi].begin() + count);
+		for (double& v : x) if (!isdefined(v) || v == xnv) v = nan;
+		for (double& v : y) if (!isdefined(v) || v == ynv) v = nan;
+	}
+
+	//Choose the coordinate fields of the line footprints
+	void prepare_footprints(cAsciiColumnFile& AF, const std::vector<bool>& isgroupby, const size_t nlines) {
+		footprint_xfield = footprint_yfield = -1;
+		if (Options.FootprintVertices == 0) return;
+		int xi, yi;
+		if (find_coordinate_fields(AF, isgroupby, xi, yi) == false) {
+			glog.logmsg("No longitude and latitude fields for the line footprints\n");
+			return;
+		}
+		footprint_xfield = xi;
+		footprint_yfield = yi;
+		Footprints = cLineFootprints(nlines, Options.FootprintVertices);
+		glog.logmsg("Line footprints from %s and %s\n", varnames[xi].c_str(), varnames[yi].c_str());
+	}
 
-		size_t fi_line = AF.fieldindexbyname("line");
+	void add_footprint(cAsciiColumnFile& AF, const size_t lineindex, const size_t count, const std::vector<std::vector<double>>& dblfields) {
+		const double nan = std::numeric_limits<double>::quiet_NaN();
+		std::vector<double> x, y;
+		get_coordinates(AF, footprint_xfield, footprint_yfield, count, dblfields, x, y);
+		Footprints.add(lineindex, x.data(), y.data(), count, nan, nan);
+	}
 
+	//Centroid of every line from a pass over just the coordinate fields, by byte offset when there are line groups.
+	//With MPI (but not shards, which each rank converts on its own) each rank reads every MPISize-th line and the sums are combined.
+	bool get_line_centroids(cAsciiColumnFile& AF, const cRecordLayout& layout, const std::vector<sLineGroup>& groups, const std::vector<bool>& isgroupby, const size_t nlines, cLineCentroids& C) {
+		const bool shared = MPISize > 1 && Options.Shards == 0;
+		int xi, yi;
+		if (find_coordinate_fields(AF, isgroupby, xi, yi) == false) return false;
+		glog.logmsg("Computing line centroids from %s and %s\n", varnames[xi].c_str(), varnames[yi].c_str());
+		const double nan = std::numeric_limits<double>::quiet_NaN();
+		C = cLineCentroids(nlines);
 		std::vector<std::vector<int>>    intfields;
 		std::vector<std::vector<double>> dblfields;
-		size_t lineindex = 0;
-		AF.rewind();
-		AF.clear_currentrecord();
-		glog.logmsg("Processing lines\n");
-		size_t nsamples;
-		while ((nsamples = AF.readnextgroup(fi_line, intfields, dblfields))) {
-			if (line_index_count[lineindex] != nsamples) {
-				std::string msg;
-				msg += strprint("Error: number of samples read in from line does not match the index\n");
-				msg += strprint("\tindex: %d and read in: %d\n", line_index_count[lineindex], nsamples);
-				std::cerr << msg << std::endl;
-				glog.errormsg(_SRC_ + msg);
+		std::vector<double> x, y;
+		if (groups.size() == nlines) {
+			std::vector<bool> wanted(AF.fields.size(), false);
+			wanted[xi] = wanted[yi] = true;
+			FILE* fp = fopen(DatPath.c_str(), "rb");
+			for (size_t li = shared ? (size_t)MPIRank : 0; li < nlines; li += shared ? (size_t)MPISize : 1) {
+				const size_t n = parse_line_group(fp, groups[li], AF, layout, wanted, intfields, dblfields);
+				get_coordinates(AF, xi, yi, n, dblfields, x, y);
+				C.add(li, x.data(), y.data(), n, nan, nan);
+			}
+			fclose(fp);
+		}
+		else {
+			size_t li = 0;
+			size_t n;
+			AF.rewind();
+			AF.clear_currentrecord();
+			while ((n = AF.readnextgroup((size_t)line_field_index, intfields, dblfields))) {
+				get_coordinates(AF, xi, yi, n, dblfields, x, y);
+				C.add(li++, x.data(), y.data(), n, nan, nan);
 			}
+		}
+#ifdef ENABLE_MPI
+		if (shared) C.mpi_allsum(MPI_COMM_WORLD);
+#endif
+		return true;
+	}
 
-			glog.logmsg("Processing line index:%zu linenumber:%u\n", lineindex + 1, line_number[lineindex]);
-			for (size_t fi = 0; fi < AF.fields.size(); fi++) {
-				cAsciiColumnField& f = AF.fields[fi];
-				std::string& vname = varnames[fi];
-				//std::cout << f.name << std::endl;								
+	//Rebuild the line index in the requested output order and record where each input line goes
+	void order_lines(cAsciiColumnFile& AF, const cRecordLayout& layout, const std::vector<sLineGroup>& groups, const std::vector<bool>& isgroupby, cCompactLineIndex& L) {
+		const size_t nl = L.nlines();
+		std::vector<size_t> order(nl);
+		std::iota(order.begin(), order.end(), (size_t)0);
+		int64_t linenumber;
+		uint64_t start, count;
+		if (Options.LineOrder == eLineOrder::NUMBER) {
+			glog.logmsg("Ordering lines by line number\n");
+			std::vector<int64_t> ln(nl);
+			for (size_t li = 0; li < nl; li++) L.get(li, ln[li], start, count);
+			order = number_line_order(ln);
+		}
+		else if (Options.LineOrder == eLineOrder::HILBERT && HilbertOrder.size() == nl) {
+			order = HilbertOrder;
+		}
+		else if (Options.LineOrder == eLineOrder::HILBERT) {
+			cLineCentroids C;
+			if (get_line_centroids(AF, layout, groups, isgroupby, nl, C)) {
+				glog.logmsg("Ordering lines along a Hilbert curve through their centroids\n");
+				order = hilbert_line_order(C);
+			}
+			else glog.logmsg("No longitude and latitude fields to order the lines by, keeping the input order\n");
+			HilbertOrder = order;
+		}
 
-				if (f.name == line_field_name) {
-					continue;
-				}
+		cCompactLineIndex O;
+		O.reserve(nl);
+		for (size_t k = 0; k < nl; k++) {
+			L.get(order[k], linenumber, start, count);
+			O.add(linenumber, count);
+		}
+		L = O;
+		OutIndex = invert_line_order(order);
+	}
 
-				if (f.ischar()) {
-					continue;
-				}
+	//Keep only the output lines of the current shard, the other input lines are skipped
+	void restrict_to_shard(cCompactLineIndex& L) {
+		const size_t nl = L.nlines();
+		size_t l0 = nl;
+		size_t l1 = nl;
+		int64_t linenumber;
+		uint64_t start, count;
+		for (size_t li = 0; li < nl; li++) {
+			L.get(li, linenumber, start, count);
+			const size_t k = shard_of_line(start, L.nsamples(), Options.Shards);
+			if (k == ShardIndex && l0 == nl) l0 = li;
+			if (k > ShardIndex) {
+				l1 = li;
+				break;
+			}
+		}
+		if (l0 == nl) l1 = nl;
 
-				if (tolower(f.name) == "rt") {
-					continue;
-				}
+		cCompactLineIndex O;
+		O.reserve(l1 - l0);
+		for (size_t li = l0; li < l1; li++) {
+			L.get(li, linenumber, start, count);
+			O.add(linenumber, count);
+		}
+		for (size_t& oi : OutIndex) oi = (oi >= l0 && oi < l1) ? oi - l0 : SIZE_MAX;
+		glog.logmsg("Shard %zu has output lines %zu to %zu of %zu\n", ShardIndex, l0, l1, nl);
+		L = O;
+	}
+
+	void write_footprints(GFile& ncFile) {
+		if (footprint_xfield < 0) return;
+		glog.logmsg("Adding line bounding boxes and footprints\n");
+		Footprints.write(ncFile, varnames[footprint_xfield], varnames[footprint_yfield]);
+	}
+
+	//Store the statistics accumulated while the lines were written as attributes of each variable
+	void write_statistics(GFile& ncFile, cAsciiColumnFile& AF) {
+		if (Options.Statistics == false) return;
+		glog.logmsg("Adding variable statistics\n");
+		for (size_t fi = 0; fi < AF.fields.size(); fi++) {
+			if (convertfield[fi] == false || AF.fields[fi].ischar()) continue;
+			if (Options.HistogramBins > 0) add_histogram(Stats[fi], ncFile, varnames[fi], Options.HistogramBins);
+			Stats[fi].write(ncFile.getVar(varnames[fi]));
+		}
+	}
+
+	//The plain line number and count vectors are only expanded while the index variables are written
+	void initialise_line_index(GFile& ncFile, const cCompactLineIndex& L) {
+		std::vector<size_t> line_number;
+		std::vector<size_t> line_index_count;
+		L.decode(line_number, line_index_count);
+		ncFile.InitialiseNew(line_number, line_index_count);
+	}
+
+	void check_line_count(const size_t indexcount, const size_t nsamples) {
+		if (indexcount != nsamples) {
+			std::string msg;
+			msg += strprint("Error: number of samples read in from line does not match the index\n");
+			msg += strprint("\tindex: %zu and read in: %zu\n", indexcount, nsamples);
+			std::cerr << msg << std::endl;
+			glog.errormsg(_SRC_ + msg);
+		}
+	}
+
+	//Write the decimated overview levels of the requested sample variables
+	void add_overview_variables(GFile& ncFile, cAsciiColumnFile& AF, const std::vector<bool>& isgroupby) {
+		if (Options.OverviewFactors.size() == 0) return;
+		std::vector<std::string> names;
+		for (size_t fi = 0; fi < AF.fields.size(); fi++) {
+			if (convertfield[fi] == false || isgroupby[fi] || AF.fields[fi].ischar()) continue;
+			if (Options.isoverview(varnames[fi]) == false) continue;
+			names.push_back(varnames[fi]);
+		}
+		glog.logmsg("Adding %zu overview levels of %zu variables\n", Options.OverviewFactors.size(), names.size());
+		add_overviews(ncFile, names, Options.OverviewFactors);
+	}
+
+	//Write band-major copies of the requested multiband sample variables
+	void add_bandmajor_variables(GFile& ncFile, cAsciiColumnFile& AF, const std::vector<bool>& isgroupby) {
+		for (size_t fi = 0; fi < AF.fields.size(); fi++) {
+			if (convertfield[fi] == false || isgroupby[fi]) continue;
+			if (AF.fields[fi].nbands < 2) continue;
+			if (Options.isbandmajor(varnames[fi]) == false) continue;
+			glog.logmsg("Adding band-major copy of %s\n", varnames[fi].c_str());
+			add_bandmajor_variable(ncFile, varnames[fi]);
+		}
+	}
+
+	bool convert_aseggdf2_file() {
+		_GSTPUSH_
+
+		if (check_input_files() == false) return false;
+
+		glog.logmsg("Opening data file %s\n", DatPath.c_str());
+		cAsciiColumnFile AF(DatPath);
+
+		glog.logmsg("Parsing ASEGGDF2 header\n");
+		AF.parse_dfn_header(DfnPath);
+
+		//Force change attribute name "desc" or "DESC" to "description"
+		//for (size_t i = 0; i < AF.fields.size(); i++) {
+		//	for (size_t j = 0; j < AF.fields[i].atts.size(); j++) {
+		//		if (tolower(AF.fields[i].atts[j].first) == "desc") {
+		//			AF.fields[i].atts[j].first = "description";
+		//		}
+		//	}
+		//}
+
+		if (determine_line_field(AF) == false) return false;
+
+		//The .idx sidecar gives the line index and groupby fields without the two sequential scans
+		const cRecordLayout layout(AF);
+		cLineGroupIndex index;
+		std::vector<bool> isgroupby;
+		bool useindex = false;
+		if (Options.UseLineIndex) {
+			bool rebuilt;
+			glog.logmsg("Opening line index %s\n", cLineGroupIndex::sidecarpath(DatPath).c_str());
+			useindex = index.open(DatPath, layout, (size_t)line_field_index, rebuilt);
+			if (useindex) glog.logmsg(rebuilt ? "Line index was rebuilt\n" : "Line index is up to date\n");
+			else glog.logmsg("Could not index the data file by byte offset, scanning sequentially\n");
+		}
+
+		cCompactLineIndex L;
+		if (useindex) {
+			L.reserve(index.groups.size());
+			for (const sLineGroup& g : index.groups) L.add(g.linenumber, g.nrecords);
+			isgroupby = index.isgroupby();
+		}
+		else {
+			//The sequential scanner's index is limited to 32 bits
+			std::vector<unsigned int> line_number;
+			std::vector<unsigned int> line_index_start;
+			std::vector<unsigned int> line_index_count;
+			glog.logmsg("Scanning for line index\n");
+			AF.scan_for_line_index(line_field_index, line_index_start, line_index_count, line_number);
+			uint64_t nsamples = 0;
+			for (size_t li = 0; li < line_index_count.size(); li++) nsamples += line_index_count[li];
+			if (nsamples > UINT_MAX) {
+				throw(std::runtime_error(_SRC_ + strprint("%s has more samples than the sequential scan can index, convert it with the line index\n", DatPath.c_str())));
+			}
+			L.reserve(line_number.size());
+			for (size_t li = 0; li < line_number.size(); li++) L.add(line_number[li], line_index_count[li]);
+			glog.logmsg("Scanning for groupby fields\n");
+			isgroupby = AF.scan_for_groupby_fields(line_index_count);
+		}
+		glog.logmsg("Total number of points is %llu\n", (unsigned long long)L.nsamples());
+		glog.logmsg("Total number of lines is %zu\n", L.nlines());
+
+		prepare_fields(AF);
+		order_lines(AF, layout, useindex ? index.groups : std::vector<sLineGroup>(), isgroupby, L);
+		if (Options.Shards > 0) {
+			restrict_to_shard(L);
+			if (L.nlines() == 0) {
+				glog.logmsg("Shard %zu has no lines, not writing %s\n", ShardIndex, OutPath.c_str());
+				if (exists(OutPath)) std::filesystem::remove(OutPath);
+				return true;
+			}
+		}
+		prepare_footprints(AF, isgroupby, L.nlines());
+		determine_packing(AF, layout, 0, (unsigned long long)std::filesystem::file_size(DatPath));
+		choose_compression_by_trial(AF, layout, useindex ? index.groups : std::vector<sLineGroup>(), isgroupby);
+
+		bool status = exists(extractfiledirectory(OutPath));
+		if (status == false) {
+			makedirectorydeep(extractfiledirectory(OutPath));
+		}
 
-				if (tolower(f.name) == "fltline") {
+		glog.logmsg("Creating NetCDF file %s\n", OutPath.c_str());
+		GFile ncFile(OutPath, NcFile::replace);
+
+		glog.logmsg("Adding line index variables\n");
+		initialise_line_index(ncFile, L);
+
+		define_variables(ncFile, AF, isgroupby);
+		add_global_attributes(ncFile);
+
+		std::vector<std::vector<int>>    intfields;
+		std::vector<std::vector<double>> dblfields;
+		int64_t linenumber;
+		uint64_t start, count;
+		glog.logmsg("Processing lines\n");
+		if (useindex) {
+			FILE* fp = fopen(DatPath.c_str(), "rb");
+			for (size_t lineindex = 0; lineindex < index.groups.size(); lineindex++) {
+				const size_t outindex = OutIndex[lineindex];
+				if (outindex == SIZE_MAX) continue;
+				L.get(outindex, linenumber, start, count);
+				size_t nsamples = parse_line_group(fp, index.groups[lineindex], AF, layout, convertfield, intfields, dblfields);
+				check_line_count((size_t)count, nsamples);
+				glog.logmsg("Processing line index:%zu linenumber:%lld\n", lineindex + 1, (long long)linenumber);
+				write_line(&ncFile, AF, isgroupby, outindex, (size_t)start, (size_t)count, intfields, dblfields);
+			}
+			fclose(fp);
+		}
+		else {
+			size_t lineindex = 0;
+			AF.rewind();
+			AF.clear_currentrecord();
+			size_t nsamples;
+			while ((nsamples = AF.readnextgroup((size_t)line_field_index, intfields, dblfields))) {
+				const size_t outindex = OutIndex[lineindex];
+				if (outindex == SIZE_MAX) {
+					lineindex++;
 					continue;
 				}
+				L.get(outindex, linenumber, start, count);
+				check_line_count((size_t)count, nsamples);
+				glog.logmsg("Processing line index:%zu linenumber:%lld\n", lineindex + 1, (long long)linenumber);
+				write_line(&ncFile, AF, isgroupby, outindex, (size_t)start, (size_t)count, intfields, dblfields);
+				lineindex++;
+			}
+		}
+		write_statistics(ncFile, AF);
+		write_footprints(ncFile);
+		add_overview_variables(ncFile, AF, isgroupby);
+		add_bandmajor_variables(ncFile, AF, isgroupby);
+		glog.logmsg("Conversion complete\n");
+		_GSTPOP_
+			return true;
+	}
 
+	//Convert each of Options.Shards contiguous ranges of the output lines to its own file and tie them together with a manifest.
+	//With MPI each rank converts every MPISize-th shard by itself, so no parallel HDF5 is needed.
+	bool convert_aseggdf2_file_sharded() {
+		const size_t n = Options.Shards;
+		glog.logmsg("Writing %zu shards of %s\n", n, NCPath.c_str());
+#ifdef ENABLE_MPI
+		//The first rank brings the .idx sidecar up to date before the others read it
+		if (MPISize > 1) {
+			if (MPIRank == 0 && Options.UseLineIndex) update_line_index_sidecar();
+			MPI_Barrier(MPI_COMM_WORLD);
+		}
+#endif
+		std::vector<std::string> paths;
+		for (size_t k = 0; k < n; k++) paths.push_back(shard_path(NCPath, k));
+		if ((size_t)MPIRank < n) scan_packing_ranges();
+		for (size_t k = (size_t)MPIRank; k < n; k += (size_t)MPISize) {
+			ShardIndex = k;
+			OutPath = paths[k];
+			convert_aseggdf2_file();
+		}
+#ifdef ENABLE_MPI
+		if (MPISize > 1) MPI_Barrier(MPI_COMM_WORLD);
+#endif
+		if (MPIRank == 0) {
+			const std::string manifest = shard_manifest_path(NCPath);
+			glog.logmsg("Writing shard manifest %s\n", manifest.c_str());
+			write_shard_manifest(manifest, paths);
+		}
+		return true;
+	}
 
-				size_t nbands = AF.fields[fi].nbands;
+	//Scan the ranges of the fields to be packed over the whole .dat file once, before the shards reuse them
+	void scan_packing_ranges() {
+		if (Options.PackVariables.size() == 0) return;
+		if (check_input_files() == false) return;
+		cAsciiColumnFile AF(DatPath);
+		AF.parse_dfn_header(DfnPath);
+		if (determine_line_field(AF) == false) return;
+		const cRecordLayout layout(AF);
+		prepare_fields(AF);
+		determine_packing(AF, layout, 0, (unsigned long long)std::filesystem::file_size(DatPath));
+	}
 
-				NcVar var = ncFile.getSampleVar(vname);
+	void update_line_index_sidecar() {
+		if (check_input_files() == false) return;
+		cAsciiColumnFile AF(DatPath);
+		AF.parse_dfn_header(DfnPath);
+		if (determine_line_field(AF) == false) return;
+		const cRecordLayout layout(AF);
+		cLineGroupIndex index;
+		bool rebuilt;
+		if (index.open(DatPath, layout, (size_t)line_field_index, rebuilt) && rebuilt) {
+			glog.logmsg("Line index %s was rebuilt\n", cLineGroupIndex::sidecarpath(DatPath).c_str());
+		}
+	}
 
-				std::vector<size_t> startp(2);
-				std::vector<size_t> countp(2);
-				for (size_t bi = 0; bi < nbands; bi++) {
-					size_t nactive;
-					if (isgroupby[fi]) {
-						nactive = 1;
-						startp[0] = lineindex;
-						startp[1] = bi;
-						countp[0] = 1;
-						countp[1] = 1;
-					}
-					else {
-						nactive = nsamples;
-						startp[0] = line_index_start[lineindex];
-						startp[1] = bi;
-						countp[0] = line_index_count[lineindex];
-						countp[1] = 1;
-					}
+#ifdef ENABLE_MPI
+	//Gather the line groups of all ranks on rank 0, join the groups that were split across byte range boundaries, and broadcast the result
+	void merge_line_groups(const cASEGGDFRangeScanner& S, std::vector<sLineGroup>& groups, std::vector<bool>& isgroupby) {
+		const size_t nf = S.varies.size();
+		const size_t nv = 4;//values per group
+		std::vector<long long> local(S.groups.size() * nv);
+		for (size_t i = 0; i < S.groups.size(); i++) {
+			local[i * nv + 0] = S.groups[i].linenumber;
+			local[i * nv + 1] = (long long)S.groups[i].byteoffset;
+			local[i * nv + 2] = (long long)S.groups[i].nbytes;
+			local[i * nv + 3] = (long long)S.groups[i].nrecords;
+		}
 
-					if (AF.fields[fi].isinteger()) {
-						std::vector<int> data(nactive);
-						int mv;
-						GVar gv(ncFile, var);
-						mv = gv.missingvalue(mv);
-						for (size_t si = 0; si < nactive; si++) {
-							int& val = data[si] = intfields[fi][si * nbands + bi];
-							if (!isdefined(val)) {
-								val = mv;
-							}
-							else if (val == AF.fields[fi].nullvalue<int>()) {
-								val = mv;
-							}
-						}
-						var.putVar(startp, countp, data.data());
-					}
-					else {
-						double mv;
-						GVar gv(ncFile, var);
-						mv = gv.missingvalue(mv);
-						std::vector<double> data(nsamples);
-						for (size_t si = 0; si < nactive; si++) {
-							double& val = data[si] = dblfields[fi][si * nbands + bi];
-							if (!isdefined(val)) {
-								val = mv;
-							}
-							else if (val == AF.fields[fi].nullvalue<double>()) {
-								val = mv;
-							}
-						}
-						var.putVar(startp, countp, data.data());
+		int nlocal = (int)local.size();
+		std::vector<int> counts(MPISize);
+		MPI_Gather(&nlocal, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+		std::vector<int> displs(MPISize, 0);
+		for (int r = 1; r < MPISize; r++) displs[r] = displs[r - 1] + counts[r - 1];
+		std::vector<long long> all(MPIRank == 0 ? (size_t)(displs[MPISize - 1] + counts[MPISize - 1]) : 0);
+		MPI_Gatherv(local.data(), nlocal, MPI_LONG_LONG, all.data(), counts.data(), displs.data(), MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+
+		std::vector<int> varies(nf);
+		MPI_Reduce(S.varies.data(), varies.data(), (int)nf, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+
+		std::vector<unsigned long long> localhash(2 * nf);
+		for (size_t fi = 0; fi < nf; fi++) {
+			localhash[fi] = S.firstgrouphash[fi];
+			localhash[nf + fi] = S.lastgrouphash[fi];
+		}
+		std::vector<unsigned long long> allhash(MPIRank == 0 ? 2 * nf * MPISize : 0);
+		MPI_Gather(localhash.data(), (int)(2 * nf), MPI_UNSIGNED_LONG_LONG, allhash.data(), (int)(2 * nf), MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+
+		std::vector<long long> merged;
+		if (MPIRank == 0) {
+			const unsigned long long* prevhash = nullptr;
+			for (int r = 0; r < MPISize; r++) {
+				const size_t ng = (size_t)counts[r] / nv;
+				if (ng == 0) continue;
+				const long long* g = all.data() + displs[r];
+				const unsigned long long* firsthash = allhash.data() + 2 * nf * r;
+				const unsigned long long* lasthash = firsthash + nf;
+				size_t k = 0;
+				const bool continued = merged.size() > 0 && merged[merged.size() - nv] == g[0];
+				if (continued) {
+					//The first group of this rank continues the last group of an earlier rank
+					merged[merged.size() - 2] += g[2];
+					merged[merged.size() - 1] += g[3];
+					for (size_t fi = 0; fi < nf; fi++) {
+						if (firsthash[fi] != prevhash[fi]) varies[fi] = 1;
 					}
+					k = 1;
+				}
+				for (; k < ng; k++) {
+					merged.insert(merged.end(), g + k * nv, g + (k + 1) * nv);
 				}
+				//Unless this rank only held a continuation, its last group is now the last merged group
+				if (continued == false || ng > 1) prevhash = lasthash;
 			}
-			lineindex++;
 		}
-		add_global_attributes(ncFile);
+
+		unsigned long long nmerged = merged.size();
+		MPI_Bcast(&nmerged, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+		merged.resize(nmerged);
+		MPI_Bcast(merged.data(), (int)nmerged, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+		MPI_Bcast(varies.data(), (int)nf, MPI_INT, 0, MPI_COMM_WORLD);
+
+		groups.resize(nmerged / nv);
+		for (size_t i = 0; i < groups.size(); i++) {
+			groups[i].linenumber = merged[i * nv + 0];
+			groups[i].byteoffset = (unsigned long long)merged[i * nv + 1];
+			groups[i].nbytes = (unsigned long long)merged[i * nv + 2];
+			groups[i].nrecords = (unsigned long long)merged[i * nv + 3];
+		}
+		isgroupby.resize(nf);
+		for (size_t fi = 0; fi < nf; fi++) isgroupby[fi] = (varies[fi] == 0);
+	}
+#endif
+
+	//Each rank scans its own byte range of the .dat file for the line index (unless a valid .idx sidecar exists),
+	//the line index is merged and broadcast, then each rank parses the lines it owns and sends them to the writer rank
+	bool convert_aseggdf2_file_mpi() {
+		_GSTPUSH_
+#ifdef ENABLE_MPI
+		if (check_input_files() == false) {
+			throw(std::runtime_error(_SRC_ + strprint("Missing input files on rank %d\n", MPIRank)));
+		}
+
+		glog.logmsg("Opening data file %s on %d MPI ranks\n", DatPath.c_str(), MPISize);
+		cAsciiColumnFile AF(DatPath);
+		glog.logmsg("Parsing ASEGGDF2 header\n");
+		AF.parse_dfn_header(DfnPath);
+		if (determine_line_field(AF) == false) {
+			throw(std::runtime_error(_SRC_ + strprint("Could not determine the line number field\n")));
+		}
+
+		const cRecordLayout layout(AF);
+		const unsigned long long filesize = (unsigned long long)std::filesystem::file_size(DatPath);
+		const unsigned long long begin = filesize * (unsigned long long)MPIRank / (unsigned long long)MPISize;
+		const unsigned long long end = filesize * (unsigned long long)(MPIRank + 1) / (unsigned long long)MPISize;
+
+		std::vector<sLineGroup> groups;
+		std::vector<bool> isgroupby;
+
+		//Every rank reads a valid .idx sidecar rather than scanning its byte range
+		const std::string idxpath = cLineGroupIndex::sidecarpath(DatPath);
+		cLineGroupIndex index;
+		int useindex = 0;
+		if (MPIRank == 0 && Options.UseLineIndex) {
+			useindex = (exists(idxpath) && index.load(idxpath) && index.isvalid(DatPath, layout, (size_t)line_field_index)) ? 1 : 0;
+		}
+		MPI_Bcast(&useindex, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+		if (useindex) {
+			if (MPIRank > 0) index.load(idxpath);
+			glog.logmsg("Using line index %s\n", idxpath.c_str());
+			groups = index.groups;
+			isgroupby = index.isgroupby();
+		}
+		else {
+			glog.logmsg("Scanning bytes %llu to %llu for line index\n", begin, end);
+			cASEGGDFRangeScanner S;
+			S.scan(DatPath, layout, (size_t)line_field_index, begin, end);
+			glog.logmsg("Found %zu records in %zu line groups\n", S.nrecords, S.groups.size());
+			merge_line_groups(S, groups, isgroupby);
+
+			//The ranks parse records by whitespace delimited tokens, so records that are not would be lost from the output
+			unsigned long long nskipped = S.nskipped;
+			MPI_Allreduce(MPI_IN_PLACE, &nskipped, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+			if (nskipped > 0) {
+				throw(std::runtime_error(_SRC_ + strprint("%llu records of %s do not have one whitespace delimited token per band of each field, convert it without MPI\n", nskipped, DatPath.c_str())));
+			}
+			if (MPIRank == 0 && Options.UseLineIndex) {
+				std::vector<int> varies(isgroupby.size());
+				for (size_t fi = 0; fi < varies.size(); fi++) varies[fi] = isgroupby[fi] ? 0 : 1;
+				index.set(DatPath, layout, (size_t)line_field_index, groups, varies);
+				if (index.save(idxpath)) glog.logmsg("Saved line index %s\n", idxpath.c_str());
+			}
+		}
+
+		cCompactLineIndex L;
+		L.reserve(groups.size());
+		for (const sLineGroup& g : groups) L.add(g.linenumber, g.nrecords);
+		glog.logmsg("Total number of points is %llu\n", (unsigned long long)L.nsamples());
+		glog.logmsg("Total number of lines is %zu\n", L.nlines());
+
+		prepare_fields(AF);
+		order_lines(AF, layout, groups, isgroupby, L);
+		prepare_footprints(AF, isgroupby, L.nlines());
+		determine_packing(AF, layout, begin, end);
+
+		std::unique_ptr<GFile> ncFile;
+		if (MPIRank == 0) {
+			bool status = exists(extractfiledirectory(NCPath));
+			if (status == false) {
+				makedirectorydeep(extractfiledirectory(NCPath));
+			}
+			glog.logmsg("Creating NetCDF file %s\n", NCPath.c_str());
+			ncFile = std::make_unique<GFile>(NCPath, NcFile::replace);
+			glog.logmsg("Adding line index variables\n");
+			initialise_line_index(*ncFile, L);
+			choose_compression_by_trial(AF, layout, groups, isgroupby);
+			define_variables(*ncFile, AF, isgroupby);
+			add_global_attributes(*ncFile);
+		}
+		MPI_Bcast(missingvalues.data(), (int)missingvalues.size(), MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+		Writer = std::make_unique<cMPILineWriter>(MPI_COMM_WORLD, 0, ncFile.get());
+		Writer->barrier();
+
+		glog.logmsg("Processing lines\n");
+		FILE* fp = fopen(DatPath.c_str(), "rb");
+		std::vector<std::vector<int>>    intfields;
+		std::vector<std::vector<double>> dblfields;
+		for (size_t li = 0; li < groups.size(); li++) {
+			if (Writer->owns(li) == false) continue;
+			int64_t linenumber;
+			uint64_t start, count;
+			L.get(OutIndex[li], linenumber, start, count);
+			size_t nsamples = parse_line_group(fp, groups[li], AF, layout, convertfield, intfields, dblfields);
+			check_line_count((size_t)count, nsamples);
+			glog.logmsg("Processing line index:%zu linenumber:%lld\n", li + 1, (long long)linenumber);
+			write_line(ncFile.get(), AF, isgroupby, OutIndex[li], (size_t)start, (size_t)count, intfields, dblfields);
+		}
+		fclose(fp);
+		Writer->flush();
+		Writer.reset();
+
+		if (Options.Statistics) {
+			for (size_t fi = 0; fi < AF.fields.size(); fi++) {
+				if (convertfield[fi] && AF.fields[fi].ischar() == false) Stats[fi].mpi_merge(MPI_COMM_WORLD, 0);
+			}
+		}
+
+		if (footprint_xfield >= 0) Footprints.mpi_gather(MPI_COMM_WORLD, 0);
+
+		if (ncFile) {
+			write_statistics(*ncFile, AF);
+			write_footprints(*ncFile);
+			add_overview_variables(*ncFile, AF, isgroupby);
+			add_bandmajor_variables(*ncFile, AF, isgroupby);
+			ncFile->close();
+		}
 		glog.logmsg("Conversion complete\n");
+#endif
 		_GSTPOP_
 			return true;
 	}
@@ -374,6 +1167,8 @@ public:
 		ncFile.putAtt("CreationMethod", "aseggdf2netcdf.exe");
 		ncFile.putAtt("ASEGGDF2SourceDataFile", DatPath);
 		ncFile.putAtt("ASEGGDF2SourceDFNFile", DfnPath);
+		size_t n = Options.put_metadata_attributes(ncFile, DatPath);
+		if (n > 0) glog.logmsg("Added %zu metadata attributes\n", n);
 		return true;
 	}
 };
@@ -381,17 +1176,32 @@ public:
 int main(int argc, char** argv)
 {
 	_GSTITEM_
+#ifdef ENABLE_MPI
+	MPI_Init(&argc, &argv);
+#endif
 		try
 	{
-		if (argc == 3) {
-			std::string datpath = argv[1];
-			std::string ncpath = argv[2];
+		cConversionOptions options;
+		std::vector<std::string> args = options.parse(argc, argv);
+		options.loadmetadata();
+		if (args.size() == 2) {
+			std::string datpath = args[0];
+			std::string ncpath = args[1];
 			std::string cmdl = commandlinestring(argc, argv);
-			cASEGGDF2Converter C(datpath, ncpath, cmdl);
+			{
+				cASEGGDF2Converter C(datpath, ncpath, cmdl, options);
+			}
+#ifdef ENABLE_MPI
+			MPI_Finalize();
+#endif
 			return 0;
 		}
 		else {
-			std::cout << "Usage: " << extractfilename(argv[0]) << " datpath ncpath" << std::endl;
+			std::cout << "Usage: " << extractfilename(argv[0]) << " [options] datpath ncpath" << std::endl;
+			cConversionOptions::usage();
+#ifdef ENABLE_MPI
+			MPI_Finalize();
+#endif
 			return 1;
 		}
 	}
@@ -400,6 +1210,9 @@ int main(int argc, char** argv)
 			std::cerr << e.what();
 		//glog.logmsg(e.what());
 		//glog.logmsg("\n");
+#ifdef ENABLE_MPI
+		MPI_Abort(MPI_COMM_WORLD, 1);
+#endif
 		return 1;
 	}
 	catch (const std::runtime_error& e) {
@@ -407,6 +1220,9 @@ int main(int argc, char** argv)
 			std::cerr << e.what();
 		//glog.logmsg(e.what());
 		//glog.logmsg("\n");
+#ifdef ENABLE_MPI
+		MPI_Abort(MPI_COMM_WORLD, 1);
+#endif
 		return 1;
 	}
 	catch (std::exception& e) {
@@ -414,6 +1230,9 @@ int main(int argc, char** argv)
 			std::cerr << e.what();
 		//glog.logmsg(e.what());
 		//glog.logmsg("\n");
+#ifdef ENABLE_MPI
+		MPI_Abort(MPI_COMM_WORLD, 1);
+#endif
 		return 1;
 	}
 	return 0;
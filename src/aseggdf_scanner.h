@@ -0,0 +1,476 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _aseggdf_scanner_H
+#define _aseggdf_scanner_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cfloat>
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <fstream>
+#include <filesystem>
+#include <unordered_map>
+
+#include "general_utils.h"
+#include "file_utils.h"
+#include "asciicolumnfile.h"
+
+//A contiguous group of records in an ASEG-GDF .dat file that share the same line number
+struct sLineGroup {
+	long long linenumber = 0;
+	unsigned long long byteoffset = 0;
+	unsigned long long nbytes = 0;
+	unsigned long long nrecords = 0;
+};
+
+inline int fileseek64(FILE* fp, const unsigned long long offset) {
+#if defined(_MSC_VER)
+	return _fseeki64(fp, (__int64)offset, SEEK_SET);
+#else
+	return fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+}
+
+//Splits a record into whitespace separated tokens without copying, stopping after maxtokens
+inline size_t tokenise(const std::string_view& record, std::vector<std::string_view>& tokens, const size_t maxtokens = SIZE_MAX) {
+	tokens.clear();
+	const size_t n = record.size();
+	size_t i = 0;
+	while (i < n && tokens.size() < maxtokens) {
+		while (i < n && (record[i] == ' ' || record[i] == '\t' || record[i] == ',')) i++;
+		if (i >= n) break;
+		const size_t j = i;
+		while (i < n && record[i] != ' ' && record[i] != '\t' && record[i] != ',') i++;
+		tokens.push_back(record.substr(j, i - j));
+	}
+	return tokens.size();
+}
+
+//Numbers parsed within the token's own bounds, as tokens point into a reused buffer and are not NUL terminated
+inline bool token_to_double(std::string_view t, double& v) {
+	if (t.size() && t[0] == '+') t.remove_prefix(1);
+	const auto r = std::from_chars(t.data(), t.data() + t.size(), v);
+	return r.ec == std::errc();
+}
+
+inline bool token_to_int(std::string_view t, int& v) {
+	if (t.size() && t[0] == '+') t.remove_prefix(1);
+	const auto r = std::from_chars(t.data(), t.data() + t.size(), v);
+	return r.ec == std::errc();
+}
+
+//Position of each field's first token in a whitespace delimited record
+class cRecordLayout {
+
+public:
+	std::vector<size_t> firsttoken;
+	std::vector<size_t> nbands;
+	size_t ntokens = 0;
+
+	cRecordLayout() {};
+
+	cRecordLayout(const cAsciiColumnFile& AF) {
+		firsttoken.resize(AF.fields.size());
+		nbands.resize(AF.fields.size());
+		for (size_t fi = 0; fi < AF.fields.size(); fi++) {
+			firsttoken[fi] = ntokens;
+			nbands[fi] = AF.fields[fi].nbands;
+			ntokens += nbands[fi];
+		}
+	}
+
+	size_t nfields() const { return firsttoken.size(); }
+
+	//Number of leading tokens that hold all the wanted fields, the rest of a record need not be tokenised
+	size_t tokensneeded(const std::vector<bool>& wanted) const {
+		size_t n = 0;
+		for (size_t fi = 0; fi < nfields(); fi++) {
+			if (wanted[fi]) n = std::max(n, firsttoken[fi] + nbands[fi]);
+		}
+		return n;
+	}
+
+	uint64_t fieldhash(const size_t fi, const std::vector<std::string_view>& tokens) const {
+		uint64_t h = 1469598103934665603ULL;
+		for (size_t bi = 0; bi < nbands[fi]; bi++) {
+			h ^= std::hash<std::string_view>()(tokens[firsttoken[fi] + bi]) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+		}
+		return h;
+	}
+};
+
+//Buffered reader of the records whose first byte lies in [begin, end) of a file
+class cRecordReader {
+
+	FILE* fp = nullptr;
+	std::vector<char> buf;
+	size_t bufstart = 0;//position in buf of the next unread byte
+	size_t buflen = 0;//number of valid bytes in buf
+	unsigned long long bufoffset = 0;//file offset of buf[0]
+	unsigned long long end = 0;
+	bool eof = false;
+
+	bool fill() {
+		if (eof) return false;
+		if (bufstart > 0) {
+			std::memmove(buf.data(), buf.data() + bufstart, buflen - bufstart);
+			bufoffset += bufstart;
+			buflen -= bufstart;
+			bufstart = 0;
+		}
+		if (buflen == buf.size()) buf.resize(buf.size() * 2);
+		size_t n = fread(buf.data() + buflen, 1, buf.size() - buflen, fp);
+		if (n == 0) eof = true;
+		buflen += n;
+		return n > 0;
+	}
+
+public:
+
+	cRecordReader(const std::string& path, const unsigned long long _begin, const unsigned long long _end, const size_t buffersize = 16777216) {
+		end = _end;
+		fp = fopen(path.c_str(), "rb");
+		if (fp == nullptr) {
+			throw(std::runtime_error(_SRC_ + strprint("Could not open %s\n", path.c_str())));
+		}
+		buf.resize(buffersize);
+
+		//Unless starting at the top of the file, the first record is the one after the next end of line
+		unsigned long long begin = _begin;
+		if (begin > 0) begin--;
+		fileseek64(fp, begin);
+		bufoffset = begin;
+		if (_begin > 0) {
+			std::string_view skip;
+			unsigned long long offset;
+			next(skip, offset);
+		}
+	}
+
+	~cRecordReader() {
+		if (fp) fclose(fp);
+	}
+
+	//File offset of the byte following the last record returned
+	unsigned long long position() const {
+		return bufoffset + bufstart;
+	}
+
+	//Returns the next record (without the end of line characters) and its file offset
+	bool next(std::string_view& record, unsigned long long& offset) {
+		while (true) {
+			const char* p = (const char*)memchr(buf.data() + bufstart, '\n', buflen - bufstart);
+			if (p == nullptr && eof == false) {
+				fill();
+				continue;
+			}
+
+			offset = bufoffset + bufstart;
+			if (offset >= end || bufstart >= buflen) return false;
+
+			size_t len = p ? (size_t)(p - (buf.data() + bufstart)) : buflen - bufstart;
+			record = std::string_view(buf.data() + bufstart, len);
+			bufstart += len + (p ? 1 : 0);
+			while (record.size() > 0 && (record.back() == '\r' || record.back() == 26)) record.remove_suffix(1);
+			return true;
+		}
+	}
+};
+
+//Scans a byte range of an ASEG-GDF .dat file for its line groups.
+//It also flags the fields that vary within any line, so groupby (line) fields can be determined without a second pass.
+class cASEGGDFRangeScanner {
+
+public:
+	std::vector<sLineGroup> groups;
+	std::vector<int> varies;//per field
+	std::vector<uint64_t> firstgrouphash;//per field hash of the first record of the first group
+	std::vector<uint64_t> lastgrouphash;//per field hash of the first record of the last group
+	size_t nrecords = 0;
+	size_t nskipped = 0;//non-blank records without exactly one token per band of each field
+
+	void scan(const std::string& datpath, const cRecordLayout& layout, const size_t linefield, const unsigned long long begin, const unsigned long long end) {
+		const size_t nf = layout.nfields();
+		varies.assign(nf, 0);
+		firstgrouphash.assign(nf, 0);
+		lastgrouphash.assign(nf, 0);
+		const size_t linetoken = layout.firsttoken[linefield];
+
+		cRecordReader R(datpath, begin, end);
+		std::vector<std::string_view> tokens;
+		std::string_view record;
+		unsigned long long offset;
+		while (R.next(record, offset)) {
+			const size_t nt = tokenise(record, tokens);
+			//Too few or too many tokens (e.g. a blank inside an A format field) would put later fields in the wrong place
+			if (nt != layout.ntokens) {
+				if (nt > 0) nskipped++;
+				continue;
+			}
+
+			long long ln = 0;
+			std::from_chars(tokens[linetoken].data(), tokens[linetoken].data() + tokens[linetoken].size(), ln);
+			if (groups.size() == 0 || groups.back().linenumber != ln) {
+				sLineGroup g;
+				g.linenumber = ln;
+				g.byteoffset = offset;
+				groups.push_back(g);
+				for (size_t fi = 0; fi < nf; fi++) {
+					lastgrouphash[fi] = layout.fieldhash(fi, tokens);
+				}
+				if (groups.size() == 1) firstgrouphash = lastgrouphash;
+			}
+			else {
+				for (size_t fi = 0; fi < nf; fi++) {
+					if (varies[fi] == 0 && layout.fieldhash(fi, tokens) != lastgrouphash[fi]) varies[fi] = 1;
+				}
+			}
+			sLineGroup& g = groups.back();
+			g.nrecords++;
+			g.nbytes = R.position() - g.byteoffset;
+			nrecords++;
+		}
+	}
+};
+
+//The line groups of a whole .dat file, saved in a sidecar file (datpath + ".idx") so that
+//later runs can seek straight to any line and split the work on exact line boundaries without rescanning.
+//The sidecar is stale once the .dat file's size or modification time changes.
+//It is text: a "ASEGGDF_LINE_INDEX 2" tag line, the datsize, datmtime, linefield and ntokens (tokens per record) lines,
+//"varies n" followed by the n per field flags, then "groups n" followed by n lines of linenumber byteoffset nbytes nrecords.
+class cLineGroupIndex {
+
+	std::unordered_map<long long, size_t> LineMap;//linenumber to group index
+
+	static unsigned long long mtime(const std::string& datpath) {
+		return (unsigned long long)std::filesystem::last_write_time(datpath).time_since_epoch().count();
+	}
+
+	void map_lines() {
+		LineMap.clear();
+		for (size_t i = 0; i < groups.size(); i++) LineMap.emplace(groups[i].linenumber, i);
+	}
+
+public:
+	std::vector<sLineGroup> groups;
+	std::vector<int> varies;//per field, as in cASEGGDFRangeScanner
+	unsigned long long datsize = 0;
+	unsigned long long datmtime = 0;
+	size_t linefield = 0;
+	size_t ntokens = 0;
+
+	static std::string sidecarpath(const std::string& datpath) {
+		return datpath + ".idx";
+	}
+
+	size_t nrecords() const {
+		size_t n = 0;
+		for (const auto& g : groups) n += (size_t)g.nrecords;
+		return n;
+	}
+
+	std::vector<bool> isgroupby() const {
+		std::vector<bool> b(varies.size());
+		for (size_t fi = 0; fi < varies.size(); fi++) b[fi] = (varies[fi] == 0);
+		return b;
+	}
+
+	//Scan the whole file, returns false if some records could not be tokenised (e.g. fixed width fields that run together)
+	bool build(const std::string& datpath, const cRecordLayout& layout, const size_t _linefield) {
+		cASEGGDFRangeScanner S;
+		S.scan(datpath, layout, _linefield, 0, (unsigned long long)std::filesystem::file_size(datpath));
+		if (S.nskipped > 0 || S.nrecords == 0) return false;
+		set(datpath, layout, _linefield, S.groups, S.varies);
+		return true;
+	}
+
+	void set(const std::string& datpath, const cRecordLayout& layout, const size_t _linefield, const std::vector<sLineGroup>& _groups, const std::vector<int>& _varies) {
+		groups = _groups;
+		varies = _varies;
+		datsize = (unsigned long long)std::filesystem::file_size(datpath);
+		datmtime = mtime(datpath);
+		linefield = _linefield;
+		ntokens = layout.ntokens;
+		map_lines();
+	}
+
+	bool save(const std::string& idxpath) const {
+		std::ofstream file(idxpath);
+		if (!file) return false;
+		file << "ASEGGDF_LINE_INDEX 2\n";
+		file << "datsize " << datsize << "\n";
+		file << "datmtime " << datmtime << "\n";
+		file << "linefield " << linefield << "\n";
+		file << "ntokens " << ntokens << "\n";
+		file << "varies " << varies.size();
+		for (const int v : varies) file << " " << v;
+		file << "\n";
+		file << "groups " << groups.size() << "\n";
+		for (const auto& g : groups) {
+			file << g.linenumber << " " << g.byteoffset << " " << g.nbytes << " " << g.nrecords << "\n";
+		}
+		return (bool)file;
+	}
+
+	bool load(const std::string& idxpath) {
+		std::ifstream file(idxpath);
+		if (!file) return false;
+		std::string tag;
+		int version = 0;
+		size_t n = 0;
+		file >> tag >> version;
+		if (tag != "ASEGGDF_LINE_INDEX" || version != 2) return false;
+		file >> tag >> datsize >> tag >> datmtime >> tag >> linefield >> tag >> ntokens;
+		file >> tag >> n;
+		varies.resize(n);
+		for (size_t i = 0; i < n; i++) file >> varies[i];
+		file >> tag >> n;
+		groups.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			file >> groups[i].linenumber >> groups[i].byteoffset >> groups[i].nbytes >> groups[i].nrecords;
+		}
+		if (!file) return false;
+		map_lines();
+		return true;
+	}
+
+	//True if the index was built from this .dat file, as it is now, with the same field layout and line field
+	bool isvalid(const std::string& datpath, const cRecordLayout& layout, const size_t _linefield) const {
+		if (groups.size() == 0 || exists(datpath) == false) return false;
+		if (datsize != (unsigned long long)std::filesystem::file_size(datpath)) return false;
+		if (datmtime != mtime(datpath)) return false;
+		return linefield == _linefield && ntokens == layout.ntokens && varies.size() == layout.nfields();
+	}
+
+	//Load the sidecar if it is valid, otherwise rebuild it by scanning and (if writable) save it
+	bool open(const std::string& datpath, const cRecordLayout& layout, const size_t _linefield, bool& rebuilt) {
+		rebuilt = false;
+		const std::string idxpath = sidecarpath(datpath);
+		if (exists(idxpath) && load(idxpath) && isvalid(datpath, layout, _linefield)) return true;
+		if (build(datpath, layout, _linefield) == false) return false;
+		rebuilt = true;
+		save(idxpath);
+		return true;
+	}
+
+	//Index of the group of a line number or -1 if it is not in the file
+	long long find(const long long linenumber) const {
+		auto it = LineMap.find(linenumber);
+		if (it == LineMap.end()) return -1;
+		return (long long)it->second;
+	}
+};
+
+//Minimum and maximum of the non-null values of the wanted real fields over the records whose first byte is in [begin, end).
+//Fields with no values are left at +DBL_MAX / -DBL_MAX. Returns false if some records could not be tokenised.
+inline bool scan_field_ranges(const std::string& datpath, const cAsciiColumnFile& AF, const cRecordLayout& layout, const std::vector<bool>& wanted, const unsigned long long begin, const unsigned long long end, std::vector<double>& minvalues, std::vector<double>& maxvalues) {
+	const size_t nf = layout.nfields();
+	minvalues.assign(nf, DBL_MAX);
+	maxvalues.assign(nf, -DBL_MAX);
+	std::vector<double> nulls(nf, 0.0);
+	for (size_t fi = 0; fi < nf; fi++) {
+		if (wanted[fi]) nulls[fi] = AF.fields[fi].nullvalue<double>();
+	}
+
+	//Records are tokenised whole so that those with extra tokens, whose fields would be misplaced, are detected
+	bool complete = true;
+	cRecordReader R(datpath, begin, end);
+	std::vector<std::string_view> tokens;
+	std::string_view record;
+	unsigned long long offset;
+	while (R.next(record, offset)) {
+		const size_t nt = tokenise(record, tokens, layout.ntokens + 1);
+		if (nt != layout.ntokens) {
+			if (nt > 0) complete = false;
+			continue;
+		}
+		for (size_t fi = 0; fi < nf; fi++) {
+			if (wanted[fi] == false) continue;
+			for (size_t bi = 0; bi < layout.nbands[fi]; bi++) {
+				double v;
+				if (token_to_double(tokens[layout.firsttoken[fi] + bi], v) == false) continue;
+				if (v == nulls[fi] || !isdefined(v)) continue;
+				if (v < minvalues[fi]) minvalues[fi] = v;
+				if (v > maxvalues[fi]) maxvalues[fi] = v;
+			}
+		}
+	}
+	return complete;
+}
+
+//Parses all records of one line group into the same layout as cAsciiColumnFile::readnextgroup()
+//i.e. intfields[fi][si*nbands+bi] for integer fields and dblfields[fi][si*nbands+bi] for real fields
+inline size_t parse_line_group(FILE* fp, const sLineGroup& g, const cAsciiColumnFile& AF, const cRecordLayout& layout, const std::vector<bool>& wanted, std::vector<std::vector<int>>& intfields, std::vector<std::vector<double>>& dblfields) {
+	std::string text(g.nbytes, '\0');
+	fileseek64(fp, g.byteoffset);
+	size_t nread = fread(&text[0], 1, g.nbytes, fp);
+	text.resize(nread);
+
+	const size_t nf = AF.fields.size();
+	intfields.resize(nf);
+	dblfields.resize(nf);
+	for (size_t fi = 0; fi < nf; fi++) {
+		const size_t n = (size_t)g.nrecords * layout.nbands[fi];
+		if (wanted[fi] && AF.fields[fi].isinteger()) intfields[fi].resize(n);
+		else if (wanted[fi] && AF.fields[fi].isreal()) dblfields[fi].resize(n);
+	}
+
+	//Unwanted fields are neither converted nor, if they follow the last wanted field, tokenised
+	const size_t needed = layout.tokensneeded(wanted);
+	std::vector<std::string_view> tokens;
+	size_t si = 0;
+	size_t pos = 0;
+	while (pos < text.size() && si < g.nrecords) {
+		size_t eol = text.find('\n', pos);
+		if (eol == std::string::npos) eol = text.size();
+		std::string_view record(text.data() + pos, eol - pos);
+		pos = eol + 1;
+		if (tokenise(record, tokens, needed) < needed || (needed == 0 && tokenise(record, tokens, 1) == 0)) continue;
+
+		for (size_t fi = 0; fi < nf; fi++) {
+			if (wanted[fi] == false) continue;
+			const cAsciiColumnField& f = AF.fields[fi];
+			const size_t nb = layout.nbands[fi];
+			const size_t t0 = layout.firsttoken[fi];
+			if (f.isinteger()) {
+				for (size_t bi = 0; bi < nb; bi++) {
+					int v = 0;
+					token_to_int(tokens[t0 + bi], v);
+					intfields[fi][si * nb + bi] = v;
+				}
+			}
+			else if (f.isreal()) {
+				for (size_t bi = 0; bi < nb; bi++) {
+					double v = 0.0;
+					token_to_double(tokens[t0 + bi], v);
+					dblfields[fi][si * nb + bi] = v;
+				}
+			}
+		}
+		si++;
+	}
+	return si;
+}
+
+//Seeks straight to and parses the records of one line via the index, returns 0 if the line is not in the file
+inline size_t parse_line(FILE* fp, const cLineGroupIndex& index, const long long linenumber, const cAsciiColumnFile& AF, const cRecordLayout& layout, const std::vector<bool>& wanted, std::vector<std::vector<int>>& intfields, std::vector<std::vector<double>>& dblfields) {
+	const long long gi = index.find(linenumber);
+	if (gi < 0) return 0;
+	return parse_line_group(fp, index.groups[(size_t)gi], AF, layout, wanted, intfields, dblfields);
+}
+
+#endif
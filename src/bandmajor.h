@@ -0,0 +1,210 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _bandmajor_H
+#define _bandmajor_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+
+#include "general_utils.h"
+#include "geophysics_netcdf.hpp"
+#include "ncvar_utils.h"
+
+//Band-major (transposed) companions of multiband sample variables.
+//A sample variable var(point, band...) is stored sample-major, so reading one band for a whole line or survey is a strided scan.
+//The companion var_bandmajor(band..., point) is chunked one band at a time so the same read is contiguous.
+//The two are linked by the band_major_variable and sample_major_variable attributes.
+
+constexpr auto BANDMAJOR_SUFFIX = "_bandmajor";
+constexpr auto BANDMAJOR_ATT = "band_major_variable";
+constexpr auto SAMPLEMAJOR_ATT = "sample_major_variable";
+
+namespace bandmajor_detail {
+
+	template<typename T>
+	void transpose_copy(const netCDF::NcVar& src, const netCDF::NcVar& dst, const size_t npoints, const size_t nbands, const std::vector<size_t>& banddims, const size_t blockbytes) {
+		const size_t blocksamples = std::max((size_t)1, blockbytes / (nbands * sizeof(T)));
+		std::vector<T> in;
+		std::vector<T> out;
+		for (size_t p0 = 0; p0 < npoints; p0 += blocksamples) {
+			const size_t ns = std::min(blocksamples, npoints - p0);
+			std::vector<size_t> startp(banddims.size() + 1, 0);
+			std::vector<size_t> countp(banddims.size() + 1);
+
+			startp[0] = p0;
+			countp[0] = ns;
+			std::copy(banddims.begin(), banddims.end(), countp.begin() + 1);
+			in.resize(ns * nbands);
+			src.getVar(startp, countp, in.data());
+
+			out.resize(ns * nbands);
+			for (size_t si = 0; si < ns; si++) {
+				for (size_t bi = 0; bi < nbands; bi++) {
+					out[bi * ns + si] = in[si * nbands + bi];
+				}
+			}
+
+			std::fill(startp.begin(), startp.end(), 0);
+			startp.back() = p0;
+			std::copy(banddims.begin(), banddims.end(), countp.begin());
+			countp.back() = ns;
+			dst.putVar(startp, countp, out.data());
+		}
+	}
+}
+
+//Add a band-major companion of a multiband sample variable to a file open for writing and fill it from the sample-major data
+inline bool add_bandmajor_variable(GeophysicsNetCDF::GFile& ncFile, const std::string& varname, const size_t blockbytes = 67108864) {
+	using namespace netCDF;
+
+	NcVar src = ncFile.getVar(varname);
+	if (src.isNull() || ncFile.isSampleVar(src) == false) {
+		throw(std::runtime_error(_SRC_ + strprint("%s is not a sample variable\n", varname.c_str())));
+	}
+
+	std::vector<NcDim> dims = src.getDims();
+	if (dims.size() < 2) return false;
+
+	std::vector<NcDim> cdims(dims.begin() + 1, dims.end());
+	cdims.push_back(dims[0]);
+	std::vector<size_t> banddims;
+	size_t nbands = 1;
+	for (size_t i = 1; i < dims.size(); i++) {
+		banddims.push_back(dims[i].getSize());
+		nbands *= dims[i].getSize();
+	}
+	const size_t npoints = dims[0].getSize();
+
+	const std::string cname = varname + BANDMAJOR_SUFFIX;
+	NcVar dst = ncFile.addVar(cname, src.getType(), cdims);
+
+	//One band per chunk, and a whole line or more along the point dimension
+	std::vector<size_t> chunks(cdims.size(), 1);
+	chunks.back() = std::max((size_t)1, std::min(npoints, (size_t)65536));
+	dst.setChunking(NcVar::nc_CHUNKED, chunks);
+	bool shuffle, deflate; int level;
+	src.getCompressionParameters(shuffle, deflate, level);
+	if (deflate) dst.setCompression(shuffle, deflate, level);
+
+	copy_var_attributes(src, dst);
+	dst.putAtt(SAMPLEMAJOR_ATT, varname);
+	src.putAtt(BANDMAJOR_ATT, cname);
+
+	nctype_dispatch(src.getType().getId(), [&](auto t) {
+		bandmajor_detail::transpose_copy<decltype(t)>(src, dst, npoints, nbands, banddims, blockbytes);
+	});
+	return true;
+}
+
+//Routes reads of multiband sample variables to whichever layout suits the access pattern:
+//whole lines come from the sample-major variable, single bands from the band-major companion when there is one
+class cBandRouter {
+
+	const GeophysicsNetCDF::GFile& File;
+	std::vector<size_t> LineStart;
+	std::vector<size_t> LineCount;
+	std::map<std::string, netCDF::NcVar> Companions;//null NcVar if there is none
+
+	const netCDF::NcVar& companion(const std::string& varname) {
+		auto it = Companions.find(varname);
+		if (it != Companions.end()) return it->second;
+
+		netCDF::NcVar c;
+		netCDF::NcVar v = File.getVar(varname);
+		if (v.isNull() == false) {
+			auto atts = v.getAtts();
+			auto a = atts.find(BANDMAJOR_ATT);
+			if (a != atts.end()) {
+				std::string cname;
+				a->second.getValues(cname);
+				c = File.getVar(cname);
+			}
+		}
+		return Companions.emplace(varname, c).first->second;
+	}
+
+	//Hyperslab of band bi over points [first, first+count) in the band-major companion
+	template<typename T>
+	void getbandrange(const netCDF::NcVar& c, const size_t bandindex, const size_t first, const size_t count, std::vector<T>& v) {
+		std::vector<netCDF::NcDim> dims = c.getDims();
+		std::vector<size_t> startp(dims.size(), 0);
+		std::vector<size_t> countp(dims.size(), 1);
+		size_t b = bandindex;
+		for (size_t k = dims.size() - 1; k-- > 0;) {
+			const size_t n = dims[k].getSize();
+			startp[k] = b % n;
+			b /= n;
+		}
+		if (b > 0) {
+			throw(std::runtime_error(_SRC_ + strprint("Band index %zu is out of range for %s\n", bandindex, c.getName().c_str())));
+		}
+		startp.back() = first;
+		countp.back() = count;
+		v.resize(count);
+		c.getVar(startp, countp, v.data());
+	}
+
+public:
+
+	cBandRouter(const GeophysicsNetCDF::GFile& file) : File(file) {
+		get_line_index(File, LineStart, LineCount);
+	}
+
+	bool hasbandmajor(const std::string& varname) {
+		return companion(varname).isNull() == false;
+	}
+
+	template<typename T>
+	bool getLine(const std::string& varname, const size_t lineindex, std::vector<T>& v) {
+		return File.getSampleVar(varname).getLine(lineindex, v);
+	}
+
+	template<typename T>
+	bool getLineBand(const std::string& varname, const size_t lineindex, const size_t bandindex, std::vector<T>& v) {
+		const netCDF::NcVar& c = companion(varname);
+		if (c.isNull()) return File.getSampleVar(varname).getLineBand(lineindex, bandindex, v);
+		getbandrange(c, bandindex, LineStart[lineindex], LineCount[lineindex], v);
+		return true;
+	}
+
+	//One band for every sample in the survey
+	template<typename T>
+	bool getBand(const std::string& varname, const size_t bandindex, std::vector<T>& v) {
+		const netCDF::NcVar& c = companion(varname);
+		if (c.isNull() == false) {
+			getbandrange(c, bandindex, 0, File.ntotalsamples(), v);
+			return true;
+		}
+
+		GeophysicsNetCDF::GSampleVar s = File.getSampleVar(varname);
+		const size_t nbands = s.nbands();
+		std::vector<size_t> startp = { 0, bandindex };
+		std::vector<size_t> countp = { File.ntotalsamples(), 1 };
+		if (s.getDimCount() != 2) {
+			//Multiple band dimensions, fall back to reading line by line
+			v.clear();
+			v.reserve(File.ntotalsamples());
+			std::vector<T> w;
+			for (size_t li = 0; li < LineStart.size(); li++) {
+				s.getLineBand(li, bandindex, w);
+				v.insert(v.end(), w.begin(), w.end());
+			}
+			return true;
+		}
+		if (bandindex >= nbands) return false;
+		v.resize(File.ntotalsamples());
+		s.getVar(startp, countp, v.data());
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,236 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _compression_policy_H
+#define _compression_policy_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <netcdf>
+#include <netcdf.h>
+#if __has_include(<netcdf_meta.h>)
+#include <netcdf_meta.h>
+#endif
+#if __has_include(<netcdf_filter.h>)
+#include <netcdf_filter.h>
+#endif
+
+#include "general_utils.h"
+
+//nc_def_var_filter appeared in 4.8.0 but nc_inq_filter_avail only in 4.8.1
+#if defined(NC_VERSION_MAJOR) && (NC_VERSION_MAJOR > 4 || (NC_VERSION_MAJOR == 4 && (NC_VERSION_MINOR > 8 || (NC_VERSION_MINOR == 8 && NC_VERSION_PATCH >= 1))))
+#define _NC_HAS_FILTER_API
+#endif
+
+//How one variable is stored: a compression filter with an optional byte shuffle in front of it
+struct sCompressionSetting {
+	std::string filter = "none";//none, deflate, zstd or bitshuffle
+	int level = 0;
+	bool shuffle = false;
+
+	static const unsigned int BITSHUFFLE_FILTER_ID = 32008;//registered HDF5 filter id, needs the plugin at run time
+
+	//filter[:level][+shuffle], e.g. deflate:4+shuffle, zstd:3, bitshuffle or shuffle on its own
+	static sCompressionSetting parse(const std::string& spec) {
+		sCompressionSetting c;
+		std::string s = tolower(trim(spec));
+		const size_t plus = s.find('+');
+		if (plus != std::string::npos) {
+			if (s.substr(plus + 1) != "shuffle") {
+				throw(std::runtime_error(_SRC_ + strprint("Unknown compression modifier in %s\n", spec.c_str())));
+			}
+			c.shuffle = true;
+			s = s.substr(0, plus);
+		}
+		const size_t colon = s.find(':');
+		if (colon != std::string::npos) {
+			c.level = atoi(s.substr(colon + 1).c_str());
+			s = s.substr(0, colon);
+		}
+		if (s == "shuffle") {
+			c.shuffle = true;
+			s = "none";
+		}
+		if (s != "none" && s != "deflate" && s != "zstd" && s != "bitshuffle") {
+			throw(std::runtime_error(_SRC_ + strprint("Unknown compression filter %s\n", spec.c_str())));
+		}
+		c.filter = s;
+		if (c.level == 0 && s == "deflate") c.level = 4;
+		if (c.level == 0 && s == "zstd") c.level = 3;
+		return c;
+	}
+
+	std::string str() const {
+		std::string s = filter;
+		if (filter == "deflate" || filter == "zstd") s += strprint(":%d", level);
+		if (shuffle) s += "+shuffle";
+		return s;
+	}
+
+	//Set the filters of a variable that is still in define mode, returns false if this NetCDF build (or its plugins) lacks the filter
+	bool apply(const netCDF::NcVar& var) const {
+		const int ncid = var.getParentGroup().getId();
+		const int varid = var.getId();
+		if (filter == "deflate") {
+			return nc_def_var_deflate(ncid, varid, shuffle ? 1 : 0, 1, level) == NC_NOERR;
+		}
+		if (shuffle && nc_def_var_deflate(ncid, varid, 1, 0, 0) != NC_NOERR) return false;
+		if (filter == "none") return true;
+#ifdef _NC_HAS_FILTER_API
+		if (filter == "zstd") {
+#if defined(NC_HAS_ZSTD) && NC_HAS_ZSTD
+			return nc_def_var_zstandard(ncid, varid, level) == NC_NOERR;
+#else
+			return false;
+#endif
+		}
+		if (filter == "bitshuffle") {
+			if (nc_inq_filter_avail(ncid, BITSHUFFLE_FILTER_ID) != NC_NOERR) return false;
+			//Reserved, reserved, element size (set by the filter), block size (default) and lz4 compression
+			const unsigned int params[5] = { 0, 0, 0, 0, 2 };
+			return nc_def_var_filter(ncid, varid, BITSHUFFLE_FILTER_ID, 5, params) == NC_NOERR;
+		}
+#endif
+		return false;
+	}
+
+	//The candidates tried by -autocompress
+	static std::vector<sCompressionSetting> candidates() {
+		std::vector<sCompressionSetting> c;
+		for (const char* s : { "none", "deflate:1+shuffle", "deflate:4+shuffle", "deflate:6+shuffle", "zstd:1+shuffle", "zstd:5+shuffle", "bitshuffle" }) {
+			c.push_back(parse(s));
+		}
+		return c;
+	}
+};
+
+//Compression settings per variable class (all, line, sample, multiband) or named variable, the most specific taking precedence
+class cCompressionPolicy {
+
+	std::vector<std::pair<std::string, sCompressionSetting>> Rules;
+
+public:
+	bool Auto = false;//choose per variable by trial compression of a sample of lines where the converter supports it
+
+	//class=setting or variable=setting, a bare setting applies to all variables
+	void add(const std::string& spec) {
+		const size_t eq = spec.find('=');
+		if (eq == std::string::npos) Rules.push_back(std::make_pair(std::string("all"), sCompressionSetting::parse(spec)));
+		else Rules.push_back(std::make_pair(tolower(trim(spec.substr(0, eq))), sCompressionSetting::parse(spec.substr(eq + 1))));
+	}
+
+	bool empty() const { return Rules.size() == 0; }
+
+	const sCompressionSetting* get(const std::string& varname, const bool islinevar, const size_t nbands) const {
+		const std::string name = tolower(varname);
+		const std::string cls = islinevar ? "line" : (nbands > 1 ? "multiband" : "sample");
+		for (const std::string& key : { name, cls, std::string(islinevar ? "line" : "sample"), std::string("all") }) {
+			for (const auto& r : Rules) {
+				if (r.first == key) return &r.second;
+			}
+		}
+		return nullptr;
+	}
+
+	//Apply the variable's setting if there is one, returns false only if a setting could not be applied
+	bool apply(const netCDF::NcVar& var, const bool islinevar, const size_t nbands) const {
+		const sCompressionSetting* c = get(var.getName(), islinevar, nbands);
+		if (c == nullptr) return true;
+		return c->apply(var);
+	}
+};
+
+//Result of storing a sample of a variable's values with one compression setting
+struct sCompressionTrial {
+	sCompressionSetting setting;
+	bool available = false;
+	size_t bytes = 0;//file size with this setting
+	double ratio = 0.0;//relative to the uncompressed file
+	double decodeseconds = 0.0;//fastest of the repeated full reads
+};
+
+//Write values[nrecords][nbands] to a scratch NetCDF file with each candidate setting, then time reading it back
+template<typename T>
+std::vector<sCompressionTrial> trial_compression(const std::vector<T>& values, const size_t nbands, const nc_type type, const std::vector<sCompressionSetting>& candidates, const std::string& scratchpath, const size_t repeats = 3) {
+	std::vector<sCompressionTrial> trials;
+	const size_t nrecords = nbands > 0 ? values.size() / nbands : 0;
+	if (nrecords == 0) return trials;
+
+	const std::vector<sCompressionSetting> all = [&]() {
+		std::vector<sCompressionSetting> c = { sCompressionSetting() };
+		for (const auto& s : candidates) {
+			if (s.filter != "none" || s.shuffle) c.push_back(s);
+		}
+		return c;
+	}();
+
+	size_t nonebytes = 0;
+	for (const auto& s : all) {
+		sCompressionTrial t;
+		t.setting = s;
+		{
+			netCDF::NcFile nc(scratchpath, netCDF::NcFile::replace, netCDF::NcFile::nc4);
+			std::vector<netCDF::NcDim> dims = { nc.addDim("record", nrecords) };
+			std::vector<size_t> chunks = { std::min(nrecords, (size_t)std::max((size_t)1, (size_t)1048576 / (nbands * sizeof(T)))) };
+			if (nbands > 1) {
+				dims.push_back(nc.addDim("band", nbands));
+				chunks.push_back(nbands);
+			}
+			netCDF::NcVar v = nc.addVar("v", netCDF::NcType(type), dims);
+			v.setChunking(netCDF::NcVar::nc_CHUNKED, chunks);
+			t.available = s.apply(v);
+			if (t.available) v.putVar(values.data());
+			nc.close();
+		}
+		if (t.available) {
+			t.bytes = (size_t)std::filesystem::file_size(scratchpath);
+			if (s.filter == "none" && s.shuffle == false) nonebytes = t.bytes;
+			std::vector<T> buf(values.size());
+			t.decodeseconds = 1e300;
+			for (size_t k = 0; k < repeats; k++) {
+				netCDF::NcFile nc(scratchpath, netCDF::NcFile::read);
+				const double t1 = gettime();
+				nc.getVar("v").getVar(buf.data());
+				const double t2 = gettime();
+				t.decodeseconds = std::min(t.decodeseconds, t2 - t1);
+				nc.close();
+			}
+		}
+		trials.push_back(t);
+	}
+	std::filesystem::remove(scratchpath);
+	for (auto& t : trials) {
+		if (t.available && t.bytes > 0) t.ratio = (double)nonebytes / (double)t.bytes;
+	}
+	return trials;
+}
+
+//The best compression ratio among the candidates that decode at least half as fast as the fastest compressed candidate
+inline sCompressionSetting choose_compression(const std::vector<sCompressionTrial>& trials) {
+	double fastest = 1e300;
+	for (const auto& t : trials) {
+		if (t.available && t.setting.filter != "none") fastest = std::min(fastest, t.decodeseconds);
+	}
+	sCompressionSetting best;
+	double bestratio = 1.0;
+	for (const auto& t : trials) {
+		if (t.available == false || t.decodeseconds > 2.0 * fastest) continue;
+		if (t.ratio > bestratio) {
+			bestratio = t.ratio;
+			best = t.setting;
+		}
+	}
+	return best;
+}
+
+#endif
@@ -0,0 +1,254 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _conversion_options_H
+#define _conversion_options_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <netcdf>
+
+#include "general_utils.h"
+#include "file_utils.h"
+#include "logger.h"
+#include "metadata.h"
+#include "compression_policy.h"
+#include "line_order.h"
+#include "string_list.h"
+
+extern class cLogger glog;
+
+//Lossy quantization of a variable, nsd = 0 to take the significant digits from the source's declared precision
+struct sQuantizeSpec {
+	std::string varname;
+	std::string mode = "granular";
+	int nsd = 0;
+
+	//var[=mode[:nsd]] or var[=nsd], e.g. all=granular:4, conductivity=3
+	static sQuantizeSpec parse(const std::string& s) {
+		sQuantizeSpec q;
+		const size_t eq = s.find('=');
+		q.varname = trim(s.substr(0, eq));
+		if (eq == std::string::npos) return q;
+		std::string rest = trim(s.substr(eq + 1));
+		const size_t colon = rest.find(':');
+		if (colon != std::string::npos) {
+			q.nsd = atoi(rest.substr(colon + 1).c_str());
+			rest = rest.substr(0, colon);
+		}
+		if (rest.size() > 0 && isdigit((unsigned char)rest[0])) q.nsd = atoi(rest.c_str());
+		else if (rest.size() > 0) q.mode = tolower(rest);
+		return q;
+	}
+};
+
+//Options shared by the batch converters (aseggdf2netcdf and intrepid2netcdf).
+//parse() removes the options it recognises from the command line and returns the remaining positional arguments.
+class cConversionOptions {
+
+	static bool inlist(const std::vector<std::string>& list, const std::string& name) {
+		for (const auto& s : list) {
+			if (tolower(s) == "all" || tolower(s) == tolower(name)) return true;
+		}
+		return false;
+	}
+
+public:
+	std::vector<std::string> IncludeFields;//only convert these fields (all if empty)
+	std::vector<std::string> ExcludeFields;//do not convert these fields
+	std::vector<std::string> BandMajorVariables;//multiband variables that also get a band-major companion
+	std::vector<std::string> PackVariables;//real variables stored as packed short/int at their declared precision
+	std::vector<size_t> OverviewFactors;//decimation of each overview level, none if empty
+	std::vector<std::string> OverviewVariables;//sample variables with overviews (all if empty)
+	std::vector<sQuantizeSpec> QuantizeSpecs;//lossy quantization of float/double variables
+	cCompressionPolicy Compression;//compression filters per variable class or variable
+	bool UseLineIndex = true;//read and write the .idx line index sidecar of ASEG-GDF .dat files
+	bool Statistics = false;//store each variable's statistics as attributes
+	size_t HistogramBins = 0;//bins of each variable's stored histogram, 0 for none
+	eLineOrder LineOrder = eLineOrder::SOURCE;//order the lines are written in
+	size_t Shards = 0;//write this many files of contiguous line ranges and a manifest instead of one file
+	size_t FootprintVertices = 0;//vertices of each line's stored footprint, 0 for no footprints or bounding boxes
+	std::string MetaDataFile;//tab separated table of survey metadata
+	std::string MetaDataKey;//field of the table that identifies each survey
+	std::string MetaDataValue;//key value of this survey, by default the input file name (without extension)
+	size_t MetaDataSkip = 0;//lines to skip after the table's header
+	std::shared_ptr<const cLazyMetaDataTable> MetaData;//loaded once by loadmetadata() and shared by all the files of a batch
+
+	std::vector<std::string> parse(int argc, char** argv) {
+		std::vector<std::string> args;
+		for (int i = 1; i < argc; i++) {
+			std::string a = argv[i];
+			const bool hasvalue = (i + 1 < argc);
+			if (a == "-bandmajor" && hasvalue) BandMajorVariables = split_list(argv[++i]);
+			else if (a == "-include" && hasvalue) IncludeFields = split_list(argv[++i]);
+			else if (a == "-exclude" && hasvalue) ExcludeFields = split_list(argv[++i]);
+			else if (a == "-pack" && hasvalue) PackVariables = split_list(argv[++i]);
+			else if (a == "-overviews" && hasvalue) {
+				for (const auto& item : split_list(argv[++i])) OverviewFactors.push_back((size_t)atoll(item.c_str()));
+			}
+			else if (a == "-overviewvars" && hasvalue) OverviewVariables = split_list(argv[++i]);
+			else if (a == "-quantize" && hasvalue) {
+				for (const auto& item : split_list(argv[++i])) QuantizeSpecs.push_back(sQuantizeSpec::parse(item));
+			}
+			else if (a == "-compress" && hasvalue) {
+				for (const auto& item : split_list(argv[++i])) Compression.add(item);
+			}
+			else if (a == "-autocompress") Compression.Auto = true;
+			else if (a == "-nolineindex") UseLineIndex = false;
+			else if (a == "-statistics") Statistics = true;
+			else if (a == "-histogram" && hasvalue) {
+				HistogramBins = (size_t)atoll(argv[++i]);
+				Statistics = true;
+			}
+			else if (a == "-shards" && hasvalue) Shards = (size_t)atoll(argv[++i]);
+			else if (a == "-lineorder" && hasvalue) LineOrder = parse_line_order(argv[++i]);
+			else if (a == "-footprint" && hasvalue) FootprintVertices = (size_t)atoll(argv[++i]);
+			else if (a == "-metadata" && hasvalue) MetaDataFile = argv[++i];
+			else if (a == "-metadatakey" && hasvalue) MetaDataKey = argv[++i];
+			else if (a == "-metadatavalue" && hasvalue) MetaDataValue = argv[++i];
+			else if (a == "-metadataskip" && hasvalue) MetaDataSkip = (size_t)atoll(argv[++i]);
+			else args.push_back(a);
+		}
+		return args;
+	}
+
+	static void usage() {
+		std::cout << "Options:" << std::endl;
+		std::cout << "   -include field1,field2,...    only convert these fields (the RT and FLTLINE fields are only converted if named here)" << std::endl;
+		std::cout << "   -exclude field1,field2,...    do not convert these fields" << std::endl;
+		std::cout << "   -bandmajor all|var1,var2,...  also write band-major copies of these multiband variables for fast per-band reads" << std::endl;
+		std::cout << "   -pack all|var1,var2,...       store these real variables as short/int with scale_factor/add_offset, lossless at the .dfn decimals (aseggdf2netcdf)" << std::endl;
+		std::cout << "   -overviews f1,f2,...          add overview levels keeping every f-th sample of each line, e.g. -overviews 10,100,1000" << std::endl;
+		std::cout << "   -overviewvars var1,var2,...   sample variables included in the overviews (default all)" << std::endl;
+		std::cout << "   -quantize var[=mode[:nsd]],...  quantize float/double variables (or all) with mode bitgroom|granular|bitround (default granular)" << std::endl;
+		std::cout << "                                 to nsd significant digits (bits for bitround), by default from the .dfn format (aseggdf2netcdf)" << std::endl;
+		std::cout << "   -compress [class=]filter[:level][+shuffle],...  compression of all, line, sample or multiband variables, or a named variable" << std::endl;
+		std::cout << "                                 with filter none|deflate|zstd|bitshuffle, e.g. -compress sample=deflate:4+shuffle,multiband=zstd:5" << std::endl;
+		std::cout << "   -autocompress                 choose each sample variable's compression by trying the candidates on a sample of lines (aseggdf2netcdf)" << std::endl;
+		std::cout << "   -nolineindex                  do not use or create the .idx line index sidecar of the .dat file" << std::endl;
+		std::cout << "   -statistics                   store actual_range, mean, standard_deviation, valid_count and null_count attributes" << std::endl;
+		std::cout << "   -histogram n                  also store a histogram of n bins over the actual range (implies -statistics)" << std::endl;
+		std::cout << "   -shards n                     write n files (out_shard0000.nc, ...) of contiguous line ranges and a manifest out.manifest" << std::endl;
+		std::cout << "                                 tying them together, with MPI each rank writing its own shards without parallel HDF5" << std::endl;
+		std::cout << "   -lineorder source|number|hilbert  write the lines in input order, by line number, or along a Hilbert curve through their centroids" << std::endl;
+		std::cout << "   -footprint n                  vertices of the per line footprints stored with the line bounding boxes (default 0, none)" << std::endl;
+		std::cout << "   -metadata file.tsv            write the matching record of this tab separated table as global attributes" << std::endl;
+		std::cout << "   -metadatakey field            field of the metadata table to match" << std::endl;
+		std::cout << "   -metadatavalue value          value to match (default the input file name without extension)" << std::endl;
+		std::cout << "   -metadataskip n               lines to skip after the metadata table's header (default 0)" << std::endl;
+	}
+
+	//Whether a field is converted, by its field or variable name
+	bool isincluded(const std::string& name) const {
+		if (IncludeFields.size() > 0 && inlist(IncludeFields, name) == false) return false;
+		return isexcluded(name) == false;
+	}
+
+	//Whether a field that has both a field name and a different variable name (e.g. an ASEG-GDF label and its NAME=)
+	//is converted, it is included if either name is in the -include list and excluded if either is in the -exclude list
+	bool isincluded(const std::string& name, const std::string& varname) const {
+		if (IncludeFields.size() > 0 && inlist(IncludeFields, name) == false && inlist(IncludeFields, varname) == false) return false;
+		return isexcluded(name) == false && isexcluded(varname) == false;
+	}
+
+	bool isexcluded(const std::string& name) const {
+		for (const auto& s : ExcludeFields) {
+			if (tolower(s) == tolower(name)) return true;
+		}
+		return false;
+	}
+
+	//Whether a field is named in the -include list, rather than just not excluded
+	bool isnamedinclude(const std::string& name) const {
+		for (const auto& s : IncludeFields) {
+			if (tolower(s) == tolower(name)) return true;
+		}
+		return false;
+	}
+
+	bool isbandmajor(const std::string& varname) const {
+		return inlist(BandMajorVariables, varname);
+	}
+
+	bool isoverview(const std::string& varname) const {
+		return OverviewVariables.size() == 0 || inlist(OverviewVariables, varname);
+	}
+
+	bool ispacked(const std::string& varname) const {
+		return inlist(PackVariables, varname);
+	}
+
+	//The quantization of a variable, an explicitly named one taking precedence over "all", or nullptr
+	const sQuantizeSpec* quantizespec(const std::string& varname) const {
+		const sQuantizeSpec* all = nullptr;
+		for (const auto& q : QuantizeSpecs) {
+			if (tolower(q.varname) == tolower(varname)) return &q;
+			if (tolower(q.varname) == "all" && all == nullptr) all = &q;
+		}
+		return all;
+	}
+
+	void loadmetadata() {
+		if (MetaDataFile.size() == 0 || MetaData) return;
+		if (MetaDataKey.size() == 0) {
+			throw(std::runtime_error(_SRC_ + strprint("-metadata needs -metadatakey\n")));
+		}
+		auto T = std::make_shared<cLazyMetaDataTable>(MetaDataFile, MetaDataSkip);
+		if (T->findkeyindex(MetaDataKey) < 0) {
+			throw(std::runtime_error(_SRC_ + strprint("Metadata key %s is not a field of %s\n", MetaDataKey.c_str(), MetaDataFile.c_str())));
+		}
+		MetaData = T;
+	}
+
+	//Write the fields of the survey's metadata record as global attributes, returns the number written.
+	//Call after the converter's own global attributes, which are not replaced, and before any data is written
+	//so the attributes go in the initial header rather than forcing a rewrite.
+	size_t put_metadata_attributes(netCDF::NcGroup& nc, const std::string& inputpath) const {
+		if (!MetaData) return 0;
+		std::string value = MetaDataValue;
+		if (value.size() == 0) value = getfilepathparts(inputpath).prefix;
+		std::vector<size_t> recs = MetaData->findmatchingrecords(MetaDataKey, value);
+		if (recs.size() == 0) {
+			char* end;
+			const long n = strtol(value.c_str(), &end, 10);
+			if (*end == 0 && value.size() > 0) recs = MetaData->findmatchingrecords(MetaDataKey, (int)n);
+		}
+		if (recs.size() == 0) {
+			glog.logmsg("Warning: no record with %s=%s in metadata table %s\n", MetaDataKey.c_str(), value.c_str(), MetaDataFile.c_str());
+			return 0;
+		}
+		if (recs.size() > 1) {
+			glog.logmsg("Warning: %zu records with %s=%s in metadata table %s, using the first\n", recs.size(), MetaDataKey.c_str(), value.c_str(), MetaDataFile.c_str());
+		}
+
+		size_t n = 0;
+		for (size_t fi = 0; fi < MetaData->nfields(); fi++) {
+			const std::string_view v = MetaData->value(recs[0], fi);
+			if (v.size() == 0) continue;
+			std::string name = trim(MetaData->header[fi]);
+			for (char& c : name) {
+				if (!isalnum((unsigned char)c) && c != '_') c = '_';
+			}
+			if (name.size() == 0) continue;
+			//Leading underscores are reserved by NetCDF and names cannot start with a digit
+			if (name[0] == '_' || isdigit((unsigned char)name[0])) name = "metadata" + (name[0] == '_' ? name : "_" + name);
+			//Never replace the attributes the converter has already written (CreationTime, CreationMethod, source file)
+			if (nc.getAtts().count(name)) {
+				glog.logmsg("Warning: metadata field %s would replace an existing global attribute, skipping it\n", name.c_str());
+				continue;
+			}
+			nc.putAtt(name, std::string(v));
+			n++;
+		}
+		return n;
+	}
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _coverage_H
+#define _coverage_H
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#ifdef ENABLE_CGAL
+#include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
+#include <CGAL/ch_akl_toussaint.h>
+#include <CGAL/Delaunay_triangulation_2.h>
+#include <CGAL/Alpha_shape_vertex_base_2.h>
+#include <CGAL/Alpha_shape_face_base_2.h>
+#include <CGAL/Alpha_shape_2.h>
+#endif
+
+//A closed ring of vertices, counter-clockwise for outer boundaries and clockwise for holes
+typedef std::vector<std::pair<double, double>> cCoverageRing;
+
+//Computes survey coverage polygons from coordinates that are streamed in one block (usually one line) at a time.
+//Memory is bounded independently of the number of points:
+//	- the convex hull method only keeps the current hull plus one pending block
+//	- the alpha shape method keeps one representative point per occupied cell of a regular grid,
+//	  and the grid is coarsened whenever the number of occupied cells exceeds maxcells
+class cCoverageAccumulator {
+
+public:
+	enum class Method { NONE, CONVEX, ALPHA };
+
+private:
+	Method method = Method::NONE;
+	double alpha = 0.0;
+	double cellsize = 0.0;
+	size_t maxcells = 0;
+	size_t maxpending = 65536;
+	size_t npoints = 0;
+
+	std::vector<std::pair<double, double>> hull;
+	std::vector<std::pair<double, double>> pending;
+	std::unordered_map<uint64_t, std::pair<double, double>> cells;
+
+	uint64_t cellkey(const double x, const double y) const {
+		const int64_t ix = (int64_t)std::floor(x / cellsize);
+		const int64_t iy = (int64_t)std::floor(y / cellsize);
+		return ((uint64_t)(uint32_t)ix << 32) | (uint64_t)(uint32_t)iy;
+	}
+
+	void coarsen() {
+		//Double the cell size until the occupied cells fit within the budget again
+		while (cells.size() > maxcells) {
+			cellsize *= 2.0;
+			std::unordered_map<uint64_t, std::pair<double, double>> coarse;
+			coarse.reserve(cells.size() / 2);
+			for (const auto& [key, p] : cells) {
+				coarse.emplace(cellkey(p.first, p.second), p);
+			}
+			cells.swap(coarse);
+		}
+	}
+
+#ifdef ENABLE_CGAL
+	typedef CGAL::Exact_predicates_inexact_constructions_kernel K;
+	typedef K::Point_2 Point;
+
+	void merge_pending() {
+		if (pending.size() == 0) return;
+		std::vector<Point> p;
+		p.reserve(hull.size() + pending.size());
+		for (const auto& v : hull) p.push_back(Point(v.first, v.second));
+		for (const auto& v : pending) p.push_back(Point(v.first, v.second));
+		std::vector<Point> h;
+		CGAL::ch_akl_toussaint(p.begin(), p.end(), std::back_inserter(h));
+		hull.resize(h.size());
+		for (size_t i = 0; i < h.size(); i++) {
+			hull[i] = std::make_pair(h[i].x(), h[i].y());
+		}
+		pending.clear();
+	}
+
+	std::vector<cCoverageRing> alpha_shape_rings() const {
+		typedef CGAL::Alpha_shape_vertex_base_2<K> Vb;
+		typedef CGAL::Alpha_shape_face_base_2<K> Fb;
+		typedef CGAL::Triangulation_data_structure_2<Vb, Fb> Tds;
+		typedef CGAL::Delaunay_triangulation_2<K, Tds> Triangulation;
+		typedef CGAL::Alpha_shape_2<Triangulation> AlphaShape;
+		typedef AlphaShape::Vertex_handle Vertex_handle;
+
+		std::vector<Point> p;
+		p.reserve(cells.size());
+		for (const auto& [key, v] : cells) {
+			p.push_back(Point(v.first, v.second));
+		}
+
+		//The grid may have been coarsened, so the radius can never be smaller than one cell diagonal
+		const double r = std::max(alpha, cellsize * std::sqrt(2.0));
+		AlphaShape A(p.begin(), p.end(), K::FT(r * r), AlphaShape::REGULARIZED);
+
+		//Orient every boundary edge so that the interior of the shape is on its left
+		std::multimap<Vertex_handle, Vertex_handle> next;
+		for (auto it = A.alpha_shape_edges_begin(); it != A.alpha_shape_edges_end(); ++it) {
+			auto f = it->first;
+			int i = it->second;
+			if (A.classify(f) != AlphaShape::INTERIOR) {
+				auto g = f->neighbor(i);
+				i = g->index(f);
+				f = g;
+			}
+			Vertex_handle a = f->vertex(f->ccw(i));
+			Vertex_handle b = f->vertex(f->cw(i));
+			next.emplace(a, b);
+		}
+
+		//Chain the oriented edges into closed rings
+		std::vector<cCoverageRing> rings;
+		while (next.size() > 0) {
+			cCoverageRing ring;
+			auto it = next.begin();
+			const Vertex_handle start = it->first;
+			Vertex_handle v = start;
+			do {
+				ring.push_back(std::make_pair(v->point().x(), v->point().y()));
+				Vertex_handle w = it->second;
+				next.erase(it);
+				v = w;
+				it = next.find(v);
+			} while (v != start && it != next.end());
+			if (ring.size() >= 3) {
+				ring.push_back(ring.front());
+				rings.push_back(ring);
+			}
+		}
+		return rings;
+	}
+#endif
+
+public:
+
+	cCoverageAccumulator() {};
+
+	cCoverageAccumulator(const Method _method, const double _alpha, const size_t _maxcells = 4000000) {
+		method = _method;
+		alpha = _alpha;
+		maxcells = _maxcells;
+		//Half the alpha radius keeps the decimated boundary within the requested resolution
+		cellsize = alpha / 2.0;
+	}
+
+	static bool available() {
+#ifdef ENABLE_CGAL
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	Method getmethod() const { return method; }
+
+	size_t npointsadded() const { return npoints; }
+
+	void add_points(const std::vector<double>& x, const std::vector<double>& y, const double nullvalue) {
+		if (method == Method::NONE || available() == false) return;
+		for (size_t i = 0; i < x.size(); i++) {
+			if (x[i] == nullvalue || y[i] == nullvalue) continue;
+			npoints++;
+			if (method == Method::CONVEX) {
+				pending.push_back(std::make_pair(x[i], y[i]));
+			}
+			else {
+				cells.emplace(cellkey(x[i], y[i]), std::make_pair(x[i], y[i]));
+			}
+		}
+#ifdef ENABLE_CGAL
+		if (pending.size() > maxpending) merge_pending();
+#endif
+		if (method == Method::ALPHA && cells.size() > maxcells) coarsen();
+	}
+
+	std::vector<cCoverageRing> finish() {
+		std::vector<cCoverageRing> rings;
+#ifdef ENABLE_CGAL
+		if (method == Method::CONVEX) {
+			merge_pending();
+			if (hull.size() >= 3) {
+				cCoverageRing ring = hull;
+				ring.push_back(ring.front());
+				rings.push_back(ring);
+			}
+		}
+		else if (method == Method::ALPHA) {
+			if (cells.size() >= 3) rings = alpha_shape_rings();
+		}
+#endif
+		return rings;
+	}
+
+	static double signedarea(const cCoverageRing& r) {
+		double a = 0.0;
+		for (size_t i = 0; i + 1 < r.size(); i++) {
+			a += r[i].first * r[i + 1].second - r[i + 1].first * r[i].second;
+		}
+		return a / 2.0;
+	}
+
+	static bool inside(const cCoverageRing& r, const double x, const double y) {
+		bool in = false;
+		for (size_t i = 0, j = r.size() - 1; i < r.size(); j = i++) {
+			const auto& a = r[i];
+			const auto& b = r[j];
+			if (((a.second > y) != (b.second > y)) &&
+				(x < (b.first - a.first) * (y - a.second) / (b.second - a.second) + a.first)) {
+				in = !in;
+			}
+		}
+		return in;
+	}
+};
+
+#endif
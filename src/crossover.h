@@ -0,0 +1,243 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _crossover_H
+#define _crossover_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <functional>
+
+#include "thread_pool.h"
+
+//Where two lines cross, as the segment (from sample index to index + 1) and the fraction along it on each line
+struct sCrossover {
+	uint32_t linea;//line index
+	uint32_t lineb;
+	uint64_t samplea;//sample offset within the line
+	uint64_t sampleb;
+	double ta;
+	double tb;
+	double x;
+	double y;
+
+	bool operator<(const sCrossover& c) const {
+		if (linea != c.linea) return linea < c.linea;
+		if (samplea != c.samplea) return samplea < c.samplea;
+		if (lineb != c.lineb) return lineb < c.lineb;
+		return sampleb < c.sampleb;
+	}
+};
+
+//Finds every crossing of the lines of a survey. The lines are split into chunks of a fixed number of
+//segments and the chunk bounding boxes are indexed in a uniform grid, so only chunks sharing a grid cell
+//are tested against each other. Each chunk pair is examined in just one cell (the one holding the low
+//corner of the overlap of their boxes), so the chunks can be processed in parallel without deduplication.
+//Coordinates are held as float offsets from an origin within the survey, 8 bytes per sample.
+class cCrossoverFinder {
+
+	struct sChunk {
+		uint32_t line;
+		uint32_t first;//first segment
+		uint32_t nsegments;
+		float xmin, ymin, xmax, ymax;
+	};
+
+	size_t ChunkSegments;
+	double X0 = 0.0;
+	double Y0 = 0.0;
+	std::vector<std::vector<float>> X;
+	std::vector<std::vector<float>> Y;
+	std::vector<sChunk> Chunks;
+
+	//Uniform grid of chunk indices in compressed row form
+	double GX0 = 0.0;
+	double GY0 = 0.0;
+	double CellSize = 1.0;
+	size_t NX = 0;
+	size_t NY = 0;
+	std::vector<size_t> CellStart;
+	std::vector<uint32_t> CellChunks;
+
+	size_t cellx(const double x) const { return (size_t)std::clamp((long long)std::floor((x - GX0) / CellSize), 0LL, (long long)NX - 1); }
+	size_t celly(const double y) const { return (size_t)std::clamp((long long)std::floor((y - GY0) / CellSize), 0LL, (long long)NY - 1); }
+
+	void build_chunks(const size_t li) {
+		const std::vector<float>& x = X[li];
+		const std::vector<float>& y = Y[li];
+		const size_t nseg = x.size() > 1 ? x.size() - 1 : 0;
+		for (size_t first = 0; first < nseg; first += ChunkSegments) {
+			sChunk c;
+			c.line = (uint32_t)li;
+			c.first = (uint32_t)first;
+			c.nsegments = (uint32_t)std::min(ChunkSegments, nseg - first);
+			c.xmin = c.ymin = std::numeric_limits<float>::max();
+			c.xmax = c.ymax = -std::numeric_limits<float>::max();
+			for (size_t k = first; k <= first + c.nsegments; k++) {
+				if (std::isnan(x[k]) || std::isnan(y[k])) continue;
+				c.xmin = std::min(c.xmin, x[k]);
+				c.xmax = std::max(c.xmax, x[k]);
+				c.ymin = std::min(c.ymin, y[k]);
+				c.ymax = std::max(c.ymax, y[k]);
+			}
+			if (c.xmin <= c.xmax) Chunks.push_back(c);
+		}
+	}
+
+	void build_grid() {
+		double xmin = 0.0, ymin = 0.0, xmax = 0.0, ymax = 0.0, sumsize = 0.0;
+		for (size_t ci = 0; ci < Chunks.size(); ci++) {
+			const sChunk& c = Chunks[ci];
+			xmin = ci ? std::min(xmin, (double)c.xmin) : c.xmin;
+			ymin = ci ? std::min(ymin, (double)c.ymin) : c.ymin;
+			xmax = ci ? std::max(xmax, (double)c.xmax) : c.xmax;
+			ymax = ci ? std::max(ymax, (double)c.ymax) : c.ymax;
+			sumsize += std::max(c.xmax - c.xmin, c.ymax - c.ymin);
+		}
+		GX0 = xmin;
+		GY0 = ymin;
+		//Cells about the size of a chunk, but no more cells than a few per chunk
+		CellSize = std::max(sumsize / std::max((size_t)1, Chunks.size()), 1e-9);
+		while (((xmax - xmin) / CellSize + 1) * ((ymax - ymin) / CellSize + 1) > 4.0 * (double)Chunks.size() + 16.0) CellSize *= 1.5;
+		NX = (size_t)((xmax - xmin) / CellSize) + 1;
+		NY = (size_t)((ymax - ymin) / CellSize) + 1;
+
+		CellStart.assign(NX * NY + 1, 0);
+		auto forcells = [&](const sChunk& c, const std::function<void(size_t)>& f) {
+			for (size_t iy = celly(c.ymin); iy <= celly(c.ymax); iy++) {
+				for (size_t ix = cellx(c.xmin); ix <= cellx(c.xmax); ix++) f(iy * NX + ix);
+			}
+		};
+		for (const auto& c : Chunks) forcells(c, [&](const size_t cell) { CellStart[cell + 1]++; });
+		for (size_t k = 1; k < CellStart.size(); k++) CellStart[k] += CellStart[k - 1];
+		CellChunks.resize(CellStart.back());
+		std::vector<size_t> next(CellStart.begin(), CellStart.end() - 1);
+		for (size_t ci = 0; ci < Chunks.size(); ci++) {
+			forcells(Chunks[ci], [&](const size_t cell) { CellChunks[next[cell]++] = (uint32_t)ci; });
+		}
+	}
+
+	//Crossing of segment a (k to k+1) with segment b, fractions in [0,1) so shared chunk end points count once
+	static bool intersect(const double ax0, const double ay0, const double ax1, const double ay1, const double bx0, const double by0, const double bx1, const double by1, double& ta, double& tb) {
+		const double dax = ax1 - ax0, day = ay1 - ay0;
+		const double dbx = bx1 - bx0, dby = by1 - by0;
+		const double den = dax * dby - day * dbx;
+		if (den == 0.0) return false;//parallel or degenerate
+		const double ex = bx0 - ax0, ey = by0 - ay0;
+		ta = (ex * dby - ey * dbx) / den;
+		tb = (ex * day - ey * dax) / den;
+		return ta >= 0.0 && ta < 1.0 && tb >= 0.0 && tb < 1.0;
+	}
+
+	void cross_chunks(const sChunk& a, const sChunk& b, std::vector<sCrossover>& out) const {
+		const float oxmin = std::max(a.xmin, b.xmin), oxmax = std::min(a.xmax, b.xmax);
+		const float oymin = std::max(a.ymin, b.ymin), oymax = std::min(a.ymax, b.ymax);
+		const std::vector<float>& xa = X[a.line];
+		const std::vector<float>& ya = Y[a.line];
+		const std::vector<float>& xb = X[b.line];
+		const std::vector<float>& yb = Y[b.line];
+
+		//Only the segments of b that reach into the overlap of the two boxes
+		std::vector<uint32_t> sb;
+		for (uint32_t k = b.first; k < b.first + b.nsegments; k++) {
+			if (std::max(xb[k], xb[k + 1]) < oxmin || std::min(xb[k], xb[k + 1]) > oxmax) continue;
+			if (std::max(yb[k], yb[k + 1]) < oymin || std::min(yb[k], yb[k + 1]) > oymax) continue;
+			sb.push_back(k);
+		}
+		if (sb.size() == 0) return;
+
+		for (uint32_t i = a.first; i < a.first + a.nsegments; i++) {
+			const float axmin = std::min(xa[i], xa[i + 1]), axmax = std::max(xa[i], xa[i + 1]);
+			const float aymin = std::min(ya[i], ya[i + 1]), aymax = std::max(ya[i], ya[i + 1]);
+			if (axmax < oxmin || axmin > oxmax || aymax < oymin || aymin > oymax) continue;
+			for (const uint32_t j : sb) {
+				if (std::max(xb[j], xb[j + 1]) < axmin || std::min(xb[j], xb[j + 1]) > axmax) continue;
+				if (std::max(yb[j], yb[j + 1]) < aymin || std::min(yb[j], yb[j + 1]) > aymax) continue;
+				double ta, tb;
+				if (intersect(xa[i], ya[i], xa[i + 1], ya[i + 1], xb[j], yb[j], xb[j + 1], yb[j + 1], ta, tb) == false) continue;
+				sCrossover c;
+				c.linea = a.line;
+				c.lineb = b.line;
+				c.samplea = i;
+				c.sampleb = j;
+				c.ta = ta;
+				c.tb = tb;
+				c.x = X0 + (double)xa[i] + ta * ((double)xa[i + 1] - (double)xa[i]);
+				c.y = Y0 + (double)ya[i] + ta * ((double)ya[i + 1] - (double)ya[i]);
+				out.push_back(c);
+			}
+		}
+	}
+
+public:
+
+	cCrossoverFinder(const size_t chunksegments = 64) : ChunkSegments(std::max((size_t)1, chunksegments)) {}
+
+	//Coordinates are stored relative to this origin (e.g. the first sample of the survey), set before adding lines
+	void setorigin(const double x0, const double y0) {
+		X0 = x0;
+		Y0 = y0;
+	}
+
+	//Lines are added in line index order, null samples as nan
+	void addline(const std::vector<double>& x, const std::vector<double>& y) {
+		const size_t li = X.size();
+		X.emplace_back(x.size());
+		Y.emplace_back(y.size());
+		for (size_t k = 0; k < x.size(); k++) {
+			X[li][k] = (float)(x[k] - X0);
+			Y[li][k] = (float)(y[k] - Y0);
+		}
+		build_chunks(li);
+	}
+
+	size_t nlines() const { return X.size(); }
+	size_t nchunks() const { return Chunks.size(); }
+
+	//All crossings between lines a and b for which cross(a, b) is true, sorted by line and sample
+	std::vector<sCrossover> find(const std::function<bool(size_t, size_t)>& cross, const size_t nthreads = 0) {
+		build_grid();
+		cWorkStealingPool P(nthreads);
+		std::vector<std::vector<sCrossover>> found(P.size());
+		P.run(Chunks.size(), [&](const size_t ci, const size_t wi) {
+			const sChunk& a = Chunks[ci];
+			for (size_t iy = celly(a.ymin); iy <= celly(a.ymax); iy++) {
+				for (size_t ix = cellx(a.xmin); ix <= cellx(a.xmax); ix++) {
+					const size_t cell = iy * NX + ix;
+					for (size_t k = CellStart[cell]; k < CellStart[cell + 1]; k++) {
+						const uint32_t cj = CellChunks[k];
+						const sChunk& b = Chunks[cj];
+						if (b.line <= a.line) continue;//each pair of lines once, and not a line with itself
+						if (b.xmax < a.xmin || b.xmin > a.xmax || b.ymax < a.ymin || b.ymin > a.ymax) continue;
+						if (cellx(std::max(a.xmin, b.xmin)) != ix || celly(std::max(a.ymin, b.ymin)) != iy) continue;
+						if (cross(a.line, b.line) == false) continue;
+						cross_chunks(a, b, found[wi]);
+					}
+				}
+			}
+		});
+
+		std::vector<sCrossover> all;
+		for (auto& f : found) all.insert(all.end(), f.begin(), f.end());
+		std::sort(all.begin(), all.end());
+		return all;
+	}
+
+	//Value of a line's variable at a crossing, or null if either neighbouring sample is null
+	static double interpolate(const std::vector<double>& v, const uint64_t sample, const double t, const double null) {
+		const double v0 = v[sample];
+		const double v1 = v[sample + 1];
+		if (v0 == null || v1 == null) return null;
+		return v0 + t * (v1 - v0);
+	}
+};
+
+#endif
@@ -0,0 +1,270 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _footprint_H
+#define _footprint_H
+
+#include <cmath>
+#include <vector>
+#include <string>
+#include <queue>
+#include <algorithm>
+#include <netcdf>
+
+#ifdef ENABLE_MPI
+#include "mpi.h"
+#endif
+
+#include "general_utils.h"
+#include "geophysics_netcdf.hpp"
+
+//Bounding box and simplified path of one line
+struct sLineFootprint {
+	double xmin = 0.0;
+	double ymin = 0.0;
+	double xmax = 0.0;
+	double ymax = 0.0;
+	std::vector<double> x;
+	std::vector<double> y;
+
+	bool valid() const { return x.size() > 0; }
+};
+
+//Per line bounding boxes and footprints computed from the coordinates as a converter streams them, and
+//stored as small line variables so exporters and catalog tools need not read the coordinate variables:
+//  line_bbox_xmin, line_bbox_ymin, line_bbox_xmax, line_bbox_ymax (line)
+//  line_footprint_x, line_footprint_y (line, footprint_vertex) padded with the fill value
+//  line_footprint_count (line)
+//The footprint is the Douglas-Peucker simplification of the line to at most a fixed number of vertices,
+//adding at each step the vertex furthest from the current simplified path.
+class cLineFootprints {
+
+	size_t MaxVertices;
+	std::vector<sLineFootprint> Lines;//by line index, unset for the lines of other MPI ranks
+
+	struct sSpan {
+		size_t a;
+		size_t b;
+		size_t far;//vertex furthest from the segment a-b
+		double d2;//its squared distance
+		bool operator<(const sSpan& s) const { return d2 < s.d2; }
+	};
+
+	static sSpan span(const std::vector<double>& x, const std::vector<double>& y, const size_t a, const size_t b) {
+		sSpan s = { a, b, a, 0.0 };
+		const double dx = x[b] - x[a];
+		const double dy = y[b] - y[a];
+		const double len2 = dx * dx + dy * dy;
+		for (size_t k = a + 1; k < b; k++) {
+			//Distance to the segment a-b, not the line through it, so the far end of an out-and-back or loop still counts
+			const double ex = x[k] - x[a];
+			const double ey = y[k] - y[a];
+			const double dot = ex * dx + ey * dy;
+			double d2;
+			if (len2 <= 0.0 || dot <= 0.0) d2 = ex * ex + ey * ey;
+			else if (dot >= len2) {
+				const double fx = x[k] - x[b];
+				const double fy = y[k] - y[b];
+				d2 = fx * fx + fy * fy;
+			}
+			else {
+				const double c = ex * dy - ey * dx;
+				d2 = c * c / len2;
+			}
+			if (d2 > s.d2) {
+				s.d2 = d2;
+				s.far = k;
+			}
+		}
+		return s;
+	}
+
+	void simplify(const std::vector<double>& x, const std::vector<double>& y, sLineFootprint& f) const {
+		const size_t n = x.size();
+		std::vector<char> keep(n, 0);
+		keep[0] = keep[n - 1] = 1;
+		size_t nkept = n > 1 ? 2 : 1;
+		std::priority_queue<sSpan> q;
+		if (n > 2) q.push(span(x, y, 0, n - 1));
+		while (nkept < MaxVertices && q.size() > 0) {
+			const sSpan s = q.top();
+			q.pop();
+			if (s.d2 <= 0.0) break;//the rest are collinear
+			keep[s.far] = 1;
+			nkept++;
+			if (s.far - s.a > 1) q.push(span(x, y, s.a, s.far));
+			if (s.b - s.far > 1) q.push(span(x, y, s.far, s.b));
+		}
+		f.x.reserve(nkept);
+		f.y.reserve(nkept);
+		for (size_t k = 0; k < n; k++) {
+			if (keep[k] == 0) continue;
+			f.x.push_back(x[k]);
+			f.y.push_back(y[k]);
+		}
+	}
+
+public:
+
+	//Coordinate variables the footprints are computed from, in order of preference
+	static const std::vector<std::string>& xcandidates() {
+		static const std::vector<std::string> c = { "longitude", "longitude_gda94" };
+		return c;
+	}
+
+	static const std::vector<std::string>& ycandidates() {
+		static const std::vector<std::string> c = { "latitude", "latitude_gda94" };
+		return c;
+	}
+
+	cLineFootprints(const size_t nlines = 0, const size_t maxvertices = 20) : MaxVertices(std::max((size_t)2, maxvertices)), Lines(nlines) {}
+
+	size_t nlines() const { return Lines.size(); }
+	const sLineFootprint& line(const size_t li) const { return Lines[li]; }
+
+	//The coordinates of all samples of a line, null samples are skipped
+	template<typename T>
+	void add(const size_t lineindex, const T* x, const T* y, const size_t nsamples, const T xnull, const T ynull) {
+		std::vector<double> vx;
+		std::vector<double> vy;
+		vx.reserve(nsamples);
+		vy.reserve(nsamples);
+		for (size_t k = 0; k < nsamples; k++) {
+			if (x[k] == xnull || y[k] == ynull) continue;
+			if (x[k] != x[k] || y[k] != y[k]) continue;
+			vx.push_back((double)x[k]);
+			vy.push_back((double)y[k]);
+		}
+		sLineFootprint& f = Lines[lineindex];
+		f = sLineFootprint();
+		if (vx.size() == 0) return;
+		f.xmin = *std::min_element(vx.begin(), vx.end());
+		f.xmax = *std::max_element(vx.begin(), vx.end());
+		f.ymin = *std::min_element(vy.begin(), vy.end());
+		f.ymax = *std::max_element(vy.begin(), vy.end());
+		simplify(vx, vy, f);
+	}
+
+#ifdef ENABLE_MPI
+	//Collect the footprints of the lines of all ranks on the root rank (collective)
+	void mpi_gather(MPI_Comm comm, const int root) {
+		int rank, size;
+		MPI_Comm_rank(comm, &rank);
+		MPI_Comm_size(comm, &size);
+
+		//Each line as index, nvertices, bbox, then the vertices
+		std::vector<double> mine;
+		for (size_t li = 0; li < Lines.size(); li++) {
+			const sLineFootprint& f = Lines[li];
+			if (f.valid() == false || rank == root) continue;
+			mine.insert(mine.end(), { (double)li, (double)f.x.size(), f.xmin, f.ymin, f.xmax, f.ymax });
+			for (size_t k = 0; k < f.x.size(); k++) mine.insert(mine.end(), { f.x[k], f.y[k] });
+		}
+		int n = (int)mine.size();
+		std::vector<int> counts(rank == root ? size : 0);
+		MPI_Gather(&n, 1, MPI_INT, counts.data(), 1, MPI_INT, root, comm);
+		std::vector<int> displs(counts.size(), 0);
+		for (size_t r = 1; r < counts.size(); r++) displs[r] = displs[r - 1] + counts[r - 1];
+		std::vector<double> all(rank == root ? (size_t)displs.back() + (size_t)counts.back() : 0);
+		MPI_Gatherv(mine.data(), n, MPI_DOUBLE, all.data(), counts.data(), displs.data(), MPI_DOUBLE, root, comm);
+		if (rank != root) return;
+
+		for (size_t p = 0; p < all.size();) {
+			sLineFootprint& f = Lines[(size_t)all[p]];
+			const size_t nv = (size_t)all[p + 1];
+			f.xmin = all[p + 2]; f.ymin = all[p + 3]; f.xmax = all[p + 4]; f.ymax = all[p + 5];
+			p += 6;
+			f.x.resize(nv);
+			f.y.resize(nv);
+			for (size_t k = 0; k < nv; k++, p += 2) {
+				f.x[k] = all[p];
+				f.y[k] = all[p + 1];
+			}
+		}
+	}
+#endif
+
+	//Add the bounding box and footprint line variables
+	void write(GeophysicsNetCDF::GFile& ncFile, const std::string& xname, const std::string& yname) const {
+		const size_t nl = Lines.size();
+		const double null = GeophysicsNetCDF::defaultmissingvalue(netCDF::ncDouble);
+
+		auto define = [&](const std::string& name, const netCDF::NcType& type, const std::vector<netCDF::NcDim>& dims, const std::string& description) {
+			if (ncFile.addLineVar(name, type, dims) == false) {
+				throw(std::runtime_error(_SRC_ + strprint("Could not add variable %s\n", name.c_str())));
+			}
+			GeophysicsNetCDF::GVar v = ncFile.getGeophysicsVar(name);
+			v.add_attribute("description", description);
+			v.add_attribute("coordinates_source", xname + " " + yname);
+			return v;
+		};
+
+		std::vector<double> xmin(nl, null), ymin(nl, null), xmax(nl, null), ymax(nl, null);
+		std::vector<int> count(nl, 0);
+		std::vector<double> fx(nl * MaxVertices, null);
+		std::vector<double> fy(nl * MaxVertices, null);
+		for (size_t li = 0; li < nl; li++) {
+			const sLineFootprint& f = Lines[li];
+			if (f.valid() == false) continue;
+			xmin[li] = f.xmin; ymin[li] = f.ymin; xmax[li] = f.xmax; ymax[li] = f.ymax;
+			count[li] = (int)f.x.size();
+			std::copy(f.x.begin(), f.x.end(), fx.begin() + li * MaxVertices);
+			std::copy(f.y.begin(), f.y.end(), fy.begin() + li * MaxVertices);
+		}
+
+		define("line_bbox_xmin", netCDF::ncDouble, {}, "Minimum " + xname + " of the line").putVar(xmin.data());
+		define("line_bbox_ymin", netCDF::ncDouble, {}, "Minimum " + yname + " of the line").putVar(ymin.data());
+		define("line_bbox_xmax", netCDF::ncDouble, {}, "Maximum " + xname + " of the line").putVar(xmax.data());
+		define("line_bbox_ymax", netCDF::ncDouble, {}, "Maximum " + yname + " of the line").putVar(ymax.data());
+
+		netCDF::NcDim dv = ncFile.addDim("footprint_vertex", MaxVertices);
+		define("line_footprint_count", netCDF::ncInt, {}, "Number of vertices of the line's footprint").putVar(count.data());
+		define("line_footprint_x", netCDF::ncDouble, { dv }, "Simplified path of the line, " + xname).putVar(fx.data());
+		define("line_footprint_y", netCDF::ncDouble, { dv }, "Simplified path of the line, " + yname).putVar(fy.data());
+	}
+
+	//Footprints stored in a file, false if it has none
+	static bool read(const GeophysicsNetCDF::GFile& ncFile, std::vector<sLineFootprint>& lines) {
+		netCDF::NcVar vc = ncFile.getVar("line_footprint_count");
+		netCDF::NcVar vx = ncFile.getVar("line_footprint_x");
+		netCDF::NcVar vy = ncFile.getVar("line_footprint_y");
+		if (vc.isNull() || vx.isNull() || vy.isNull() || vx.getDimCount() != 2) return false;
+		const size_t nl = vx.getDim(0).getSize();
+		const size_t nv = vx.getDim(1).getSize();
+		std::vector<int> count(nl);
+		std::vector<double> fx(nl * nv);
+		std::vector<double> fy(nl * nv);
+		vc.getVar(count.data());
+		vx.getVar(fx.data());
+		vy.getVar(fy.data());
+
+		const char* bbnames[4] = { "line_bbox_xmin", "line_bbox_ymin", "line_bbox_xmax", "line_bbox_ymax" };
+		std::vector<std::vector<double>> bb(4);
+		for (size_t i = 0; i < 4; i++) {
+			netCDF::NcVar v = ncFile.getVar(bbnames[i]);
+			if (v.isNull()) continue;
+			bb[i].resize(nl);
+			v.getVar(bb[i].data());
+		}
+
+		const bool hasbbox = bb[0].size() && bb[1].size() && bb[2].size() && bb[3].size();
+		lines.assign(nl, sLineFootprint());
+		for (size_t li = 0; li < nl; li++) {
+			sLineFootprint& f = lines[li];
+			const size_t n = std::min((size_t)std::max(0, count[li]), nv);
+			f.x.assign(fx.begin() + li * nv, fx.begin() + li * nv + n);
+			f.y.assign(fy.begin() + li * nv, fy.begin() + li * nv + n);
+			if (hasbbox) {
+				f.xmin = bb[0][li]; f.ymin = bb[1][li]; f.xmax = bb[2][li]; f.ymax = bb[3][li];
+			}
+		}
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,378 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#include <cstdio>
+#include <cmath>
+#include <netcdf>
+#include <vector>
+
+#define _PROGRAM_ "geophysicsnc2crossover"
+#define _VERSION_ "1.0"
+
+#include "general_utils.h"
+#include "file_utils.h"
+#include "logger.h"
+#include "gdal_utils.h"
+#include "geophysics_netcdf.hpp"
+#include "ncvar_utils.h"
+#include "linecache.h"
+#include "crossover.h"
+#include "string_list.h"
+
+using namespace netCDF;
+using namespace netCDF::exceptions;
+using namespace GeophysicsNetCDF;
+
+class cLogger glog; //The instance of the global log file manager
+
+struct sCrossoverOptions {
+	std::vector<std::string> vars;
+	std::string xvar;//empty to look for the usual names
+	std::string yvar;
+	bool alllines = false;
+	std::vector<double> tietypes;
+	size_t chunksegments = 64;
+	int epsg = 0;
+	size_t budgetbytes = 268435456;
+	size_t nthreads = 0;
+};
+
+//Finds the crossings of the lines of a survey (by default between lines of different line types,
+//e.g. traverse and tie lines) and writes them, with the values of the chosen variables interpolated
+//along both lines, to a NetCDF file or, for a .gpkg output path, a GeoPackage point layer
+class cCrossoverConverter {
+
+	GFile& In;
+	sCrossoverOptions O;
+	std::vector<int> LineNumbers;
+	std::vector<double> LineTypes;
+	std::vector<sCrossover> X;
+	std::vector<std::vector<double>> ValuesA;//per variable, per crossover
+	std::vector<std::vector<double>> ValuesB;
+	std::vector<double> Nulls;
+
+	std::string find_var(const std::string& name, const std::vector<std::string>& candidates) const {
+		if (name.size() > 0) {
+			if (In.getVar(name).isNull()) {
+				throw(std::runtime_error(_SRC_ + strprint("Variable %s does not exist\n", name.c_str())));
+			}
+			return name;
+		}
+		return look_for_var(In, candidates);
+	}
+
+	bool istie(const size_t li) const {
+		return std::find(O.tietypes.begin(), O.tietypes.end(), LineTypes[li]) != O.tietypes.end();
+	}
+
+	bool cross(const size_t la, const size_t lb) const {
+		if (O.alllines || LineTypes.size() == 0) return true;
+		if (O.tietypes.size() > 0) return istie(la) != istie(lb);
+		return LineTypes[la] != LineTypes[lb];
+	}
+
+	void find_crossovers(cLineCache& C) {
+		const std::string xname = find_var(O.xvar, { "easting", "x", "longitude", "longitude_gda94" });
+		const std::string yname = find_var(O.yvar, { "northing", "y", "latitude", "latitude_gda94" });
+		if (xname.size() == 0 || yname.size() == 0) {
+			throw(std::runtime_error(_SRC_ + strprint("Could not find the coordinate variables, use -x and -y\n")));
+		}
+		glog.logmsg("Using %s and %s as the coordinates\n", xname.c_str(), yname.c_str());
+		C.wait();
+		const size_t nlines = In.nlines();
+		const double xnull = In.getGeophysicsVar(xname).missingvalue(double());
+		const double ynull = In.getGeophysicsVar(yname).missingvalue(double());
+		const sPacking xpack(In.getVar(xname));
+		const sPacking ypack(In.getVar(yname));
+
+		cCrossoverFinder F(O.chunksegments);
+		bool haveorigin = false;
+		std::vector<double> x, y;
+		for (size_t li = 0; li < nlines; li++) {
+			C.getLine(xname, li, x);
+			C.getLine(yname, li, y);
+			xpack.unpack(x, xnull);
+			ypack.unpack(y, ynull);
+			for (size_t si = 0; si < x.size(); si++) {
+				if (x[si] == xnull || y[si] == ynull) {
+					x[si] = y[si] = std::numeric_limits<double>::quiet_NaN();
+				}
+				else if (haveorigin == false) {
+					F.setorigin(x[si], y[si]);
+					haveorigin = true;
+				}
+			}
+			F.addline(x, y);
+		}
+		C.clear();
+
+		double t1 = gettime();
+		X = F.find([this](const size_t la, const size_t lb) { return cross(la, lb); }, O.nthreads);
+		double t2 = gettime();
+		glog.logmsg("Found %zu crossovers among %zu lines (%zu chunks) in %.2lf s\n", X.size(), F.nlines(), F.nchunks(), t2 - t1);
+	}
+
+	//Each line of each variable is read once, for all the crossovers on it
+	void interpolate_values(cLineCache& C) {
+		C.wait();
+		const size_t nlines = In.nlines();
+		std::vector<std::vector<std::pair<size_t, bool>>> online(nlines);
+		for (size_t xi = 0; xi < X.size(); xi++) {
+			online[X[xi].linea].push_back(std::make_pair(xi, true));
+			online[X[xi].lineb].push_back(std::make_pair(xi, false));
+		}
+
+		std::vector<std::string> vars;
+		for (const auto& name : O.vars) {
+			GVar gv = In.getGeophysicsVar(name);
+			if (gv.isNull() || In.isSampleVar(gv) == false || gv.nbands() > 1) {
+				glog.logmsg("Warning: %s is not a single band sample variable and is skipped\n", name.c_str());
+				continue;
+			}
+			vars.push_back(name);
+		}
+		O.vars = vars;
+
+		ValuesA.assign(O.vars.size(), std::vector<double>(X.size()));
+		ValuesB.assign(O.vars.size(), std::vector<double>(X.size()));
+		Nulls.resize(O.vars.size());
+		std::vector<double> v;
+		for (size_t vi = 0; vi < O.vars.size(); vi++) {
+			//Packed variables are interpolated unpacked, with the double fill value as their null
+			C.wait();
+			const double stored = In.getGeophysicsVar(O.vars[vi]).missingvalue(double());
+			const sPacking pack(In.getVar(O.vars[vi]));
+			Nulls[vi] = pack.ispacked() ? defaultmissingvalue(ncDouble) : stored;
+			for (size_t li = 0; li < nlines; li++) {
+				if (online[li].size() == 0) continue;
+				C.getLine(O.vars[vi], li, v);
+				if (pack.ispacked()) {
+					for (double& a : v) a = (a == stored) ? Nulls[vi] : a * pack.scale + pack.offset;
+				}
+				for (const auto& [xi, isa] : online[li]) {
+					const sCrossover& c = X[xi];
+					if (isa) ValuesA[vi][xi] = cCrossoverFinder::interpolate(v, c.samplea, c.ta, Nulls[vi]);
+					else ValuesB[vi][xi] = cCrossoverFinder::interpolate(v, c.sampleb, c.tb, Nulls[vi]);
+				}
+			}
+		}
+	}
+
+	double difference(const size_t vi, const size_t xi) const {
+		const double a = ValuesA[vi][xi];
+		const double b = ValuesB[vi][xi];
+		if (a == Nulls[vi] || b == Nulls[vi]) return Nulls[vi];
+		return a - b;
+	}
+
+	void write_netcdf(const std::string& path) const {
+		NcFile out(path, NcFile::replace, NcFile::nc4);
+		NcDim d = out.addDim("crossover", X.size());
+		const size_t n = X.size();
+		std::vector<double> dx(n), dy(n), ia(n), ib(n);
+		std::vector<int> lna(n), lnb(n);
+		for (size_t xi = 0; xi < n; xi++) {
+			dx[xi] = X[xi].x;
+			dy[xi] = X[xi].y;
+			ia[xi] = (double)X[xi].samplea + X[xi].ta;
+			ib[xi] = (double)X[xi].sampleb + X[xi].tb;
+			lna[xi] = LineNumbers[X[xi].linea];
+			lnb[xi] = LineNumbers[X[xi].lineb];
+		}
+		auto put = [&](const std::string& name, const NcType& type, const void* data, const std::string& longname) {
+			NcVar v = out.addVar(name, type, d);
+			v.putAtt("long_name", longname);
+			v.putVar(data);
+			return v;
+		};
+		put("x", ncDouble, dx.data(), "crossover x coordinate");
+		put("y", ncDouble, dy.data(), "crossover y coordinate");
+		put("line_a", ncInt, lna.data(), "line number of the first line");
+		put("line_b", ncInt, lnb.data(), "line number of the second line");
+		put("index_a", ncDouble, ia.data(), "fractional sample index of the crossover within the first line");
+		put("index_b", ncDouble, ib.data(), "fractional sample index of the crossover within the second line");
+		if (LineTypes.size() > 0) {
+			std::vector<double> lta(n), ltb(n);
+			for (size_t xi = 0; xi < n; xi++) {
+				lta[xi] = LineTypes[X[xi].linea];
+				ltb[xi] = LineTypes[X[xi].lineb];
+			}
+			put("linetype_a", ncDouble, lta.data(), "line type of the first line");
+			put("linetype_b", ncDouble, ltb.data(), "line type of the second line");
+		}
+		for (size_t vi = 0; vi < O.vars.size(); vi++) {
+			const std::string& name = O.vars[vi];
+			std::vector<double> diff(n);
+			for (size_t xi = 0; xi < n; xi++) diff[xi] = difference(vi, xi);
+			put(name + "_a", ncDouble, ValuesA[vi].data(), name + " on the first line").putAtt("missing_value", ncDouble, Nulls[vi]);
+			put(name + "_b", ncDouble, ValuesB[vi].data(), name + " on the second line").putAtt("missing_value", ncDouble, Nulls[vi]);
+			put(name + "_difference", ncDouble, diff.data(), name + " on the first line minus the second").putAtt("missing_value", ncDouble, Nulls[vi]);
+		}
+		out.putAtt("CreationTime", timestamp());
+		out.putAtt("CreationMethod", "geophysicsnc2crossover.exe");
+		out.close();
+	}
+
+	void write_geopackage(const std::string& path) const {
+		GDALDriver* driver = GetGDALDriverManager()->GetDriverByName("GPKG");
+		GDALDataset* ds = driver->Create(path.c_str(), 0, 0, 0, GDT_Unknown, nullptr);
+		if (ds == nullptr) {
+			throw(std::runtime_error(_SRC_ + strprint("Could not create GeoPackage %s\n", path.c_str())));
+		}
+		OGRSpatialReference srs;
+		if (O.epsg > 0) srs.importFromEPSG(O.epsg);
+		OGRLayer* layer = ds->CreateLayer("crossovers", O.epsg > 0 ? &srs : nullptr, wkbPoint, nullptr);
+
+		std::vector<std::string> fields = { "index_a", "index_b" };
+		OGRFieldDefn fla("line_a", OFTInteger);
+		OGRFieldDefn flb("line_b", OFTInteger);
+		layer->CreateField(&fla);
+		layer->CreateField(&flb);
+		if (LineTypes.size() > 0) {
+			fields.push_back("linetype_a");
+			fields.push_back("linetype_b");
+		}
+		for (const auto& name : O.vars) {
+			fields.push_back(name + "_a");
+			fields.push_back(name + "_b");
+			fields.push_back(name + "_difference");
+		}
+		for (const auto& f : fields) {
+			OGRFieldDefn fd(f.c_str(), OFTReal);
+			layer->CreateField(&fd);
+		}
+
+		//One transaction for all the features, otherwise each is committed separately
+		ds->StartTransaction();
+		for (size_t xi = 0; xi < X.size(); xi++) {
+			const sCrossover& c = X[xi];
+			OGRFeature* feature = OGRFeature::CreateFeature(layer->GetLayerDefn());
+			feature->SetField("line_a", LineNumbers[c.linea]);
+			feature->SetField("line_b", LineNumbers[c.lineb]);
+			feature->SetField("index_a", (double)c.samplea + c.ta);
+			feature->SetField("index_b", (double)c.sampleb + c.tb);
+			if (LineTypes.size() > 0) {
+				feature->SetField("linetype_a", LineTypes[c.linea]);
+				feature->SetField("linetype_b", LineTypes[c.lineb]);
+			}
+			for (size_t vi = 0; vi < O.vars.size(); vi++) {
+				feature->SetField((O.vars[vi] + "_a").c_str(), ValuesA[vi][xi]);
+				feature->SetField((O.vars[vi] + "_b").c_str(), ValuesB[vi][xi]);
+				feature->SetField((O.vars[vi] + "_difference").c_str(), difference(vi, xi));
+			}
+			OGRPoint p(c.x, c.y);
+			feature->SetGeometry(&p);
+			layer->CreateFeature(feature);
+			OGRFeature::DestroyFeature(feature);
+		}
+		ds->CommitTransaction();
+		GDALClose(ds);
+	}
+
+public:
+
+	cCrossoverConverter(GFile& in, const sCrossoverOptions& options) : In(in), O(options) {}
+
+	void run(const std::string& outpath) {
+		In.getLineNumbers(LineNumbers);
+		LineTypes = get_linetype(In);
+		if (LineTypes.size() == 0 && O.alllines == false) {
+			glog.logmsg("There is no line type variable so all pairs of lines are crossed\n");
+		}
+		if (O.tietypes.size() > 0 && LineTypes.size() == 0) {
+			throw(std::runtime_error(_SRC_ + strprint("-tietypes requires a linetype variable\n")));
+		}
+
+		cLineCache C(In, O.budgetbytes);
+		find_crossovers(C);
+		interpolate_values(C);
+
+		if (tolower(extractfileextension(outpath)) == ".gpkg") write_geopackage(outpath);
+		else write_netcdf(outpath);
+		glog.logmsg("Wrote %zu crossovers to %s\n", X.size(), outpath.c_str());
+	}
+};
+
+void usage(const char* program) {
+	std::cout << "Usage: " << extractfilename(program) << " [options] input_ncfile output_ncfile|output_gpkgfile" << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "   -vars var1,var2,...         variables interpolated at the crossovers on both lines" << std::endl;
+	std::cout << "   -x name -y name             coordinate variables (default easting/northing, x/y or longitude/latitude)" << std::endl;
+	std::cout << "   -tietypes t1,t2,...         line types of the tie lines, cross tie lines with all other lines" << std::endl;
+	std::cout << "   -alllines                   cross every pair of lines (default lines of different line types)" << std::endl;
+	std::cout << "   -chunk n                    segments per spatial index entry (default 64)" << std::endl;
+	std::cout << "   -epsg code                  coordinate reference system of a GeoPackage output" << std::endl;
+	std::cout << "   -memory MB                  memory budget for the line cache (default 256)" << std::endl;
+	std::cout << "   -threads n                  number of threads searching for crossovers (default all cores)" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	_GSTITEM_
+	try
+	{
+		sCrossoverOptions O;
+		std::vector<std::string> args;
+		for (int i = 1; i < argc; i++) {
+			std::string a = argv[i];
+			auto nvalues = [&](const int n) { return i + n < argc; };
+			if (a == "-vars" && nvalues(1)) O.vars = split_list(argv[++i]);
+			else if (a == "-x" && nvalues(1)) O.xvar = argv[++i];
+			else if (a == "-y" && nvalues(1)) O.yvar = argv[++i];
+			else if (a == "-tietypes" && nvalues(1)) {
+				for (const auto& t : split_list(argv[++i])) O.tietypes.push_back(atof(t.c_str()));
+			}
+			else if (a == "-alllines") O.alllines = true;
+			else if (a == "-chunk" && nvalues(1)) O.chunksegments = (size_t)atoll(argv[++i]);
+			else if (a == "-epsg" && nvalues(1)) O.epsg = atoi(argv[++i]);
+			else if (a == "-memory" && nvalues(1)) O.budgetbytes = (size_t)atoll(argv[++i]) * 1048576;
+			else if (a == "-threads" && nvalues(1)) O.nthreads = (size_t)atoll(argv[++i]);
+			else args.push_back(a);
+		}
+
+		if (args.size() != 2) {
+			usage(argv[0]);
+			return 1;
+		}
+
+		const std::string inpath = fixseparator(args[0]);
+		const std::string outpath = fixseparator(args[1]);
+		if (!exists(extractfiledirectory(outpath))) {
+			makedirectorydeep(extractfiledirectory(outpath));
+		}
+
+		glog.open(outpath + ".log");
+		glog.logmsg("Program %s starting at %s\n", _PROGRAM_, timestamp().c_str());
+		glog.logmsg("Version %s Compiled at %s on %s\n", _VERSION_, __TIME__, __DATE__);
+		glog.logmsg("%s\n", commandlinestring(argc, argv).c_str());
+		glog.logmsg("Working directory: %s\n", getcurrentdirectory().c_str());
+
+		GDALAllRegister();
+		double t1 = gettime();
+		GFile in(inpath, NcFile::read);
+		cCrossoverConverter C(in, O);
+		C.run(outpath);
+		double t2 = gettime();
+		glog.logmsg("Elapsed time = %.2lf\n", t2 - t1);
+		glog.logmsg("Finished at %s\n", timestamp().c_str());
+		glog.close();
+	}
+	catch (NcException& e)
+	{
+		_GSTPRINT_
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	catch (std::exception& e)
+	{
+		_GSTPRINT_
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,339 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#include <cstdio>
+#include <cmath>
+#include <netcdf>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+#define _PROGRAM_ "geophysicsnc2grid"
+#define _VERSION_ "1.0"
+
+#include "general_utils.h"
+#include "file_utils.h"
+#include "logger.h"
+#include "gdal_utils.h"
+#include "geophysics_netcdf.hpp"
+#include "ncvar_utils.h"
+#include "linecache.h"
+#include "thread_pool.h"
+#include "gridding.h"
+
+using namespace netCDF;
+using namespace netCDF::exceptions;
+using namespace GeophysicsNetCDF;
+
+class cLogger glog; //The instance of the global log file manager
+
+struct sNcToGridOptions {
+	std::string var;
+	long long band = -1;//-1 for a single band variable
+	std::string xvar;//empty to look for the usual names
+	std::string yvar;
+	double cellsize = 0.0;
+	bool usebounds = false;
+	double xmin = 0.0, ymin = 0.0, xmax = 0.0, ymax = 0.0;
+	sGridOptions grid;
+	double radius = 0.0;//in coordinate units, 0 for the default number of cells
+	std::string compress = "deflate";
+	int epsg = 0;
+	float nodata = defaultmissingvalue(ncFloat);
+	size_t budgetbytes = 268435456;
+	size_t nthreads = 0;
+};
+
+//Streams the coordinates and values of a line dataset into tiles, interpolates the tiles on a
+//work stealing thread pool and writes each one as it completes into a tiled, compressed GeoTIFF
+class cNcToGridConverter {
+
+	GFile& In;
+	sNcToGridOptions O;
+	std::string xname, yname;
+
+	std::string find_var(const std::string& name, const std::vector<std::string>& candidates) const {
+		if (name.size() > 0) {
+			if (In.getVar(name).isNull()) {
+				throw(std::runtime_error(_SRC_ + strprint("Variable %s does not exist\n", name.c_str())));
+			}
+			return name;
+		}
+		std::vector<NcVar> vars = In.getAllVars();
+		for (const auto& c : candidates) {
+			for (const auto& v : vars) {
+				if (tolower(v.getName()) == tolower(c)) return v.getName();
+			}
+		}
+		return std::string();
+	}
+
+	//Coordinate extent of all the non-null samples
+	void scan_bounds(cLineCache& C) {
+		C.wait();
+		const size_t nlines = In.nlines();
+		const double xnull = In.getGeophysicsVar(xname).missingvalue(double());
+		const double ynull = In.getGeophysicsVar(yname).missingvalue(double());
+		const sPacking xpack(In.getVar(xname));
+		const sPacking ypack(In.getVar(yname));
+		O.xmin = O.ymin = 1e300;
+		O.xmax = O.ymax = -1e300;
+		std::vector<double> x, y;
+		for (size_t li = 0; li < nlines; li++) {
+			C.getLine(xname, li, x);
+			C.getLine(yname, li, y);
+			xpack.unpack(x, xnull);
+			ypack.unpack(y, ynull);
+			for (size_t si = 0; si < x.size(); si++) {
+				if (x[si] == xnull || y[si] == ynull) continue;
+				O.xmin = std::min(O.xmin, x[si]);
+				O.xmax = std::max(O.xmax, x[si]);
+				O.ymin = std::min(O.ymin, y[si]);
+				O.ymax = std::max(O.ymax, y[si]);
+			}
+		}
+		if (O.xmin > O.xmax) {
+			throw(std::runtime_error(_SRC_ + strprint("There are no non-null coordinates\n")));
+		}
+	}
+
+	void bucket(cLineCache& C, cTiledGridder& T) {
+		C.wait();
+		const size_t nlines = In.nlines();
+		const double xnull = In.getGeophysicsVar(xname).missingvalue(double());
+		const double ynull = In.getGeophysicsVar(yname).missingvalue(double());
+		const double vnull = In.getGeophysicsVar(O.var).missingvalue(double());
+		const sPacking xpack(In.getVar(xname));
+		const sPacking ypack(In.getVar(yname));
+		const sPacking vpack(In.getVar(O.var));
+		std::vector<double> x, y, v;
+		for (size_t li = 0; li < nlines; li++) {
+			C.getLine(xname, li, x);
+			C.getLine(yname, li, y);
+			if (O.band >= 0) C.getLineBand(O.var, li, (size_t)O.band, v);
+			else C.getLine(O.var, li, v);
+			if (v.size() != x.size()) {
+				throw(std::runtime_error(_SRC_ + strprint("Variable %s is not a single band sample variable, use -band\n", O.var.c_str())));
+			}
+			xpack.unpack(x, xnull);
+			ypack.unpack(y, ynull);
+			vpack.unpack(v, vnull);
+			for (size_t si = 0; si < x.size(); si++) {
+				if (x[si] == xnull || y[si] == ynull || v[si] == vnull) continue;
+				T.add(x[si], y[si], v[si]);
+			}
+		}
+	}
+
+	GDALDataset* create_geotiff(const std::string& path, const sGridGeometry& G) const {
+		GDALDriver* driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+		const std::string blocksize = strprint("%zu", O.grid.tilesize);
+		char** options = nullptr;
+		options = CSLSetNameValue(options, "TILED", "YES");
+		options = CSLSetNameValue(options, "BLOCKXSIZE", blocksize.c_str());
+		options = CSLSetNameValue(options, "BLOCKYSIZE", blocksize.c_str());
+		options = CSLSetNameValue(options, "BIGTIFF", "IF_SAFER");
+		if (O.compress != "none") {
+			options = CSLSetNameValue(options, "COMPRESS", O.compress.c_str());
+			options = CSLSetNameValue(options, "PREDICTOR", "3");//floating point predictor
+			options = CSLSetNameValue(options, "NUM_THREADS", "ALL_CPUS");
+		}
+		GDALDataset* ds = driver->Create(path.c_str(), (int)G.nx, (int)G.ny, 1, GDT_Float32, options);
+		CSLDestroy(options);
+		if (ds == nullptr) {
+			throw(std::runtime_error(_SRC_ + strprint("Could not create GeoTIFF %s\n", path.c_str())));
+		}
+
+		double gt[6];
+		G.geotransform(gt);
+		ds->SetGeoTransform(gt);
+		if (O.epsg > 0) {
+			OGRSpatialReference srs;
+			srs.importFromEPSG(O.epsg);
+			char* wkt = nullptr;
+			srs.exportToWkt(&wkt);
+			ds->SetProjection(wkt);
+			CPLFree(wkt);
+		}
+		ds->GetRasterBand(1)->SetNoDataValue(O.nodata);
+		return ds;
+	}
+
+public:
+
+	cNcToGridConverter(GFile& in, const sNcToGridOptions& options) : In(in), O(options) {}
+
+	void run(const std::string& outpath) {
+		if (O.var.size() == 0 || In.getVar(O.var).isNull()) {
+			throw(std::runtime_error(_SRC_ + strprint("Variable %s does not exist, use -var\n", O.var.c_str())));
+		}
+		xname = find_var(O.xvar, { "easting", "x", "longitude", "longitude_gda94" });
+		yname = find_var(O.yvar, { "northing", "y", "latitude", "latitude_gda94" });
+		if (xname.size() == 0 || yname.size() == 0) {
+			throw(std::runtime_error(_SRC_ + strprint("Could not find the coordinate variables, use -x and -y\n")));
+		}
+		if (O.cellsize <= 0.0) {
+			throw(std::runtime_error(_SRC_ + strprint("The cell size must be given with -cellsize\n")));
+		}
+		if (O.grid.tilesize == 0 || O.grid.tilesize % 16 != 0) {
+			throw(std::runtime_error(_SRC_ + strprint("The tile size must be a multiple of 16\n")));
+		}
+		if (O.radius > 0.0) O.grid.radius = O.radius / O.cellsize;
+		glog.logmsg("Gridding %s using %s and %s as the coordinates\n", O.var.c_str(), xname.c_str(), yname.c_str());
+
+		cLineCache C(In, O.budgetbytes);
+		if (O.usebounds == false) scan_bounds(C);
+		const sGridGeometry G = sGridGeometry::frombounds(O.xmin, O.ymin, O.xmax, O.ymax, O.cellsize);
+		glog.logmsg("Grid is %zu x %zu cells of %lf from (%lf, %lf)\n", G.nx, G.ny, G.cellsize, G.xmin, G.ymax);
+
+		cTiledGridder T(G, O.grid);
+		double t1 = gettime();
+		bucket(C, T);
+		C.clear();
+		double t2 = gettime();
+		glog.logmsg("Bucketed %zu points into %zu tiles in %.2lf s\n", T.npoints(), T.ntiles(), t2 - t1);
+
+		GDALDataset* ds = create_geotiff(outpath, G);
+		GDALRasterBand* band = ds->GetRasterBand(1);
+		std::mutex gdalmutex;//GDAL datasets are not thread safe
+		std::atomic<size_t> ndone(0);
+		cWorkStealingPool P(O.nthreads);
+		glog.logmsg("Interpolating with %zu threads\n", P.size());
+		try {
+			P.run(T.ntiles(), [&](const size_t ti, const size_t) {
+				std::vector<float> z;
+				T.gridtile(ti, z);
+				for (auto& v : z) {
+					if (std::isnan(v)) v = O.nodata;
+				}
+				size_t c0, r0, nc, nr;
+				T.tileextent(ti, c0, r0, nc, nr);
+				std::lock_guard<std::mutex> lock(gdalmutex);
+				CPLErr err = band->RasterIO(GF_Write, (int)c0, (int)r0, (int)nc, (int)nr, z.data(), (int)nc, (int)nr, GDT_Float32, 0, 0);
+				if (err != CE_None) {
+					throw(std::runtime_error(_SRC_ + strprint("Could not write tile %zu\n", ti)));
+				}
+				ndone++;
+			});
+		}
+		catch (...) {
+			GDALClose(ds);
+			throw;
+		}
+		GDALClose(ds);
+		double t3 = gettime();
+		glog.logmsg("Interpolated and wrote %zu tiles in %.2lf s\n", ndone.load(), t3 - t2);
+	}
+};
+
+void usage(const char* program) {
+	std::cout << "Usage: " << extractfilename(program) << " [options] input_ncfile output_tiffile" << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "   -var name                   variable to grid (required)" << std::endl;
+	std::cout << "   -band n                     band of a multiband variable (zero based)" << std::endl;
+	std::cout << "   -cellsize d                 grid cell size in coordinate units (required)" << std::endl;
+	std::cout << "   -x name -y name             coordinate variables (default easting/northing, x/y or longitude/latitude)" << std::endl;
+	std::cout << "   -bounds xmin ymin xmax ymax grid extent (default the extent of the data)" << std::endl;
+	std::cout << "   -method idw|mincurv         inverse distance weighting or minimum curvature (default idw)" << std::endl;
+	std::cout << "   -radius d                   search and blanking radius in coordinate units (default 4 cells)" << std::endl;
+	std::cout << "   -power p                    inverse distance weighting power (default 2)" << std::endl;
+	std::cout << "   -tension t                  minimum curvature tension between 0 and 1 (default 0)" << std::endl;
+	std::cout << "   -iterations n               minimum curvature iterations per level (default 250)" << std::endl;
+	std::cout << "   -halo n                     cells interpolated around each tile for minimum curvature (default 16)" << std::endl;
+	std::cout << "   -tilesize n                 tile and GeoTIFF block size in cells, a multiple of 16 (default 256)" << std::endl;
+	std::cout << "   -compress deflate|zstd|lzw|none   GeoTIFF compression (default deflate)" << std::endl;
+	std::cout << "   -epsg code                  coordinate reference system of the output" << std::endl;
+	std::cout << "   -nodata v                   null value of the output" << std::endl;
+	std::cout << "   -memory MB                  memory budget for the line cache (default 256)" << std::endl;
+	std::cout << "   -threads n                  number of interpolation threads (default all cores)" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	_GSTITEM_
+	try
+	{
+		sNcToGridOptions O;
+		O.grid.halo = 16.0;
+		std::vector<std::string> args;
+		for (int i = 1; i < argc; i++) {
+			std::string a = argv[i];
+			auto nvalues = [&](const int n) { return i + n < argc; };
+			if (a == "-var" && nvalues(1)) O.var = argv[++i];
+			else if (a == "-band" && nvalues(1)) O.band = atoll(argv[++i]);
+			else if (a == "-cellsize" && nvalues(1)) O.cellsize = atof(argv[++i]);
+			else if (a == "-x" && nvalues(1)) O.xvar = argv[++i];
+			else if (a == "-y" && nvalues(1)) O.yvar = argv[++i];
+			else if (a == "-bounds" && nvalues(4)) {
+				O.usebounds = true;
+				O.xmin = atof(argv[++i]);
+				O.ymin = atof(argv[++i]);
+				O.xmax = atof(argv[++i]);
+				O.ymax = atof(argv[++i]);
+			}
+			else if (a == "-method" && nvalues(1)) {
+				const std::string m = tolower(argv[++i]);
+				if (m == "idw") O.grid.method = sGridOptions::Method::IDW;
+				else if (m == "mincurv") O.grid.method = sGridOptions::Method::MINCURV;
+				else throw(std::runtime_error(_SRC_ + strprint("Unknown gridding method %s (use idw or mincurv)\n", m.c_str())));
+			}
+			else if (a == "-radius" && nvalues(1)) O.radius = atof(argv[++i]);
+			else if (a == "-power" && nvalues(1)) O.grid.power = atof(argv[++i]);
+			else if (a == "-tension" && nvalues(1)) O.grid.tension = atof(argv[++i]);
+			else if (a == "-iterations" && nvalues(1)) O.grid.maxiterations = (size_t)atoll(argv[++i]);
+			else if (a == "-halo" && nvalues(1)) O.grid.halo = atof(argv[++i]);
+			else if (a == "-tilesize" && nvalues(1)) O.grid.tilesize = (size_t)atoll(argv[++i]);
+			else if (a == "-compress" && nvalues(1)) O.compress = tolower(argv[++i]);
+			else if (a == "-epsg" && nvalues(1)) O.epsg = atoi(argv[++i]);
+			else if (a == "-nodata" && nvalues(1)) O.nodata = (float)atof(argv[++i]);
+			else if (a == "-memory" && nvalues(1)) O.budgetbytes = (size_t)atoll(argv[++i]) * 1048576;
+			else if (a == "-threads" && nvalues(1)) O.nthreads = (size_t)atoll(argv[++i]);
+			else args.push_back(a);
+		}
+
+		if (args.size() != 2) {
+			usage(argv[0]);
+			return 1;
+		}
+
+		const std::string inpath = fixseparator(args[0]);
+		const std::string outpath = fixseparator(args[1]);
+		if (!exists(extractfiledirectory(outpath))) {
+			makedirectorydeep(extractfiledirectory(outpath));
+		}
+
+		glog.open(outpath + ".log");
+		glog.logmsg("Program %s starting at %s\n", _PROGRAM_, timestamp().c_str());
+		glog.logmsg("Version %s Compiled at %s on %s\n", _VERSION_, __TIME__, __DATE__);
+		glog.logmsg("%s\n", commandlinestring(argc, argv).c_str());
+		glog.logmsg("Working directory: %s\n", getcurrentdirectory().c_str());
+
+		GDALAllRegister();
+		double t1 = gettime();
+		GFile in(inpath, NcFile::read);
+		cNcToGridConverter C(in, O);
+		C.run(outpath);
+		double t2 = gettime();
+		glog.logmsg("Elapsed time = %.2lf\n", t2 - t1);
+		glog.logmsg("Finished at %s\n", timestamp().c_str());
+		glog.close();
+	}
+	catch (NcException& e)
+	{
+		_GSTPRINT_
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	catch (std::exception& e)
+	{
+		_GSTPRINT_
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -10,6 +10,7 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include <netcdf>
 #include <vector>
 #include <limits>
+#include <algorithm>
 
 #define _PROGRAM_ "geophysicsnc2shape"
 #define _VERSION_ "1.0"
@@ -20,6 +21,9 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include "ogr_utils.h"
 #include "gdal_utils.h"
 #include "geophysics_netcdf.hpp"
+#include "ncvar_utils.h"
+#include "footprint.h"
+#include "coverage.h"
 
 using namespace netCDF;
 using namespace netCDF::exceptions;
@@ -34,12 +38,14 @@ class cLogger glog; //The instance of the global log file manager
 class cNcToShapefileConverter {	
 	std::string NCPath;
 	std::string ShapePath;	
+	cCoverageAccumulator Coverage;
 public:
 
-	cNcToShapefileConverter(const std::string& ncfilepath, const std::string& shapefilepath) {
+	cNcToShapefileConverter(const std::string& ncfilepath, const std::string& shapefilepath, const cCoverageAccumulator& coverage) {
 		_GSTITEM_;
 		NCPath    = fixseparator(ncfilepath);
 		ShapePath = fixseparator(shapefilepath);						
+		Coverage  = coverage;
 		bool status = process();	
 		if (status == false) {
 			glog.logmsg("Error 0: creating shapefile %s from %s\n",ShapePath.c_str(),NCPath.c_str());
@@ -49,45 +55,6 @@ public:
 
 	~cNcToShapefileConverter() {};
 
-	std::string look_for_var(GFile& N,  const std::vector<std::string>& candidates)
-	{
-		std::vector<NcVar> v = N.getAllVars();		
-		for(size_t ci=0; ci<candidates.size(); ci++){
-			for (size_t vi = 0; vi < v.size(); vi++) {
-				if(strcasecmp(v[vi].getName(), candidates[ci]) == 0){
-					return v[vi].getName();
-				}
-			}
-		}
-		return std::string();
-	}
-
-	std::vector<double> get_linetype(GFile& N)
-	{		
-		std::vector<std::string> candidates;
-		candidates.push_back("linetype");
-		candidates.push_back("line_type");
-		candidates.push_back("ltype");
-		std::string vname = look_for_var(N, candidates);
-		std::vector<double> ltype;
-
-		if (vname.size() > 0) {
-			NcVar var = N.getVar(vname);
-			if (N.isLineVar(var)) {
-				GLineVar v = N.getLineVar(vname);
-				v.getAll(ltype);
-			}
-			else if (N.isSampleVar(var)) {
-				ltype.resize(N.nlines());
-				GSampleVar v = N.getSampleVar(vname);
-				for (size_t li = 0; li < N.nlines(); li++) {
-					v.getSample(li, 0, 0, ltype[li]);
-				}
-			}
-		}
-		return ltype;
-	}
-
 	bool process() {	
 		if (!exists(extractfiledirectory(ShapePath))){
 			makedirectorydeep(extractfiledirectory(ShapePath));
@@ -103,7 +70,21 @@ public:
 		std::vector<unsigned int> ln;
 		N.getLineNumbers(ln);
 		const size_t nl = N.nlines();
-				
+
+		//The footprints stored by the converters avoid reading the coordinates, which coverage still needs
+		std::vector<sLineFootprint> stored;
+		if (Coverage.getmethod() == cCoverageAccumulator::Method::NONE && cLineFootprints::read(N, stored) && stored.size() == nl) {
+			glog.logmsg(0, "Using the stored line footprints\n");
+			std::vector<double> ltype = get_linetype(N);
+			for (size_t li = 0; li < nl; li++) {
+				if (stored[li].valid() == false) continue;
+				atts[0].value = (int)ln[li];
+				atts[1].value = ltype.size() == nl ? (int)ltype[li] : (int)0;
+				L.add_linestring_feature(atts, stored[li].x, stored[li].y);
+			}
+			return true;
+		}
+
 		std::string xvarname;				
 		std::vector<std::string> xcand = { "longitude","longitude_gda94" };
 		for (size_t i = 0; i < xcand.size(); i++) {
@@ -133,6 +114,10 @@ public:
 		}
 
 		std::vector<double> ltype = get_linetype(N);				
+		const double xnull = N.getGeophysicsVar(xvarname).missingvalue(double());
+		const double ynull = N.getGeophysicsVar(yvarname).missingvalue(double());
+		const sPacking xpack(N.getVar(xvarname));
+		const sPacking ypack(N.getVar(yvarname));
 		std::vector<double> lkm0(nl);
 		std::vector<double> lkm2(nl);
 		std::vector<double> lkm4(nl);
@@ -147,10 +132,17 @@ public:
 			N.getDataByLineIndex(xvarname, li, x);			
 			N.getDataByLineIndex(yvarname, li, y);
 
+			//Unpack the coordinates and give the nulls of both the one value
+			double null = defaultmissingvalue(ncDouble);
+			xpack.unpack(x, xnull);
+			ypack.unpack(y, ynull);
+			std::replace(x.begin(), x.end(), xnull, null);
+			std::replace(y.begin(), y.end(), ynull, null);
+
 			std::vector<double> xout;
 			std::vector<double> yout;
 
-			double null = defaultmissingvalue(ncDouble);
+			Coverage.add_points(x, y, null);
 
 			int ns = (int) x.size();
 			int k = 0;
@@ -189,6 +181,70 @@ public:
 				L.add_linestring_feature(atts, xout, yout);
 			}
 		}				
+
+		if (Coverage.getmethod() != cCoverageAccumulator::Method::NONE) {
+			write_coverage();
+		}
+		return true;
+	}
+
+	bool write_coverage() {
+		std::vector<cCoverageRing> rings = Coverage.finish();
+		if (rings.size() == 0) {
+			glog.logmsg(0, "Warning: no coverage polygon could be computed for %s\n", NCPath.c_str());
+			return false;
+		}
+
+		//Counter-clockwise rings are outer boundaries, clockwise rings are holes
+		std::vector<cCoverageRing> outer;
+		std::vector<cCoverageRing> holes;
+		for (size_t i = 0; i < rings.size(); i++) {
+			if (cCoverageAccumulator::signedarea(rings[i]) > 0.0) outer.push_back(rings[i]);
+			else holes.push_back(rings[i]);
+		}
+
+		//Shapefiles hold a single layer so the polygons go into a companion file
+		std::string CoveragePath = extractfiledirectory(ShapePath) + extractfilename_noextension(ShapePath) + "_coverage.shp";
+		GDALDriver* driver = GetGDALDriverManager()->GetDriverByName("ESRI Shapefile");
+		//Remove the coverage of a previous run, with its .shx, .dbf and .prj, rather than add to it
+		if (exists(CoveragePath) && driver->Delete(CoveragePath.c_str()) != CE_None) {
+			std::string msg = _SRC_ + strprint("Could not delete existing coverage shapefile %s\n", CoveragePath.c_str());
+			throw(std::runtime_error(msg));
+		}
+		GDALDataset* ds = driver->Create(CoveragePath.c_str(), 0, 0, 0, GDT_Unknown, nullptr);
+		if (ds == nullptr) {
+			std::string msg = _SRC_ + strprint("Could not create coverage shapefile %s\n", CoveragePath.c_str());
+			throw(std::runtime_error(msg));
+		}
+
+		OGRLayer* layer = ds->CreateLayer("coverage", nullptr, wkbPolygon, nullptr);
+		OGRFieldDefn fpart("part", OFTInteger);
+		OGRFieldDefn fnpoints("npoints", OFTInteger);
+		layer->CreateField(&fpart);
+		layer->CreateField(&fnpoints);
+
+		for (size_t oi = 0; oi < outer.size(); oi++) {
+			OGRPolygon polygon;
+			OGRLinearRing ring;
+			for (const auto& [x, y] : outer[oi]) ring.addPoint(x, y);
+			polygon.addRing(&ring);
+			for (size_t hi = 0; hi < holes.size(); hi++) {
+				if (cCoverageAccumulator::inside(outer[oi], holes[hi][0].first, holes[hi][0].second)) {
+					OGRLinearRing hole;
+					for (const auto& [x, y] : holes[hi]) hole.addPoint(x, y);
+					polygon.addRing(&hole);
+				}
+			}
+			polygon.closeRings();
+
+			OGRFeature* feature = OGRFeature::CreateFeature(layer->GetLayerDefn());
+			feature->SetField("part", (int)oi);
+			feature->SetField("npoints", (int)Coverage.npointsadded());
+			feature->SetGeometry(&polygon);
+			layer->CreateFeature(feature);
+			OGRFeature::DestroyFeature(feature);
+		}
+		GDALClose(ds);
 		return true;
 	}
 };
@@ -205,17 +261,49 @@ int main(int argc, char** argv)
 
 	try
 	{		
-		if (argc == 3) {
-			std::string NCPath    = argv[1];
-			std::string ShapePath = argv[2];									
+		//Separate the options from the positional arguments
+		std::vector<std::string> args;
+		std::string covmethod = "none";
+		double alpha = 0.0;
+		for (int i = 1; i < argc; i++) {
+			std::string a = argv[i];
+			if (a == "-coverage" && i + 1 < argc) covmethod = tolower(argv[++i]);
+			else if (a == "-alpha" && i + 1 < argc) alpha = atof(argv[++i]);
+			else args.push_back(a);
+		}
+
+		cCoverageAccumulator coverage;
+		if (covmethod == "convex") {
+			coverage = cCoverageAccumulator(cCoverageAccumulator::Method::CONVEX, alpha);
+		}
+		else if (covmethod == "alpha") {
+			if (alpha <= 0.0) {
+				std::string msg = _SRC_ + strprint("The alpha coverage method requires -alpha radius (in coordinate units) greater than zero\n");
+				throw(std::runtime_error(msg));
+			}
+			coverage = cCoverageAccumulator(cCoverageAccumulator::Method::ALPHA, alpha);
+		}
+		else if (covmethod != "none") {
+			std::string msg = _SRC_ + strprint("Unknown coverage method %s (use none, convex or alpha)\n", covmethod.c_str());
+			throw(std::runtime_error(msg));
+		}
+
+		if (coverage.getmethod() != cCoverageAccumulator::Method::NONE && cCoverageAccumulator::available() == false) {
+			std::string msg = _SRC_ + strprint("Coverage polygons require a build with CGAL support (ENABLE_CGAL)\n");
+			throw(std::runtime_error(msg));
+		}
+
+		if (args.size() == 2) {
+			std::string NCPath    = args[0];
+			std::string ShapePath = args[1];									
 			std::cout << NCPath << " " << ShapePath << std::endl << std::flush;
-			cNcToShapefileConverter C(NCPath, ShapePath);			
+			cNcToShapefileConverter C(NCPath, ShapePath, coverage);			
 			glog.logmsg(0, "Finished\n");
 		}
-		else if (argc == 4) {			
-			std::string ncdir = argv[1];
-			std::string shapedir = argv[2];
-			std::string listfile = argv[3];
+		else if (args.size() == 3) {			
+			std::string ncdir = args[0];
+			std::string shapedir = args[1];
+			std::string listfile = args[2];
 			std::ifstream file(listfile);
 			addtrailingseparator(ncdir);
 			addtrailingseparator(shapedir);
@@ -229,15 +317,18 @@ int main(int argc, char** argv)
 					std::string NCPath = ncdir + fpp.directory + fpp.prefix + ".nc";
 					std::string ShapePath = shapedir + fpp.directory + fpp.prefix + ".shp";
 					std::cout << NCPath << " " << ShapePath << std::endl << std::flush;
-					cNcToShapefileConverter C(NCPath, ShapePath);
+					cNcToShapefileConverter C(NCPath, ShapePath, coverage);
 					k++;
 				}
 			}
 			glog.logmsg(0, "Finished\n");
 		}
 		else{
-			std::cout << "Usage: " << extractfilename(argv[0]) << " ncfile shapefile" << std::endl;
-			std::cout << "   or: " << extractfilename(argv[0]) << " ncfiles_directory shapefiles_directory list_of_ncfiles.txt" << std::endl;
+			std::cout << "Usage: " << extractfilename(argv[0]) << " [options] ncfile shapefile" << std::endl;
+			std::cout << "   or: " << extractfilename(argv[0]) << " [options] ncfiles_directory shapefiles_directory list_of_ncfiles.txt" << std::endl;
+			std::cout << "Options:" << std::endl;
+			std::cout << "   -coverage none|convex|alpha  also write survey coverage polygons to <shapefile>_coverage.shp (requires CGAL)" << std::endl;
+			std::cout << "   -alpha radius                alpha shape radius in coordinate units" << std::endl;
 		}
 	}
 	catch (NcException& e)
@@ -0,0 +1,137 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#include <cstdio>
+#include <netcdf>
+#include <vector>
+#include <fstream>
+
+#define _PROGRAM_ "geophysicsnc2subset"
+#define _VERSION_ "1.0"
+
+#include "general_utils.h"
+#include "file_utils.h"
+#include "logger.h"
+#include "geophysics_netcdf.hpp"
+#include "subset.h"
+#include "string_list.h"
+
+using namespace netCDF;
+using namespace netCDF::exceptions;
+using namespace GeophysicsNetCDF;
+
+class cLogger glog; //The instance of the global log file manager
+
+//A comma separated list of line numbers, or a file of whitespace separated line numbers
+std::vector<long long> parselines(const std::string& s) {
+	std::vector<long long> lines;
+	if (exists(s)) {
+		std::ifstream file(s);
+		long long ln;
+		while (file >> ln) lines.push_back(ln);
+	}
+	else {
+		for (const auto& item : split_list(s)) lines.push_back(atoll(item.c_str()));
+	}
+	return lines;
+}
+
+void usage(const char* program) {
+	std::cout << "Usage: " << extractfilename(program) << " [options] input_ncfile output_ncfile" << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "   -bbox xmin ymin xmax ymax   keep samples within this bounding box" << std::endl;
+	std::cout << "   -x name -y name             coordinate variables for -bbox (default easting/northing, x/y or longitude/latitude)" << std::endl;
+	std::cout << "   -lines list|file            keep these comma separated line numbers, or those listed in a file" << std::endl;
+	std::cout << "   -fidrange min max           keep samples with fiducials in this range" << std::endl;
+	std::cout << "   -fid name                   fiducial variable for -fidrange (default fiducial)" << std::endl;
+	std::cout << "   -stride n                   then keep every n'th sample of each line" << std::endl;
+	std::cout << "   -include var1,var2,...      only copy these variables" << std::endl;
+	std::cout << "   -exclude var1,var2,...      do not copy these variables" << std::endl;
+	std::cout << "   -memory MB                  memory budget for the variable blocks (default 1024)" << std::endl;
+	std::cout << "   -threads n                  number of variables processed concurrently (default all cores)" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	_GSTITEM_
+	try
+	{
+		cSubsetOptions O;
+		std::vector<std::string> args;
+		for (int i = 1; i < argc; i++) {
+			std::string a = argv[i];
+			auto nvalues = [&](const int n) { return i + n < argc; };
+			if (a == "-bbox" && nvalues(4)) {
+				O.usebbox = true;
+				O.xmin = atof(argv[++i]);
+				O.ymin = atof(argv[++i]);
+				O.xmax = atof(argv[++i]);
+				O.ymax = atof(argv[++i]);
+			}
+			else if (a == "-x" && nvalues(1)) O.xvar = argv[++i];
+			else if (a == "-y" && nvalues(1)) O.yvar = argv[++i];
+			else if (a == "-lines" && nvalues(1)) O.lines = parselines(argv[++i]);
+			else if (a == "-fidrange" && nvalues(2)) {
+				O.usefidrange = true;
+				O.fidmin = atof(argv[++i]);
+				O.fidmax = atof(argv[++i]);
+			}
+			else if (a == "-fid" && nvalues(1)) O.fidvar = argv[++i];
+			else if (a == "-stride" && nvalues(1)) O.stride = (size_t)atoll(argv[++i]);
+			else if (a == "-include" && nvalues(1)) O.include = split_list(argv[++i]);
+			else if (a == "-exclude" && nvalues(1)) O.exclude = split_list(argv[++i]);
+			else if (a == "-memory" && nvalues(1)) O.budgetbytes = (size_t)atoll(argv[++i]) * 1048576;
+			else if (a == "-threads" && nvalues(1)) O.nthreads = (size_t)atoll(argv[++i]);
+			else args.push_back(a);
+		}
+
+		if (args.size() != 2) {
+			usage(argv[0]);
+			return 1;
+		}
+
+		const std::string inpath = fixseparator(args[0]);
+		const std::string outpath = fixseparator(args[1]);
+		if (!exists(extractfiledirectory(outpath))) {
+			makedirectorydeep(extractfiledirectory(outpath));
+		}
+
+		glog.open(outpath + ".log");
+		glog.logmsg("Program %s starting at %s\n", _PROGRAM_, timestamp().c_str());
+		glog.logmsg("Version %s Compiled at %s on %s\n", _VERSION_, __TIME__, __DATE__);
+		glog.logmsg("%s\n", commandlinestring(argc, argv).c_str());
+		glog.logmsg("Working directory: %s\n", getcurrentdirectory().c_str());
+
+		double t1 = gettime();
+		GFile in(inpath, NcFile::read);
+		GFile out(outpath, NcFile::replace);
+		cSubsetEngine E(in, out, O);
+		E.run();
+		out.putAtt("CreationTime", timestamp());
+		out.putAtt("CreationMethod", "geophysicsnc2subset.exe");
+		out.putAtt("SubsetSourceFile", inpath);
+		out.close();
+		double t2 = gettime();
+		glog.logmsg("Elapsed time = %.2lf\n", t2 - t1);
+		glog.logmsg("Finished at %s\n", timestamp().c_str());
+		glog.close();
+	}
+	catch (NcException& e)
+	{
+		_GSTPRINT_
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	catch (std::exception& e)
+	{
+		_GSTPRINT_
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
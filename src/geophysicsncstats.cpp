@@ -0,0 +1,252 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#include <cstdio>
+#include <cmath>
+#include <netcdf>
+#include <vector>
+#include <mutex>
+
+#define _PROGRAM_ "geophysicsncstats"
+#define _VERSION_ "1.0"
+
+#include "general_utils.h"
+#include "file_utils.h"
+#include "logger.h"
+#include "geophysics_netcdf.hpp"
+#include "ncvar_utils.h"
+#include "thread_pool.h"
+#include "statistics.h"
+#include "string_list.h"
+
+using namespace netCDF;
+using namespace netCDF::exceptions;
+using namespace GeophysicsNetCDF;
+
+class cLogger glog; //The instance of the global log file manager
+
+struct sStatsOptions {
+	std::vector<std::string> vars;//all numeric line and sample variables if empty
+	size_t nbins = 0;//histogram bins, 0 for no histogram
+	size_t blockvalues = 1048576;//values read per task
+	size_t nthreads = 0;
+};
+
+//Backfills the statistics attributes that the converters store, for files converted without them.
+//Each variable is split into blocks of whole lines. The blocks are read one at a time (the NetCDF and
+//HDF5 libraries are not thread safe) but summarised concurrently on a work stealing pool, and the
+//partial statistics are then merged in block order. A histogram takes a second pass over the blocks
+//once the range is known.
+class cStatsBackfiller {
+
+	GFile& File;
+	sStatsOptions O;
+	std::vector<size_t> LineStart;
+	std::vector<size_t> LineCount;
+	std::mutex NcMutex;
+
+	struct sBlock {
+		size_t vi;//index into Vars
+		size_t start;//first record (sample, or line for a line variable)
+		size_t count;
+	};
+
+	struct sVarInfo {
+		NcVar var;
+		std::vector<size_t> dimsizes;//found while planning, as the workers may only call the library under NcMutex
+		size_t nbands = 1;
+		double null = 0.0;
+		double scale = 1.0;
+		double offset = 0.0;
+	};
+
+	std::vector<sVarInfo> Vars;
+	std::vector<sBlock> Blocks;
+
+	static double getattdouble(const NcVar& var, const std::string& name, const double def) {
+		const auto atts = var.getAtts();
+		auto it = atts.find(name);
+		if (it == atts.end()) return def;
+		double v;
+		it->second.getValues(&v);
+		return v;
+	}
+
+	bool wanted(const NcVar& v) const {
+		if (O.vars.size() == 0) return true;
+		for (const auto& s : O.vars) {
+			if (tolower(s) == tolower(v.getName())) return true;
+		}
+		return false;
+	}
+
+	void plan() {
+		for (const NcVar& v : File.getAllVars()) {
+			const nc_type t = v.getType().getId();
+			if (t == NC_CHAR || t == NC_STRING || t >= NC_VLEN) continue;
+			const bool islinevar = File.isLineVar(v);
+			if (islinevar == false && File.isSampleVar(v) == false) continue;
+			if (wanted(v) == false) continue;
+
+			sVarInfo info;
+			info.var = v;
+			for (const NcDim& d : v.getDims()) info.dimsizes.push_back(d.getSize());
+			for (size_t di = 1; di < info.dimsizes.size(); di++) info.nbands *= info.dimsizes[di];
+			info.null = File.getGeophysicsVar(v.getName()).missingvalue(double());
+			info.scale = getattdouble(v, "scale_factor", 1.0);
+			info.offset = getattdouble(v, "add_offset", 0.0);
+			const size_t vi = Vars.size();
+			Vars.push_back(info);
+
+			//Blocks of whole lines of about blockvalues values
+			sBlock b = { vi, 0, 0 };
+			for (size_t li = 0; li < LineStart.size(); li++) {
+				const size_t n = islinevar ? 1 : LineCount[li];
+				if (b.count > 0 && (b.count + n) * info.nbands > O.blockvalues) {
+					Blocks.push_back(b);
+					b.start += b.count;
+					b.count = 0;
+				}
+				b.count += n;
+			}
+			if (b.count > 0) Blocks.push_back(b);
+		}
+	}
+
+	//Values of a block, unpacked, with nan for the nulls
+	void read(const sBlock& b, std::vector<double>& v) {
+		const sVarInfo& info = Vars[b.vi];
+		std::vector<size_t> start(info.dimsizes.size(), 0);
+		std::vector<size_t> count = info.dimsizes;
+		start[0] = b.start;
+		count[0] = b.count;
+		v.resize(b.count * info.nbands);
+		{
+			std::lock_guard<std::mutex> lock(NcMutex);
+			info.var.getVar(start, count, v.data());
+		}
+		for (double& x : v) {
+			if (x == info.null) x = std::numeric_limits<double>::quiet_NaN();
+			else x = x * info.scale + info.offset;
+		}
+	}
+
+	//Statistics (or the histogram) of every variable, from the blocks in parallel
+	std::vector<cVariableStats> pass(const std::vector<cVariableStats>& initial) {
+		std::vector<cVariableStats> partial(Blocks.size());
+		cWorkStealingPool P(O.nthreads);
+		P.run(Blocks.size(), [&](const size_t bi, const size_t) {
+			std::vector<double> v;
+			read(Blocks[bi], v);
+			partial[bi] = initial[Blocks[bi].vi];
+			partial[bi].add(v.data(), Blocks[bi].count, std::numeric_limits<double>::quiet_NaN());
+		});
+		std::vector<cVariableStats> s = initial;
+		for (size_t bi = 0; bi < Blocks.size(); bi++) s[Blocks[bi].vi].merge(partial[bi]);
+		return s;
+	}
+
+public:
+
+	cStatsBackfiller(GFile& file, const sStatsOptions& options) : File(file), O(options) {
+		get_line_index(File, LineStart, LineCount);
+	}
+
+	void run() {
+		plan();
+		glog.logmsg("Computing statistics of %zu variables in %zu blocks\n", Vars.size(), Blocks.size());
+
+		std::vector<cVariableStats> initial;
+		for (const auto& info : Vars) initial.push_back(cVariableStats(info.nbands));
+		double t1 = gettime();
+		std::vector<cVariableStats> stats = pass(initial);
+		double t2 = gettime();
+		glog.logmsg("Statistics pass took %.2lf s\n", t2 - t1);
+
+		if (O.nbins > 0) {
+			//Bins over the range from the first pass, the moments come out the same again
+			for (size_t vi = 0; vi < Vars.size(); vi++) {
+				const sRunningStats t = stats[vi].total();
+				initial[vi].sethistogram(O.nbins, t.n ? t.min : 0.0, t.n ? t.max : 0.0);
+			}
+			stats = pass(initial);
+			double t3 = gettime();
+			glog.logmsg("Histogram pass took %.2lf s\n", t3 - t2);
+		}
+
+		for (size_t vi = 0; vi < Vars.size(); vi++) {
+			const sRunningStats t = stats[vi].total();
+			glog.logmsg("%s: valid %llu null %llu min %lf max %lf mean %lf std %lf\n", Vars[vi].var.getName().c_str(), (unsigned long long)t.n, (unsigned long long)t.nnull, t.min, t.max, t.mean, t.stddev());
+			stats[vi].write(Vars[vi].var);
+		}
+	}
+};
+
+void usage(const char* program) {
+	std::cout << "Usage: " << extractfilename(program) << " [options] ncfile" << std::endl;
+	std::cout << "Adds actual_range, mean, standard_deviation, valid_count and null_count attributes (per band for multiband variables) to the variables of an existing file" << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "   -vars var1,var2,...         only these variables (default all numeric line and sample variables)" << std::endl;
+	std::cout << "   -histogram n                also add a histogram of n bins over the actual range" << std::endl;
+	std::cout << "   -block n                    values read per task (default 1048576)" << std::endl;
+	std::cout << "   -threads n                  number of threads (default all cores)" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	_GSTITEM_
+	try
+	{
+		sStatsOptions O;
+		std::vector<std::string> args;
+		for (int i = 1; i < argc; i++) {
+			std::string a = argv[i];
+			auto nvalues = [&](const int n) { return i + n < argc; };
+			if (a == "-vars" && nvalues(1)) O.vars = split_list(argv[++i]);
+			else if (a == "-histogram" && nvalues(1)) O.nbins = (size_t)atoll(argv[++i]);
+			else if (a == "-block" && nvalues(1)) O.blockvalues = (size_t)atoll(argv[++i]);
+			else if (a == "-threads" && nvalues(1)) O.nthreads = (size_t)atoll(argv[++i]);
+			else args.push_back(a);
+		}
+
+		if (args.size() != 1) {
+			usage(argv[0]);
+			return 1;
+		}
+
+		const std::string path = fixseparator(args[0]);
+		glog.open(path + ".stats.log");
+		glog.logmsg("Program %s starting at %s\n", _PROGRAM_, timestamp().c_str());
+		glog.logmsg("Version %s Compiled at %s on %s\n", _VERSION_, __TIME__, __DATE__);
+		glog.logmsg("%s\n", commandlinestring(argc, argv).c_str());
+		glog.logmsg("Working directory: %s\n", getcurrentdirectory().c_str());
+
+		double t1 = gettime();
+		GFile file(path, NcFile::write);
+		cStatsBackfiller B(file, O);
+		B.run();
+		file.close();
+		double t2 = gettime();
+		glog.logmsg("Elapsed time = %.2lf\n", t2 - t1);
+		glog.logmsg("Finished at %s\n", timestamp().c_str());
+		glog.close();
+	}
+	catch (NcException& e)
+	{
+		_GSTPRINT_
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	catch (std::exception& e)
+	{
+		_GSTPRINT_
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
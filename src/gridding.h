@@ -0,0 +1,324 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _gridding_H
+#define _gridding_H
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#include "general_utils.h"
+
+//A north up grid, node (ix,iy) is at the centre of cell ix from the west and cell iy from the north
+struct sGridGeometry {
+	double xmin = 0.0;//west edge
+	double ymax = 0.0;//north edge
+	double cellsize = 0.0;
+	size_t nx = 0;
+	size_t ny = 0;
+
+	//Snap the bounds outwards to whole cells
+	static sGridGeometry frombounds(const double x0, const double y0, const double x1, const double y1, const double cellsize) {
+		if (cellsize <= 0.0 || x1 < x0 || y1 < y0) {
+			throw(std::runtime_error(_SRC_ + strprint("Invalid grid bounds or cell size\n")));
+		}
+		sGridGeometry g;
+		g.cellsize = cellsize;
+		g.xmin = std::floor(x0 / cellsize) * cellsize;
+		g.ymax = std::ceil(y1 / cellsize) * cellsize;
+		g.nx = (size_t)std::ceil((x1 - g.xmin) / cellsize) + 1;
+		g.ny = (size_t)std::ceil((g.ymax - y0) / cellsize) + 1;
+		return g;
+	}
+
+	//Continuous node coordinates of a point
+	double u(const double x) const { return (x - xmin) / cellsize - 0.5; }
+	double w(const double y) const { return (ymax - y) / cellsize - 0.5; }
+
+	//GDAL geotransform
+	void geotransform(double* gt) const {
+		gt[0] = xmin; gt[1] = cellsize; gt[2] = 0.0;
+		gt[3] = ymax; gt[4] = 0.0; gt[5] = -cellsize;
+	}
+};
+
+//A data point in continuous node coordinates, 12 bytes so that a whole survey can be held bucketed by tile
+struct sGridPoint {
+	float u;
+	float w;
+	float v;
+};
+
+struct sGridOptions {
+	enum class Method { IDW, MINCURV };
+	Method method = Method::IDW;
+	double radius = 4.0;//search and blanking radius in cells
+	double power = 2.0;//inverse distance weighting power
+	double tension = 0.0;//0 for pure minimum curvature, 1 for pure harmonic (Laplace) surfaces
+	size_t maxiterations = 250;//per multigrid level
+	double tolerance = 1e-4;//stop when the largest change is less than this fraction of the tile's data range
+	double halo = 0.0;//extra cells interpolated around each tile for continuity at tile edges (minimum curvature)
+	size_t tilesize = 256;
+
+	//Cells beyond a tile's edges whose points must be bucketed with it
+	double haloneeded() const {
+		return method == Method::MINCURV ? std::max(radius, halo) : radius;
+	}
+};
+
+//Points binned on a regular grid for fixed radius neighbour queries
+class cPointBins {
+
+	double U0 = 0.0;
+	double W0 = 0.0;
+	double BinSize = 1.0;
+	size_t NU = 0;
+	size_t NW = 0;
+	std::vector<size_t> Start;
+	std::vector<sGridPoint> Points;
+
+	size_t binu(const double u) const { return (size_t)std::clamp((long long)std::floor((u - U0) / BinSize), 0LL, (long long)NU - 1); }
+	size_t binw(const double w) const { return (size_t)std::clamp((long long)std::floor((w - W0) / BinSize), 0LL, (long long)NW - 1); }
+
+public:
+
+	cPointBins(const std::vector<sGridPoint>& pts, const double u0, const double w0, const double u1, const double w1, const double binsize) {
+		U0 = u0;
+		W0 = w0;
+		BinSize = std::max(binsize, 1.0);
+		NU = std::max((size_t)1, (size_t)std::ceil((u1 - u0) / BinSize));
+		NW = std::max((size_t)1, (size_t)std::ceil((w1 - w0) / BinSize));
+
+		//Counting sort of the points by bin
+		Start.assign(NU * NW + 1, 0);
+		for (const auto& p : pts) Start[binw(p.w) * NU + binu(p.u) + 1]++;
+		for (size_t b = 1; b < Start.size(); b++) Start[b] += Start[b - 1];
+		std::vector<size_t> next(Start.begin(), Start.end() - 1);
+		Points.resize(pts.size());
+		for (const auto& p : pts) Points[next[binw(p.w) * NU + binu(p.u)]++] = p;
+	}
+
+	//Call f(point, squared distance) for every point within radius r of (u,w)
+	template<typename F>
+	void within(const double u, const double w, const double r, F&& f) const {
+		const double r2 = r * r;
+		const size_t bu0 = binu(u - r), bu1 = binu(u + r);
+		const size_t bw0 = binw(w - r), bw1 = binw(w + r);
+		for (size_t bw = bw0; bw <= bw1; bw++) {
+			for (size_t bu = bu0; bu <= bu1; bu++) {
+				const size_t b = bw * NU + bu;
+				for (size_t k = Start[b]; k < Start[b + 1]; k++) {
+					const double du = Points[k].u - u;
+					const double dw = Points[k].w - w;
+					const double d2 = du * du + dw * dw;
+					if (d2 <= r2) f(Points[k], d2);
+				}
+			}
+		}
+	}
+};
+
+//Points bucketed into square tiles of the grid, each tile also receiving the points within its halo
+class cTiledGridder {
+
+	sGridGeometry G;
+	sGridOptions O;
+	size_t NTX = 0;
+	size_t NTY = 0;
+	double Halo = 0.0;
+	std::vector<std::vector<sGridPoint>> Buckets;
+	size_t NumPoints = 0;
+
+	//Inverse distance weighted nodes of the tile, nan where there is no data within the radius
+	void idw(const std::vector<sGridPoint>& pts, const size_t c0, const size_t r0, const size_t nc, const size_t nr, std::vector<float>& z) const {
+		const double R = O.radius;
+		const cPointBins bins(pts, (double)c0 - R, (double)r0 - R, (double)(c0 + nc) + R, (double)(r0 + nr) + R, R);
+		const double halfpower = O.power / 2.0;
+		for (size_t j = 0; j < nr; j++) {
+			for (size_t i = 0; i < nc; i++) {
+				double sw = 0.0, swv = 0.0;
+				bool exact = false;
+				double exactv = 0.0;
+				bins.within((double)(c0 + i), (double)(r0 + j), R, [&](const sGridPoint& p, const double d2) {
+					if (d2 < 1e-12) {
+						exact = true;
+						exactv = p.v;
+						return;
+					}
+					const double wt = halfpower == 1.0 ? 1.0 / d2 : 1.0 / std::pow(d2, halfpower);
+					sw += wt;
+					swv += wt * p.v;
+				});
+				if (exact) z[j * nc + i] = (float)exactv;
+				else if (sw > 0.0) z[j * nc + i] = (float)(swv / sw);
+				else z[j * nc + i] = std::numeric_limits<float>::quiet_NaN();
+			}
+		}
+	}
+
+	//Minimum curvature (with optional tension) over the tile plus its halo, solved by Gauss-Seidel
+	//over-relaxation on successively finer lattices, each initialised from the coarser solution.
+	//Nodes further than the radius from any point are blanked with nan.
+	void mincurv(const std::vector<sGridPoint>& pts, const size_t c0, const size_t r0, const size_t nc, const size_t nr, std::vector<float>& z) const {
+		const long long H = (long long)std::ceil(Halo);
+		const long long ou = (long long)c0 - H;
+		const long long ow = (long long)r0 - H;
+		const size_t mu = nc + 2 * (size_t)H;
+		const size_t mw = nr + 2 * (size_t)H;
+
+		double vmin = 1e300, vmax = -1e300, vsum = 0.0;
+		for (const auto& p : pts) {
+			vmin = std::min(vmin, (double)p.v);
+			vmax = std::max(vmax, (double)p.v);
+			vsum += p.v;
+		}
+		const double tol = O.tolerance * std::max(vmax - vmin, 1e-12);
+
+		size_t smax = 1;
+		while (smax < 16 && (mu - 1) / (smax * 2) >= 4 && (mw - 1) / (smax * 2) >= 4) smax *= 2;
+
+		std::vector<double> Z(mu * mw, vsum / (double)pts.size());
+		std::vector<double> sum(mu * mw);
+		std::vector<unsigned int> cnt(mu * mw);
+		const double t = O.tension;
+		const double omega = 1.4;
+		for (size_t s = smax; s >= 1; s /= 2) {
+			const size_t lu = (mu - 1) / s + 1;
+			const size_t lw = (mw - 1) / s + 1;
+
+			//Data constrain their nearest node of this lattice
+			std::fill(sum.begin(), sum.end(), 0.0);
+			std::fill(cnt.begin(), cnt.end(), 0);
+			for (const auto& p : pts) {
+				const long long i = std::llround(((double)p.u - (double)ou) / (double)s);
+				const long long j = std::llround(((double)p.w - (double)ow) / (double)s);
+				if (i < 0 || j < 0 || i >= (long long)lu || j >= (long long)lw) continue;
+				const size_t k = (size_t)j * s * mu + (size_t)i * s;
+				sum[k] += p.v;
+				cnt[k]++;
+			}
+			for (size_t k = 0; k < Z.size(); k++) {
+				if (cnt[k]) Z[k] = sum[k] / cnt[k];
+			}
+
+			auto at = [&](long long i, long long j) {
+				i = std::clamp(i, 0LL, (long long)lu - 1);
+				j = std::clamp(j, 0LL, (long long)lw - 1);
+				return Z[(size_t)j * s * mu + (size_t)i * s];
+			};
+			for (size_t it = 0; it < O.maxiterations; it++) {
+				double maxchange = 0.0;
+				for (long long j = 0; j < (long long)lw; j++) {
+					for (long long i = 0; i < (long long)lu; i++) {
+						const size_t k = (size_t)j * s * mu + (size_t)i * s;
+						if (cnt[k]) continue;
+						const double s1 = at(i - 1, j) + at(i + 1, j) + at(i, j - 1) + at(i, j + 1);
+						double znew;
+						if (t >= 1.0) znew = s1 / 4.0;
+						else {
+							const double s2 = at(i - 1, j - 1) + at(i + 1, j - 1) + at(i - 1, j + 1) + at(i + 1, j + 1);
+							const double s3 = at(i - 2, j) + at(i + 2, j) + at(i, j - 2) + at(i, j + 2);
+							znew = ((1.0 - t) * (8.0 * s1 - 2.0 * s2 - s3) + t * s1) / ((1.0 - t) * 20.0 + t * 4.0);
+						}
+						const double dz = omega * (znew - Z[k]);
+						Z[k] += dz;
+						maxchange = std::max(maxchange, std::fabs(dz));
+					}
+				}
+				if (maxchange < tol) break;
+			}
+
+			//Bilinear initial values for the nodes of the next finer lattice
+			if (s > 1) {
+				const size_t h = s / 2;
+				for (size_t jj = 0; jj < mw; jj += h) {
+					for (size_t ii = 0; ii < mu; ii += h) {
+						if (ii % s == 0 && jj % s == 0) continue;
+						const long long i = (long long)(ii / s);
+						const long long j = (long long)(jj / s);
+						const double fu = (double)(ii % s) / s;
+						const double fw = (double)(jj % s) / s;
+						Z[jj * mu + ii] = (1 - fu) * (1 - fw) * at(i, j) + fu * (1 - fw) * at(i + 1, j) + (1 - fu) * fw * at(i, j + 1) + fu * fw * at(i + 1, j + 1);
+					}
+				}
+			}
+		}
+
+		const cPointBins bins(pts, (double)c0 - O.radius, (double)r0 - O.radius, (double)(c0 + nc) + O.radius, (double)(r0 + nr) + O.radius, O.radius);
+		for (size_t j = 0; j < nr; j++) {
+			for (size_t i = 0; i < nc; i++) {
+				bool covered = false;
+				bins.within((double)(c0 + i), (double)(r0 + j), O.radius, [&](const sGridPoint&, const double) { covered = true; });
+				z[j * nc + i] = covered ? (float)Z[(j + (size_t)H) * mu + i + (size_t)H] : std::numeric_limits<float>::quiet_NaN();
+			}
+		}
+	}
+
+public:
+
+	cTiledGridder(const sGridGeometry& g, const sGridOptions& o) : G(g), O(o) {
+		if (O.tilesize == 0 || O.radius <= 0.0) {
+			throw(std::runtime_error(_SRC_ + strprint("The tile size and search radius must be greater than zero\n")));
+		}
+		NTX = (G.nx + O.tilesize - 1) / O.tilesize;
+		NTY = (G.ny + O.tilesize - 1) / O.tilesize;
+		Halo = O.haloneeded();
+		Buckets.resize(NTX * NTY);
+	}
+
+	const sGridGeometry& geometry() const { return G; }
+	size_t ntiles() const { return Buckets.size(); }
+	size_t ntilesx() const { return NTX; }
+	size_t npoints() const { return NumPoints; }
+
+	//Add a point to every tile whose extent plus halo contains it
+	void add(const double x, const double y, const double v) {
+		const double u = G.u(x);
+		const double w = G.w(y);
+		const double T = (double)O.tilesize;
+		const long long tx0 = std::max(0LL, (long long)std::floor((u - Halo + 0.5) / T));
+		const long long tx1 = std::min((long long)NTX - 1, (long long)std::floor((u + Halo + 0.5) / T));
+		const long long ty0 = std::max(0LL, (long long)std::floor((w - Halo + 0.5) / T));
+		const long long ty1 = std::min((long long)NTY - 1, (long long)std::floor((w + Halo + 0.5) / T));
+		if (tx0 > tx1 || ty0 > ty1) return;
+		const sGridPoint p = { (float)u, (float)w, (float)v };
+		for (long long ty = ty0; ty <= ty1; ty++) {
+			for (long long tx = tx0; tx <= tx1; tx++) {
+				Buckets[(size_t)ty * NTX + (size_t)tx].push_back(p);
+			}
+		}
+		NumPoints++;
+	}
+
+	//Column, row and extent of a tile within the grid
+	void tileextent(const size_t tileindex, size_t& c0, size_t& r0, size_t& nc, size_t& nr) const {
+		c0 = (tileindex % NTX) * O.tilesize;
+		r0 = (tileindex / NTX) * O.tilesize;
+		nc = std::min(O.tilesize, G.nx - c0);
+		nr = std::min(O.tilesize, G.ny - r0);
+	}
+
+	//Interpolate one tile into z[nr][nc], nan where blanked, and release its points.
+	//Different tiles may be interpolated concurrently.
+	void gridtile(const size_t tileindex, std::vector<float>& z) {
+		size_t c0, r0, nc, nr;
+		tileextent(tileindex, c0, r0, nc, nr);
+		z.assign(nc * nr, std::numeric_limits<float>::quiet_NaN());
+		std::vector<sGridPoint> pts;
+		pts.swap(Buckets[tileindex]);
+		if (pts.size() == 0) return;
+		if (O.method == sGridOptions::Method::MINCURV) mincurv(pts, c0, r0, nc, nr, z);
+		else idw(pts, c0, r0, nc, nr, z);
+	}
+};
+
+#endif
@@ -10,6 +10,9 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include <netcdf>
 #include <vector>
 #include <limits>
+#include <memory>
+#include <numeric>
+#include <filesystem>
 
 
 #define _PROGRAM_ "intrepid2netcdf"
@@ -25,6 +28,14 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include "logger.h"
 #include "streamredirecter.h"
 #include "geophysics_netcdf.hpp"
+#include "mpi_linewriter.h"
+#include "conversion_options.h"
+#include "bandmajor.h"
+#include "ncvar_utils.h"
+#include "statistics.h"
+#include "footprint.h"
+#include "overview.h"
+#include "shards.h"
 #ifdef HAVE_GDAL
 #include "crs.h"
 #endif
@@ -38,16 +49,39 @@ class cLogger glog; //The instance of the global log file manager
 class cIntrepidToNetCDFConverter {
 	std::string IntrepiDatabasePath;
 	std::string NCPath;
+	std::string OutPath;//the file being written, NCPath or one of its shards
+	size_t ShardIndex = 0;
 	bool OverWriteExistingNcFiles = true;
+	cConversionOptions Options;
+	int MPIRank = 0;
+	int MPISize = 1;
+#ifdef ENABLE_MPI
+	std::unique_ptr<cMPILineWriter> Writer;
+#endif
+	cVariableStats Stats;//of the variable being converted
+	cLineFootprints Footprints;//per line, computed while the longitude field is converted
+	ILField* FootprintX = nullptr;
+	ILField* FootprintY = nullptr;
+	std::vector<size_t> OutIndex;//output line index of each input line, or SIZE_MAX if it is not in the current shard
+	std::vector<size_t> OutStart;//output index of the first sample of each input line
+	std::vector<size_t> HilbertOrder;//kept for the other shards
 
 public:
 
-	cIntrepidToNetCDFConverter(const std::string& intrepiddatabasepath, const std::string& ncfilepath, std::string& commandline) {
+	cIntrepidToNetCDFConverter(const std::string& intrepiddatabasepath, const std::string& ncfilepath, std::string& commandline, const cConversionOptions& options) {
 		IntrepiDatabasePath = fixseparator(intrepiddatabasepath);
+		Options = options;
 		NCPath = fixseparator(ncfilepath);
+		OutPath = NCPath;
 
-		std::string LogPath = NCPath + ".log";
-		std::string WLogPath = NCPath + ".warn.log";
+#ifdef ENABLE_MPI
+		MPI_Comm_rank(MPI_COMM_WORLD, &MPIRank);
+		MPI_Comm_size(MPI_COMM_WORLD, &MPISize);
+#endif
+		//Only the writer rank uses the normal log file names
+		std::string suffix = (MPIRank > 0) ? strprint(".rank%d", MPIRank) : "";
+		std::string LogPath = NCPath + suffix + ".log";
+		std::string WLogPath = NCPath + suffix + ".warn.log";
 
 		std::ofstream wlog(WLogPath, std::ios::ate);
 		cStreamRedirecter R(wlog, std::cerr);
@@ -58,7 +92,7 @@ public:
 		glog.logmsg("Version %s Compiled at %s on %s\n", _VERSION_, __TIME__, __DATE__);
 		glog.logmsg("%s\n", commandline.c_str());
 		glog.logmsg("Working directory: %s\n", getcurrentdirectory().c_str());
-		bool status = process();
+		bool status = Options.Shards > 0 ? process_sharded() : process();
 		if (status == false) {
 			std::string msg = strprint("Error 0: converting %s to %s\n", intrepiddatabasepath.c_str(), ncfilepath.c_str());
 			glog.logmsg(msg);
@@ -79,9 +113,9 @@ public:
 		std::string IDBPath = ILDataset::dbdirpath(IntrepiDatabasePath);
 		std::string IDBName = ILDataset::dbname(IntrepiDatabasePath);
 
-		if (exists(NCPath)) {
+		if (exists(OutPath)) {
 			if (OverWriteExistingNcFiles == false) {
-				glog.logmsg("Warning 1: NetCDF file %s already exists - skipping this database\n", NCPath.c_str());
+				glog.logmsg("Warning 1: NetCDF file %s already exists - skipping this database\n", OutPath.c_str());
 				return false;
 			}
 		}
@@ -126,26 +160,330 @@ public:
 			glog.logmsg("Warning 3: could not determine the Y field in the SurveyInfo file\n");
 		}
 
-		glog.logmsg("Creating NetCDF file: %s\n", NCPath.c_str());
-		GFile ncFile(NCPath, NcFile::replace);
-
-		glog.logmsg("\nAdding the line index variable\n");
 		std::vector<size_t> count = D.linesamplecount();
-		ncFile.InitialiseNew(linenumbers, count);
+		order_lines(D, linenumbers, count);
+		if (Options.Shards > 0) {
+			restrict_to_shard(linenumbers, count);
+			if (linenumbers.size() == 0) {
+				glog.logmsg("Shard %zu has no lines, not writing %s\n", ShardIndex, OutPath.c_str());
+				if (exists(OutPath)) std::filesystem::remove(OutPath);
+				return true;
+			}
+		}
+
+		//With MPI only the writer rank opens the NetCDF file, the other ranks read and send lines to it.
+		//Shards are written whole by the rank converting them.
+		const bool shared = MPISize > 1 && Options.Shards == 0;
+		std::unique_ptr<GFile> ncFile;
+		if (MPIRank == 0 || shared == false) {
+			glog.logmsg("Creating NetCDF file: %s\n", OutPath.c_str());
+			ncFile = std::make_unique<GFile>(OutPath, NcFile::replace);
+
+			glog.logmsg("\nAdding the line index variable\n");
+			ncFile->InitialiseNew(linenumbers, count);
 
-		glog.logmsg("\nAdding global attributes\n");
-		add_global_attributes(ncFile);
+			glog.logmsg("\nAdding global attributes\n");
+			add_global_attributes(*ncFile);
+		}
+
+#ifdef ENABLE_MPI
+		if (shared) {
+			glog.logmsg("\nUsing %d MPI ranks with rank 0 writing\n", MPISize);
+			Writer = std::make_unique<cMPILineWriter>(MPI_COMM_WORLD, 0, ncFile.get());
+		}
+#endif
 
 		glog.logmsg("\nAdding groupby varaibles\n");
-		add_groupbyline_variables(ncFile, D);
+		add_groupbyline_variables(ncFile.get(), D);
+
+		prepare_footprints(D, linenumbers.size());
 
 		glog.logmsg("\nAdding indexed varaibles\n");
-		add_indexed_variables(ncFile, D);
+		add_indexed_variables(ncFile.get(), D);
 
+#ifdef ENABLE_MPI
+		Writer.reset();
+		if (FootprintX && shared) Footprints.mpi_gather(MPI_COMM_WORLD, 0);
+#endif
+		if (ncFile) {
+			if (FootprintX) {
+				glog.logmsg("\nAdding line bounding boxes and footprints\n");
+				Footprints.write(*ncFile, FootprintX->getName(), FootprintY->getName());
+			}
+			add_overview_variables(*ncFile);
+			add_bandmajor_variables(*ncFile);
+		}
 		glog.logmsg("\nConversion complete\n");
 		return true;
 	}
 
+	//The longitude and latitude fields, single band real indexed fields, false if there are none
+	bool find_coordinate_fields(ILDataset& D, ILField*& x, ILField*& y) {
+		auto find = [&](const std::vector<std::string>& candidates) -> ILField* {
+			for (const std::string& c : candidates) {
+				for (auto it = D.Fields.begin(); it != D.Fields.end(); ++it) {
+					if (it->isgroupbyline() || it->nbands() != 1) continue;
+					if (it->getType().isfloat() == false && it->getType().isdouble() == false) continue;
+					if (Options.isincluded(it->getName()) == false) continue;
+					if (tolower(it->getName()) == tolower(c)) return &(*it);
+				}
+			}
+			return nullptr;
+		};
+		x = find(cLineFootprints::xcandidates());
+		y = find(cLineFootprints::ycandidates());
+		return x != nullptr && y != nullptr;
+	}
+
+	//The NetCDF null of a segment of a coordinate field, after change_fillvalues()
+	static double coordinate_null(const ILSegment& S) {
+		return S.getType().isfloat() ? (double)defaultmissingvalue(ncFloat) : defaultmissingvalue(ncDouble);
+	}
+
+	//Rebuild the line numbers and counts in the requested output order and record where each input line goes.
+	//The Hilbert order needs the line centroids, from a pass over the coordinate fields (every MPISize-th line on each rank,
+	//unless writing shards, which each rank converts on its own).
+	void order_lines(ILDataset& D, std::vector<size_t>& linenumbers, std::vector<size_t>& count) {
+		const size_t nl = linenumbers.size();
+		const bool shared = MPISize > 1 && Options.Shards == 0;
+		std::vector<size_t> order(nl);
+		std::iota(order.begin(), order.end(), (size_t)0);
+		ILField* fx;
+		ILField* fy;
+		if (Options.LineOrder == eLineOrder::NUMBER) {
+			glog.logmsg("\nOrdering lines by line number\n");
+			order = number_line_order(linenumbers);
+		}
+		else if (Options.LineOrder == eLineOrder::HILBERT && HilbertOrder.size() == nl) {
+			order = HilbertOrder;
+		}
+		else if (Options.LineOrder == eLineOrder::HILBERT && find_coordinate_fields(D, fx, fy) == false) {
+			glog.logmsg("\nNo longitude and latitude fields to order the lines by, keeping the input order\n");
+		}
+		else if (Options.LineOrder == eLineOrder::HILBERT) {
+			glog.logmsg("\nOrdering lines along a Hilbert curve through their centroids\n");
+			cLineCentroids C(nl);
+			for (size_t li = shared ? (size_t)MPIRank : 0; li < nl; li += shared ? (size_t)MPISize : 1) {
+				ILSegment SX(*fx, li);
+				ILSegment SY(*fy, li);
+				if (SX.readbuffer() == false || SY.readbuffer() == false) continue;
+				change_fillvalues(SX);
+				change_fillvalues(SY);
+				std::vector<double> x;
+				std::vector<double> y;
+				SX.getband(x, 0);
+				SY.getband(y, 0);
+				C.add(li, x.data(), y.data(), std::min(x.size(), y.size()), coordinate_null(SX), coordinate_null(SY));
+			}
+#ifdef ENABLE_MPI
+			if (shared) C.mpi_allsum(MPI_COMM_WORLD);
+#endif
+			order = hilbert_line_order(C);
+			HilbertOrder = order;
+		}
+
+		std::vector<size_t> ln(nl);
+		std::vector<size_t> cn(nl);
+		for (size_t k = 0; k < nl; k++) {
+			ln[k] = linenumbers[order[k]];
+			cn[k] = count[order[k]];
+		}
+		OutIndex = invert_line_order(order);
+		OutStart.assign(nl, 0);
+		size_t start = 0;
+		for (size_t k = 0; k < nl; k++) {
+			OutStart[order[k]] = start;
+			start += cn[k];
+		}
+		linenumbers = ln;
+		count = cn;
+	}
+
+	//Keep only the output lines of the current shard, the other input lines are skipped
+	void restrict_to_shard(std::vector<size_t>& linenumbers, std::vector<size_t>& count) {
+		const size_t nl = linenumbers.size();
+		const size_t nsamples = std::accumulate(count.begin(), count.end(), (size_t)0);
+		size_t l0 = nl;
+		size_t l1 = nl;
+		size_t start = 0;
+		for (size_t k = 0; k < nl; k++) {
+			const size_t s = shard_of_line(start, nsamples, Options.Shards);
+			if (s == ShardIndex && l0 == nl) l0 = k;
+			if (s > ShardIndex) {
+				l1 = k;
+				break;
+			}
+			start += count[k];
+		}
+		if (l0 == nl) l1 = nl;
+
+		size_t firstsample = 0;
+		for (size_t k = 0; k < l0; k++) firstsample += count[k];
+		for (size_t li = 0; li < nl; li++) {
+			if (OutIndex[li] >= l0 && OutIndex[li] < l1) {
+				OutIndex[li] -= l0;
+				OutStart[li] -= firstsample;
+			}
+			else OutIndex[li] = OutStart[li] = SIZE_MAX;
+		}
+		glog.logmsg("Shard %zu has output lines %zu to %zu of %zu\n", ShardIndex, l0, l1, nl);
+		linenumbers = std::vector<size_t>(linenumbers.begin() + l0, linenumbers.begin() + l1);
+		count = std::vector<size_t>(count.begin() + l0, count.begin() + l1);
+	}
+
+	//Convert each of Options.Shards contiguous ranges of the output lines to its own file and tie them together with a manifest.
+	//With MPI each rank converts every MPISize-th shard by itself, so no parallel HDF5 is needed.
+	bool process_sharded() {
+		const size_t n = Options.Shards;
+		glog.logmsg("Writing %zu shards of %s\n", n, NCPath.c_str());
+		std::vector<std::string> paths;
+		for (size_t k = 0; k < n; k++) paths.push_back(shard_path(NCPath, k));
+		bool status = true;
+		for (size_t k = (size_t)MPIRank; k < n; k += (size_t)MPISize) {
+			ShardIndex = k;
+			OutPath = paths[k];
+			if (process() == false) status = false;
+		}
+#ifdef ENABLE_MPI
+		if (MPISize > 1) MPI_Barrier(MPI_COMM_WORLD);
+#endif
+		if (MPIRank == 0) {
+			const std::string manifest = shard_manifest_path(NCPath);
+			glog.logmsg("Writing shard manifest %s\n", manifest.c_str());
+			write_shard_manifest(manifest, paths);
+		}
+		return status;
+	}
+
+	//Choose the coordinate fields of the line footprints
+	void prepare_footprints(ILDataset& D, const size_t noutlines) {
+		FootprintX = FootprintY = nullptr;
+		if (Options.FootprintVertices == 0) return;
+		if (find_coordinate_fields(D, FootprintX, FootprintY) == false) {
+			glog.logmsg("No longitude and latitude fields for the line footprints\n");
+			FootprintX = FootprintY = nullptr;
+			return;
+		}
+		Footprints = cLineFootprints(noutlines, Options.FootprintVertices);
+		glog.logmsg("Line footprints from %s and %s\n", FootprintX->getName().c_str(), FootprintY->getName().c_str());
+	}
+
+	//The footprint of a line from its already read longitude segment and its latitude segment
+	void add_footprint(const ILSegment& SX, const size_t lineindex) {
+		ILSegment SY(*FootprintY, lineindex);
+		if (SY.readbuffer() == false) {
+			glog.logmsg("Warning 9: could not read buffer for line sequence number %zu in field %s, no footprint\n", lineindex, FootprintY->datasetpath().c_str());
+			return;
+		}
+		change_fillvalues(SY);
+		std::vector<double> x;
+		std::vector<double> y;
+		SX.getband(x, 0);
+		SY.getband(y, 0);
+		Footprints.add(OutIndex[lineindex], x.data(), y.data(), std::min(x.size(), y.size()), coordinate_null(SX), coordinate_null(SY));
+	}
+
+	//Write the decimated overview levels of the requested sample variables
+	void add_overview_variables(GFile& ncFile) {
+		if (Options.OverviewFactors.size() == 0) return;
+		std::vector<std::string> names;
+		for (const NcVar& v : ncFile.getAllVars()) {
+			if (ncFile.isSampleVar(v) == false || v.getName() == "line_index") continue;
+			if (Options.isoverview(v.getName()) == false) continue;
+			names.push_back(v.getName());
+		}
+		glog.logmsg("Adding %zu overview levels of %zu variables\n", Options.OverviewFactors.size(), names.size());
+		add_overviews(ncFile, names, Options.OverviewFactors);
+	}
+
+	//Write band-major copies of the requested multiband sample variables
+	void add_bandmajor_variables(GFile& ncFile) {
+		for (const NcVar& v : ncFile.getAllVars()) {
+			if (v.getDimCount() < 2 || ncFile.isSampleVar(v) == false) continue;
+			if (Options.isbandmajor(v.getName()) == false) continue;
+			glog.logmsg("Adding band-major copy of %s\n", v.getName().c_str());
+			add_bandmajor_variable(ncFile, v.getName());
+		}
+	}
+
+	bool owns(const size_t lineindex) const {
+		if (OutIndex[lineindex] == SIZE_MAX) return false;
+#ifdef ENABLE_MPI
+		if (Writer) return Writer->owns(lineindex);
+#endif
+		return true;
+	}
+
+	//Make all ranks agree with the status determined on the writer rank
+	bool agree(const bool status) {
+#ifdef ENABLE_MPI
+		if (Writer) return Writer->broadcast(status);
+#endif
+		return status;
+	}
+
+	//Called once the writer rank has defined a variable and before any rank puts data into it
+	void begin_variable() {
+#ifdef ENABLE_MPI
+		if (Writer) Writer->barrier();
+#endif
+	}
+
+	//Called when every rank has put all of its data for the current variable
+	void end_variable() {
+#ifdef ENABLE_MPI
+		if (Writer) {
+			Writer->flush();
+			if (Options.Statistics) Stats.mpi_merge(MPI_COMM_WORLD, 0);
+		}
+#endif
+	}
+
+	template<typename T>
+	void put(const std::string& varname, const NcVar& var, const std::vector<size_t>& startp, const std::vector<size_t>& countp, const T* data) {
+#ifdef ENABLE_MPI
+		if (Writer) {
+			Writer->put(varname, startp, countp, data);
+			return;
+		}
+#endif
+		var.putVar(startp, countp, data);
+	}
+
+	//Accumulate the statistics of the current variable from a [samples][bands] block with the NetCDF default fill value as null
+	template<typename T>
+	void accumulate(const std::vector<size_t>& countp, const T* data, const T null) {
+		if (Options.Statistics) Stats.add(data, countp[0], null);
+	}
+
+	void put(const std::string& varname, const NcVar& var, const std::vector<size_t>& startp, const std::vector<size_t>& countp, const IDataType& t, void* data) {
+		if (t.isubyte()) {
+			accumulate(countp, (const unsigned char*)data, defaultmissingvalue(ncUbyte));
+			put(varname, var, startp, countp, (const unsigned char*)data);
+		}
+		else if (t.isshort()) {
+			accumulate(countp, (const short*)data, defaultmissingvalue(ncShort));
+			put(varname, var, startp, countp, (const short*)data);
+		}
+		else if (t.isint()) {
+			accumulate(countp, (const int*)data, defaultmissingvalue(ncInt));
+			put(varname, var, startp, countp, (const int*)data);
+		}
+		else if (t.isfloat()) {
+			accumulate(countp, (const float*)data, defaultmissingvalue(ncFloat));
+			put(varname, var, startp, countp, (const float*)data);
+		}
+		else if (t.isdouble()) {
+			accumulate(countp, (const double*)data, defaultmissingvalue(ncDouble));
+			put(varname, var, startp, countp, (const double*)data);
+		}
+		else {
+			std::string msg = strprint("Error 12: Unsupported data type %s for variable %s\n", t.getName().c_str(), varname.c_str());
+			glog.logmsg(msg);
+			throw(std::runtime_error(msg));
+		}
+	}
+
 	NcType nc_datatype(const ILField& F)
 	{
 		if (F.getType().isubyte()) return NcType(ncUbyte);
@@ -179,11 +517,10 @@ public:
 		return true;
 	}
 
-	bool add_groupbyline_variables(GFile& ncFile, ILDataset& D)
+	bool add_groupbyline_variables(GFile* ncFile, ILDataset& D)
 	{
 		if (D.valid == false)return false;
 		size_t nlines = D.nlines();
-		NcDim  dim_line = ncFile.getDim(DN_LINE);
 
 		std::string linenumberfield;
 		D.getlinenumberfieldname(linenumberfield);
@@ -191,15 +528,17 @@ public:
 		for (auto it = D.Fields.begin(); it != D.Fields.end(); ++it) {
 			fi++;
 			ILField& F = *it;
+			//Deselected fields are skipped before anything of theirs is read
+			if (Options.isincluded(F.getName()) == false) continue;
 			if (F.isgroupbyline() == false) continue;
 			if (F.getName() == linenumberfield) continue;
 
-			if (tolower(F.getName()) == "rt") {
+			if (tolower(F.getName()) == "rt" && Options.isnamedinclude(F.getName()) == false) {
 				glog.logmsg("Warning 7: skipping field %s: this appears to be a RECORD_TYPE field\n", F.datafilepath().c_str());
 				continue;
 			}
 
-			if (tolower(F.getName()) == "fltline") {
+			if (tolower(F.getName()) == "fltline" && Options.isnamedinclude(F.getName()) == false) {
 				glog.logmsg("Warning 8: skipping field %s: this appears to be a GEOSOFT flight line field\n", F.datafilepath().c_str());
 				continue;
 			}
@@ -210,13 +549,6 @@ public:
 			}
 
 			glog.logmsg("Converting field %s\n", F.getName().c_str());
-			std::vector<NcDim> dims;
-			if (F.nbands() > 1) {
-				std::string dimname = "nbands_" + F.getName();
-				NcDim dim_band = ncFile.addDim(dimname, F.nbands());
-				dims.push_back(dim_band);
-			}
-
 			std::vector<int> vstringasint;
 			nc_type outdatatype = nc_datatype(F).getId();
 			if (F.getTypeId() == IDataType::ID::STRING) {
@@ -225,19 +557,36 @@ public:
 				glog.logmsg("Warning 5: Converting field %s: with STRING datatype to 'int' datatype\n", F.datafilepath().c_str());
 			}
 
-			bool status = ncFile.addLineVar(F.getName(), NcType(outdatatype), dims);
-			if (status == false) {
-				std::string msg = strprint("Error 9: Could not add variable %s\n", F.getName().c_str());
-				glog.logmsg(msg);
-				throw(std::exception(msg.c_str()));
+			GLineVar var;
+			if (ncFile) {
+				std::vector<NcDim> dims;
+				if (F.nbands() > 1) {
+					std::string dimname = "nbands_" + F.getName();
+					NcDim dim_band = ncFile->addDim(dimname, F.nbands());
+					dims.push_back(dim_band);
+				}
+
+				bool status = ncFile->addLineVar(F.getName(), NcType(outdatatype), dims);
+				if (status == false) {
+					std::string msg = strprint("Error 9: Could not add variable %s\n", F.getName().c_str());
+					glog.logmsg(msg);
+					throw(std::exception(msg.c_str()));
+				}
+				var = ncFile->getLineVar(F.getName());
+				set_compression(var, true, F.nbands());
+				quantize_variable(var);
 			}
+			Stats = cVariableStats(F.nbands());
+			begin_variable();
 
-			GLineVar var = ncFile.getLineVar(F.getName());
 			for (size_t li = 0; li < nlines; li++) {
+				if (owns(li) == false) continue;
 				ILSegment S(F, li);
 
 				if (S.readbuffer() == false) {
 					glog.logmsg("Error 8: could not read buffer for line sequence number %zu in field %s\n", li, F.getName().c_str());
+					//Other ranks would wait forever for this rank to finish the variable
+					if (MPISize > 1) throw(std::runtime_error(strprint("Error 8: on MPI rank %d\n", MPIRank)));
 					return false;
 				}
 				change_fillvalues(S);
@@ -246,25 +595,30 @@ public:
 				std::vector<size_t> countp(2);
 
 				//Point dimension
-				startp[0] = li;
+				startp[0] = OutIndex[li];
 				countp[0] = 1;
 
 				//Band dimension
 				startp[1] = 0;
 				countp[1] = S.nbands();
 				if (F.getTypeId() == IDataType::ID::STRING) {
-					var.putVar(startp, countp, (void*)&(vstringasint[li]));
+					put(F.getName(), var, startp, countp, &(vstringasint[li]));
 				}
 				else {
-					var.putVar(startp, countp, S.pvoid_groupby());
+					put(F.getName(), var, startp, countp, S.getType(), S.pvoid_groupby());
 				}
 			}
-			add_field_attributes(F, var);
+			end_variable();
+			if (ncFile) add_field_attributes(F, var);
+			if (ncFile && Options.Statistics && F.getTypeId() != IDataType::ID::STRING) {
+				if (Options.HistogramBins > 0) add_histogram(Stats, *ncFile, F.getName(), Options.HistogramBins);
+				Stats.write(var);
+			}
 		}
 		return true;
 	}
 
-	bool add_indexed_variables(GFile& ncFile, ILDataset& D)
+	bool add_indexed_variables(GFile* ncFile, ILDataset& D)
 	{
 		if (D.valid == false)return false;
 		size_t nlines = D.nlines();
@@ -273,9 +627,12 @@ public:
 		for (auto it = D.Fields.begin(); it != D.Fields.end(); ++it) {
 			fi++;
 			ILField& F = *it;
+			//Deselected fields are skipped before anything of theirs is read
+			if (Options.isincluded(F.getName()) == false) continue;
 			if (F.isgroupbyline() == true) continue;
 
-			if (ncFile.getVar(F.getName()).isNull() == false) {
+			bool varexists = ncFile ? (ncFile->getVar(F.getName()).isNull() == false) : false;
+			if (agree(varexists)) {
 				glog.logmsg("Warning 6: variable name %s already exists in this NC file - skipping field %s\n", F.getName().c_str(), F.datafilepath().c_str());
 				return false;
 			}
@@ -285,12 +642,12 @@ public:
 				continue;
 			}
 
-			if (tolower(F.getName()) == "rt") {
+			if (tolower(F.getName()) == "rt" && Options.isnamedinclude(F.getName()) == false) {
 				glog.logmsg("Warning 7: skipping field %s: this appears to be a RECORD_TYPE field\n", F.datafilepath().c_str());
 				continue;
 			}
 
-			if (tolower(F.getName()) == "fltline") {
+			if (tolower(F.getName()) == "fltline" && Options.isnamedinclude(F.getName()) == false) {
 				glog.logmsg("Warning 8: skipping field %s: this appears to be a GEOSOFT flight line field\n", F.datafilepath().c_str());
 				continue;
 			}
@@ -302,36 +659,46 @@ public:
 			}
 
 			glog.logmsg("Converting field %s\n", F.getName().c_str());
-			std::vector<NcDim> dims;
-			if (F.nbands() > 1) {
-				std::string dimname = "nbands_" + F.getName();
-				NcDim dim_band = ncFile.addDim(dimname, F.nbands());
-				dims.push_back(dim_band);
-			}
+			GSampleVar var;
+			if (ncFile) {
+				std::vector<NcDim> dims;
+				if (F.nbands() > 1) {
+					std::string dimname = "nbands_" + F.getName();
+					NcDim dim_band = ncFile->addDim(dimname, F.nbands());
+					dims.push_back(dim_band);
+				}
 
-			bool status = ncFile.addSampleVar(F.getName(), NcType(outdatatype), dims);
-			if (status == false) {
-				std::string msg = strprint("Error 9: Could not add variable %s\n", F.getName().c_str());
-				glog.logmsg(msg);
-				throw(std::exception(msg.c_str()));
+				bool status = ncFile->addSampleVar(F.getName(), NcType(outdatatype), dims);
+				if (status == false) {
+					std::string msg = strprint("Error 9: Could not add variable %s\n", F.getName().c_str());
+					glog.logmsg(msg);
+					throw(std::exception(msg.c_str()));
+				}
+				var = ncFile->getSampleVar(F.getName());
+				set_compression(var, false, F.nbands());
+				quantize_variable(var);
 			}
+			Stats = cVariableStats(F.nbands());
+			begin_variable();
 
-			GSampleVar var = ncFile.getSampleVar(F.getName());
-			size_t startindex = 0;
 			for (size_t li = 0; li < nlines; li++) {
+				if (owns(li) == false) continue;
 				ILSegment S(F, li);
 
 				if (S.readbuffer() == false) {
 					glog.logmsg("Error 10: could not read buffer for line sequence number %zu in field %s\n", li, F.datasetpath().c_str());
+					//Other ranks would wait forever for this rank to finish the variable
+					if (MPISize > 1) throw(std::runtime_error(strprint("Error 10: on MPI rank %d\n", MPIRank)));
 					return false;
 				}
 				change_fillvalues(S);
+				if (&F == FootprintX) add_footprint(S, li);
 
 				std::vector<size_t> startp(2);
 				std::vector<size_t> countp(2);
 
 				//Sample dimension
-				startp[0] = startindex;
+				startp[0] = OutStart[li];
 				countp[0] = S.nsamples();
 
 				//Band dimension
@@ -341,7 +708,7 @@ public:
 				if (F.getTypeId() == IDataType::ID::STRING) {
 					std::vector<int> vstringasint;
 					S.getband(vstringasint, 0);
-					var.putVar(startp, countp, (void*)vstringasint.data());
+					put(F.getName(), var, startp, countp, vstringasint.data());
 
 					//std::vector<std::string> svec;
 					//bool stat = S.getband(svec, 0);
@@ -352,11 +719,15 @@ public:
 					//var.putVar(startp, countp, p.data());
 				}
 				else {
-					var.putVar(startp, countp, S.pvoid());
+					put(F.getName(), var, startp, countp, S.getType(), S.pvoid());
 				}
-				startindex += S.nsamples();
 			}
-			add_field_attributes(F, var);
+			end_variable();
+			if (ncFile) add_field_attributes(F, var);
+			if (ncFile && Options.Statistics && F.getTypeId() != IDataType::ID::STRING) {
+				if (Options.HistogramBins > 0) add_histogram(Stats, *ncFile, F.getName(), Options.HistogramBins);
+				Stats.write(var);
+			}
 		}
 		return true;
 	}
@@ -399,30 +770,66 @@ public:
 		}
 	}
 
+	void set_compression(GVar& var, const bool islinevar, const size_t nbands) {
+		const sCompressionSetting* c = Options.Compression.get(var.getName(), islinevar, nbands);
+		if (c == nullptr) return;
+		if (c->apply(var)) glog.logmsg("Compressing %s with %s\n", var.getName().c_str(), c->str().c_str());
+		else glog.logmsg("Warning: could not compress %s with %s, the filter is not available in this NetCDF build\n", var.getName().c_str(), c->str().c_str());
+	}
+
+	//Apply the -quantize option, Intrepid fields have no declared precision so the digits must be given
+	void quantize_variable(GVar& var) {
+		const sQuantizeSpec* q = Options.quantizespec(var.getName());
+		if (q == nullptr) return;
+		const nc_type t = var.getType().getId();
+		if (t != NC_FLOAT && t != NC_DOUBLE) return;
+		if (q->nsd <= 0) {
+			glog.logmsg("Warning: not quantizing %s, give the number of significant digits e.g. -quantize %s=%s:3\n", var.getName().c_str(), var.getName().c_str(), q->mode.c_str());
+			return;
+		}
+		if (set_quantize(var, q->mode, q->nsd)) {
+			glog.logmsg("Quantizing %s with %s to %d significant digits\n", var.getName().c_str(), q->mode.c_str(), q->nsd);
+		}
+		else {
+			glog.logmsg("Warning: could not quantize %s, requires NetCDF 4.9 or later\n", var.getName().c_str());
+		}
+	}
+
 	bool add_global_attributes(GFile& ncFile) {
 
 		ncFile.putAtt("CreationTime", timestamp());
 		ncFile.putAtt("CreationMethod", "intrepid2netcdf.exe");
 		ncFile.putAtt("IntrepidSourceDataset", IntrepiDatabasePath);
+		size_t n = Options.put_metadata_attributes(ncFile, IntrepiDatabasePath);
+		if (n > 0) glog.logmsg("Added %zu metadata attributes\n", n);
 		return true;
 	}
 };
 
 int main(int argc, char** argv)
 {
+#ifdef ENABLE_MPI
+	MPI_Init(&argc, &argv);
+#endif
 	std::string cmdl = commandlinestring(argc, argv);
 	try
 	{
-		if (argc == 3) {
-			std::string dbname = argv[1];
-			std::string ncname = argv[2];
-			cIntrepidToNetCDFConverter C(dbname, ncname, cmdl);
+		cConversionOptions options;
+		std::vector<std::string> args = options.parse(argc, argv);
+		options.loadmetadata();
+		if (options.Compression.Auto) {
+			std::cout << "Warning: -autocompress is not supported by intrepid2netcdf, using the -compress settings" << std::endl;
+		}
+		if (args.size() == 2) {
+			std::string dbname = args[0];
+			std::string ncname = args[1];
+			cIntrepidToNetCDFConverter C(dbname, ncname, cmdl, options);
 			glog.logmsg("Finished\n");
 		}
-		else if (argc == 4) {
-			std::string dbdir = argv[1];
-			std::string ncdir = argv[2];
-			std::string listfile = argv[3];
+		else if (args.size() == 3) {
+			std::string dbdir = args[0];
+			std::string ncdir = args[1];
+			std::string listfile = args[2];
 			std::ifstream file(listfile);
 			addtrailingseparator(dbdir);
 			addtrailingseparator(ncdir);
@@ -435,25 +842,35 @@ int main(int argc, char** argv)
 					std::string dbname = dbdir + fpp.directory + fpp.prefix;
 					std::string ncname = ncdir + fpp.directory + fpp.prefix + ".nc";
 					std::cout << dbname << " " << ncname << std::endl << std::flush;
-					cIntrepidToNetCDFConverter C(dbname, ncname, cmdl);
+					cIntrepidToNetCDFConverter C(dbname, ncname, cmdl, options);
 				}
 			}
 		}
 		else {
-			std::cout << "Usage: " << extractfilename(argv[0]) << " input_database output_ncfile" << std::endl;
-			std::cout << "   or: " << extractfilename(argv[0]) << " databases_dir ncfiles_dir list_of_databases.txt" << std::endl;
+			std::cout << "Usage: " << extractfilename(argv[0]) << " [options] input_database output_ncfile" << std::endl;
+			std::cout << "   or: " << extractfilename(argv[0]) << " [options] databases_dir ncfiles_dir list_of_databases.txt" << std::endl;
+			cConversionOptions::usage();
 		}
 	}
 	catch (NcException& e)
 	{
 		std::cout << e.what() << std::endl;
+#ifdef ENABLE_MPI
+		MPI_Abort(MPI_COMM_WORLD, 1);
+#endif
 		return 1;
 	}
 	catch (std::exception& e)
 	{
 		std::cout << e.what() << std::endl;
+#ifdef ENABLE_MPI
+		MPI_Abort(MPI_COMM_WORLD, 1);
+#endif
 		return 1;
 	}
+#ifdef ENABLE_MPI
+	MPI_Finalize();
+#endif
 	return 0;
 }
 
@@ -0,0 +1,165 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _line_index_H
+#define _line_index_H
+
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
+
+#include "general_utils.h"
+
+//Line index of a survey (the line number, and the start and count of the samples, of each line) with 64 bit
+//sample offsets, held in a compact delta encoded form. Each line is stored as the zigzag encoded difference of
+//its line number from the previous line's and its sample count, both as variable length (LEB128) integers,
+//i.e. typically 2-4 bytes per line. The absolute start, line number and byte position are checkpointed every
+//BLOCK lines, so random access decodes at most BLOCK lines and sequential access decodes each line once.
+class cCompactLineIndex {
+
+	static constexpr size_t BLOCK = 64;
+
+	struct sCheckpoint {
+		uint64_t start;
+		int64_t linenumber;
+		size_t pos;
+	};
+
+	std::vector<uint8_t> Bytes;
+	std::vector<sCheckpoint> Checkpoints;
+	size_t NumLines = 0;
+	uint64_t NumSamples = 0;
+	int64_t LastLineNumber = 0;
+
+	//Decoding position after the most recently accessed line, for sequential access
+	mutable size_t CursorLine = (size_t)-1;
+	mutable size_t CursorPos = 0;
+	mutable uint64_t CursorStart = 0;
+	mutable int64_t CursorLineNumber = 0;
+
+	static void putvarint(std::vector<uint8_t>& b, uint64_t v) {
+		while (v >= 0x80) {
+			b.push_back((uint8_t)(v | 0x80));
+			v >>= 7;
+		}
+		b.push_back((uint8_t)v);
+	}
+
+	uint64_t getvarint(size_t& pos) const {
+		uint64_t v = 0;
+		int shift = 0;
+		while (true) {
+			const uint8_t c = Bytes[pos++];
+			v |= (uint64_t)(c & 0x7f) << shift;
+			if ((c & 0x80) == 0) return v;
+			shift += 7;
+		}
+	}
+
+	static uint64_t zigzag(const int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+	static int64_t unzigzag(const uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+public:
+
+	void clear() {
+		Bytes.clear();
+		Checkpoints.clear();
+		NumLines = 0;
+		NumSamples = 0;
+		LastLineNumber = 0;
+		CursorLine = (size_t)-1;
+	}
+
+	void reserve(const size_t nlines) {
+		Bytes.reserve(nlines * 3);
+		Checkpoints.reserve(nlines / BLOCK + 1);
+	}
+
+	//Append the next line
+	void add(const int64_t linenumber, const uint64_t count) {
+		if (NumLines % BLOCK == 0) {
+			Checkpoints.push_back({ NumSamples, linenumber, Bytes.size() });
+			LastLineNumber = linenumber;
+		}
+		putvarint(Bytes, zigzag(linenumber - LastLineNumber));
+		putvarint(Bytes, count);
+		LastLineNumber = linenumber;
+		NumSamples += count;
+		NumLines++;
+	}
+
+	size_t nlines() const { return NumLines; }
+
+	uint64_t nsamples() const { return NumSamples; }
+
+	//Memory used by the encoded index
+	size_t nbytes() const { return Bytes.capacity() + Checkpoints.capacity() * sizeof(sCheckpoint); }
+
+	void get(const size_t lineindex, int64_t& linenumber, uint64_t& start, uint64_t& count) const {
+		if (lineindex >= NumLines) {
+			throw(std::runtime_error(_SRC_ + strprint("Line index %zu is out of range\n", lineindex)));
+		}
+		size_t li;
+		if (CursorLine != (size_t)-1 && lineindex > CursorLine && lineindex / BLOCK == CursorLine / BLOCK) {
+			li = CursorLine + 1;
+		}
+		else {
+			const sCheckpoint& cp = Checkpoints[lineindex / BLOCK];
+			li = (lineindex / BLOCK) * BLOCK;
+			CursorPos = cp.pos;
+			CursorStart = cp.start;
+			CursorLineNumber = cp.linenumber;
+		}
+		for (; ; li++) {
+			CursorLineNumber += unzigzag(getvarint(CursorPos));
+			const uint64_t c = getvarint(CursorPos);
+			if (li == lineindex) {
+				linenumber = CursorLineNumber;
+				start = CursorStart;
+				count = c;
+				CursorStart += c;
+				CursorLine = li;
+				return;
+			}
+			CursorStart += c;
+		}
+	}
+
+	int64_t linenumber(const size_t lineindex) const {
+		int64_t ln; uint64_t s, c;
+		get(lineindex, ln, s, c);
+		return ln;
+	}
+
+	uint64_t start(const size_t lineindex) const {
+		int64_t ln; uint64_t s, c;
+		get(lineindex, ln, s, c);
+		return s;
+	}
+
+	uint64_t count(const size_t lineindex) const {
+		int64_t ln; uint64_t s, c;
+		get(lineindex, ln, s, c);
+		return c;
+	}
+
+	//Expand into the plain vectors used by GFile::InitialiseNew()
+	template<typename T>
+	void decode(std::vector<T>& linenumbers, std::vector<T>& counts) const {
+		linenumbers.resize(NumLines);
+		counts.resize(NumLines);
+		for (size_t li = 0; li < NumLines; li++) {
+			int64_t ln; uint64_t s, c;
+			get(li, ln, s, c);
+			linenumbers[li] = (T)ln;
+			counts[li] = (T)c;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,139 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _line_order_H
+#define _line_order_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef ENABLE_MPI
+#include "mpi.h"
+#endif
+
+#include "general_utils.h"
+
+//The order the converters write the lines in. SOURCE keeps the input order, NUMBER sorts by line number
+//and HILBERT sorts by the position of each line's centroid along a Hilbert curve over the survey, so
+//lines that are close on the ground are close in the file and spatial windows read fewer chunks.
+enum class eLineOrder { SOURCE, NUMBER, HILBERT };
+
+inline eLineOrder parse_line_order(const std::string& s) {
+	if (tolower(s) == "source") return eLineOrder::SOURCE;
+	if (tolower(s) == "number") return eLineOrder::NUMBER;
+	if (tolower(s) == "hilbert") return eLineOrder::HILBERT;
+	throw(std::runtime_error(_SRC_ + strprint("Unknown line order %s (use source, number or hilbert)\n", s.c_str())));
+}
+
+//Distance of cell (x, y) along the Hilbert curve filling a 2^order by 2^order grid
+inline uint64_t hilbert_index(uint32_t x, uint32_t y, const int order) {
+	uint64_t d = 0;
+	for (uint32_t s = 1u << (order - 1); s > 0; s >>= 1) {
+		const uint32_t rx = (x & s) ? 1 : 0;
+		const uint32_t ry = (y & s) ? 1 : 0;
+		d += (uint64_t)s * (uint64_t)s * ((3 * rx) ^ ry);
+		//Rotate the quadrant
+		if (ry == 0) {
+			if (rx == 1) {
+				x = s - 1 - (x & (s - 1));
+				y = s - 1 - (y & (s - 1));
+			}
+			std::swap(x, y);
+		}
+	}
+	return d;
+}
+
+//Running coordinate sums of each line, for the centroids
+class cLineCentroids {
+
+	std::vector<double> Sum;//x, y, n per line
+
+public:
+
+	cLineCentroids(const size_t nlines = 0) : Sum(3 * nlines, 0.0) {}
+
+	size_t nlines() const { return Sum.size() / 3; }
+
+	template<typename T>
+	void add(const size_t lineindex, const T* x, const T* y, const size_t nsamples, const T xnull, const T ynull) {
+		double* s = &Sum[3 * lineindex];
+		for (size_t k = 0; k < nsamples; k++) {
+			if (x[k] == xnull || y[k] == ynull) continue;
+			if (x[k] != x[k] || y[k] != y[k]) continue;
+			s[0] += (double)x[k];
+			s[1] += (double)y[k];
+			s[2] += 1.0;
+		}
+	}
+
+#ifdef ENABLE_MPI
+	//Combine the lines summed on each rank so every rank has all centroids (collective)
+	void mpi_allsum(MPI_Comm comm) {
+		MPI_Allreduce(MPI_IN_PLACE, Sum.data(), (int)Sum.size(), MPI_DOUBLE, MPI_SUM, comm);
+	}
+#endif
+
+	bool valid(const size_t li) const { return Sum[3 * li + 2] > 0.0; }
+	double x(const size_t li) const { return Sum[3 * li] / Sum[3 * li + 2]; }
+	double y(const size_t li) const { return Sum[3 * li + 1] / Sum[3 * li + 2]; }
+};
+
+//Source line indices in Hilbert order of their centroids, lines without coordinates last in source order
+inline std::vector<size_t> hilbert_line_order(const cLineCentroids& c) {
+	const size_t nl = c.nlines();
+	double xmin = 0.0, ymin = 0.0, xmax = 0.0, ymax = 0.0;
+	bool any = false;
+	for (size_t li = 0; li < nl; li++) {
+		if (c.valid(li) == false) continue;
+		xmin = any ? std::min(xmin, c.x(li)) : c.x(li);
+		xmax = any ? std::max(xmax, c.x(li)) : c.x(li);
+		ymin = any ? std::min(ymin, c.y(li)) : c.y(li);
+		ymax = any ? std::max(ymax, c.y(li)) : c.y(li);
+		any = true;
+	}
+
+	//A square grid so the curve is not stretched along the longer side of the survey
+	const int order = 16;
+	const double ncells = (double)(1u << order);
+	const double size = std::max(std::max(xmax - xmin, ymax - ymin), 1e-12);
+	std::vector<uint64_t> key(nl, UINT64_MAX);
+	for (size_t li = 0; li < nl; li++) {
+		if (c.valid(li) == false) continue;
+		const uint32_t ix = (uint32_t)std::min(ncells - 1.0, std::floor((c.x(li) - xmin) / size * ncells));
+		const uint32_t iy = (uint32_t)std::min(ncells - 1.0, std::floor((c.y(li) - ymin) / size * ncells));
+		key[li] = hilbert_index(ix, iy, order);
+	}
+	std::vector<size_t> o(nl);
+	std::iota(o.begin(), o.end(), (size_t)0);
+	std::stable_sort(o.begin(), o.end(), [&](const size_t a, const size_t b) { return key[a] < key[b]; });
+	return o;
+}
+
+//Source line indices in ascending line number order
+template<typename T>
+std::vector<size_t> number_line_order(const std::vector<T>& linenumbers) {
+	std::vector<size_t> o(linenumbers.size());
+	std::iota(o.begin(), o.end(), (size_t)0);
+	std::stable_sort(o.begin(), o.end(), [&](const size_t a, const size_t b) { return linenumbers[a] < linenumbers[b]; });
+	return o;
+}
+
+//Output position of each source line, the inverse of an order
+inline std::vector<size_t> invert_line_order(const std::vector<size_t>& order) {
+	std::vector<size_t> inv(order.size());
+	for (size_t k = 0; k < order.size(); k++) inv[order[k]] = k;
+	return inv;
+}
+
+#endif
@@ -0,0 +1,358 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _linecache_H
+#define _linecache_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <chrono>
+#include <typeinfo>
+#include <algorithm>
+#include <stdexcept>
+
+#include "general_utils.h"
+#include "geophysics_netcdf.hpp"
+#include "ncvar_utils.h"
+
+//Read cache for line by line access to the sample (and line) variables of a geophysics NetCDF file.
+//Variables are read in blocks that are aligned with their chunks along the point (or line) dimension,
+//so each chunk is only decompressed once however many lines it spans.
+//Blocks are kept in a least recently used list within a byte budget.
+//When a variable is being read in line order, the blocks ahead are read asynchronously.
+//The read ahead uses the file on another thread, serialised only with the cache's own reads, so while a cache
+//exists the file must not be used directly (e.g. getVar, getLineNumbers or inquiries) without calling wait() first.
+//
+//Typical use:
+//	cLineCache C(ncfile, 256 * 1024 * 1024);
+//	for (size_t li = 0; li < ncfile.nlines(); li++) C.getLine("conductivity", li, v);
+class cLineCache {
+
+	struct sKey {
+		std::string varname;
+		size_t type;
+		size_t block;
+		bool operator<(const sKey& k) const {
+			if (varname != k.varname) return varname < k.varname;
+			if (type != k.type) return type < k.type;
+			return block < k.block;
+		}
+	};
+
+	struct sBlock {
+		std::shared_ptr<void> data;//std::vector<T>
+		size_t bytes = 0;
+		size_t first = 0;//index along the first dimension of the first record in the block
+		size_t count = 0;//number of records in the block
+	};
+
+	struct sVarInfo {
+		netCDF::NcVar var;
+		bool islinevar = false;
+		size_t nrecords = 0;//size of the first dimension
+		size_t nbands = 1;//number of values per record
+		size_t blocklength = 0;//records per block
+		std::vector<size_t> dimsizes;
+		size_t lastline = (size_t)-1;
+	};
+
+	typedef std::list<sKey> cLRUList;
+	struct sEntry {
+		sBlock block;
+		cLRUList::iterator lru;
+	};
+
+	const GeophysicsNetCDF::GFile& File;
+	size_t BudgetBytes = 0;
+	size_t PrefetchBlocks = 2;
+	size_t DefaultBlockBytes = 4194304;//used for contiguous variables
+	std::vector<size_t> LineStart;
+	std::vector<size_t> LineCount;
+
+	std::map<std::string, sVarInfo> Vars;
+	std::map<sKey, sEntry> Cache;
+	std::map<sKey, std::shared_future<sBlock>> InFlight;
+	cLRUList LRU;
+	size_t CachedBytes = 0;
+
+	std::mutex CacheMutex;//guards Cache, LRU and InFlight
+	std::mutex NcMutex;//the netCDF/HDF5 libraries are not thread safe
+
+	size_t NumHits = 0;
+	size_t NumMisses = 0;
+	size_t NumPrefetched = 0;
+
+	sVarInfo& varinfo(const std::string& varname) {
+		auto it = Vars.find(varname);
+		if (it != Vars.end()) return it->second;
+
+		sVarInfo vi;
+		{
+			std::lock_guard<std::mutex> lock(NcMutex);
+			vi.var = File.getVar(varname);
+			if (vi.var.isNull()) {
+				throw(std::runtime_error(_SRC_ + strprint("Variable %s does not exist\n", varname.c_str())));
+			}
+			vi.islinevar = File.isLineVar(vi.var);
+			if (vi.islinevar == false && File.isSampleVar(vi.var) == false) {
+				throw(std::runtime_error(_SRC_ + strprint("Variable %s is neither a line nor a sample variable\n", varname.c_str())));
+			}
+
+			std::vector<netCDF::NcDim> dims = vi.var.getDims();
+			for (size_t i = 0; i < dims.size(); i++) {
+				vi.dimsizes.push_back(dims[i].getSize());
+				if (i > 0) vi.nbands *= dims[i].getSize();
+			}
+			vi.nrecords = vi.dimsizes[0];
+
+			netCDF::NcVar::ChunkMode mode;
+			std::vector<size_t> chunks;
+			vi.var.getChunkingParameters(mode, chunks);
+			if (mode == netCDF::NcVar::nc_CHUNKED && chunks.size() > 0 && chunks[0] > 0) {
+				vi.blocklength = chunks[0];
+			}
+			else {
+				const size_t recordbytes = vi.nbands * vi.var.getType().getSize();
+				vi.blocklength = std::max((size_t)1, DefaultBlockBytes / std::max((size_t)1, recordbytes));
+			}
+		}
+		return Vars.emplace(varname, vi).first->second;
+	}
+
+	template<typename T>
+	sBlock readblock(const sVarInfo& vi, const size_t block) {
+		sBlock b;
+		b.first = block * vi.blocklength;
+		b.count = std::min(vi.blocklength, vi.nrecords - b.first);
+		std::vector<size_t> startp(vi.dimsizes.size(), 0);
+		std::vector<size_t> countp = vi.dimsizes;
+		startp[0] = b.first;
+		countp[0] = b.count;
+
+		auto data = std::make_shared<std::vector<T>>(b.count * vi.nbands);
+		{
+			std::lock_guard<std::mutex> lock(NcMutex);
+			vi.var.getVar(startp, countp, data->data());
+		}
+		b.bytes = data->size() * sizeof(T);
+		b.data = data;
+		return b;
+	}
+
+	//Must be called with CacheMutex held
+	void insert(const sKey& key, const sBlock& b) {
+		if (Cache.find(key) != Cache.end()) return;
+		LRU.push_front(key);
+		Cache.emplace(key, sEntry{ b, LRU.begin() });
+		CachedBytes += b.bytes;
+		//Keep at least the block just inserted, even if it alone exceeds the budget
+		while (CachedBytes > BudgetBytes && LRU.size() > 1) {
+			auto it = Cache.find(LRU.back());
+			CachedBytes -= it->second.block.bytes;
+			Cache.erase(it);
+			LRU.pop_back();
+		}
+	}
+
+	//Move completed read ahead blocks into the cache, must be called with CacheMutex held.
+	//A read ahead that failed is dropped before its exception is rethrown, so it is not rethrown by every later lookup.
+	void collect() {
+		for (auto it = InFlight.begin(); it != InFlight.end();) {
+			if (it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+				std::shared_future<sBlock> f = it->second;
+				const sKey key = it->first;
+				it = InFlight.erase(it);
+				insert(key, f.get());
+			}
+			else ++it;
+		}
+	}
+
+	template<typename T>
+	sBlock getblock(const std::string& varname, const sVarInfo& vi, const size_t block) {
+		sKey key{ varname, typeid(T).hash_code(), block };
+		std::shared_future<sBlock> pending;
+		{
+			std::lock_guard<std::mutex> lock(CacheMutex);
+			collect();
+			auto it = Cache.find(key);
+			if (it != Cache.end()) {
+				LRU.splice(LRU.begin(), LRU, it->second.lru);
+				NumHits++;
+				return it->second.block;
+			}
+			auto fit = InFlight.find(key);
+			if (fit != InFlight.end()) {
+				pending = fit->second;
+				NumHits++;
+			}
+			else {
+				NumMisses++;
+			}
+		}
+
+		sBlock b;
+		try {
+			b = pending.valid() ? pending.get() : readblock<T>(vi, block);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(CacheMutex);
+			InFlight.erase(key);
+			throw;
+		}
+		std::lock_guard<std::mutex> lock(CacheMutex);
+		InFlight.erase(key);
+		insert(key, b);
+		return b;
+	}
+
+	template<typename T>
+	void prefetch(const std::string& varname, const sVarInfo& vi, const size_t fromblock) {
+		const size_t nblocks = (vi.nrecords + vi.blocklength - 1) / vi.blocklength;
+		for (size_t k = 0; k < PrefetchBlocks; k++) {
+			const size_t block = fromblock + k;
+			if (block >= nblocks) break;
+			//Do not prefetch more than the budget can hold alongside the blocks in use
+			if ((k + 2) * vi.blocklength * vi.nbands * sizeof(T) > BudgetBytes) break;
+
+			sKey key{ varname, typeid(T).hash_code(), block };
+			std::lock_guard<std::mutex> lock(CacheMutex);
+			if (Cache.find(key) != Cache.end() || InFlight.find(key) != InFlight.end()) continue;
+			const sVarInfo* pvi = &vi;
+			std::shared_future<sBlock> f = std::async(std::launch::async, [this, pvi, block]() {
+				return readblock<T>(*pvi, block);
+			}).share();
+			InFlight.emplace(key, f);
+			NumPrefetched++;
+		}
+	}
+
+	//Copy records [first, first+count) of a variable into v, band bi only if bi >= 0
+	template<typename T>
+	void gather(const std::string& varname, const size_t first, const size_t count, const long long bi, std::vector<T>& v) {
+		sVarInfo& vi = varinfo(varname);
+		if (first + count > vi.nrecords) {
+			throw(std::runtime_error(_SRC_ + strprint("Records %zu to %zu are out of range for variable %s\n", first, first + count, varname.c_str())));
+		}
+		if (bi >= (long long)vi.nbands) {
+			throw(std::runtime_error(_SRC_ + strprint("Band %lld is out of range for variable %s\n", bi, varname.c_str())));
+		}
+
+		const size_t nb = vi.nbands;
+		v.resize(bi >= 0 ? count : count * nb);
+		size_t r = first;
+		const size_t end = first + count;
+		size_t lastblock = first / vi.blocklength;
+		while (r < end) {
+			const size_t block = r / vi.blocklength;
+			lastblock = block;
+			sBlock b = getblock<T>(varname, vi, block);
+			const std::vector<T>& d = *std::static_pointer_cast<std::vector<T>>(b.data);
+			const size_t n = std::min(end, b.first + b.count) - r;
+			const size_t o = r - b.first;
+			if (bi >= 0) {
+				for (size_t i = 0; i < n; i++) v[r - first + i] = d[(o + i) * nb + (size_t)bi];
+			}
+			else {
+				std::memcpy(v.data() + (r - first) * nb, d.data() + o * nb, n * nb * sizeof(T));
+			}
+			r += n;
+		}
+
+		if (PrefetchBlocks > 0) {
+			prefetch<T>(varname, vi, lastblock + 1);
+		}
+	}
+
+	template<typename T>
+	void getlinerecords(const std::string& varname, const size_t lineindex, const long long bi, std::vector<T>& v) {
+		if (lineindex >= LineStart.size()) {
+			throw(std::runtime_error(_SRC_ + strprint("Line index %zu is out of range\n", lineindex)));
+		}
+		sVarInfo& vi = varinfo(varname);
+		const bool sequential = (lineindex == vi.lastline + 1);
+		vi.lastline = lineindex;
+
+		//Only read ahead once a sequential scan has been detected
+		const size_t prefetchblocks = PrefetchBlocks;
+		if (sequential == false) PrefetchBlocks = 0;
+		if (vi.islinevar) gather(varname, lineindex, 1, bi, v);
+		else gather(varname, LineStart[lineindex], LineCount[lineindex], bi, v);
+		PrefetchBlocks = prefetchblocks;
+	}
+
+public:
+
+	cLineCache(const GeophysicsNetCDF::GFile& file, const size_t budgetbytes = 268435456, const size_t prefetchblocks = 2)
+		: File(file)
+	{
+		BudgetBytes = budgetbytes;
+		PrefetchBlocks = prefetchblocks;
+		get_line_index(File, LineStart, LineCount);
+	}
+
+	~cLineCache() {
+		wait();
+	}
+
+	//Wait for any outstanding read ahead to complete, after which the file may be used directly until the next lookup
+	void wait() {
+		std::vector<std::shared_future<sBlock>> f;
+		{
+			std::lock_guard<std::mutex> lock(CacheMutex);
+			for (auto& [key, fut] : InFlight) f.push_back(fut);
+		}
+		for (auto& fut : f) fut.wait();
+	}
+
+	void clear() {
+		wait();
+		std::lock_guard<std::mutex> lock(CacheMutex);
+		InFlight.clear();
+		Cache.clear();
+		LRU.clear();
+		CachedBytes = 0;
+	}
+
+	void setbudget(const size_t budgetbytes) { BudgetBytes = budgetbytes; }
+	void setprefetch(const size_t prefetchblocks) { PrefetchBlocks = prefetchblocks; }
+	size_t budget() const { return BudgetBytes; }
+	size_t cachedbytes() const { return CachedBytes; }
+	size_t nhits() const { return NumHits; }
+	size_t nmisses() const { return NumMisses; }
+	size_t nprefetched() const { return NumPrefetched; }
+
+	//All bands of all samples of a line, same layout as GSampleVar::getLine()
+	//For a line variable it is the value(s) of the line
+	template<typename T>
+	bool getLine(const std::string& varname, const size_t lineindex, std::vector<T>& v) {
+		getlinerecords(varname, lineindex, -1, v);
+		return true;
+	}
+
+	//One band of all samples of a line, same layout as GSampleVar::getLineBand()
+	template<typename T>
+	bool getLineBand(const std::string& varname, const size_t lineindex, const size_t bandindex, std::vector<T>& v) {
+		getlinerecords(varname, lineindex, (long long)bandindex, v);
+		return true;
+	}
+
+	//Same as GFile::getDataByLineIndex() for single band variables
+	template<typename T>
+	bool getDataByLineIndex(const std::string& varname, const size_t lineindex, std::vector<T>& v) {
+		return getLine(varname, lineindex, v);
+	}
+};
+
+#endif
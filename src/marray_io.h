@@ -0,0 +1,162 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _marray_io_H
+#define _marray_io_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdexcept>
+
+#include "marray.hxx"
+#include "general_utils.h"
+#include "geophysics_netcdf.hpp"
+#include "ncvar_utils.h"
+
+//Line and band reads and writes directly into caller owned andres::Marray arrays and (strided) views.
+//The view's element strides are passed to NetCDF as the memory map (imap), so the data lands in place
+//without an intermediate std::vector or per sample row allocations, whatever the view's coordinate order.
+//
+//Typical use:
+//	cMarrayLineIO IO(ncfile);
+//	andres::Marray<float> em;
+//	for (size_t li = 0; li < ncfile.nlines(); li++) IO.getLine("em", li, em);//em is [nsamples][nwindows]
+class cMarrayLineIO {
+
+	const GeophysicsNetCDF::GFile& File;
+	std::vector<size_t> LineStart;
+	std::vector<size_t> LineCount;
+
+	//Start and count of one line of a variable, all bands
+	void line_extent(const netCDF::NcVar& var, const size_t lineindex, std::vector<size_t>& start, std::vector<size_t>& count) const {
+		if (lineindex >= LineStart.size()) {
+			throw(std::runtime_error(_SRC_ + strprint("Line index %zu is out of range\n", lineindex)));
+		}
+		const std::vector<netCDF::NcDim> dims = var.getDims();
+		start.assign(dims.size(), 0);
+		count.resize(dims.size());
+		for (size_t di = 0; di < dims.size(); di++) count[di] = dims[di].getSize();
+		if (File.isLineVar(var)) {
+			start[0] = lineindex;
+			count[0] = 1;
+		}
+		else {
+			start[0] = LineStart[lineindex];
+			count[0] = LineCount[lineindex];
+		}
+	}
+
+	template<typename T, bool isConst, typename A>
+	static std::vector<ptrdiff_t> imap(const andres::View<T, isConst, A>& v, const netCDF::NcVar& var, const std::vector<size_t>& count) {
+		if (v.dimension() != count.size()) {
+			throw(std::runtime_error(_SRC_ + strprint("Variable %s has %zu dimensions but the view has %zu\n", var.getName().c_str(), count.size(), (size_t)v.dimension())));
+		}
+		std::vector<ptrdiff_t> m(count.size());
+		for (size_t di = 0; di < count.size(); di++) {
+			if (v.shape(di) != count[di]) {
+				throw(std::runtime_error(_SRC_ + strprint("Variable %s needs extent %zu in dimension %zu but the view has %zu\n", var.getName().c_str(), count[di], di, (size_t)v.shape(di))));
+			}
+			m[di] = (ptrdiff_t)v.strides(di);
+		}
+		return m;
+	}
+
+	netCDF::NcVar getvar(const std::string& varname) const {
+		netCDF::NcVar var = File.getVar(varname);
+		if (var.isNull()) {
+			throw(std::runtime_error(_SRC_ + strprint("Variable %s does not exist\n", varname.c_str())));
+		}
+		return var;
+	}
+
+public:
+
+	cMarrayLineIO(const GeophysicsNetCDF::GFile& ncfile) : File(ncfile) {
+		get_line_index(File, LineStart, LineCount);
+	}
+
+	//Shape of one line of a variable, i.e. [nsamples][nbands...] or [1][nbands...] for a line variable
+	std::vector<size_t> lineshape(const std::string& varname, const size_t lineindex) const {
+		std::vector<size_t> start, count;
+		line_extent(getvar(varname), lineindex, start, count);
+		return count;
+	}
+
+	//Read a line into an array, which is only reallocated if its shape changes
+	template<typename T, typename A>
+	void getLine(const std::string& varname, const size_t lineindex, andres::Marray<T, A>& a) const {
+		const std::vector<size_t> shape = lineshape(varname, lineindex);
+		bool reshape = (a.dimension() != shape.size());
+		for (size_t di = 0; reshape == false && di < shape.size(); di++) {
+			if (a.shape(di) != shape[di]) reshape = true;
+		}
+		if (reshape) a.resize(shape.begin(), shape.end());
+		getLine(varname, lineindex, (const andres::View<T, false, A>&)a);
+	}
+
+	//Read a line into a view that already has the line's shape, e.g. a slice of a larger array
+	template<typename T, typename A>
+	void getLine(const std::string& varname, const size_t lineindex, const andres::View<T, false, A>& v) const {
+		netCDF::NcVar var = getvar(varname);
+		std::vector<size_t> start, count;
+		line_extent(var, lineindex, start, count);
+		const std::vector<ptrdiff_t> stride(count.size(), 1);
+		var.getVar(start, count, stride, imap(v, var, count), &v(0));
+	}
+
+	//Read one band of a 2D sample variable into a 1D view of length nsamples
+	template<typename T, typename A>
+	void getLineBand(const std::string& varname, const size_t lineindex, const size_t bandindex, const andres::View<T, false, A>& v) const {
+		netCDF::NcVar var = getvar(varname);
+		std::vector<size_t> start, count;
+		line_extent(var, lineindex, start, count);
+		if (count.size() != 2 || bandindex >= count[1]) {
+			throw(std::runtime_error(_SRC_ + strprint("Band %zu is not valid for variable %s\n", bandindex, varname.c_str())));
+		}
+		if (v.dimension() != 1 || v.shape(0) != count[0]) {
+			throw(std::runtime_error(_SRC_ + strprint("Variable %s needs a 1D view of extent %zu\n", varname.c_str(), count[0])));
+		}
+		start[1] = bandindex;
+		count[1] = 1;
+		const std::vector<ptrdiff_t> stride(2, 1);
+		const std::vector<ptrdiff_t> m = { (ptrdiff_t)v.strides(0), 1 };
+		var.getVar(start, count, stride, m, &v(0));
+	}
+
+	//Write a line from an array or view with the line's shape
+	template<typename T, bool isConst, typename A>
+	void putLine(const std::string& varname, const size_t lineindex, const andres::View<T, isConst, A>& v) const {
+		netCDF::NcVar var = getvar(varname);
+		std::vector<size_t> start, count;
+		line_extent(var, lineindex, start, count);
+		const std::vector<ptrdiff_t> stride(count.size(), 1);
+		var.putVar(start, count, stride, imap(v, var, count), (const T*)&v(0));
+	}
+
+	//Write one band of a 2D sample variable from a 1D view of length nsamples
+	template<typename T, bool isConst, typename A>
+	void putLineBand(const std::string& varname, const size_t lineindex, const size_t bandindex, const andres::View<T, isConst, A>& v) const {
+		netCDF::NcVar var = getvar(varname);
+		std::vector<size_t> start, count;
+		line_extent(var, lineindex, start, count);
+		if (count.size() != 2 || bandindex >= count[1]) {
+			throw(std::runtime_error(_SRC_ + strprint("Band %zu is not valid for variable %s\n", bandindex, varname.c_str())));
+		}
+		if (v.dimension() != 1 || v.shape(0) != count[0]) {
+			throw(std::runtime_error(_SRC_ + strprint("Variable %s needs a 1D view of extent %zu\n", varname.c_str(), count[0])));
+		}
+		start[1] = bandindex;
+		count[1] = 1;
+		const std::vector<ptrdiff_t> stride(2, 1);
+		const std::vector<ptrdiff_t> m = { (ptrdiff_t)v.strides(0), 1 };
+		var.putVar(start, count, stride, m, (const T*)&v(0));
+	}
+};
+
+#endif
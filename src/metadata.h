@@ -9,12 +9,55 @@ Author: Ross C. Brodie, Geoscience Australia.
 #ifndef _metadata_H
 #define _metadata_H
 
+#include <cstdio>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <charconv>
+#include <algorithm>
+#include <stdexcept>
 #include "general_utils.h"
 #include "file_utils.h"
 #include "blocklanguage.h"
 
+//Tab separated table of survey metadata.
+//Lookups by field name and by key value go through hash indexes that are built on first use (or by buildindex()),
+//with integer keys parsed once per record. If records or header are modified directly call clearindexes().
 class cMetaDataTable{
 
+	typedef std::unordered_map<int, std::vector<size_t>> cIntIndex;
+	typedef std::unordered_map<std::string, std::vector<size_t>> cStringIndex;
+
+	mutable std::unordered_map<std::string, size_t> HeaderIndex;//lower case field name to field index
+	mutable size_t HeaderIndexSize = (size_t)-1;//header.size() when HeaderIndex was built
+	mutable std::unordered_map<size_t, cIntIndex> IntIndexes;//per key field
+	mutable std::unordered_map<size_t, cStringIndex> StringIndexes;//per key field
+
+	const cIntIndex& intindex(const size_t keyindex) const {
+		auto it = IntIndexes.find(keyindex);
+		if (it != IntIndexes.end()) return it->second;
+		cIntIndex& index = IntIndexes[keyindex];
+		for (size_t i = 0; i < records.size(); i++){
+			if (keyindex < records[i].size()) index[atoi(records[i][keyindex].c_str())].push_back(i);
+		}
+		return index;
+	}
+
+	const cStringIndex& stringindex(const size_t keyindex) const {
+		auto it = StringIndexes.find(keyindex);
+		if (it != StringIndexes.end()) return it->second;
+		cStringIndex& index = StringIndexes[keyindex];
+		for (size_t i = 0; i < records.size(); i++){
+			if (keyindex < records[i].size()) index[records[i][keyindex]].push_back(i);
+		}
+		return index;
+	}
+
+	void clearindex(const size_t keyindex){
+		IntIndexes.erase(keyindex);
+		StringIndexes.erase(keyindex);
+	}
+
 public:
 	std::vector<std::string> header;
 	std::vector<std::vector<std::string>> records;
@@ -71,6 +114,21 @@ public:
 		}
 	}
 
+	void clearindexes(){
+		HeaderIndexSize = (size_t)-1;
+		IntIndexes.clear();
+		StringIndexes.clear();
+	}
+
+	//Build the integer and string value indexes of a key field now rather than on the first lookup
+	bool buildindex(const std::string& key){
+		int keyindex = findkeyindex(key);
+		if (keyindex < 0) return false;
+		intindex((size_t)keyindex);
+		stringindex((size_t)keyindex);
+		return true;
+	}
+
 	bool addfield(const std::string fname){
 		header.push_back(fname);
 		for (size_t i = 0; i < records.size(); i++){
@@ -83,6 +141,7 @@ public:
 	bool setfield(const std::string fname, const std::string value, const size_t recindex){
 		int k = findkeyindex(fname);
 		if (k < 0)return false;
+		clearindex((size_t)k);
 		records[recindex][(size_t)k] = value;
 		return true;
 	}
@@ -90,6 +149,7 @@ public:
 	bool setfield(const std::string fname, const std::string value){
 		int k = findkeyindex(fname);
 		if (k < 0)return false;
+		clearindex((size_t)k);
 		if (records.size() == 0){
 			records.resize(1);
 			records[0].resize(header.size());
@@ -101,27 +161,28 @@ public:
 		return true;
 	}
 
-	int findkeyindex(const std::string& fname){
-		for (size_t i = 0; i < header.size(); i++){
-			if (strcasecmp(header[i].c_str(),fname.c_str())==0){
-				return (int)i;
+	int findkeyindex(const std::string& fname) const {
+		if (HeaderIndexSize != header.size()){
+			//First occurrence wins as in a linear search
+			HeaderIndex.clear();
+			HeaderIndexSize = header.size();
+			for (size_t i = header.size(); i-- > 0;){
+				HeaderIndex[tolower(header[i])] = i;
 			}
 		}
-		return -1;
+		auto it = HeaderIndex.find(tolower(fname));
+		if (it == HeaderIndex.end()) return -1;
+		return (int)it->second;
 	}
 
-	std::vector<size_t> findmatchingrecords(const size_t keyindex, const int value){
-		std::vector<size_t> indices;
-		for (size_t i = 0; i < records.size(); i++){
-			int n = atoi(records[i][keyindex].c_str());
-			if (n == value){
-				indices.push_back(i);
-			}
-		}
-		return indices;
+	std::vector<size_t> findmatchingrecords(const size_t keyindex, const int value) const {
+		const cIntIndex& index = intindex(keyindex);
+		auto it = index.find(value);
+		if (it == index.end()) return std::vector<size_t>();
+		return it->second;
 	}
 
-	std::vector<size_t> findmatchingrecords(const std::string key, const int value)	{
+	std::vector<size_t> findmatchingrecords(const std::string key, const int value) const {
 		int keyindex = findkeyindex(key);
 		if (keyindex < 0){
 			std::vector<size_t> indices;
@@ -130,6 +191,16 @@ public:
 		return findmatchingrecords((size_t)keyindex, value);
 	}
 
+	//Records whose key field is exactly this string
+	std::vector<size_t> findmatchingrecords(const std::string key, const std::string& value) const {
+		int keyindex = findkeyindex(key);
+		if (keyindex < 0) return std::vector<size_t>();
+		const cStringIndex& index = stringindex((size_t)keyindex);
+		auto it = index.find(value);
+		if (it == index.end()) return std::vector<size_t>();
+		return it->second;
+	}
+
 	void printrecord(const size_t n){
 		for (size_t mi = 0; mi < header.size(); mi++){
 			std::printf("%s: %s\n", header[mi].c_str(), records[n][mi].c_str());
@@ -138,6 +209,160 @@ public:
 	}
 };
 
+//Read only, lazily parsed alternative to cMetaDataTable for large tab separated exports.
+//The file is read in one go into a single string arena and only the record boundaries are found on loading.
+//A column is split out of the records (as string_views into the arena, trimmed and unquoted) the first time it is used,
+//so load time and memory are proportional to the file size plus the columns actually accessed.
+//The lazy members are not thread safe.
+class cLazyMetaDataTable{
+
+	std::string Arena;
+	std::vector<std::pair<size_t, size_t>> Rows;//offset and length of each record in the arena
+	std::unordered_map<std::string, size_t> HeaderIndex;//lower case field name to field index
+	mutable std::vector<std::unique_ptr<std::vector<std::string_view>>> Columns;
+	mutable std::vector<std::unique_ptr<std::unordered_map<int, std::vector<size_t>>>> IntIndexes;
+	mutable std::vector<std::unique_ptr<std::unordered_map<std::string_view, std::vector<size_t>>>> StringIndexes;
+
+	static std::string_view clean(std::string_view v){
+		while (v.size() > 0 && (v.front() == ' ' || v.front() == '\t' || v.front() == '\r')) v.remove_prefix(1);
+		while (v.size() > 0 && (v.back() == ' ' || v.back() == '\t' || v.back() == '\r')) v.remove_suffix(1);
+		if (v.size() >= 2 && (v.front() == '"' || v.front() == '\'') && v.back() == v.front()){
+			v.remove_prefix(1);
+			v.remove_suffix(1);
+		}
+		return v;
+	}
+
+	//The k'th tab separated field of a record, empty if the record is short
+	std::string_view field(const size_t recindex, const size_t k) const {
+		std::string_view r(Arena.data() + Rows[recindex].first, Rows[recindex].second);
+		for (size_t i = 0; i < k; i++){
+			const size_t tab = r.find('\t');
+			if (tab == std::string_view::npos) return std::string_view();
+			r.remove_prefix(tab + 1);
+		}
+		return clean(r.substr(0, r.find('\t')));
+	}
+
+public:
+	std::vector<std::string> header;
+
+	cLazyMetaDataTable(){ }
+
+	cLazyMetaDataTable(const std::string& metadatafile, const size_t nskip){
+		FILE* fp = fileopen(metadatafile, "rb");
+		if (fp == nullptr){
+			throw(std::runtime_error(_SRC_ + strprint("Could not open %s\n", metadatafile.c_str())));
+		}
+		std::fseek(fp, 0, SEEK_END);
+		const long nbytes = std::ftell(fp);
+		std::fseek(fp, 0, SEEK_SET);
+		Arena.resize(nbytes > 0 ? (size_t)nbytes : 0);
+		Arena.resize(std::fread(&Arena[0], 1, Arena.size(), fp));
+		fclose(fp);
+
+		size_t pos = 0;
+		size_t lineno = 0;
+		size_t nfields = 0;
+		while (pos < Arena.size()){
+			size_t eol = Arena.find('\n', pos);
+			if (eol == std::string::npos) eol = Arena.size();
+			size_t len = eol - pos;
+			if (len > 0 && Arena[pos + len - 1] == '\r') len--;
+			lineno++;
+			if (lineno == 1){
+				std::string str = Arena.substr(pos, len);
+				split(str, '\t', header);
+				nfields = header.size();
+			}
+			else if (lineno > 1 + nskip){
+				const size_t ntokens = 1 + (size_t)std::count(Arena.begin() + pos, Arena.begin() + pos + len, '\t');
+				if (ntokens != nfields && ntokens != nfields - 1){
+					std::printf("Error: On line %zu of file %s\n", lineno, metadatafile.c_str());
+					std::printf("Error: The number of header items (%zu) does not match the number of data items (%zu)\n", nfields, ntokens);
+				}
+				Rows.push_back(std::make_pair(pos, len));
+			}
+			pos = eol + 1;
+		}
+
+		for (size_t i = header.size(); i-- > 0;){
+			HeaderIndex[tolower(header[i])] = i;
+		}
+		Columns.resize(header.size());
+		IntIndexes.resize(header.size());
+		StringIndexes.resize(header.size());
+	}
+
+	size_t nrecords() const { return Rows.size(); }
+
+	size_t nfields() const { return header.size(); }
+
+	int findkeyindex(const std::string& fname) const {
+		auto it = HeaderIndex.find(tolower(fname));
+		if (it == HeaderIndex.end()) return -1;
+		return (int)it->second;
+	}
+
+	//All values of a field, split out of the records on first access
+	const std::vector<std::string_view>& column(const size_t keyindex) const {
+		if (Columns[keyindex] == nullptr){
+			auto c = std::make_unique<std::vector<std::string_view>>(Rows.size());
+			for (size_t i = 0; i < Rows.size(); i++) (*c)[i] = field(i, keyindex);
+			Columns[keyindex] = std::move(c);
+		}
+		return *Columns[keyindex];
+	}
+
+	std::string_view value(const size_t recindex, const size_t keyindex) const {
+		return column(keyindex)[recindex];
+	}
+
+	std::vector<size_t> findmatchingrecords(const size_t keyindex, const int value) const {
+		if (IntIndexes[keyindex] == nullptr){
+			auto index = std::make_unique<std::unordered_map<int, std::vector<size_t>>>();
+			const std::vector<std::string_view>& c = column(keyindex);
+			for (size_t i = 0; i < c.size(); i++){
+				int n = 0;
+				std::from_chars(c[i].data(), c[i].data() + c[i].size(), n);
+				(*index)[n].push_back(i);
+			}
+			IntIndexes[keyindex] = std::move(index);
+		}
+		auto it = IntIndexes[keyindex]->find(value);
+		if (it == IntIndexes[keyindex]->end()) return std::vector<size_t>();
+		return it->second;
+	}
+
+	std::vector<size_t> findmatchingrecords(const std::string key, const int value) const {
+		int keyindex = findkeyindex(key);
+		if (keyindex < 0) return std::vector<size_t>();
+		return findmatchingrecords((size_t)keyindex, value);
+	}
+
+	std::vector<size_t> findmatchingrecords(const std::string key, const std::string& value) const {
+		int keyindex = findkeyindex(key);
+		if (keyindex < 0) return std::vector<size_t>();
+		if (StringIndexes[(size_t)keyindex] == nullptr){
+			auto index = std::make_unique<std::unordered_map<std::string_view, std::vector<size_t>>>();
+			const std::vector<std::string_view>& c = column((size_t)keyindex);
+			for (size_t i = 0; i < c.size(); i++) (*index)[c[i]].push_back(i);
+			StringIndexes[(size_t)keyindex] = std::move(index);
+		}
+		auto it = StringIndexes[(size_t)keyindex]->find(value);
+		if (it == StringIndexes[(size_t)keyindex]->end()) return std::vector<size_t>();
+		return it->second;
+	}
+
+	void printrecord(const size_t n) const {
+		for (size_t mi = 0; mi < header.size(); mi++){
+			const std::string_view v = value(n, mi);
+			std::printf("%s: %.*s\n", header[mi].c_str(), (int)v.size(), v.data());
+		}
+		std::printf("\n");
+	}
+};
+
 class cMetaDataRecord{
 
 public:
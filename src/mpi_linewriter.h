@@ -0,0 +1,259 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _mpi_linewriter_H
+#define _mpi_linewriter_H
+
+#ifdef ENABLE_MPI
+
+#include "mpi.h"
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include "general_utils.h"
+#include "geophysics_netcdf.hpp"
+
+//Aggregating writer for MPI programs that write to a single geophysics NetCDF file.
+//Only the writer rank ever opens the file for writing, so no parallel HDF5 is needed.
+//The other ranks send their hyperslabs (usually whole lines) to the writer rank, which writes them.
+//
+//Typical use (collective on all ranks):
+//	if(W.iswriter()) { ...define variable... }
+//	W.barrier();
+//	for (li...) if (W.owns(li)) W.put(varname, startp, countp, data);
+//	W.flush();
+class cMPILineWriter {
+
+	static constexpr size_t MAXDIMS = 4;
+	static constexpr int TAG_HEADER = 7101;
+	static constexpr int TAG_DATA = 7102;
+	static constexpr size_t MAXMESSAGE = 1073741824;//elements per data message, below INT_MAX
+
+	struct sMessageHeader {
+		long long ndims;//ndims < 0 signals the end of a batch
+		long long type;
+		long long start[MAXDIMS];
+		long long count[MAXDIMS];
+		char name[256];
+	};
+
+	MPI_Comm Comm;
+	int Rank = 0;
+	int Size = 1;
+	int WriterRank = 0;
+	netCDF::NcGroup* File = nullptr;
+	std::map<std::string, netCDF::NcVar> Vars;
+	size_t NumWritten = 0;
+	int PendingMarkers = 0;
+
+	static MPI_Datatype mpitype(const nc_type t) {
+		switch (t) {
+		case NC_UBYTE: return MPI_UNSIGNED_CHAR;
+		case NC_SHORT: return MPI_SHORT;
+		case NC_INT: return MPI_INT;
+		case NC_FLOAT: return MPI_FLOAT;
+		case NC_DOUBLE: return MPI_DOUBLE;
+		default:
+			throw(std::runtime_error(_SRC_ + strprint("Unsupported datatype %d for MPI line transfer\n", (int)t)));
+		}
+	}
+
+	static size_t typesize(const nc_type t) {
+		switch (t) {
+		case NC_UBYTE: return sizeof(unsigned char);
+		case NC_SHORT: return sizeof(short);
+		case NC_INT: return sizeof(int);
+		case NC_FLOAT: return sizeof(float);
+		case NC_DOUBLE: return sizeof(double);
+		default: return 0;
+		}
+	}
+
+	template<typename T> static nc_type nctype() {
+		if constexpr (std::is_same<T, unsigned char>::value) return NC_UBYTE;
+		else if constexpr (std::is_same<T, short>::value) return NC_SHORT;
+		else if constexpr (std::is_same<T, int>::value) return NC_INT;
+		else if constexpr (std::is_same<T, float>::value) return NC_FLOAT;
+		else if constexpr (std::is_same<T, double>::value) return NC_DOUBLE;
+		else static_assert(sizeof(T) == 0, "Unsupported type for cMPILineWriter");
+	}
+
+	netCDF::NcVar& getvar(const std::string& name) {
+		auto it = Vars.find(name);
+		if (it == Vars.end()) {
+			netCDF::NcVar v = File->getVar(name);
+			if (v.isNull()) {
+				throw(std::runtime_error(_SRC_ + strprint("Variable %s does not exist on the writer rank\n", name.c_str())));
+			}
+			it = Vars.emplace(name, v).first;
+		}
+		return it->second;
+	}
+
+	void write(const sMessageHeader& h, const void* data) {
+		std::vector<size_t> startp(h.ndims);
+		std::vector<size_t> countp(h.ndims);
+		for (long long i = 0; i < h.ndims; i++) {
+			startp[i] = (size_t)h.start[i];
+			countp[i] = (size_t)h.count[i];
+		}
+		netCDF::NcVar& var = getvar(h.name);
+		switch (h.type) {
+		case NC_UBYTE: var.putVar(startp, countp, (const unsigned char*)data); break;
+		case NC_SHORT: var.putVar(startp, countp, (const short*)data); break;
+		case NC_INT: var.putVar(startp, countp, (const int*)data); break;
+		case NC_FLOAT: var.putVar(startp, countp, (const float*)data); break;
+		case NC_DOUBLE: var.putVar(startp, countp, (const double*)data); break;
+		}
+		NumWritten++;
+	}
+
+	//Receive one message from any rank and write it, returns false if it was an end of batch marker
+	bool receive_one() {
+		sMessageHeader h;
+		MPI_Status status;
+		MPI_Recv(&h, sizeof(h), MPI_BYTE, MPI_ANY_SOURCE, TAG_HEADER, Comm, &status);
+		if (h.ndims < 0) return false;
+
+		size_t n = 1;
+		for (long long i = 0; i < h.ndims; i++) n *= (size_t)h.count[i];
+		const size_t ts = typesize((nc_type)h.type);
+		std::vector<char> buf(n * ts);
+		for (size_t o = 0; o < n; o += MAXMESSAGE) {
+			MPI_Recv(buf.data() + o * ts, (int)std::min(MAXMESSAGE, n - o), mpitype((nc_type)h.type), status.MPI_SOURCE, TAG_DATA, Comm, MPI_STATUS_IGNORE);
+		}
+		write(h, buf.data());
+		return true;
+	}
+
+public:
+
+	//The file is only dereferenced on the writer rank and may be nullptr on all others
+	cMPILineWriter(MPI_Comm comm, const int writerrank, netCDF::NcGroup* file) {
+		Comm = comm;
+		WriterRank = writerrank;
+		MPI_Comm_rank(Comm, &Rank);
+		MPI_Comm_size(Comm, &Size);
+		if (iswriter()) {
+			File = file;
+			if (File == nullptr) {
+				throw(std::runtime_error(_SRC_ + strprint("The writer rank must supply an open NetCDF file\n")));
+			}
+		}
+	}
+
+	int rank() const { return Rank; }
+	int size() const { return Size; }
+	bool iswriter() const { return Rank == WriterRank; }
+	size_t nwritten() const { return NumWritten; }
+
+	//With more than two ranks the writer rank is dedicated to writing and owns no lines
+	bool owns(const size_t lineindex) const {
+		if (Size <= 2) {
+			return (int)(lineindex % (size_t)Size) == Rank;
+		}
+		if (iswriter()) return false;
+		const int nworkers = Size - 1;
+		int w = (int)(lineindex % (size_t)nworkers);
+		if (w >= WriterRank) w++;
+		return w == Rank;
+	}
+
+	//Queue a hyperslab for writing, blocks until the writer has received it
+	template<typename T>
+	void put(const std::string& varname, const std::vector<size_t>& startp, const std::vector<size_t>& countp, const T* data) {
+		if (startp.size() > MAXDIMS || startp.size() != countp.size()) {
+			throw(std::runtime_error(_SRC_ + strprint("Invalid hyperslab for variable %s\n", varname.c_str())));
+		}
+		if (varname.size() >= sizeof(sMessageHeader::name)) {
+			throw(std::runtime_error(_SRC_ + strprint("Variable name %s is too long\n", varname.c_str())));
+		}
+
+		sMessageHeader h;
+		std::memset(&h, 0, sizeof(h));
+		h.ndims = (long long)startp.size();
+		h.type = (long long)nctype<T>();
+		size_t n = 1;
+		for (size_t i = 0; i < startp.size(); i++) {
+			h.start[i] = (long long)startp[i];
+			h.count[i] = (long long)countp[i];
+			n *= countp[i];
+		}
+		std::strncpy(h.name, varname.c_str(), sizeof(h.name) - 1);
+
+		if (iswriter()) {
+			write(h, data);
+			drain();
+		}
+		else {
+			MPI_Send(&h, sizeof(h), MPI_BYTE, WriterRank, TAG_HEADER, Comm);
+			//MPI counts are int, so large hyperslabs go in several messages, which arrive in order
+			for (size_t o = 0; o < n; o += MAXMESSAGE) {
+				MPI_Send((void*)(data + o), (int)std::min(MAXMESSAGE, n - o), mpitype(h.type), WriterRank, TAG_DATA, Comm);
+			}
+		}
+	}
+
+	template<typename T>
+	void put(const std::string& varname, const std::vector<size_t>& startp, const std::vector<size_t>& countp, const std::vector<T>& data) {
+		put(varname, startp, countp, data.data());
+	}
+
+	//Write whatever has already arrived without blocking (writer rank only)
+	void drain() {
+		if (iswriter() == false) return;
+		int flag = 1;
+		while (flag) {
+			MPI_Iprobe(MPI_ANY_SOURCE, TAG_HEADER, Comm, &flag, MPI_STATUS_IGNORE);
+			if (flag && receive_one() == false) {
+				//An end of batch marker arrived early, remember it for flush()
+				PendingMarkers++;
+			}
+		}
+	}
+
+	//Collective: completes the current batch, after which everything put on any rank has been written
+	void flush() {
+		if (iswriter()) {
+			int nmarkers = PendingMarkers;
+			while (nmarkers < Size - 1) {
+				if (receive_one() == false) nmarkers++;
+			}
+			PendingMarkers = 0;
+		}
+		else {
+			sMessageHeader h;
+			std::memset(&h, 0, sizeof(h));
+			h.ndims = -1;
+			MPI_Send(&h, sizeof(h), MPI_BYTE, WriterRank, TAG_HEADER, Comm);
+		}
+		MPI_Barrier(Comm);
+	}
+
+	//Collective: used after the writer rank has defined variables and before any rank puts data into them
+	void barrier() {
+		MPI_Barrier(Comm);
+	}
+
+	//Collective: broadcast a status from the writer rank so all ranks take the same branch
+	bool broadcast(const bool status) {
+		int s = status ? 1 : 0;
+		MPI_Bcast(&s, 1, MPI_INT, WriterRank, Comm);
+		return s != 0;
+	}
+};
+
+#endif
+
+#endif
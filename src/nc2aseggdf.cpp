@@ -0,0 +1,490 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#include <cstdio>
+#include <netcdf>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <cstdlib>
+#include <cmath>
+#include <charconv>
+#include <fstream>
+#include <memory>
+#include <filesystem>
+
+#define _PROGRAM_ "nc2aseggdf"
+#define _VERSION_ "1.0"
+
+#include "general_utils.h"
+#include "file_utils.h"
+#include "logger.h"
+#include "geophysics_netcdf.hpp"
+#include "ncvar_utils.h"
+#include "string_list.h"
+#include "thread_pool.h"
+
+using namespace netCDF;
+using namespace netCDF::exceptions;
+using namespace GeophysicsNetCDF;
+
+class cLogger glog; //The instance of the global log file manager
+
+//Fortran style ASEG-GDF2 field format, e.g. I10, F12.3 or E15.6
+struct sFieldFormat {
+	char type = 'F';
+	int width = 12;
+	int decimals = 3;
+
+	sFieldFormat() {};
+
+	sFieldFormat(const char _type, const int _width, const int _decimals) {
+		type = _type;
+		width = _width;
+		decimals = _decimals;
+	}
+
+	static bool parse(const std::string& s, sFieldFormat& f) {
+		std::string u = trim(s);
+		size_t i = 0;
+		while (i < u.size() && isdigit((unsigned char)u[i])) i++;//optional repeat count
+		if (i >= u.size()) return false;
+		f.type = (char)toupper((unsigned char)u[i]);
+		if (f.type != 'I' && f.type != 'F' && f.type != 'E') return false;
+		f.width = atoi(u.c_str() + i + 1);
+		size_t dot = u.find('.', i);
+		f.decimals = (dot == std::string::npos) ? 0 : atoi(u.c_str() + dot + 1);
+		return f.width > 0;
+	}
+
+	std::string str() const {
+		if (type == 'I') return strprint("I%d", width);
+		return strprint("%c%d.%d", type, width, decimals);
+	}
+};
+
+//Right justify a formatted number in its field, keeping at least one separating space
+inline void put_field(std::string& out, const char* b, const size_t n, const int width) {
+	if ((int)n >= width) {
+		out.append(1, ' ');
+		out.append((size_t)width - 1, '*');
+		return;
+	}
+	out.append((size_t)width - n, ' ');
+	out.append(b, n);
+}
+
+inline void format_integer(std::string& out, const long long v, const int width) {
+	char buf[32];
+	auto r = std::to_chars(buf, buf + sizeof(buf), v);
+	put_field(out, buf, (size_t)(r.ptr - buf), width);
+}
+
+inline void format_real(std::string& out, const double v, const sFieldFormat& f) {
+	char buf[512];
+	const std::chars_format cf = (f.type == 'E') ? std::chars_format::scientific : std::chars_format::fixed;
+	auto r = std::to_chars(buf, buf + sizeof(buf), v, cf, f.decimals);
+	if (r.ec != std::errc()) {
+		put_field(out, buf, (size_t)f.width, f.width);
+		return;
+	}
+	if (f.type == 'E') {
+		for (char* p = buf; p < r.ptr; p++) if (*p == 'e') *p = 'E';
+	}
+	put_field(out, buf, (size_t)(r.ptr - buf), f.width);
+}
+
+//Written for nulls whose own value does not fit the field's format, such as the NetCDF default fill values
+constexpr double NULL_SENTINEL = -99999.0;
+
+class cNcToASEGGDFExporter {
+
+	struct sColumn {
+		std::string varname;
+		std::string label;
+		std::string units;
+		NcVar var;
+		bool islinevar = false;
+		size_t nbands = 1;
+		bool isinteger = false;
+		bool hasnull = false;
+		double nullvalue = 0.0;//as stored, packed if the variable is packed
+		double exportnull = 0.0;//as written to the .dat and .dfn files
+		bool ispacked = false;//CF packed with scale_factor and/or add_offset
+		double scale = 1.0;
+		double offset = 0.0;
+		sFieldFormat format;
+	};
+
+	std::string NCPath;
+	std::string DatPath;
+	std::string DfnPath;
+	size_t NumThreads = 0;
+	size_t BlockBytes = 33554432;//approximate size of the text formatted by each task
+	std::vector<std::string> Include;
+	std::vector<std::string> Exclude;
+	std::map<std::string, std::string> Formats;//user supplied formats by variable name
+
+	std::unique_ptr<GFile> File;
+	std::vector<size_t> LineStart;
+	std::vector<size_t> LineCount;
+	std::vector<long long> LineNumbers;
+	sFieldFormat LineFormat;
+	std::vector<sColumn> Columns;
+	size_t RecordWidth = 0;
+	std::mutex NcMutex;//the netCDF/HDF5 libraries are not thread safe
+
+	static std::string stringatt(const NcVar& v, const std::string& name) {
+		auto atts = v.getAtts();
+		auto it = atts.find(name);
+		if (it == atts.end() || it->second.getType().getId() != NC_CHAR) return std::string();
+		std::string s;
+		it->second.getValues(s);
+		return s;
+	}
+
+	static bool numberatt(const NcVar& v, const std::string& name, double& value) {
+		auto atts = v.getAtts();
+		auto it = atts.find(name);
+		if (it == atts.end() || it->second.getType().getId() == NC_CHAR || it->second.getAttLength() == 0) return false;
+		std::vector<double> d(it->second.getAttLength());
+		it->second.getValues(d.data());
+		value = d[0];
+		return true;
+	}
+
+	bool wanted(const std::string& varname) const {
+		auto has = [&](const std::vector<std::string>& list) {
+			for (const auto& s : list) if (tolower(s) == tolower(varname)) return true;
+			return false;
+		};
+		if (Include.size() > 0 && has(Include) == false) return false;
+		if (has(Exclude)) return false;
+		//The per line bounding boxes and footprints are geometry, not fields, unless explicitly included
+		if (has(Include) == false && (varname.rfind("line_bbox_", 0) == 0 || varname.rfind("line_footprint_", 0) == 0)) return false;
+		return true;
+	}
+
+	static std::string format_value(const double v, const bool isinteger, const sFieldFormat& f) {
+		std::string s;
+		if (isinteger) format_integer(s, (long long)v, f.width);
+		else format_real(s, v, f);
+		return s;
+	}
+
+	//Choose the null written for a column and widen its format if need be so the null is readable
+	static void prepare_null(sColumn& c) {
+		if (c.hasnull == false) return;
+		c.exportnull = c.ispacked ? NULL_SENTINEL : c.nullvalue;
+		if (format_value(c.exportnull, c.isinteger, c.format).find('*') != std::string::npos) c.exportnull = NULL_SENTINEL;
+		sFieldFormat wide = c.format;
+		wide.width = 64;
+		const int needed = (int)trim(format_value(c.exportnull, c.isinteger, wide)).size() + 1;
+		if (c.format.width < needed) {
+			glog.logmsg("Widening the format of %s to %d so its null %s fits\n", c.varname.c_str(), needed, trim(format_value(c.exportnull, c.isinteger, wide)).c_str());
+			c.format.width = needed;
+		}
+	}
+
+	//Fixed point format with the decimals of the scale_factor, wide enough for the whole range of the packed type
+	static sFieldFormat packed_format(const nc_type t, const double scale, const double offset) {
+		double maxpacked = 2147483647.0;
+		if (t == NC_BYTE || t == NC_UBYTE) maxpacked = 255.0;
+		else if (t == NC_SHORT || t == NC_USHORT) maxpacked = 65535.0;
+		const int decimals = scale > 0.0 ? std::max(0, (int)std::ceil(-std::log10(scale) - 1e-9)) : 6;
+		const double maxabs = std::fabs(offset) + maxpacked * std::fabs(scale);
+		const int digits = (int)std::to_string((long long)std::ceil(maxabs)).size();
+		return sFieldFormat('F', digits + decimals + 3, decimals);
+	}
+
+	sFieldFormat default_format(const nc_type t) const {
+		switch (t) {
+		case NC_BYTE: case NC_UBYTE: return sFieldFormat('I', 5, 0);
+		case NC_SHORT: case NC_USHORT: return sFieldFormat('I', 7, 0);
+		case NC_INT: case NC_UINT: return sFieldFormat('I', 12, 0);
+		case NC_INT64: case NC_UINT64: return sFieldFormat('I', 21, 0);
+		case NC_FLOAT: return sFieldFormat('E', 15, 6);
+		default: return sFieldFormat('F', 20, 6);
+		}
+	}
+
+	void prepare_columns() {
+		const std::vector<std::string> indexvars = { DN_LINE, "line_index", "index_count", "index_lines" };
+		for (const NcVar& v : File->getAllVars()) {
+			const std::string name = v.getName();
+			bool isindex = false;
+			for (const auto& iv : indexvars) if (name == iv) isindex = true;
+			if (isindex || wanted(name) == false) continue;
+
+			sColumn c;
+			if (File->isSampleVar(v)) c.islinevar = false;
+			else if (File->isLineVar(v)) c.islinevar = true;
+			else continue;
+
+			const nc_type t = v.getType().getId();
+			if (t == NC_CHAR || t == NC_STRING) {
+				glog.logmsg("Skipping %s as it is not numeric\n", name.c_str());
+				continue;
+			}
+			c.varname = name;
+			c.var = v;
+			for (int i = 1; i < v.getDimCount(); i++) c.nbands *= v.getDim(i).getSize();
+			c.isinteger = (t != NC_FLOAT && t != NC_DOUBLE);
+			const bool hasscale = numberatt(v, "scale_factor", c.scale);
+			const bool hasoffset = numberatt(v, "add_offset", c.offset);
+			c.ispacked = hasscale || hasoffset;
+			if (c.ispacked) c.isinteger = false;//read as double and unpacked
+			c.label = stringatt(v, "original_dataset_fieldname");
+			if (c.label.size() == 0 || c.label.find(' ') != std::string::npos) c.label = name;
+			c.units = stringatt(v, "units");
+			c.hasnull = numberatt(v, "missing_value", c.nullvalue);
+			if (c.hasnull == false) c.hasnull = numberatt(v, "_FillValue", c.nullvalue);
+
+			c.format = c.ispacked ? packed_format(t, c.scale, c.offset) : default_format(t);
+			std::string fmt = stringatt(v, "aseggdf_format");
+			auto it = Formats.find(tolower(name));
+			if (it != Formats.end()) fmt = it->second;
+			if (fmt.size() > 0 && sFieldFormat::parse(fmt, c.format) == false) {
+				throw(std::runtime_error(_SRC_ + strprint("Invalid format %s for %s\n", fmt.c_str(), name.c_str())));
+			}
+			if (c.isinteger) c.format.type = 'I';
+			else if (c.format.type == 'I') c.format = sFieldFormat('F', c.format.width, 0);
+			prepare_null(c);
+			Columns.push_back(c);
+		}
+
+		long long maxline = 1;
+		for (const auto& ln : LineNumbers) maxline = std::max(maxline, std::abs(ln));
+		LineFormat = sFieldFormat('I', (int)std::to_string(maxline).size() + 2, 0);
+		RecordWidth = (size_t)LineFormat.width + 1;
+		for (const auto& c : Columns) RecordWidth += c.nbands * (size_t)c.format.width;
+	}
+
+	//Read and format the records of lines [l0, l1)
+	std::string format_lines(const size_t l0, const size_t l1) {
+		const size_t s0 = LineStart[l0];
+		const size_t ns = LineStart[l1 - 1] + LineCount[l1 - 1] - s0;
+		std::vector<std::vector<double>> reals(Columns.size());
+		std::vector<std::vector<long long>> ints(Columns.size());
+		{
+			std::lock_guard<std::mutex> lock(NcMutex);
+			for (size_t ci = 0; ci < Columns.size(); ci++) {
+				const sColumn& c = Columns[ci];
+				std::vector<size_t> startp(c.var.getDimCount(), 0);
+				std::vector<size_t> countp(c.var.getDimCount());
+				for (size_t i = 1; i < countp.size(); i++) countp[i] = c.var.getDim((int)i).getSize();
+				startp[0] = c.islinevar ? l0 : s0;
+				countp[0] = c.islinevar ? l1 - l0 : ns;
+				if (c.isinteger) {
+					ints[ci].resize(countp[0] * c.nbands);
+					c.var.getVar(startp, countp, ints[ci].data());
+				}
+				else {
+					reals[ci].resize(countp[0] * c.nbands);
+					c.var.getVar(startp, countp, reals[ci].data());
+				}
+			}
+		}
+
+		std::string out;
+		out.reserve(ns * RecordWidth);
+		for (size_t li = l0; li < l1; li++) {
+			for (size_t si = 0; si < LineCount[li]; si++) {
+				format_integer(out, LineNumbers[li], LineFormat.width);
+				for (size_t ci = 0; ci < Columns.size(); ci++) {
+					const sColumn& c = Columns[ci];
+					const size_t r = c.islinevar ? li - l0 : LineStart[li] - s0 + si;
+					for (size_t bi = 0; bi < c.nbands; bi++) {
+						if (c.isinteger) {
+							const long long v = ints[ci][r * c.nbands + bi];
+							if (c.hasnull && (double)v == c.nullvalue) format_integer(out, (long long)c.exportnull, c.format.width);
+							else format_integer(out, v, c.format.width);
+						}
+						else {
+							const double v = reals[ci][r * c.nbands + bi];
+							if (c.hasnull && v == c.nullvalue) format_real(out, c.exportnull, c.format);
+							else if (c.ispacked) format_real(out, v * c.scale + c.offset, c.format);
+							else format_real(out, v, c.format);
+						}
+					}
+				}
+				out += '\n';
+			}
+		}
+		return out;
+	}
+
+	void write_dfn() const {
+		std::ofstream of(DfnPath);
+		of << "DEFN   ST=RECD,RT=COMM;RT:A4;COMMENTS:A76" << std::endl;
+		size_t k = 1;
+		of << "DEFN " << k++ << " ST=RECD,RT=;LINE:" << LineFormat.str() << ":NAME=line" << std::endl;
+		for (const auto& c : Columns) {
+			of << "DEFN " << k++ << " ST=RECD,RT=;" << c.label << ":";
+			if (c.nbands > 1) of << c.nbands;
+			of << c.format.str();
+			std::vector<std::string> atts;
+			if (c.units.size() > 0) atts.push_back("UNITS=" + c.units);
+			if (c.hasnull) atts.push_back("NULL=" + trim(format_value(c.exportnull, c.isinteger, c.format)));
+			if (c.label != c.varname) atts.push_back("NAME=" + c.varname);
+			for (size_t i = 0; i < atts.size(); i++) of << (i == 0 ? ":" : ",") << atts[i];
+			of << std::endl;
+		}
+		of << "DEFN " << k << " ST=RECD,RT=;END DEFN" << std::endl;
+	}
+
+public:
+
+	cNcToASEGGDFExporter(const std::string& ncpath, const std::string& datpath, const size_t nthreads, const std::vector<std::string>& include, const std::vector<std::string>& exclude, const std::map<std::string, std::string>& formats) {
+		NCPath = fixseparator(ncpath);
+		DatPath = fixseparator(datpath);
+		DfnPath = extractfiledirectory(DatPath) + extractfilename_noextension(DatPath) + ".dfn";
+		NumThreads = nthreads;
+		Include = include;
+		Exclude = exclude;
+		Formats = formats;
+	}
+
+	bool process() {
+		glog.logmsg("Opening NetCDF file %s\n", NCPath.c_str());
+		File = std::make_unique<GFile>(NCPath, NcFile::read);
+		get_line_index(*File, LineStart, LineCount);
+		File->getLineNumbers(LineNumbers);
+		if (LineStart.size() == 0) {
+			glog.logmsg("Warning: there are no lines to export\n");
+			return false;
+		}
+
+		prepare_columns();
+		glog.logmsg("Exporting %zu variables, record width %zu\n", Columns.size(), RecordWidth);
+
+		if (!exists(extractfiledirectory(DatPath))) {
+			makedirectorydeep(extractfiledirectory(DatPath));
+		}
+		write_dfn();
+
+		std::unique_ptr<FILE, int(*)(FILE*)> fp(fopen(DatPath.c_str(), "wb"), &fclose);
+		if (fp == nullptr) {
+			throw(std::runtime_error(_SRC_ + strprint("Could not open %s for writing\n", DatPath.c_str())));
+		}
+
+		size_t nbytes = 0;
+		try {
+			//Each task formats a block of whole lines, the blocks are written in order as they complete
+			cThreadPool pool(NumThreads);
+			const size_t maxinflight = 2 * pool.size();
+			std::deque<std::future<std::string>> inflight;
+			auto writeone = [&]() {
+				std::string text = inflight.front().get();
+				inflight.pop_front();
+				if (fwrite(text.data(), 1, text.size(), fp.get()) != text.size()) {
+					throw(std::runtime_error(_SRC_ + strprint("Error writing %s\n", DatPath.c_str())));
+				}
+				nbytes += text.size();
+			};
+
+			size_t l0 = 0;
+			while (l0 < LineStart.size()) {
+				size_t l1 = l0 + 1;
+				size_t bytes = LineCount[l0] * RecordWidth;
+				while (l1 < LineStart.size() && bytes + LineCount[l1] * RecordWidth <= BlockBytes) {
+					bytes += LineCount[l1] * RecordWidth;
+					l1++;
+				}
+				inflight.push_back(pool.submit([this, l0, l1]() { return format_lines(l0, l1); }));
+				if (inflight.size() >= maxinflight) writeone();
+				l0 = l1;
+			}
+			while (inflight.size() > 0) writeone();
+			if (fclose(fp.release()) != 0) {
+				throw(std::runtime_error(_SRC_ + strprint("Error closing %s\n", DatPath.c_str())));
+			}
+		}
+		catch (...) {
+			//Do not leave a partial .dat file beside its complete .dfn
+			fp.reset();
+			std::error_code ec;
+			std::filesystem::remove(DatPath, ec);
+			std::filesystem::remove(DfnPath, ec);
+			glog.logmsg("Removed the partial output %s and %s\n", DatPath.c_str(), DfnPath.c_str());
+			throw;
+		}
+		glog.logmsg("Wrote %zu bytes to %s\n", nbytes, DatPath.c_str());
+		return true;
+	}
+};
+
+void usage(const char* program) {
+	std::cout << "Usage: " << extractfilename(program) << " [options] input_ncfile output_datfile" << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "   -include var1,var2,...      only export these variables (line_bbox_* and line_footprint_* only if named here)" << std::endl;
+	std::cout << "   -exclude var1,var2,...      do not export these variables" << std::endl;
+	std::cout << "   -format var=F10.3,...       override the output format of variables" << std::endl;
+	std::cout << "   -threads n                  number of formatting threads (default all cores)" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	_GSTITEM_
+	try
+	{
+		std::vector<std::string> args;
+		std::vector<std::string> include;
+		std::vector<std::string> exclude;
+		std::map<std::string, std::string> formats;
+		size_t nthreads = 0;
+		for (int i = 1; i < argc; i++) {
+			std::string a = argv[i];
+			const bool hasvalue = (i + 1 < argc);
+			if (a == "-include" && hasvalue) include = split_list(argv[++i]);
+			else if (a == "-exclude" && hasvalue) exclude = split_list(argv[++i]);
+			else if (a == "-threads" && hasvalue) nthreads = (size_t)atoll(argv[++i]);
+			else if (a == "-format" && hasvalue) {
+				for (const auto& item : split_list(argv[++i])) {
+					const size_t eq = item.find('=');
+					if (eq != std::string::npos) formats[tolower(trim(item.substr(0, eq)))] = trim(item.substr(eq + 1));
+				}
+			}
+			else args.push_back(a);
+		}
+
+		if (args.size() != 2) {
+			usage(argv[0]);
+			return 1;
+		}
+
+		const std::string datpath = fixseparator(args[1]);
+		glog.open(datpath + ".log");
+		glog.logmsg("Program %s starting at %s\n", _PROGRAM_, timestamp().c_str());
+		glog.logmsg("Version %s Compiled at %s on %s\n", _VERSION_, __TIME__, __DATE__);
+		glog.logmsg("%s\n", commandlinestring(argc, argv).c_str());
+		glog.logmsg("Working directory: %s\n", getcurrentdirectory().c_str());
+
+		double t1 = gettime();
+		cNcToASEGGDFExporter E(args[0], datpath, nthreads, include, exclude, formats);
+		E.process();
+		double t2 = gettime();
+		glog.logmsg("Elapsed time = %.2lf\n", t2 - t1);
+		glog.logmsg("Finished at %s\n", timestamp().c_str());
+		glog.close();
+	}
+	catch (NcException& e)
+	{
+		_GSTPRINT_
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	catch (std::exception& e)
+	{
+		_GSTPRINT_
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
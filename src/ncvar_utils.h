@@ -0,0 +1,251 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _ncvar_utils_H
+#define _ncvar_utils_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <netcdf.h>
+
+#include "general_utils.h"
+#include "logger.h"
+#include "geophysics_netcdf.hpp"
+#include "compression_policy.h"
+
+extern class cLogger glog;
+
+//Helpers for the programs that derive one geophysics NetCDF file (or variable) from another
+
+//Start index and sample count of every line, as used by the line by line readers
+inline void get_line_index(const GeophysicsNetCDF::GFile& ncFile, std::vector<size_t>& start, std::vector<size_t>& count) {
+	const size_t nlines = ncFile.nlines();
+	start.resize(nlines);
+	count.resize(nlines);
+	size_t s = 0;
+	for (size_t li = 0; li < nlines; li++) {
+		start[li] = s;
+		count[li] = ncFile.nlinesamples(li);
+		s += count[li];
+	}
+}
+
+//CF packing of a variable, unpacked = stored * scale + offset, so scale 1 and offset 0 if it is not packed
+struct sPacking {
+	double scale = 1.0;
+	double offset = 0.0;
+
+	sPacking() {};
+
+	sPacking(const netCDF::NcVar& var) {
+		const auto atts = var.getAtts();
+		auto s = atts.find("scale_factor");
+		if (s != atts.end()) s->second.getValues(&scale);
+		auto o = atts.find("add_offset");
+		if (o != atts.end()) o->second.getValues(&offset);
+	}
+
+	bool ispacked() const { return scale != 1.0 || offset != 0.0; }
+
+	//Unpack stored values in place, leaving the nulls as they are so they can still be tested against the stored null
+	void unpack(std::vector<double>& v, const double null) const {
+		if (ispacked() == false) return;
+		for (double& x : v) {
+			if (x != null) x = x * scale + offset;
+		}
+	}
+};
+
+//Name of the first variable matching one of the candidate names (case insensitive), or an empty string
+inline std::string look_for_var(const GeophysicsNetCDF::GFile& ncFile, const std::vector<std::string>& candidates) {
+	std::vector<netCDF::NcVar> v = ncFile.getAllVars();
+	for (size_t ci = 0; ci < candidates.size(); ci++) {
+		for (size_t vi = 0; vi < v.size(); vi++) {
+			if (tolower(v[vi].getName()) == tolower(candidates[ci])) {
+				return v[vi].getName();
+			}
+		}
+	}
+	return std::string();
+}
+
+//Line type of every line from a linetype line variable, or the first sample of a linetype sample variable.
+//Empty if the file has no linetype variable.
+inline std::vector<double> get_linetype(const GeophysicsNetCDF::GFile& ncFile) {
+	std::string vname = look_for_var(ncFile, { "linetype", "line_type", "ltype" });
+	std::vector<double> ltype;
+	if (vname.size() > 0) {
+		netCDF::NcVar var = ncFile.getVar(vname);
+		if (ncFile.isLineVar(var)) {
+			GeophysicsNetCDF::GLineVar v = ncFile.getLineVar(vname);
+			v.getAll(ltype);
+		}
+		else if (ncFile.isSampleVar(var)) {
+			ltype.resize(ncFile.nlines());
+			GeophysicsNetCDF::GSampleVar v = ncFile.getSampleVar(vname);
+			for (size_t li = 0; li < ncFile.nlines(); li++) {
+				v.getSample(li, 0, 0, ltype[li]);
+			}
+		}
+	}
+	return ltype;
+}
+
+//Calls f(T()) with T the C++ type of a numeric NetCDF type
+template<typename F>
+void nctype_dispatch(const nc_type t, F&& f) {
+	switch (t) {
+	case NC_BYTE: f((signed char)0); break;
+	case NC_UBYTE: f((unsigned char)0); break;
+	case NC_SHORT: f((short)0); break;
+	case NC_USHORT: f((unsigned short)0); break;
+	case NC_INT: f((int)0); break;
+	case NC_UINT: f((unsigned int)0); break;
+	case NC_INT64: f((long long)0); break;
+	case NC_UINT64: f((unsigned long long)0); break;
+	case NC_FLOAT: f((float)0); break;
+	case NC_DOUBLE: f((double)0); break;
+	default:
+		throw(std::runtime_error(_SRC_ + strprint("Unsupported NetCDF datatype %d\n", (int)t)));
+	}
+}
+
+//Attributes that summarise a variable's values (written by cVariableStats), so are wrong for a copy of only some of them
+inline bool is_statistics_attribute(const std::string& name) {
+	static const std::vector<std::string> names = {
+		"actual_range", "mean", "standard_deviation", "valid_count", "null_count",
+		"band_minimum", "band_maximum", "band_mean", "band_standard_deviation", "band_null_count",
+		"histogram_range", "histogram_counts" };
+	return std::find(names.begin(), names.end(), name) != names.end();
+}
+
+inline void copy_var_attributes(const netCDF::NcVar& src, const netCDF::NcVar& dst, const bool statistics = true) {
+	for (const auto& [name, att] : src.getAtts()) {
+		if (statistics == false && is_statistics_attribute(name)) continue;
+		if (att.getType().getId() == NC_CHAR) {
+			std::string s;
+			att.getValues(s);
+			dst.putAtt(name, s);
+		}
+		else {
+			std::vector<char> buf(att.getAttLength() * att.getType().getSize());
+			att.getValues((void*)buf.data());
+			dst.putAtt(name, att.getType(), att.getAttLength(), (const void*)buf.data());
+		}
+	}
+}
+
+//Lossy quantization of a float or double variable, which must still be in define mode (NetCDF 4.9.0 or later).
+//mode is "bitgroom", "granular" (granular bit-round) or "bitround" and nsd the number of significant decimal digits
+//(significant bits for bitround). The zeroed trailing mantissa bits only save space when the variable is also deflated.
+//Returns false if the library or variable type does not support it.
+inline bool set_quantize(const netCDF::NcVar& var, const std::string& mode, const int nsd) {
+#ifdef NC_QUANTIZE_BITGROOM
+	const nc_type t = var.getType().getId();
+	if (t != NC_FLOAT && t != NC_DOUBLE) return false;
+	int m;
+	if (mode == "bitgroom") m = NC_QUANTIZE_BITGROOM;
+	else if (mode == "granular") m = NC_QUANTIZE_GRANULARBR;
+	else if (mode == "bitround") m = NC_QUANTIZE_BITROUND;
+	else {
+		throw(std::runtime_error(_SRC_ + strprint("Unknown quantize mode %s\n", mode.c_str())));
+	}
+	return nc_def_var_quantize(var.getParentGroup().getId(), var.getId(), m, nsd) == NC_NOERR;
+#else
+	return false;
+#endif
+}
+
+//The quantize mode and digits of a variable, e.g. "granular=3", or an empty string
+inline std::string quantize_string(const netCDF::NcVar& var) {
+#ifdef NC_QUANTIZE_BITGROOM
+	int m = NC_NOQUANTIZE, nsd = 0;
+	if (nc_inq_var_quantize(var.getParentGroup().getId(), var.getId(), &m, &nsd) != NC_NOERR) return std::string();
+	if (m == NC_QUANTIZE_BITGROOM) return strprint("bitgroom=%d", nsd);
+	if (m == NC_QUANTIZE_GRANULARBR) return strprint("granular=%d", nsd);
+	if (m == NC_QUANTIZE_BITROUND) return strprint("bitround=%d", nsd);
+#endif
+	return std::string();
+}
+
+//Copy the chunking (clipped to the new dimension sizes), compression filters and quantization of a variable.
+//Filters that this NetCDF build or its plugins cannot define (e.g. bitshuffle without the plugin) are logged and dropped.
+inline void copy_var_storage(const netCDF::NcVar& src, const netCDF::NcVar& dst) {
+	netCDF::NcVar::ChunkMode mode;
+	std::vector<size_t> chunks;
+	src.getChunkingParameters(mode, chunks);
+	if (mode == netCDF::NcVar::nc_CHUNKED && chunks.size() == (size_t)dst.getDimCount()) {
+		std::vector<netCDF::NcDim> dims = dst.getDims();
+		for (size_t i = 0; i < chunks.size(); i++) {
+			chunks[i] = std::max((size_t)1, std::min(chunks[i], dims[i].getSize()));
+		}
+		dst.setChunking(netCDF::NcVar::nc_CHUNKED, chunks);
+	}
+	bool shuffle, deflate; int level;
+	src.getCompressionParameters(shuffle, deflate, level);
+	if (deflate || shuffle) dst.setCompression(shuffle, deflate, level);
+
+#ifdef _NC_HAS_FILTER_API
+	//The other filters, e.g. zstd or bitshuffle, in their original order
+	const int sid = src.getParentGroup().getId();
+	const int did = dst.getParentGroup().getId();
+	size_t nfilters = 0;
+	if (nc_inq_var_filter_ids(sid, src.getId(), &nfilters, nullptr) == NC_NOERR && nfilters > 0) {
+		std::vector<unsigned int> ids(nfilters);
+		nc_inq_var_filter_ids(sid, src.getId(), &nfilters, ids.data());
+		for (const unsigned int id : ids) {
+			if (id == H5Z_FILTER_DEFLATE || id == H5Z_FILTER_SHUFFLE) continue;
+			size_t nparams = 0;
+			nc_inq_var_filter_info(sid, src.getId(), id, &nparams, nullptr);
+			std::vector<unsigned int> params(nparams);
+			nc_inq_var_filter_info(sid, src.getId(), id, &nparams, params.data());
+			if (nc_def_var_filter(did, dst.getId(), id, nparams, params.data()) != NC_NOERR) {
+				glog.logmsg("Warning: could not define filter %u of variable %s, it is stored without it\n", id, src.getName().c_str());
+			}
+		}
+	}
+#endif
+
+	const std::string q = quantize_string(src);
+	const size_t eq = q.find('=');
+	if (eq != std::string::npos && set_quantize(dst, q.substr(0, eq), atoi(q.substr(eq + 1).c_str())) == false) {
+		glog.logmsg("Warning: could not quantize variable %s with %s, it is stored without it\n", src.getName().c_str(), q.c_str());
+	}
+}
+
+//Define a variable in dst with the same name, type, dimensions (by name), storage and attributes as src, except the
+//statistics attributes as the new variable is meant for a subset of the values.
+//Dimensions missing from dst are added with their src size, and their coordinate variables copied.
+inline netCDF::NcVar define_var_like(const netCDF::NcGroup& dst, const netCDF::NcGroup& src, const netCDF::NcVar& v) {
+	std::vector<netCDF::NcDim> dims;
+	for (const netCDF::NcDim& d : v.getDims()) {
+		netCDF::NcDim od = dst.getDim(d.getName());
+		if (od.isNull()) {
+			od = dst.addDim(d.getName(), d.getSize());
+			netCDF::NcVar cv = src.getVar(d.getName());
+			if (cv.isNull() == false && cv.getDimCount() == 1 && cv.getName() != v.getName()) {
+				netCDF::NcVar ocv = dst.addVar(cv.getName(), cv.getType(), od);
+				copy_var_attributes(cv, ocv);
+				nctype_dispatch(cv.getType().getId(), [&](auto t) {
+					std::vector<decltype(t)> buf(d.getSize());
+					cv.getVar(buf.data());
+					ocv.putVar(buf.data());
+				});
+			}
+		}
+		dims.push_back(od);
+	}
+	netCDF::NcVar ov = dst.addVar(v.getName(), v.getType(), dims);
+	copy_var_storage(v, ov);
+	copy_var_attributes(v, ov, false);
+	return ov;
+}
+
+#endif
@@ -0,0 +1,255 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _overview_H
+#define _overview_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "general_utils.h"
+#include "geophysics_netcdf.hpp"
+#include "ncvar_utils.h"
+
+//Decimated overviews of sample variables for previews and zoomed-out views.
+//Each level keeps every f-th sample of every line (always including the first) in the group overviews/decimation_f,
+//which has its own point and line dimensions and line index:
+//  line (line), index_count (line), line_index (point) as in the root group
+//  source_index (point) the sample's index in the full resolution variables
+//and decimated copies of the selected variables with the same names, types, attributes and storage.
+
+constexpr auto OVERVIEW_GROUP = "overviews";
+constexpr auto OVERVIEW_LEVEL_PREFIX = "decimation_";
+constexpr auto OVERVIEW_FACTOR_ATT = "decimation";
+
+namespace overview_detail {
+
+	template<typename T>
+	void decimate_copy(const netCDF::NcVar& src, const netCDF::NcVar& dst, const std::vector<size_t>& linestart, const std::vector<size_t>& linecount, const size_t factor, const size_t blockbytes) {
+		std::vector<netCDF::NcDim> dims = src.getDims();
+		size_t nbands = 1;
+		for (size_t i = 1; i < dims.size(); i++) nbands *= dims[i].getSize();
+		const size_t blocksamples = std::max((size_t)1, blockbytes / (nbands * sizeof(T)));
+
+		std::vector<size_t> startp(dims.size(), 0);
+		std::vector<size_t> countp(dims.size());
+		for (size_t i = 1; i < dims.size(); i++) countp[i] = dims[i].getSize();
+
+		std::vector<T> in;
+		std::vector<T> out;
+		size_t outstart = 0;
+		size_t l0 = 0;
+		while (l0 < linestart.size()) {
+			//Whole lines up to the block size
+			size_t l1 = l0 + 1;
+			while (l1 < linestart.size() && linestart[l1] + linecount[l1] - linestart[l0] <= blocksamples) l1++;
+			const size_t first = linestart[l0];
+			const size_t ns = linestart[l1 - 1] + linecount[l1 - 1] - first;
+
+			startp[0] = first;
+			countp[0] = ns;
+			in.resize(ns * nbands);
+			if (ns > 0) src.getVar(startp, countp, in.data());
+
+			out.clear();
+			for (size_t li = l0; li < l1; li++) {
+				for (size_t k = 0; k < linecount[li]; k += factor) {
+					const T* p = &in[(linestart[li] + k - first) * nbands];
+					out.insert(out.end(), p, p + nbands);
+				}
+			}
+			const size_t nout = out.size() / nbands;
+			if (nout > 0) {
+				startp[0] = outstart;
+				countp[0] = nout;
+				dst.putVar(startp, countp, out.data());
+			}
+			outstart += nout;
+			l0 = l1;
+		}
+	}
+}
+
+//Add decimated overview levels of the named sample variables to a file open for writing
+inline void add_overviews(GeophysicsNetCDF::GFile& ncFile, const std::vector<std::string>& varnames, std::vector<size_t> factors, const size_t blockbytes = 67108864) {
+	using namespace netCDF;
+	using namespace GeophysicsNetCDF;
+
+	std::vector<size_t> linestart;
+	std::vector<size_t> linecount;
+	get_line_index(ncFile, linestart, linecount);
+	const size_t nlines = linestart.size();
+
+	std::sort(factors.begin(), factors.end());
+	factors.erase(std::unique(factors.begin(), factors.end()), factors.end());
+
+	NcGroup og = ncFile.getGroup(OVERVIEW_GROUP);
+	if (og.isNull()) og = ncFile.addGroup(OVERVIEW_GROUP);
+
+	for (const size_t f : factors) {
+		if (f < 2) continue;
+		const std::string name = OVERVIEW_LEVEL_PREFIX + std::to_string(f);
+		if (og.getGroup(name).isNull() == false) {
+			throw(std::runtime_error(_SRC_ + strprint("Overview level %s already exists\n", name.c_str())));
+		}
+		NcGroup g = og.addGroup(name);
+		g.putAtt(OVERVIEW_FACTOR_ATT, ncUint64, (unsigned long long)f);
+
+		//The level's own line index
+		std::vector<unsigned int> count(nlines);
+		std::vector<unsigned int> lineindex;
+		std::vector<unsigned long long> sourceindex;
+		for (size_t li = 0; li < nlines; li++) {
+			count[li] = (unsigned int)((linecount[li] + f - 1) / f);
+			for (size_t k = 0; k < linecount[li]; k += f) {
+				lineindex.push_back((unsigned int)li);
+				sourceindex.push_back((unsigned long long)(linestart[li] + k));
+			}
+		}
+		NcDim dpoint = g.addDim(DN_POINT, lineindex.size());
+		NcDim dline = g.addDim(DN_LINE, nlines);
+
+		NcVar srcline = ncFile.getVar(DN_LINE);
+		if (srcline.isNull() == false && srcline.getDimCount() == 1) {
+			NcVar v = g.addVar(DN_LINE, srcline.getType(), dline);
+			copy_var_attributes(srcline, v);
+			nctype_dispatch(srcline.getType().getId(), [&](auto t) {
+				std::vector<decltype(t)> buf(nlines);
+				srcline.getVar(buf.data());
+				v.putVar(buf.data());
+			});
+		}
+		NcVar vc = g.addVar("index_count", ncUint, dline);
+		vc.putAtt("long_name", "number of samples in each line at this level");
+		vc.putVar(count.data());
+		NcVar vl = g.addVar("line_index", ncUint, dpoint);
+		vl.putAtt("long_name", "zero based index of the line of each sample at this level");
+		if (lineindex.size()) vl.putVar(lineindex.data());
+		NcVar vs = g.addVar("source_index", ncUint64, dpoint);
+		vs.putAtt("long_name", "index of each sample in the full resolution variables");
+		if (sourceindex.size()) vs.putVar(sourceindex.data());
+
+		for (const std::string& varname : varnames) {
+			NcVar src = ncFile.getVar(varname);
+			if (src.isNull() || ncFile.isSampleVar(src) == false) {
+				throw(std::runtime_error(_SRC_ + strprint("%s is not a sample variable\n", varname.c_str())));
+			}
+			NcVar dst = define_var_like(g, ncFile, src);
+			nctype_dispatch(src.getType().getId(), [&](auto t) {
+				overview_detail::decimate_copy<decltype(t)>(src, dst, linestart, linecount, f, blockbytes);
+			});
+		}
+	}
+}
+
+//Reads sample variables at the coarsest overview level that still meets a requested sample density,
+//falling back to the full resolution variables
+class cOverviewReader {
+
+	struct sLevel {
+		size_t factor;
+		netCDF::NcGroup group;
+		std::vector<size_t> start;
+		std::vector<size_t> count;
+	};
+
+	const GeophysicsNetCDF::GFile& File;
+	std::vector<sLevel> Levels;//ascending factor, the full resolution level (factor 1) first
+
+public:
+
+	cOverviewReader(const GeophysicsNetCDF::GFile& file) : File(file) {
+		sLevel full;
+		full.factor = 1;
+		full.group = File;
+		get_line_index(File, full.start, full.count);
+		Levels.push_back(full);
+
+		netCDF::NcGroup og = File.getGroup(OVERVIEW_GROUP);
+		if (og.isNull()) return;
+		for (const auto& [name, g] : og.getGroups()) {
+			auto atts = g.getAtts();
+			auto a = atts.find(OVERVIEW_FACTOR_ATT);
+			netCDF::NcVar vc = g.getVar("index_count");
+			if (a == atts.end() || vc.isNull()) continue;
+			unsigned long long f;
+			a->second.getValues(&f);
+			sLevel l;
+			l.factor = (size_t)f;
+			l.group = g;
+			std::vector<unsigned int> c(vc.getDim(0).getSize());
+			vc.getVar(c.data());
+			size_t s = 0;
+			for (const unsigned int n : c) {
+				l.start.push_back(s);
+				l.count.push_back(n);
+				s += n;
+			}
+			Levels.push_back(l);
+		}
+		std::sort(Levels.begin(), Levels.end(), [](const sLevel& a, const sLevel& b) { return a.factor < b.factor; });
+	}
+
+	size_t nlevels() const { return Levels.size(); }
+	size_t factor(const size_t level) const { return Levels[level].factor; }
+
+	//Coarsest level keeping at least the fraction density (0 to 1) of the samples of varname
+	size_t select(const std::string& varname, const double density) const {
+		size_t best = 0;
+		for (size_t i = 1; i < Levels.size(); i++) {
+			if (1.0 / (double)Levels[i].factor < density) break;
+			if (Levels[i].group.getVar(varname).isNull() == false) best = i;
+		}
+		return best;
+	}
+
+	//Coarsest level with at least nsamples samples of varname in the survey
+	size_t select_nsamples(const std::string& varname, const size_t nsamples) const {
+		const double n = (double)File.ntotalsamples();
+		return select(varname, n > 0.0 ? (double)nsamples / n : 1.0);
+	}
+
+	//All bands of the samples of a line at a level, [samples][bands]
+	template<typename T>
+	void getLine(const std::string& varname, const size_t level, const size_t lineindex, std::vector<T>& v) const {
+		const sLevel& l = Levels[level];
+		netCDF::NcVar var = l.group.getVar(varname);
+		if (var.isNull()) {
+			throw(std::runtime_error(_SRC_ + strprint("Variable %s has no overview at decimation %zu\n", varname.c_str(), l.factor)));
+		}
+		std::vector<netCDF::NcDim> dims = var.getDims();
+		std::vector<size_t> startp(dims.size(), 0);
+		std::vector<size_t> countp(dims.size());
+		size_t nbands = 1;
+		for (size_t i = 1; i < dims.size(); i++) {
+			countp[i] = dims[i].getSize();
+			nbands *= countp[i];
+		}
+		startp[0] = l.start[lineindex];
+		countp[0] = l.count[lineindex];
+		v.resize(countp[0] * nbands);
+		if (v.size()) var.getVar(startp, countp, v.data());
+	}
+
+	//Indices in the full resolution variables of the samples of a line at a level
+	void getSourceIndex(const size_t level, const size_t lineindex, std::vector<size_t>& index) const {
+		const sLevel& l = Levels[level];
+		index.resize(l.count[lineindex]);
+		if (l.factor == 1) {
+			for (size_t k = 0; k < index.size(); k++) index[k] = l.start[lineindex] + k;
+			return;
+		}
+		std::vector<unsigned long long> buf(index.size());
+		if (buf.size()) l.group.getVar("source_index").getVar({ l.start[lineindex] }, { l.count[lineindex] }, buf.data());
+		std::copy(buf.begin(), buf.end(), index.begin());
+	}
+};
+
+#endif
@@ -0,0 +1,195 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _shards_H
+#define _shards_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "general_utils.h"
+#include "file_utils.h"
+#include "geophysics_netcdf.hpp"
+
+//Sharded output: a survey written as independent geophysics NetCDF files, each holding a contiguous range
+//of its lines, so parallel workers need no parallel HDF5. The shards of out.nc are out_shard0000.nc,
+//out_shard0001.nc, ... and the manifest out.manifest is a tab separated table with one row per shard:
+//  path (relative to the manifest)  first_line  nlines  first_sample  nsamples
+//after a comment line identifying the format and a header row.
+
+constexpr auto SHARD_MANIFEST_FORMAT = "# geophysics-netcdf shard manifest version 1";
+
+inline std::string shard_path(const std::string& ncpath, const size_t shardindex) {
+	return extractfiledirectory(ncpath) + extractfilename_noextension(ncpath) + strprint("_shard%04zu.nc", shardindex);
+}
+
+inline std::string shard_manifest_path(const std::string& ncpath) {
+	return extractfiledirectory(ncpath) + extractfilename_noextension(ncpath) + ".manifest";
+}
+
+//Shard of a line starting at sample start of a survey of nsamples, so the shards have about equal numbers of samples
+inline size_t shard_of_line(const uint64_t start, const uint64_t nsamples, const size_t nshards) {
+	if (nsamples == 0) return 0;
+	return (size_t)std::min((uint64_t)nshards - 1, (uint64_t)((long double)start * (long double)nshards / (long double)nsamples));
+}
+
+//Write the manifest of the shards that exist, in shard order, from their own line indexes
+inline void write_shard_manifest(const std::string& manifestpath, const std::vector<std::string>& shardpaths) {
+	std::ofstream of(manifestpath);
+	if (!of) {
+		throw(std::runtime_error(_SRC_ + strprint("Could not create shard manifest %s\n", manifestpath.c_str())));
+	}
+	of << SHARD_MANIFEST_FORMAT << "\n";
+	of << "path\tfirst_line\tnlines\tfirst_sample\tnsamples\n";
+	const std::string dir = extractfiledirectory(manifestpath);
+	size_t firstline = 0;
+	size_t firstsample = 0;
+	for (const std::string& p : shardpaths) {
+		if (exists(p) == false) continue;
+		GeophysicsNetCDF::GFile S(p);
+		const size_t nl = S.nlines();
+		const size_t ns = S.ntotalsamples();
+		std::string rel = p;
+		if (rel.compare(0, dir.size(), dir) == 0) rel = rel.substr(dir.size());
+		of << rel << "\t" << firstline << "\t" << nl << "\t" << firstsample << "\t" << ns << "\n";
+		firstline += nl;
+		firstsample += ns;
+	}
+}
+
+//The shards of a manifest opened as one survey with a single line index
+class cShardedSurvey {
+
+	struct sShard {
+		std::string path;
+		size_t firstline;
+		size_t nlines;
+		size_t firstsample;
+		size_t nsamples;
+		std::unique_ptr<GeophysicsNetCDF::GFile> file;
+	};
+
+	std::vector<sShard> Shards;
+
+	static std::vector<std::string> split_tabs(const std::string& s) {
+		std::vector<std::string> f;
+		std::stringstream ss(s);
+		std::string item;
+		while (std::getline(ss, item, '\t')) f.push_back(trim(item));
+		return f;
+	}
+
+public:
+
+	cShardedSurvey(const std::string& manifestpath) {
+		std::ifstream in(manifestpath);
+		if (!in) {
+			throw(std::runtime_error(_SRC_ + strprint("Could not open shard manifest %s\n", manifestpath.c_str())));
+		}
+		const std::string dir = extractfiledirectory(manifestpath);
+		std::string s;
+		bool header = true;
+		while (std::getline(in, s)) {
+			if (s.size() && s.back() == '\r') s.pop_back();
+			if (s.size() == 0 || s[0] == '#') continue;
+			if (header) {
+				header = false;
+				continue;
+			}
+			const std::vector<std::string> f = split_tabs(s);
+			if (f.size() < 5) {
+				throw(std::runtime_error(_SRC_ + strprint("Bad row in shard manifest %s: %s\n", manifestpath.c_str(), s.c_str())));
+			}
+			sShard sh;
+			sh.path = dir + f[0];
+			sh.firstline = (size_t)atoll(f[1].c_str());
+			sh.nlines = (size_t)atoll(f[2].c_str());
+			sh.firstsample = (size_t)atoll(f[3].c_str());
+			sh.nsamples = (size_t)atoll(f[4].c_str());
+			sh.file = std::make_unique<GeophysicsNetCDF::GFile>(sh.path);
+			if (sh.file->nlines() != sh.nlines || sh.file->ntotalsamples() != sh.nsamples) {
+				throw(std::runtime_error(_SRC_ + strprint("Shard %s does not match its manifest entry\n", sh.path.c_str())));
+			}
+			Shards.push_back(std::move(sh));
+		}
+	}
+
+	size_t nshards() const { return Shards.size(); }
+	GeophysicsNetCDF::GFile& shard(const size_t k) { return *Shards[k].file; }
+	const std::string& shardpath(const size_t k) const { return Shards[k].path; }
+
+	size_t nlines() const { return Shards.size() ? Shards.back().firstline + Shards.back().nlines : 0; }
+	size_t ntotalsamples() const { return Shards.size() ? Shards.back().firstsample + Shards.back().nsamples : 0; }
+
+	//Shard and the line index within it of a survey line index
+	void locate(const size_t lineindex, size_t& shardindex, size_t& shardline) const {
+		auto it = std::upper_bound(Shards.begin(), Shards.end(), lineindex, [](const size_t li, const sShard& s) { return li < s.firstline; });
+		if (it == Shards.begin() || lineindex >= nlines()) {
+			throw(std::runtime_error(_SRC_ + strprint("Line index %zu is out of range\n", lineindex)));
+		}
+		--it;
+		shardindex = (size_t)(it - Shards.begin());
+		shardline = lineindex - it->firstline;
+	}
+
+	size_t nlinesamples(const size_t lineindex) const {
+		size_t k, l;
+		locate(lineindex, k, l);
+		return Shards[k].file->nlinesamples(l);
+	}
+
+	template<typename T>
+	bool getLineNumbers(std::vector<T>& v) const {
+		v.clear();
+		for (const auto& s : Shards) {
+			std::vector<T> w;
+			if (s.file->getLineNumbers(w) == false) return false;
+			v.insert(v.end(), w.begin(), w.end());
+		}
+		return true;
+	}
+
+	template<typename T>
+	bool getLine(const std::string& varname, const size_t lineindex, std::vector<T>& v) const {
+		size_t k, l;
+		locate(lineindex, k, l);
+		return Shards[k].file->getSampleVar(varname).getLine(l, v);
+	}
+
+	template<typename T>
+	bool getLineBand(const std::string& varname, const size_t lineindex, const size_t bandindex, std::vector<T>& v) const {
+		size_t k, l;
+		locate(lineindex, k, l);
+		return Shards[k].file->getSampleVar(varname).getLineBand(l, bandindex, v);
+	}
+
+	//All values of a sample or line variable for the whole survey, shard after shard
+	template<typename T>
+	bool getAll(const std::string& varname, std::vector<T>& v) const {
+		v.clear();
+		for (const auto& s : Shards) {
+			std::vector<T> w;
+			netCDF::NcVar var = s.file->getVar(varname);
+			if (var.isNull()) return false;
+			bool status;
+			if (s.file->isLineVar(var)) status = s.file->getLineVar(varname).getAll(w);
+			else status = s.file->getSampleVar(varname).getAll(w);
+			if (status == false) return false;
+			v.insert(v.end(), w.begin(), w.end());
+		}
+		return true;
+	}
+};
+
+#endif
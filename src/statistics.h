@@ -0,0 +1,267 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _statistics_H
+#define _statistics_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <netcdf>
+
+#ifdef ENABLE_MPI
+#include "mpi.h"
+#endif
+
+#include "general_utils.h"
+#include "ncvar_utils.h"
+
+//Count, range, mean and variance of a stream of values by Welford's update, and the null count.
+//Partial results (from threads, blocks of lines or MPI ranks) are combined with Chan et al's pairwise
+//merge, which stays accurate where summing values and squares would cancel catastrophically.
+struct sRunningStats {
+	uint64_t n = 0;
+	uint64_t nnull = 0;
+	double min = std::numeric_limits<double>::max();
+	double max = -std::numeric_limits<double>::max();
+	double mean = 0.0;
+	double m2 = 0.0;//sum of squared deviations from the mean
+
+	static constexpr size_t NPACKED = 6;
+
+	void add(const double v) {
+		n++;
+		const double d = v - mean;
+		mean += d / (double)n;
+		m2 += d * (v - mean);
+		if (v < min) min = v;
+		if (v > max) max = v;
+	}
+
+	void merge(const sRunningStats& b) {
+		nnull += b.nnull;
+		if (b.n == 0) return;
+		if (n == 0) {
+			const uint64_t nn = nnull;
+			*this = b;
+			nnull = nn;
+			return;
+		}
+		const double na = (double)n;
+		const double nb = (double)b.n;
+		const double d = b.mean - mean;
+		mean += d * nb / (na + nb);
+		m2 += b.m2 + d * d * na * nb / (na + nb);
+		n += b.n;
+		min = std::min(min, b.min);
+		max = std::max(max, b.max);
+	}
+
+	//Sample variance
+	double variance() const { return n > 1 ? m2 / (double)(n - 1) : 0.0; }
+	double stddev() const { return std::sqrt(variance()); }
+
+	void pack(double* p) const {
+		p[0] = (double)n; p[1] = (double)nnull; p[2] = min; p[3] = max; p[4] = mean; p[5] = m2;
+	}
+
+	void unpack(const double* p) {
+		n = (uint64_t)p[0]; nnull = (uint64_t)p[1]; min = p[2]; max = p[3]; mean = p[4]; m2 = p[5];
+	}
+};
+
+//Statistics of each band of a variable and an optional fixed range histogram of all its bands
+class cVariableStats {
+
+	std::vector<sRunningStats> Bands;
+	double HistMin = 0.0;
+	double HistMax = 0.0;
+	std::vector<uint64_t> Counts;
+
+	void addhistogram(const double v) {
+		const size_t nbins = Counts.size();
+		if (v < HistMin || v > HistMax) return;
+		size_t b = HistMax > HistMin ? (size_t)((v - HistMin) / (HistMax - HistMin) * (double)nbins) : 0;
+		Counts[std::min(b, nbins - 1)]++;
+	}
+
+public:
+
+	cVariableStats(const size_t nbands = 1) : Bands(std::max((size_t)1, nbands)) {}
+
+	size_t nbands() const { return Bands.size(); }
+	const sRunningStats& band(const size_t bi) const { return Bands[bi]; }
+
+	//All bands together
+	sRunningStats total() const {
+		sRunningStats t;
+		for (const auto& b : Bands) t.merge(b);
+		return t;
+	}
+
+	//Histogram of nbins equal bins from min to max, which must be set before any values are added
+	void sethistogram(const size_t nbins, const double min, const double max) {
+		Counts.assign(nbins, 0);
+		HistMin = min;
+		HistMax = max;
+	}
+
+	bool hashistogram() const { return Counts.size() > 0; }
+
+	//Values of nsamples samples of all bands, i.e. v[nsamples][nbands], with null for the missing values
+	template<typename T>
+	void add(const T* v, const size_t nsamples, const T null) {
+		const size_t nb = Bands.size();
+		for (size_t si = 0; si < nsamples; si++) {
+			for (size_t bi = 0; bi < nb; bi++) {
+				const T& x = v[si * nb + bi];
+				if (x == null || x != x) {//null or nan
+					Bands[bi].nnull++;
+					continue;
+				}
+				Bands[bi].add((double)x);
+				if (Counts.size()) addhistogram((double)x);
+			}
+		}
+	}
+
+	//Bin values into the histogram only, e.g. on a second pass once the range is known
+	template<typename T>
+	void addtohistogram(const T* v, const size_t n, const T null) {
+		for (size_t i = 0; i < n; i++) {
+			if (v[i] == null || v[i] != v[i]) continue;
+			addhistogram((double)v[i]);
+		}
+	}
+
+	//Combine with the statistics of another part of the same variable (with the same histogram bins)
+	void merge(const cVariableStats& s) {
+		for (size_t bi = 0; bi < Bands.size() && bi < s.Bands.size(); bi++) Bands[bi].merge(s.Bands[bi]);
+		for (size_t k = 0; k < Counts.size() && k < s.Counts.size(); k++) Counts[k] += s.Counts[k];
+	}
+
+#ifdef ENABLE_MPI
+	//Merge the statistics of all ranks into those of the root rank (collective)
+	void mpi_merge(MPI_Comm comm, const int root) {
+		int rank, size;
+		MPI_Comm_rank(comm, &rank);
+		MPI_Comm_size(comm, &size);
+		const size_t np = Bands.size() * sRunningStats::NPACKED;
+		std::vector<double> mine(np);
+		for (size_t bi = 0; bi < Bands.size(); bi++) Bands[bi].pack(&mine[bi * sRunningStats::NPACKED]);
+		std::vector<double> all(rank == root ? np * (size_t)size : 0);
+		MPI_Gather(mine.data(), (int)np, MPI_DOUBLE, all.data(), (int)np, MPI_DOUBLE, root, comm);
+		if (Counts.size()) {
+			std::vector<uint64_t> counts(Counts.size());
+			MPI_Reduce(Counts.data(), counts.data(), (int)Counts.size(), MPI_UINT64_T, MPI_SUM, root, comm);
+			if (rank == root) Counts = counts;
+		}
+		if (rank != root) return;
+		for (int r = 0; r < size; r++) {
+			if (r == root) continue;
+			for (size_t bi = 0; bi < Bands.size(); bi++) {
+				sRunningStats s;
+				s.unpack(&all[(size_t)r * np + bi * sRunningStats::NPACKED]);
+				Bands[bi].merge(s);
+			}
+		}
+	}
+#endif
+
+	//Store as attributes of the variable: actual_range (in the variable's unpacked type), valid_count,
+	//null_count, mean and standard_deviation of all bands, the same per band for a multiband variable,
+	//and histogram_range and histogram_counts if there is a histogram (all listed in is_statistics_attribute())
+	void write(const netCDF::NcVar& var) const {
+		const sRunningStats t = total();
+		if (t.n > 0) {
+			netCDF::NcType type = var.getType();
+			const auto& atts = var.getAtts();
+			auto sf = atts.find("scale_factor");
+			if (sf != atts.end()) type = sf->second.getType();
+			nctype_dispatch(type.getId(), [&](auto z) {
+				typedef decltype(z) T;
+				const T range[2] = { (T)t.min, (T)t.max };
+				var.putAtt("actual_range", type, 2, range);
+			});
+			var.putAtt("mean", netCDF::ncDouble, t.mean);
+			var.putAtt("standard_deviation", netCDF::ncDouble, t.stddev());
+		}
+		const unsigned long long nvalid = t.n;
+		const unsigned long long nnull = t.nnull;
+		var.putAtt("valid_count", netCDF::ncUint64, 1, &nvalid);
+		var.putAtt("null_count", netCDF::ncUint64, 1, &nnull);
+
+		if (Bands.size() > 1) {
+			const size_t nb = Bands.size();
+			std::vector<double> bmin(nb), bmax(nb), bmean(nb), bstd(nb);
+			std::vector<unsigned long long> bnull(nb);
+			for (size_t bi = 0; bi < nb; bi++) {
+				const sRunningStats& b = Bands[bi];
+				const double nan = std::numeric_limits<double>::quiet_NaN();
+				bmin[bi] = b.n ? b.min : nan;
+				bmax[bi] = b.n ? b.max : nan;
+				bmean[bi] = b.n ? b.mean : nan;
+				bstd[bi] = b.n ? b.stddev() : nan;
+				bnull[bi] = b.nnull;
+			}
+			var.putAtt("band_minimum", netCDF::ncDouble, nb, bmin.data());
+			var.putAtt("band_maximum", netCDF::ncDouble, nb, bmax.data());
+			var.putAtt("band_mean", netCDF::ncDouble, nb, bmean.data());
+			var.putAtt("band_standard_deviation", netCDF::ncDouble, nb, bstd.data());
+			var.putAtt("band_null_count", netCDF::ncUint64, nb, bnull.data());
+		}
+
+		if (Counts.size()) {
+			const double range[2] = { HistMin, HistMax };
+			std::vector<unsigned long long> c(Counts.begin(), Counts.end());
+			var.putAtt("histogram_range", netCDF::ncDouble, 2, range);
+			var.putAtt("histogram_counts", netCDF::ncUint64, c.size(), c.data());
+		}
+	}
+};
+
+//Histogram of nbins bins over the range of the statistics s, binning the values of a variable read back from a file
+//in blocks of records, unpacked and without nulls as they were when s was accumulated.
+//Values just outside the range, from storing doubles as float or packed, go in the end bins.
+inline void add_histogram(cVariableStats& s, const GeophysicsNetCDF::GFile& ncFile, const std::string& varname, const size_t nbins, const size_t blockvalues = 1048576) {
+	const sRunningStats t = s.total();
+	s.sethistogram(nbins, t.n ? t.min : 0.0, t.n ? t.max : 0.0);
+	if (t.n == 0 || nbins == 0) return;
+
+	const netCDF::NcVar var = ncFile.getVar(varname);
+	const double null = ncFile.getGeophysicsVar(varname).missingvalue(double());
+	const sPacking pack(var);
+	std::vector<size_t> countp;
+	for (const auto& d : var.getDims()) countp.push_back(d.getSize());
+	if (countp.size() == 0) return;
+	size_t nb = 1;
+	for (size_t i = 1; i < countp.size(); i++) nb *= countp[i];
+	const size_t nrecords = countp[0];
+	const size_t blockrecords = std::max((size_t)1, blockvalues / std::max((size_t)1, nb));
+	const double tol = 1e-6 * std::max({ std::fabs(t.min), std::fabs(t.max), t.max - t.min });
+
+	std::vector<size_t> startp(countp.size(), 0);
+	std::vector<double> v;
+	for (size_t r = 0; r < nrecords; r += blockrecords) {
+		startp[0] = r;
+		countp[0] = std::min(blockrecords, nrecords - r);
+		v.resize(countp[0] * nb);
+		var.getVar(startp, countp, v.data());
+		pack.unpack(v, null);
+		for (double& x : v) {
+			if (x == null) continue;
+			if (x < t.min && x >= t.min - tol) x = t.min;
+			else if (x > t.max && x <= t.max + tol) x = t.max;
+		}
+		s.addtohistogram(v.data(), v.size(), null);
+	}
+}
+
+#endif
@@ -0,0 +1,31 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _string_list_H
+#define _string_list_H
+
+#include <string>
+#include <vector>
+
+#include "general_utils.h"
+
+//Splits a comma separated list, trimming each item and dropping empty ones
+inline std::vector<std::string> split_list(const std::string& s) {
+	std::vector<std::string> list;
+	std::string item;
+	for (const char c : s + ",") {
+		if (c == ',') {
+			if (trim(item).size() > 0) list.push_back(trim(item));
+			item.clear();
+		}
+		else item += c;
+	}
+	return list;
+}
+
+#endif
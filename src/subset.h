@@ -0,0 +1,365 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _subset_H
+#define _subset_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+
+#include "general_utils.h"
+#include "logger.h"
+#include "geophysics_netcdf.hpp"
+#include "ncvar_utils.h"
+#include "linecache.h"
+
+extern class cLogger glog;
+
+//Selection criteria and resource limits for cSubsetEngine
+struct cSubsetOptions {
+	size_t stride = 1;//keep every stride'th selected sample of each line
+
+	bool usebbox = false;
+	double xmin = 0.0, ymin = 0.0, xmax = 0.0, ymax = 0.0;
+	std::string xvar;//empty to look for the usual names
+	std::string yvar;
+
+	std::vector<long long> lines;//line numbers to keep, empty for all
+
+	bool usefidrange = false;
+	double fidmin = 0.0, fidmax = 0.0;
+	std::string fidvar;
+
+	std::vector<std::string> include;//variables to copy, empty for all
+	std::vector<std::string> exclude;//variables not to copy
+
+	size_t budgetbytes = 1073741824;//memory shared by all the worker threads
+	size_t nthreads = 0;//0 for the number of hardware threads
+};
+
+//Extracts a subset of the lines and samples of a geophysics NetCDF file into a new file.
+//Samples are selected line by line from the coordinates and fiducials, then variables are
+//streamed through in blocks of adjacent selected lines within a memory budget.
+//Several variables are processed concurrently, although the NetCDF calls themselves are serialised
+//as the library is not thread safe, so the gain is in overlapping the gathering with the reading and writing.
+class cSubsetEngine {
+
+	const GeophysicsNetCDF::GFile& In;
+	GeophysicsNetCDF::GFile& Out;
+	cSubsetOptions O;
+
+	std::vector<size_t> InStart;
+	std::vector<size_t> InCount;
+	std::vector<size_t> SelLines;//input line index of each output line
+	std::vector<std::vector<size_t>> SelSamples;//per output line, the selected sample offsets within the input line
+	std::vector<size_t> OutStart;
+	size_t NumSelected = 0;
+
+	std::mutex NcMutex;//the netCDF/HDF5 libraries are not thread safe
+
+	std::string find_var(const std::string& name, const std::vector<std::string>& candidates) const {
+		if (name.size() > 0) {
+			if (In.getVar(name).isNull()) {
+				throw(std::runtime_error(_SRC_ + strprint("Variable %s does not exist\n", name.c_str())));
+			}
+			return name;
+		}
+		std::vector<netCDF::NcVar> vars = In.getAllVars();
+		for (const auto& c : candidates) {
+			for (const auto& v : vars) {
+				if (tolower(v.getName()) == tolower(c)) return v.getName();
+			}
+		}
+		return std::string();
+	}
+
+	bool wanted(const std::string& varname) const {
+		auto has = [&](const std::vector<std::string>& list) {
+			for (const auto& s : list) if (tolower(s) == tolower(varname)) return true;
+			return false;
+		};
+		if (O.include.size() > 0 && has(O.include) == false) return false;
+		if (has(O.exclude)) return false;
+		return true;
+	}
+
+	void select() {
+		std::string xname, yname, fidname;
+		if (O.usebbox) {
+			xname = find_var(O.xvar, { "easting", "x", "longitude", "longitude_gda94" });
+			yname = find_var(O.yvar, { "northing", "y", "latitude", "latitude_gda94" });
+			if (xname.size() == 0 || yname.size() == 0) {
+				throw(std::runtime_error(_SRC_ + strprint("Could not find the coordinate variables, use -x and -y\n")));
+			}
+			glog.logmsg("Using %s and %s as the coordinates\n", xname.c_str(), yname.c_str());
+		}
+		if (O.usefidrange) {
+			fidname = find_var(O.fidvar, { "fiducial", "fid" });
+			if (fidname.size() == 0) {
+				throw(std::runtime_error(_SRC_ + strprint("Could not find the fiducial variable, use -fid\n")));
+			}
+			glog.logmsg("Using %s as the fiducial\n", fidname.c_str());
+		}
+
+		std::vector<long long> linenumbers;
+		In.getLineNumbers(linenumbers);
+		std::set<long long> keeplines(O.lines.begin(), O.lines.end());
+
+		//The criteria are in real world units, so packed values are unpacked and nulls never selected
+		double xnull = 0.0, ynull = 0.0, fidnull = 0.0;
+		sPacking xpack, ypack, fidpack;
+		if (O.usebbox) {
+			xnull = In.getGeophysicsVar(xname).missingvalue(double());
+			ynull = In.getGeophysicsVar(yname).missingvalue(double());
+			xpack = sPacking(In.getVar(xname));
+			ypack = sPacking(In.getVar(yname));
+		}
+		if (O.usefidrange) {
+			fidnull = In.getGeophysicsVar(fidname).missingvalue(double());
+			fidpack = sPacking(In.getVar(fidname));
+		}
+
+		//The file is not used directly while the cache is reading ahead
+		const size_t nlines = In.nlines();
+		cLineCache C(In, O.budgetbytes);
+		std::vector<double> x, y, fid;
+		for (size_t li = 0; li < nlines; li++) {
+			if (keeplines.size() > 0 && keeplines.count(linenumbers[li]) == 0) continue;
+			if (O.usebbox) {
+				C.getLine(xname, li, x);
+				C.getLine(yname, li, y);
+				xpack.unpack(x, xnull);
+				ypack.unpack(y, ynull);
+			}
+			if (O.usefidrange) {
+				C.getLine(fidname, li, fid);
+				fidpack.unpack(fid, fidnull);
+			}
+
+			std::vector<size_t> s;
+			size_t k = 0;
+			for (size_t si = 0; si < InCount[li]; si++) {
+				if (O.usebbox) {
+					if (x[si] == xnull || y[si] == ynull) continue;
+					if (x[si] < O.xmin || x[si] > O.xmax) continue;
+					if (y[si] < O.ymin || y[si] > O.ymax) continue;
+				}
+				if (O.usefidrange) {
+					if (fid[si] == fidnull) continue;
+					if (fid[si] < O.fidmin || fid[si] > O.fidmax) continue;
+				}
+				if (k++ % O.stride == 0) s.push_back(si);
+			}
+			if (s.size() == 0) continue;
+			SelLines.push_back(li);
+			SelSamples.push_back(s);
+		}
+
+		OutStart.resize(SelLines.size());
+		NumSelected = 0;
+		for (size_t k = 0; k < SelLines.size(); k++) {
+			OutStart[k] = NumSelected;
+			NumSelected += SelSamples[k].size();
+		}
+		glog.logmsg("Selected %zu samples on %zu lines\n", NumSelected, SelLines.size());
+	}
+
+	//First selected line of each block of adjacent selected lines that fits in the budget, then SelLines.size()
+	std::vector<size_t> blocks(const size_t recordbytes, const size_t budgetbytes) const {
+		std::vector<size_t> b;
+		size_t k = 0;
+		while (k < SelLines.size()) {
+			b.push_back(k);
+			size_t bytes = InCount[SelLines[k]] * recordbytes;
+			k++;
+			while (k < SelLines.size() && SelLines[k] == SelLines[k - 1] + 1) {
+				const size_t n = InCount[SelLines[k]] * recordbytes;
+				if (bytes + n > budgetbytes) break;
+				bytes += n;
+				k++;
+			}
+		}
+		b.push_back(SelLines.size());
+		return b;
+	}
+
+	//The copies run on the worker threads, so they are given the dimension sizes found while planning
+	//rather than inquiring (which is also a library call) outside the lock
+	template<typename T>
+	void copy_samplevar(const netCDF::NcVar& iv, const netCDF::NcVar& ov, const std::vector<size_t>& dimsizes, const size_t budgetbytes) {
+		std::vector<size_t> countp = dimsizes;
+		size_t nbands = 1;
+		for (size_t i = 1; i < countp.size(); i++) nbands *= countp[i];
+		std::vector<size_t> startp(countp.size(), 0);
+
+		std::vector<size_t> b = blocks(nbands * sizeof(T), budgetbytes);
+		std::vector<T> in, out;
+		for (size_t bi = 0; bi + 1 < b.size(); bi++) {
+			const size_t k0 = b[bi];
+			const size_t k1 = b[bi + 1];
+			const size_t first = InStart[SelLines[k0]];
+			const size_t last = InStart[SelLines[k1 - 1]] + InCount[SelLines[k1 - 1]];
+			in.resize((last - first) * nbands);
+			startp[0] = first;
+			countp[0] = last - first;
+			{
+				std::lock_guard<std::mutex> lock(NcMutex);
+				iv.getVar(startp, countp, in.data());
+			}
+
+			const size_t nout = OutStart[k1 - 1] + SelSamples[k1 - 1].size() - OutStart[k0];
+			out.resize(nout * nbands);
+			size_t o = 0;
+			for (size_t k = k0; k < k1; k++) {
+				const size_t lineoffset = InStart[SelLines[k]] - first;
+				for (const size_t si : SelSamples[k]) {
+					std::copy_n(in.begin() + (lineoffset + si) * nbands, nbands, out.begin() + o * nbands);
+					o++;
+				}
+			}
+			startp[0] = OutStart[k0];
+			countp[0] = nout;
+			{
+				std::lock_guard<std::mutex> lock(NcMutex);
+				ov.putVar(startp, countp, out.data());
+			}
+		}
+	}
+
+	template<typename T>
+	void copy_linevar(const netCDF::NcVar& iv, const netCDF::NcVar& ov, const std::vector<size_t>& dimsizes) {
+		const std::vector<size_t>& countp = dimsizes;
+		size_t nbands = 1;
+		for (size_t i = 1; i < countp.size(); i++) nbands *= countp[i];
+
+		std::vector<T> in(countp[0] * nbands);
+		{
+			std::lock_guard<std::mutex> lock(NcMutex);
+			iv.getVar(in.data());
+		}
+		std::vector<T> out(SelLines.size() * nbands);
+		for (size_t k = 0; k < SelLines.size(); k++) {
+			std::copy_n(in.begin() + SelLines[k] * nbands, nbands, out.begin() + k * nbands);
+		}
+		std::lock_guard<std::mutex> lock(NcMutex);
+		ov.putVar(out.data());
+	}
+
+	template<typename T>
+	void copy_othervar(const netCDF::NcVar& iv, const netCDF::NcVar& ov, const std::vector<size_t>& dimsizes) {
+		size_t n = 1;
+		for (const size_t d : dimsizes) n *= d;
+		std::vector<T> buf(n);
+		std::lock_guard<std::mutex> lock(NcMutex);
+		iv.getVar(buf.data());
+		ov.putVar(buf.data());
+	}
+
+public:
+
+	cSubsetEngine(const GeophysicsNetCDF::GFile& infile, GeophysicsNetCDF::GFile& outfile, const cSubsetOptions& options)
+		: In(infile), Out(outfile)
+	{
+		O = options;
+		if (O.stride == 0) O.stride = 1;
+		if (O.nthreads == 0) O.nthreads = std::max(1u, std::thread::hardware_concurrency());
+		get_line_index(In, InStart, InCount);
+	}
+
+	size_t nselectedlines() const { return SelLines.size(); }
+	size_t nselectedsamples() const { return NumSelected; }
+
+	bool run() {
+		glog.logmsg("Selecting samples\n");
+		select();
+		if (SelLines.size() == 0) {
+			glog.logmsg("Warning: no samples were selected\n");
+			return false;
+		}
+
+		std::vector<long long> linenumbers;
+		In.getLineNumbers(linenumbers);
+		std::vector<size_t> outlinenumbers(SelLines.size());
+		std::vector<size_t> outcounts(SelLines.size());
+		for (size_t k = 0; k < SelLines.size(); k++) {
+			outlinenumbers[k] = (size_t)linenumbers[SelLines[k]];
+			outcounts[k] = SelSamples[k].size();
+		}
+		Out.InitialiseNew(outlinenumbers, outcounts);
+
+		//Define every variable before writing any data
+		enum class eKind { SAMPLE, LINE, OTHER };
+		struct sJob { netCDF::NcVar in; netCDF::NcVar out; eKind kind; std::string name; nc_type type; std::vector<size_t> dimsizes; };
+		std::vector<sJob> jobs;
+		for (const netCDF::NcVar& v : In.getAllVars()) {
+			const std::string name = v.getName();
+			if (Out.getVar(name).isNull() == false) continue;//the line index or an already copied coordinate variable
+			if (wanted(name) == false) continue;
+
+			eKind kind = eKind::OTHER;
+			if (In.isSampleVar(v)) kind = eKind::SAMPLE;
+			else if (In.isLineVar(v)) kind = eKind::LINE;
+			else {
+				bool indexed = false;
+				for (const auto& d : v.getDims()) {
+					if (d.getName() == GeophysicsNetCDF::DN_POINT || d.getName() == GeophysicsNetCDF::DN_LINE) indexed = true;
+				}
+				if (indexed) {
+					glog.logmsg("Skipping %s as it is indexed by point or line but not in its first dimension\n", name.c_str());
+					continue;
+				}
+			}
+			std::vector<size_t> dimsizes;
+			for (const auto& d : v.getDims()) dimsizes.push_back(d.getSize());
+			jobs.push_back(sJob{ v, define_var_like(Out, In, v), kind, name, v.getType().getId(), dimsizes });
+		}
+
+		glog.logmsg("Copying %zu variables with %zu threads\n", jobs.size(), O.nthreads);
+		const size_t nthreads = std::min(O.nthreads, jobs.size());
+		const size_t budget = O.budgetbytes / std::max((size_t)1, nthreads);
+		std::atomic<size_t> next(0);
+		std::vector<std::string> errors;
+		auto worker = [&]() {
+			size_t j;
+			while ((j = next++) < jobs.size()) {
+				const sJob& job = jobs[j];
+				try {
+					nctype_dispatch(job.type, [&](auto t) {
+						typedef decltype(t) T;
+						if (job.kind == eKind::SAMPLE) copy_samplevar<T>(job.in, job.out, job.dimsizes, budget);
+						else if (job.kind == eKind::LINE) copy_linevar<T>(job.in, job.out, job.dimsizes);
+						else copy_othervar<T>(job.in, job.out, job.dimsizes);
+					});
+				}
+				catch (std::exception& e) {
+					std::lock_guard<std::mutex> lock(NcMutex);
+					errors.push_back(job.name + ": " + e.what());
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < nthreads; i++) threads.emplace_back(worker);
+		for (auto& t : threads) t.join();
+
+		if (errors.size() > 0) {
+			std::string msg;
+			for (const auto& e : errors) msg += e + "\n";
+			throw(std::runtime_error(_SRC_ + msg));
+		}
+		return true;
+	}
+};
+
+#endif
@@ -6,13 +6,23 @@ The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.htm
 Author: Ross C. Brodie, Geoscience Australia.
 */
 
+#ifdef ENABLE_MPI
 #include "mpi.h"
+#endif
 #include "netcdf.h"
 
 #include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <map>
 #include <netcdf>
 #include <vector>
 #include <limits>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <filesystem>
+#include <memory>
 
 #include "marray.hxx"
 using namespace andres;
@@ -24,6 +34,13 @@ using namespace andres;
 #include "geophysics_netcdf.hpp"
 #include "stopwatch.h"
 #include "logger.h"
+#include "mpi_linewriter.h"
+#include "linecache.h"
+#include "bandmajor.h"
+#include "marray_io.h"
+#include "ncvar_utils.h"
+#include "compression_policy.h"
+#include "string_list.h"
 
 using namespace netCDF;
 using namespace netCDF::exceptions;
@@ -31,353 +48,719 @@ using namespace GeophysicsNetCDF;
 
 class cLogger glog;
 
-bool example_magnetics(){
-
-	bool status;		
-	std::string indir,ncpath;
-	
-	indir   = "http://dapds00.nci.org.au/thredds/dodsC/uc0/rr2_dev/rcb547/AWAGS_Levelled_Line_Databases/mag_database_reformat_2016_adjusted/netcdf/";
-	ncpath  = indir + "GSSA_P1255MAG_Warrina.nc";
-             
-	//indir  = R"(Z:\projects\geophysics_netcdf\ncfiles\)";	
-	//ncpath = indir + "P1152MAG_V2.nc";
-
-
-	//Open the file and initialise the indexes
-	GFile ncfile(ncpath, NcFile::read);
-
-	//Get the line numbers using the standard_name attributes
-	std::vector<int> linenumber   = ncfile.getLineNumbers();
-	std::vector<int> flightnumber = ncfile.getFlightNumbers();
-
-	std::string stdname_x         = "longitude";
-	std::string stdname_y         = "latitude";
-	std::string stdname_tielev    = "total_magnetic_intensity_anomaly_tie_line_levelled";
-	std::string stdname_mlev      = "total_magnetic_intensity_anomaly_micro_levelled";
-	std::string stdname_awagslev  = "total_magnetic_intensity_anomaly_datum_levelled";
-	
-	std::string xvarname = ncfile.getVarNameByLongName(stdname_x);
-	std::string yvarname = ncfile.getVarNameByLongName(stdname_y);
-	std::string mvarname = ncfile.getVarNameByLongName(stdname_awagslev);
-
-	//Get 21th line number and index
-	size_t lnum = linenumber[20];
-	size_t lind = ncfile.getLineIndex(lnum);
-	
-	//Get mag data for 21th line by number and index
-	std::vector<double> v1darray;
-	status = ncfile.getDataByLineNumber(mvarname, lnum, v1darray);
-	status = ncfile.getDataByLineIndex(mvarname, lind, v1darray);
-
-	//Loop over all lines getting the x, y, and mag values
-	std::vector<double> x, y; std::vector<float>  mag;
-	GSampleVar xvar = ncfile.getSampleVar(xvarname);
-	GSampleVar yvar = ncfile.getSampleVar(yvarname);
-	GSampleVar mvar = ncfile.getSampleVar(mvarname);
-	
-	double t, ta, tb;
-	ta = gettime(); status = xvar.getAll(x); tb = gettime();
-	glog.logmsg("Get all of x (%lu doubles) - time=%lf s\n", x.size(), tb - ta);
-	ta = gettime(); status = yvar.getAll(x); tb = gettime();
-	glog.logmsg("Get all of y (%lu doubles) - time=%lf s\n", x.size(), tb - ta);
-	ta = gettime(); status = mvar.getAll(mag); tb = gettime();
-	glog.logmsg("Get all of mag (%lu floats) - time=%lf s\n", x.size(), tb - ta);
-
-	t = 0;
-	for (size_t li = 0; li < ncfile.nlines(); li += 100){
-		ta = gettime();	
-		status = xvar.getLine(li, x);
-		status = yvar.getLine(li, y);
-		status = mvar.getLine(li, mag);		
-		tb = gettime();
-		glog.logmsg("%lu nsamples=%lu - time=%lf s\n", li, x.size(), tb - ta);
-		t += (tb - ta);
-	}		
-	glog.logmsg("Total every 100th line - time=%lf\n", t);
-	return true;
-}
+//Settings for the synthetic survey and the benchmark run
+struct cBenchmarkOptions {
+	size_t nlines = 100;
+	size_t nsamples = 500;//mean number of samples per line
+	size_t nwindows = 45;
+	size_t nlayers = 30;
+	size_t nrxcomponents = 3;
+	size_t nrandom = 100;
+	size_t repeats = 3;
+	size_t cachebytes = 268435456;
+	unsigned int seed = 1;
+	std::string ncpath = "benchmark.nc";
+	std::string csvpath = "benchmark.csv";
+	std::string jsonpath;
+	std::string label;
+	bool keep = false;
+	bool bandmajor = false;
+	std::string quantize;//mode:nsd applied to the float variables, e.g. granular:3
+	int deflate = 0;//deflate level of the float variables, 0 for the library default
+	bool compresstrial = false;
+};
+
+//Timing results of one access pattern on one variable
+struct cBenchmarkResult {
+	std::string test;
+	std::string variable;
+	std::string storage;
+	size_t bytes = 0;
+	std::vector<double> times;
+
+	double tmin() const { return *std::min_element(times.begin(), times.end()); }
+	double tmax() const { return *std::max_element(times.begin(), times.end()); }
+	double tmean() const { return std::accumulate(times.begin(), times.end(), 0.0) / (double)times.size(); }
+	double mbps() const { return tmin() > 0.0 ? (double)bytes / 1048576.0 / tmin() : 0.0; }
+};
+
+class cBenchmark {
+
+	cBenchmarkOptions O;
+	std::vector<cBenchmarkResult> Results;
+	size_t FileBytes = 0;
+	size_t RawBytes = 0;//uncompressed size of all the variables' data
+
+public:
+
+	cBenchmark(const cBenchmarkOptions& options) {
+		O = options;
+	}
+
+	static std::string buildstring() {
+#if defined(_MSC_VER)
+		std::string compiler = strprint("MSVC %d", _MSC_VER);
+#elif defined(__VERSION__)
+		std::string compiler = std::string("GCC-compatible ") + __VERSION__;
+#else
+		std::string compiler = "unknown";
+#endif
+		return strprint("netcdf %s; %s; compiled %s %s", nc_inq_libvers(), compiler.c_str(), __DATE__, __TIME__);
+	}
 
-bool example_aem_conductivity(){
-	bool status; double t1, t2;
-	//std::string indir  = R"(Z:\projects\geophysics_netcdf\ncfiles\)";	
-	std::string indir = R"(Y:\ops\gap\geophysical_methods\mag_rad\AWAGS_Levelled_Databases\rb_working\aem\ncfiles\)";
-
-	//std::string indir  = "http://dapds00.nci.org.au/thredds/dodsC/uc0/rr2_dev/rcb547/AEM_examples/";
-	std::string ncpath = indir + "AUS_10008_WestK_LCI.nc";	
-	//Open the file, get the line numbers
-	GFile ncfile(ncpath, NcFile::write);						
-	std::vector<int> linenumber = ncfile.getLineNumbers();
-	//Determine conductivity variable name by its standard name attribute
-	std::string stdname_conductivity = "layer_conductivity";
-	std::string varname = ncfile.getVarNameByLongName(stdname_conductivity);	
-	//Get conductivity variable
-	GSampleVar vc = ncfile.getSampleVar(varname);
-	//Get conductivity data all at once in 1d array
-	std::vector<float> c1darray;
-	t1 = gettime();	status = vc.getAll(c1darray); t2 = gettime();
-	glog.logmsg("Get all at once (%lu floats) - time=%lf s\n", c1darray.size(), t2-t1);
-	//Get conductivity line by line and band by band in 1d array
-	t1 = gettime();
-	for (size_t li = 0; li < ncfile.nlines(); li++){	
-		for (size_t bi = 0; bi < vc.nbands(); bi++){			
-			//status = vc.getLine(li, bi, c1darray);
-			if (status == false)glog.logmsg("Error");
+	//A string as the contents of a JSON string literal
+	static std::string json_escape(const std::string& s) {
+		std::string e;
+		for (const char c : s) {
+			if (c == '"' || c == '\\') {
+				e += '\\';
+				e += c;
+			}
+			else if (c == '\n') e += "\\n";
+			else if (c == '\r') e += "\\r";
+			else if (c == '\t') e += "\\t";
+			else if ((unsigned char)c < 0x20) e += strprint("\\u%04x", (unsigned)c);
+			else e += c;
 		}
-	} t2 = gettime(); glog.logmsg("Get line by line and band by band in 1d array - time=%lf s\n", t2 - t1);
-	//Get conductivity line by line in 2d array
-	t1 = gettime();
-	std::vector<std::vector<float>> c2darray;
-	for (size_t li = 0; li < ncfile.nlines(); li++){	
-		status = ncfile.getDataByLineIndex(varname, li, c2darray);
-		if (status == false)glog.logmsg("Error");
-	} t2 = gettime(); glog.logmsg("Get line by line in 2D array - time=%lf s\n", t2-t1);
-	return true;	
-}
+		return e;
+	}
 
-bool test_create(){
-	std::string ncpath = "test.nc";
-	deletefile(ncpath);
-	std::vector<size_t> linenumbers   = { 100, 200, 300, 400 };
-	std::vector<size_t> linensamples  = { 10,   20,  30,  40 };
-	std::vector<size_t> flightnumbers = {11, 22, 33, 44 };
+	//A CSV field quoted as in RFC 4180, with any double quotes doubled
+	static std::string csv_quote(const std::string& s) {
+		std::string q = "\"";
+		for (const char c : s) {
+			if (c == '"') q += '"';
+			q += c;
+		}
+		return q + "\"";
+	}
 
-	GFile   nc(ncpath,NcFile::FileMode::replace);
-	nc.InitialiseNew(linenumbers, linensamples);
-	size_t nwindows = 45;
-	size_t nlayers  = 30;
-	size_t nrxcomponents = 3;
+	//Describe the chunking and compression of a variable so results from different builds can be compared
+	static std::string storagestring(const NcVar& var) {
+		NcVar::ChunkMode mode;
+		std::vector<size_t> chunks;
+		var.getChunkingParameters(mode, chunks);
+		std::string s = (mode == NcVar::nc_CHUNKED) ? "chunked" : "contiguous";
+		for (size_t i = 0; i < chunks.size(); i++) {
+			s += (i == 0 ? "=" : "x") + std::to_string(chunks[i]);
+		}
+		bool shuffle, deflate; int level;
+		var.getCompressionParameters(shuffle, deflate, level);
+		if (shuffle) s += " shuffle";
+		if (deflate) s += strprint(" deflate=%d", level);
+		const std::string q = quantize_string(var);
+		if (q.size() > 0) s += " quantize=" + q;
+		return s;
+	}
 
-	size_t ntotalsamples = nc.ntotalsamples();
-	std::vector<int> fid = increment(ntotalsamples,0,1);
-	std::vector<int> layers = increment(nlayers,0,1);
-	std::vector<int> windows = increment(nwindows,0,1);
-	std::vector<int> rxcomponents = increment(nrxcomponents,0,1);
-	
-	NcDim dim_rxcomponent = nc.addDimVar("rxcomponents", rxcomponents);
-	NcDim dim_window = nc.addDimVar("windows", windows);	
-	NcDim dim_layer  = nc.addDimVar("layers", layers);
-	
-	bool status;
-	status = nc.addSampleVar("fiducial", ncInt);
-	GSampleVar vfid = nc.getSampleVar("fiducial");
-	vfid.add_long_name("fiducial");
-	vfid.add_units("1");
-	vfid.add_missing_value(34);
-
-	status = nc.addSampleVar("easting", ncDouble);
-	GSampleVar vx   = nc.getSampleVar("easting");
-	vx.add_long_name("X");
-	vx.add_units("m");
-	
-	status = nc.addSampleVar("northing", ncDouble);
-	GSampleVar vy = nc.getSampleVar("northing");
-	
-	status = nc.addSampleVar("conductivity", ncDouble, dim_layer);
-	GSampleVar vconductivity = nc.getSampleVar("conductivity");
-	vconductivity.add_long_name("conductivity");
-	vconductivity.add_units("mS/m");
-	vconductivity.add_missing_value(-999);
-
-	status = nc.addSampleVar("thickness", ncDouble, dim_layer);
-	GSampleVar vthickness = nc.getSampleVar("thickness");
-	vthickness.add_long_name("thickness");
-	vthickness.add_units("m");
-	vthickness.add_missing_value(-999);
-
-	status = nc.addLineVar("flight", ncInt);
-	GLineVar vflight = nc.getLineVar("flight");
-	vflight.putAll(flightnumbers);
-
-	std::vector<NcDim> emdims = { dim_rxcomponent, dim_window };
-	status = nc.addSampleVar("em", ncDouble, emdims);
-	GSampleVar vem = nc.getSampleVar("em");
-		
-	const size_t n = ntotalsamples*nrxcomponents*nwindows;
-	std::vector<double> em = increment(n,0.0,1.0);		
-	vfid.putAll(fid);
-	vem.putAll(em);
-
-	for (size_t li = 0; li < nc.nlines(); li++){
-		size_t nls = nc.nlinesamples(li);
-		std::vector<double> x = increment(nls,500000.0,10.0);
-		std::vector<double> y = increment(nls,6500000.0,10.0);
-		
-		vx.putLine(li, x);
-		vy.putLine(li, y);
-		
-		for (size_t bi = 0; bi < nlayers; bi++){
-			std::vector<double> c(nls, li*10.0+bi);
-			vconductivity.putLineBand(li, bi, c);
+	//Generates a synthetic AEM style survey of configurable size, a generalisation of the old test_create()
+	bool create_synthetic() {
+		deletefile(O.ncpath);
+		std::mt19937 rng(O.seed);
+		std::uniform_int_distribution<size_t> jitter(O.nsamples / 2, O.nsamples + O.nsamples / 2);
+
+		std::vector<size_t> linenumbers(O.nlines);
+		std::vector<size_t> linensamples(O.nlines);
+		std::vector<size_t> flightnumbers(O.nlines);
+		for (size_t li = 0; li < O.nlines; li++) {
+			linenumbers[li] = 100 + li * 10;
+			linensamples[li] = std::max((size_t)1, jitter(rng));
+			flightnumbers[li] = 1 + li / 10;
 		}
 
-		for (size_t bi = 0; bi < nlayers; bi++){
-			std::vector<double> t(nls, li * 100.0 + bi);
-			vthickness.putLineBand(li, bi, t);
+		GFile nc(O.ncpath, NcFile::FileMode::replace);
+		nc.InitialiseNew(linenumbers, linensamples);
+		size_t ntotalsamples = nc.ntotalsamples();
+
+		std::vector<int> layers = increment(O.nlayers, 0, 1);
+		std::vector<int> windows = increment(O.nwindows, 0, 1);
+		std::vector<int> rxcomponents = increment(O.nrxcomponents, 0, 1);
+		NcDim dim_rxcomponent = nc.addDimVar("rxcomponents", rxcomponents);
+		NcDim dim_window = nc.addDimVar("windows", windows);
+		NcDim dim_layer = nc.addDimVar("layers", layers);
+
+		GSampleVar vfid = nc.addgetSampleVar("fiducial", ncInt);
+		vfid.add_long_name("fiducial");
+		vfid.add_units("1");
+
+		GSampleVar vx = nc.addgetSampleVar("easting", ncDouble);
+		vx.add_long_name("X");
+		vx.add_units("m");
+
+		GSampleVar vy = nc.addgetSampleVar("northing", ncDouble);
+		vy.add_long_name("Y");
+		vy.add_units("m");
+
+		GSampleVar vconductivity = nc.addgetSampleVar("conductivity", ncFloat, dim_layer);
+		vconductivity.add_long_name("conductivity");
+		vconductivity.add_units("mS/m");
+
+		std::vector<NcDim> emdims = { dim_rxcomponent, dim_window };
+		GSampleVar vem = nc.addgetSampleVar("em", ncFloat, emdims);
+		vem.add_long_name("em");
+		vem.add_units("fT");
+
+		for (GSampleVar* v : { &vconductivity, &vem }) {
+			if (O.deflate > 0) v->setCompression(true, true, O.deflate);
+			if (O.quantize.size() > 0) {
+				const size_t colon = O.quantize.find(':');
+				const std::string mode = O.quantize.substr(0, colon);
+				const int nsd = colon == std::string::npos ? 3 : atoi(O.quantize.substr(colon + 1).c_str());
+				if (set_quantize(*v, mode, nsd) == false) glog.logmsg("Warning: could not quantize %s\n", v->getName().c_str());
+			}
 		}
-		
-	}		
-	return true;
-};
 
-bool test_update(){
-	std::string ncpath = "test.nc";
-	GFile   nc(ncpath, NcFile::FileMode::write);	
-	size_t ntotalsamples = nc.ntotalsamples();
-	GLineVar   lv = nc.addgetLineVar("extralinevar", ncDouble);
-	GSampleVar sv = nc.addgetSampleVar("extrasamplevar", ncDouble);
-	GSampleVar svw = nc.addgetSampleVar("extrasamplevarwindow", ncDouble,nc.getDim("windows"));
-
-	NcDim ed = nc.addDim("extradim", 400);
-	GSampleVar sve = nc.addgetSampleVar("extrawindowsamplevarextradim", ncDouble, ed);
-
-	GSampleVar ev = nc.getSampleVar("easting");
-	std::vector<double> e;
-	bool status = ev.getAll(e);
-	status = ev.getLine(1, e);
-	e += 1.0;	
-	status = ev.putLine(1, e);
-
-	GSampleVar vem = nc.getSampleVar("em");
-	std::vector<double> em;
-	status = vem.getAll(em);
-	status = vem.getLine(0,em);
-	em *= 0.0;	
-	status = vem.putLine(0,em);	
-	return true;
-};
+		GLineVar vflight = nc.addgetLineVar("flight", ncInt);
+		vflight.putAll(flightnumbers);
+
+		std::vector<int> fid = increment(ntotalsamples, 0, 1);
+		vfid.putAll(fid);
+
+		std::normal_distribution<float> noise(0.0f, 1.0f);
+		const size_t nem = O.nrxcomponents * O.nwindows;
+		for (size_t li = 0; li < nc.nlines(); li++) {
+			size_t nls = nc.nlinesamples(li);
+			std::vector<double> x = increment(nls, 500000.0, 10.0);
+			std::vector<double> y(nls, 6500000.0 + 200.0 * li);
+			vx.putLine(li, x);
+			vy.putLine(li, y);
+
+			std::vector<float> c(nls * O.nlayers);
+			for (size_t si = 0; si < nls; si++) {
+				for (size_t bi = 0; bi < O.nlayers; bi++) {
+					c[si * O.nlayers + bi] = 10.0f + 0.1f * bi + 0.01f * noise(rng);
+				}
+			}
+			vconductivity.putLine(li, c);
+
+			std::vector<float> em(nls * nem);
+			for (size_t si = 0; si < nls; si++) {
+				for (size_t k = 0; k < nem; k++) {
+					em[si * nem + k] = 1000.0f / (1.0f + k) + noise(rng);
+				}
+			}
+			vem.putLine(li, em);
+		}
+		if (O.bandmajor) {
+			add_bandmajor_variable(nc, "conductivity");
+			add_bandmajor_variable(nc, "em");
+		}
+		RawBytes = 0;
+		for (const NcVar& v : nc.getAllVars()) {
+			size_t n = v.getType().getSize();
+			for (const NcDim& d : v.getDims()) n *= d.getSize();
+			RawBytes += n;
+		}
+		nc.close();
+		FileBytes = (size_t)std::filesystem::file_size(O.ncpath);
+		return true;
+	}
 
-bool test_aseggdfexport_1d(){
-	//std::string indir  = R"(Z:\projects\geophysics_netcdf\ncfiles\)";
-	std::string indir = R"(Y:\ops\gap\geophysical_methods\mag_rad\AWAGS_Levelled_Databases\rb_working\awags_conversions\ncfiles\)";
-	std::string ncpath  = indir + "P1152RAD.nc";
-	std::string datpath = indir + "P1152RAD.dat";
-	std::string dfnpath = indir + "P1152RAD.dfn";
-	GFile nc(ncpath, NcFile::FileMode::read);
-	nc.export_ASEGGDF2(datpath,dfnpath);
-	return true;
-};
+	template<typename F>
+	void time(const std::string& test, const GSampleVar& var, const size_t bytes, F f) {
+		cBenchmarkResult r;
+		r.test = test;
+		r.variable = var.getName();
+		r.storage = storagestring(var);
+		r.bytes = bytes;
+		for (size_t k = 0; k < O.repeats; k++) {
+			double t1 = gettime();
+			f();
+			double t2 = gettime();
+			r.times.push_back(t2 - t1);
+		}
+		glog.logmsg("%-22s %-14s %10.4lf s %10.1lf MB/s\n", r.test.c_str(), r.variable.c_str(), r.tmin(), r.mbps());
+		Results.push_back(r);
+	}
 
-bool test_aseggdfexport_2d(){
-	//std::string indir = R"(Z:\projects\geophysics_netcdf\aem\)";
-	std::string indir   = R"(Y:\ops\gap\geophysical_methods\mag_rad\AWAGS_Levelled_Databases\rb_working\aem\ncfiles\)";
-	std::string ncpath  = indir + "AUS_10008_WestK_LCI.nc";
-	std::string datpath = indir + "AUS_10008_WestK_LCI.dat";
-	std::string dfnpath = indir + "AUS_10008_WestK_LCI.dfn";
-	GFile nc(ncpath, NcFile::FileMode::read);
-	nc.export_ASEGGDF2(datpath, dfnpath);
-	return true;
-};
+	template<typename T>
+	void run_variable(GFile& nc, const std::string& varname) {
+		GSampleVar var = nc.getSampleVar(varname);
+		const size_t nbands = var.nbands();
+		const size_t nbytes = nc.ntotalsamples() * nbands * sizeof(T);
+
+		time("getAll", var, nbytes, [&]() {
+			std::vector<T> v;
+			var.getAll(v);
+		});
+
+		time("getLine", var, nbytes, [&]() {
+			std::vector<T> v;
+			for (size_t li = 0; li < nc.nlines(); li++) var.getLine(li, v);
+		});
+
+		time("cachedLine", var, nbytes, [&]() {
+			std::vector<T> v;
+			cLineCache C(nc, O.cachebytes);
+			for (size_t li = 0; li < nc.nlines(); li++) C.getLine(varname, li, v);
+		});
+
+		if (nbands > 1) {
+			time("getLineBand", var, nbytes, [&]() {
+				std::vector<T> v;
+				for (size_t li = 0; li < nc.nlines(); li++) {
+					for (size_t bi = 0; bi < nbands; bi++) var.getLineBand(li, bi, v);
+				}
+			});
+
+			time("routedLineBand", var, nbytes, [&]() {
+				std::vector<T> v;
+				cBandRouter R(nc);
+				for (size_t li = 0; li < nc.nlines(); li++) {
+					for (size_t bi = 0; bi < nbands; bi++) R.getLineBand(varname, li, bi, v);
+				}
+			});
+
+			time("getDataByLineIndex2D", var, nbytes, [&]() {
+				std::vector<std::vector<T>> v;
+				for (size_t li = 0; li < nc.nlines(); li++) nc.getDataByLineIndex(varname, li, v);
+			});
+
+			time("marrayLine", var, nbytes, [&]() {
+				Marray<T> a;
+				cMarrayLineIO IO(nc);
+				for (size_t li = 0; li < nc.nlines(); li++) IO.getLine(varname, li, a);
+			});
+		}
 
-bool test_columnfile(){
-	std::string datpath = R"(z:\projects\earth_sci_test\test_data\output\inversion.output.dat)";
-	std::string dfnpath = R"(z:\projects\earth_sci_test\test_data\output\inversion.output.dfn)";
-
-	cColumnFile A(datpath,dfnpath);
-	bool status = A.readnextrecord();
-	const std::string& s = A.currentrecordstring();
-	//A.readnextgroup()
-	std::vector<std::vector<int>> intfields;
-	std::vector<std::vector<double>> doublefields;
-	cStopWatch sw;
-	size_t i1 = A.readnextgroup(4, intfields, doublefields);
-	size_t i2 = A.readnextgroup(4, intfields, doublefields);
-	size_t i3 = A.readnextgroup(4, intfields, doublefields);
-	size_t i4 = A.readnextgroup(4, intfields, doublefields);
-	sw.reportnow();
-	prompttocontinue();
-	return true;
-};
+		std::mt19937 rng(O.seed);
+		std::uniform_int_distribution<size_t> pick(0, nc.nlines() - 1);
+		std::vector<size_t> lines(O.nrandom);
+		size_t nrandombytes = 0;
+		for (size_t k = 0; k < O.nrandom; k++) {
+			lines[k] = pick(rng);
+			nrandombytes += nc.nlinesamples(lines[k]) * nbands * sizeof(T);
+		}
+		time("randomLine", var, nrandombytes, [&]() {
+			std::vector<T> v;
+			for (size_t k = 0; k < lines.size(); k++) var.getLine(lines[k], v);
+		});
+	}
 
-bool test_aseggdfheader(){			
-	std::string dfnpath = R"(z:\projects\earth_sci_test\test_data\output\inversion.output.dfn)";	
-	cASEGGDF2Header H(dfnpath);
-	H.write(dfnpath + ".txt");
-	return true;
-};
+	//Store each variable with every candidate compression setting and time decoding it
+	template<typename T>
+	void trial_variable(GFile& nc, const std::string& varname, const nc_type type) {
+		GSampleVar var = nc.getSampleVar(varname);
+		std::vector<T> v;
+		var.getAll(v);
+		const std::string scratchpath = O.ncpath + ".trial.nc";
+		std::vector<sCompressionTrial> trials = trial_compression(v, var.nbands(), type, sCompressionSetting::candidates(), scratchpath, O.repeats);
+		for (const auto& t : trials) {
+			if (t.available == false) {
+				glog.logmsg("%-22s %-14s %-20s not available\n", "compressTrial", varname.c_str(), t.setting.str().c_str());
+				continue;
+			}
+			cBenchmarkResult r;
+			r.test = "compressTrial";
+			r.variable = varname;
+			r.storage = t.setting.str() + strprint(" ratio=%.3lf", t.ratio);
+			r.bytes = v.size() * sizeof(T);
+			r.times.push_back(t.decodeseconds);
+			glog.logmsg("%-22s %-14s %-20s ratio %6.2lf %10.1lf MB/s\n", r.test.c_str(), varname.c_str(), t.setting.str().c_str(), t.ratio, r.mbps());
+			Results.push_back(r);
+		}
+		glog.logmsg("%-22s %-14s chose %s\n", "compressTrial", varname.c_str(), choose_compression(trials).str().c_str());
+	}
 
-void test_marray(){	
-	std::vector<size_t> dims = { 3, 4, 2 };
-	Marray<int> a(dims.data(), dims.data() + dims.size());
-	
-	for (size_t j = 0; j<a.size(); ++j) a(j) = j;
-	
-	
-	std::cout << a.asString() << std::endl;
-	std::cout << a.size() << std::endl;
-
-	dims = { 3, 2, 4 };
-	a.reshape(dims.data(), dims.data() + dims.size());
-
-	std::cout << a.asString() << std::endl;
-	std::cout << a.size() << std::endl;
-};
+	bool run() {
+		glog.logmsg("Build: %s\n", buildstring().c_str());
+		glog.logmsg("Creating synthetic survey %s: %zu lines, ~%zu samples/line, %zu layers, %zu x %zu windows\n", O.ncpath.c_str(), O.nlines, O.nsamples, O.nlayers, O.nrxcomponents, O.nwindows);
+		double t1 = gettime();
+		create_synthetic();
+		double t2 = gettime();
+		glog.logmsg("Created %zu bytes in %.3lf s, compression ratio %.3lf\n", FileBytes, t2 - t1, ratio());
+
+		GFile nc(O.ncpath, NcFile::FileMode::read);
+		run_variable<double>(nc, "easting");
+		run_variable<float>(nc, "conductivity");
+		run_variable<float>(nc, "em");
+		if (O.compresstrial) {
+			trial_variable<double>(nc, "easting", NC_DOUBLE);
+			trial_variable<float>(nc, "conductivity", NC_FLOAT);
+			trial_variable<float>(nc, "em", NC_FLOAT);
+		}
+		nc.close();
 
-void test_subsample() {
-	std::string inncpath = R"(D:\inversion_netcdf\line_data_em\902467_1_Field_Survey_Data_20200826.nc)";
-	std::string outncpath = R"(D:\inversion_netcdf\line_data_em\test.nc)";
-	GFile infile(inncpath, NcFile::FileMode::read);
-	GFile outfile(outncpath, NcFile::FileMode::replace);
+		if (O.csvpath.size() > 0) write_csv();
+		if (O.jsonpath.size() > 0) write_json();
+		if (O.keep == false) deletefile(O.ncpath);
+		return true;
+	}
 
-	std::vector<std::string> include_varnames = { "proj_client", "flight", "flight_index", "longitude", "latitude", "emz_nonhprg" };
-	std::vector<std::string> exclude_varnames = { "easting", "northing" };
-	outfile.subsample(infile,30,include_varnames, exclude_varnames);
-}
+	double ratio() const { return FileBytes > 0 ? (double)RawBytes / (double)FileBytes : 0.0; }
 
-void test_mpi(int argc, char** argv) {
-	
-	int mpisize, mpirank;
-	MPI_Init(&argc, &argv);
-	MPI_Comm_size(MPI_COMM_WORLD, &mpisize);
+	bool write_csv() const {
+		bool writeheader = !exists(O.csvpath);
+		std::ofstream of(O.csvpath, std::ios::app);
+		if (writeheader) {
+			of << "label,build,nlines,nsamples,nlayers,nwindows,filebytes,test,variable,storage,repeats,bytes,tmin,tmean,tmax,mbps,rawbytes,compressionratio" << std::endl;
+		}
+		for (const auto& r : Results) {
+			of << csv_quote(O.label) << "," << csv_quote(buildstring()) << "," << O.nlines << "," << O.nsamples << "," << O.nlayers << "," << O.nrxcomponents * O.nwindows << "," << FileBytes << ",";
+			of << csv_quote(r.test) << "," << csv_quote(r.variable) << "," << csv_quote(r.storage) << "," << r.times.size() << "," << r.bytes << ",";
+			of << strprint("%.6lf,%.6lf,%.6lf,%.3lf,", r.tmin(), r.tmean(), r.tmax(), r.mbps());
+			of << RawBytes << "," << strprint("%.3lf", ratio()) << std::endl;
+		}
+		return true;
+	}
+
+	bool write_json() const {
+		std::ofstream of(O.jsonpath);
+		of << "{" << std::endl;
+		of << "  \"label\": \"" << json_escape(O.label) << "\"," << std::endl;
+		of << "  \"build\": \"" << json_escape(buildstring()) << "\"," << std::endl;
+		of << "  \"survey\": {\"nlines\": " << O.nlines << ", \"nsamples\": " << O.nsamples << ", \"nlayers\": " << O.nlayers << ", \"nwindows\": " << O.nrxcomponents * O.nwindows << ", \"filebytes\": " << FileBytes << ", \"rawbytes\": " << RawBytes << strprint(", \"compressionratio\": %.3lf", ratio()) << "}," << std::endl;
+		of << "  \"results\": [" << std::endl;
+		for (size_t i = 0; i < Results.size(); i++) {
+			const cBenchmarkResult& r = Results[i];
+			of << "    {\"test\": \"" << json_escape(r.test) << "\", \"variable\": \"" << json_escape(r.variable) << "\", \"storage\": \"" << json_escape(r.storage) << "\", ";
+			of << "\"repeats\": " << r.times.size() << ", \"bytes\": " << r.bytes << ", ";
+			of << strprint("\"tmin\": %.6lf, \"tmean\": %.6lf, \"tmax\": %.6lf, \"mbps\": %.3lf}", r.tmin(), r.tmean(), r.tmax(), r.mbps());
+			of << (i + 1 < Results.size() ? "," : "") << std::endl;
+		}
+		of << "  ]" << std::endl;
+		of << "}" << std::endl;
+		return true;
+	}
+};
+
+#ifdef ENABLE_MPI
+//Multi-rank check of cMPILineWriter, run with e.g. mpiexec -n 4 test_geophysics_netcdf -mpitest
+//Every rank puts the lines it owns into a layered variable and the writer rank verifies the result
+bool test_mpi_linewriter(const cBenchmarkOptions& O) {
+	int mpirank, mpisize;
 	MPI_Comm_rank(MPI_COMM_WORLD, &mpirank);
-		
-	//std::string inncpath = R"(D:\inversion_netcdf\line_data_em\902467_1_Field_Survey_Data_20200826.nc)";	
-	std::string inncpath = R"(D:\inversion_netcdf\line_data_em\test.nc)";	
-	
+	MPI_Comm_size(MPI_COMM_WORLD, &mpisize);
+
+	//Only rank 0 touches the file, the line sample counts are broadcast to the other ranks
+	std::vector<unsigned long long> linensamples;
+	unsigned long long nlines = 0;
 	if (mpirank == 0) {
-		GFile nc(inncpath, NcFile::FileMode::write);
-		nc.addSampleVar("newvar", NcType::nc_FLOAT);
-		nc.close();
+		cBenchmark B(O);
+		B.create_synthetic();
+		GFile nc(O.ncpath, NcFile::FileMode::read);
+		nlines = nc.nlines();
+		for (size_t li = 0; li < nc.nlines(); li++) linensamples.push_back(nc.nlinesamples(li));
+	}
+	MPI_Bcast(&nlines, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+	linensamples.resize(nlines);
+	MPI_Bcast(linensamples.data(), (int)nlines, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+
+	std::unique_ptr<GFile> nc;
+	if (mpirank == 0) {
+		nc = std::make_unique<GFile>(O.ncpath, NcFile::FileMode::write);
+		nc->addSampleVar("mpivar", ncInt, nc->getDim("layers"));
+	}
+	cMPILineWriter W(MPI_COMM_WORLD, 0, nc.get());
+	W.barrier();
+
+	size_t startindex = 0;
+	for (size_t li = 0; li < nlines; li++) {
+		const size_t ns = (size_t)linensamples[li];
+		if (W.owns(li)) {
+			std::vector<int> v(ns * O.nlayers);
+			for (size_t k = 0; k < v.size(); k++) v[k] = (int)(startindex * O.nlayers + k);
+			std::vector<size_t> startp = { startindex, 0 };
+			std::vector<size_t> countp = { ns, O.nlayers };
+			W.put("mpivar", startp, countp, v);
+		}
+		startindex += ns;
+	}
+	W.flush();
+
+	bool pass = true;
+	if (mpirank == 0) {
+		nc->close();
+		nc.reset();
+		GFile ncr(O.ncpath, NcFile::FileMode::read);
+		std::vector<int> v;
+		ncr.getSampleVar("mpivar").getAll(v);
+		pass = (v.size() == startindex * O.nlayers);
+		for (size_t k = 0; pass && k < v.size(); k++) {
+			if (v[k] != (int)k) pass = false;
+		}
+		ncr.close();
+		glog.logmsg("MPI line writer test with %d ranks: %s\n", mpisize, pass ? "PASS" : "FAIL");
+		std::cout << "MPI line writer test with " << mpisize << " ranks: " << (pass ? "PASS" : "FAIL") << std::endl;
+		if (O.keep == false) deletefile(O.ncpath);
+	}
+	return W.broadcast(pass);
+}
+#endif
+
+//A small synthetic ASEG-GDF2 survey (.dat and .dfn) for the converter round trip tests, with groupby
+//line fields, a multiband field whose label (COND) differs from its NAME= (conductivity), nulls and lines of different lengths
+bool write_synthetic_aseggdf(const std::string& datpath, const cBenchmarkOptions& O) {
+	const std::string dfnpath = extractfiledirectory(datpath) + extractfilename_noextension(datpath) + ".dfn";
+	const size_t nbands = 5;
+	std::ofstream dfn(dfnpath);
+	dfn << "DEFN   ST=RECD,RT=COMM;RT:A4;COMMENTS:A76" << std::endl;
+	dfn << "DEFN 1 ST=RECD,RT=;line:I8" << std::endl;
+	dfn << "DEFN 2 ST=RECD,RT=;flight:I6" << std::endl;
+	dfn << "DEFN 3 ST=RECD,RT=;fiducial:F12.1" << std::endl;
+	dfn << "DEFN 4 ST=RECD,RT=;easting:F12.2:UNITS=m" << std::endl;
+	dfn << "DEFN 5 ST=RECD,RT=;northing:F12.2:UNITS=m" << std::endl;
+	dfn << "DEFN 6 ST=RECD,RT=;height:F10.2:UNITS=m,NULL=-9999.99" << std::endl;
+	dfn << "DEFN 7 ST=RECD,RT=;COND:" << nbands << "E15.6:UNITS=S/m,NAME=conductivity" << std::endl;
+	dfn << "DEFN 8 ST=RECD,RT=;END DEFN" << std::endl;
+	if (!dfn) return false;
+
+	std::mt19937 rng(O.seed);
+	std::uniform_int_distribution<size_t> jitter(O.nsamples / 2, O.nsamples + O.nsamples / 2);
+	std::uniform_real_distribution<double> noise(0.0, 1.0);
+	FILE* fp = fopen(datpath.c_str(), "w");
+	if (fp == nullptr) return false;
+	double fiducial = 1000.0;
+	for (size_t li = 0; li < O.nlines; li++) {
+		const int linenumber = 100010 + 10 * (int)li;
+		const int flight = 1 + (int)li / 7;
+		const size_t ns = std::max((size_t)1, jitter(rng));
+		for (size_t si = 0; si < ns; si++) {
+			const double e = 500000.0 + 25.0 * (double)si;
+			const double n = 7000000.0 + 200.0 * (double)li + 3.0 * std::sin((double)si / 20.0);
+			const double h = (noise(rng) < 0.05) ? -9999.99 : 30.0 + 10.0 * noise(rng);
+			fprintf(fp, "%8d%6d%12.1lf%12.2lf%12.2lf%10.2lf", linenumber, flight, fiducial, e, n, h);
+			for (size_t bi = 0; bi < nbands; bi++) fprintf(fp, "%15.6E", std::pow(10.0, -3.0 + 2.0 * noise(rng)));
+			fprintf(fp, "\n");
+			fiducial += 0.1;
+		}
+	}
+	return fclose(fp) == 0;
+}
+
+//True if two files have the same groups, dimensions, variables and values, and (other than the root group's, such as
+//CreationTime) attributes. Numeric attributes may differ by a relative 1e-9 as statistics merged from several ranks
+//are summed in a different order.
+bool compare_netcdf_groups(const NcGroup& a, const NcGroup& b, const bool compareattributes) {
+	const std::string path = a.getName(true);
+	bool same = true;
+	auto fail = [&](const std::string& msg) {
+		glog.logmsg("Compare %s: %s\n", path.c_str(), msg.c_str());
+		std::cout << "Compare " << path << ": " << msg << std::endl;
+		same = false;
+	};
+
+	auto compareatts = [&](const auto& aa, const auto& ba, const std::string& owner) {
+		if (aa.size() != ba.size()) fail(strprint("%s has %zu attributes and %zu", owner.c_str(), aa.size(), ba.size()));
+		for (const auto& [name, att] : aa) {
+			auto it = ba.find(name);
+			if (it == ba.end()) {
+				fail(strprint("attribute %s of %s is missing", name.c_str(), owner.c_str()));
+				continue;
+			}
+			const NcAtt& other = it->second;
+			if (att.getType() != other.getType() || att.getAttLength() != other.getAttLength()) {
+				fail(strprint("attribute %s of %s differs in type or length", name.c_str(), owner.c_str()));
+				continue;
+			}
+			if (att.getType().getId() == NC_CHAR) {
+				std::string x, y;
+				att.getValues(x);
+				other.getValues(y);
+				if (x != y) fail(strprint("attribute %s of %s differs: %s and %s", name.c_str(), owner.c_str(), x.c_str(), y.c_str()));
+			}
+			else if (att.getType().getId() != NC_STRING) {
+				std::vector<double> x(att.getAttLength()), y(att.getAttLength());
+				att.getValues(x.data());
+				other.getValues(y.data());
+				for (size_t i = 0; i < x.size(); i++) {
+					const bool bothnan = (x[i] != x[i]) && (y[i] != y[i]);
+					if (bothnan == false && std::fabs(x[i] - y[i]) > 1e-9 * std::max(std::fabs(x[i]), std::fabs(y[i]))) {
+						fail(strprint("attribute %s of %s differs: %.17g and %.17g", name.c_str(), owner.c_str(), x[i], y[i]));
+						break;
+					}
+				}
+			}
+		}
+	};
+
+	const auto adims = a.getDims();
+	const auto bdims = b.getDims();
+	if (adims.size() != bdims.size()) fail(strprint("%zu dimensions and %zu", adims.size(), bdims.size()));
+	for (const auto& [name, d] : adims) {
+		auto it = bdims.find(name);
+		if (it == bdims.end()) fail("dimension " + name + " is missing");
+		else if (it->second.getSize() != d.getSize()) fail(strprint("dimension %s has size %zu and %zu", name.c_str(), d.getSize(), it->second.getSize()));
+	}
+
+	const auto avars = a.getVars();
+	const auto bvars = b.getVars();
+	if (avars.size() != bvars.size()) fail(strprint("%zu variables and %zu", avars.size(), bvars.size()));
+	for (const auto& [name, v] : avars) {
+		auto it = bvars.find(name);
+		if (it == bvars.end()) {
+			fail("variable " + name + " is missing");
+			continue;
+		}
+		const NcVar& w = it->second;
+		if (v.getType() != w.getType() || v.getDimCount() != w.getDimCount()) {
+			fail("variable " + name + " differs in type or dimensions");
+			continue;
+		}
+		size_t n = 1;
+		for (int i = 0; i < v.getDimCount(); i++) {
+			if (v.getDim(i).getSize() != w.getDim(i).getSize()) fail("variable " + name + " differs in shape");
+			n *= v.getDim(i).getSize();
+		}
+		compareatts(v.getAtts(), w.getAtts(), name);
+		if (same == false || n == 0 || v.getType().getId() == NC_STRING) continue;
+		std::vector<char> x(n * v.getType().getSize()), y(n * w.getType().getSize());
+		v.getVar((void*)x.data());
+		w.getVar((void*)y.data());
+		if (x != y) fail("values of " + name + " differ");
 	}
-	MPI_Barrier(MPI_COMM_WORLD);
-
-	GFile nc(inncpath, NcFile::FileMode::write);		
-	GSampleVar var = nc.getSampleVar("newvar");
-	for (size_t li = 0; li < nc.nlines(); li++) {
-		if ((li%mpisize) == mpirank){
-			float v = (float)((mpirank + 1) * 10000 + li);
-			std::vector<float> vals(nc.nlinesamples(li), v);
-			var.putLine(li, vals);
-			std::cout << "Rank " << mpirank << " Lineindex " << li << " v=" << v << std::endl;						
-		}		
+
+	if (compareattributes) compareatts(a.getAtts(), b.getAtts(), "group " + path);
+
+	const auto agroups = a.getGroups();
+	const auto bgroups = b.getGroups();
+	if (agroups.size() != bgroups.size()) fail(strprint("%zu groups and %zu", agroups.size(), bgroups.size()));
+	for (const auto& [name, g] : agroups) {
+		auto it = bgroups.find(name);
+		if (it == bgroups.end()) fail("group " + name + " is missing");
+		else if (compare_netcdf_groups(g, it->second, true) == false) same = false;
 	}
-	nc.sync();
-	MPI_Barrier(MPI_COMM_WORLD);
-	MPI_Finalize();
+	return same;
+}
+
+//True if each of the variables is (or with present false, is not) in the root group of the file
+bool check_variables(const std::string& path, const std::vector<std::string>& varnames, const bool present) {
+	NcFile nc(path, NcFile::read);
+	bool pass = true;
+	for (const auto& name : varnames) {
+		if (nc.getVar(name).isNull() == present) {
+			std::cout << "Check " << path << ": variable " << name << (present ? " is missing" : " should not be present") << std::endl;
+			pass = false;
+		}
+	}
+	return pass;
+}
+
+bool compare_netcdf(const std::string& patha, const std::string& pathb) {
+	NcFile a(patha, NcFile::read);
+	NcFile b(pathb, NcFile::read);
+	const bool same = compare_netcdf_groups(a, b, false);
+	std::cout << "Compare " << patha << " and " << pathb << ": " << (same ? "PASS" : "FAIL") << std::endl;
+	return same;
+}
+
+void usage(const char* program) {
+	std::cout << "Usage: " << extractfilename(program) << " [options]" << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "   -nlines n       number of lines in the synthetic survey" << std::endl;
+	std::cout << "   -nsamples n     mean number of samples per line" << std::endl;
+	std::cout << "   -nlayers n      number of conductivity layers" << std::endl;
+	std::cout << "   -nwindows n     number of EM windows per receiver component" << std::endl;
+	std::cout << "   -nrandom n      number of random line reads" << std::endl;
+	std::cout << "   -repeats n      number of times each access pattern is timed" << std::endl;
+	std::cout << "   -cachemb n      byte budget of the line cache in MB" << std::endl;
+	std::cout << "   -seed n         random number seed" << std::endl;
+	std::cout << "   -nc path        synthetic NetCDF file path" << std::endl;
+	std::cout << "   -csv path       CSV results file (appended to)" << std::endl;
+	std::cout << "   -json path      JSON results file" << std::endl;
+	std::cout << "   -label text     label identifying this run in the results" << std::endl;
+	std::cout << "   -keep           keep the synthetic NetCDF file" << std::endl;
+	std::cout << "   -bandmajor      also write band-major copies of the multiband variables" << std::endl;
+	std::cout << "   -quantize m:n   quantize the float variables with mode bitgroom|granular|bitround to n digits (bits for bitround)" << std::endl;
+	std::cout << "   -deflate n      deflate level of the float variables" << std::endl;
+	std::cout << "   -compresstrial  also store each variable with every candidate compression setting and time decoding it" << std::endl;
+	std::cout << "   -mpitest        run the multi-rank MPI line writer test instead of the benchmark" << std::endl;
+	std::cout << "   -writeaseggdf p write a synthetic ASEG-GDF2 survey to p (.dat) and its .dfn instead of the benchmark" << std::endl;
+	std::cout << "   -compare a b    compare NetCDF files a and b instead of the benchmark, exit status 1 if they differ" << std::endl;
+	std::cout << "   -hasvars f v,.. check NetCDF file f has these variables instead of the benchmark, exit status 1 if not" << std::endl;
+	std::cout << "   -novars f v,..  check NetCDF file f does not have these variables, may be combined with -hasvars" << std::endl;
 }
 
 int main(int argc, char** argv)
 {
 	_GSTITEM_
-	glog.logmsg("Opening log file\n");
-	glog.open("test.log");	
-	try{	
-		test_mpi(argc,argv);
-		//test_subsample();
-		//example_magnetics();
-		//example_aem_conductivity();	
-		//test_create();
-		//test_update();
-		//test_aseggdfexport_1d();
-		//test_aseggdfexport_2d();
-		//test_columnfile();
-		//test_aseggdfheader();
-		//test_marray();
-		//test_convert();		
+	glog.open("test.log");
+	try{
+		cBenchmarkOptions O;
+		bool mpitest = false;
+		std::string aseggdfpath;
+		std::vector<std::string> comparepaths;
+		std::vector<std::pair<std::string, std::string>> hasvars, novars;
+		for (int i = 1; i < argc; i++) {
+			std::string a = argv[i];
+			bool hasvalue = (i + 1 < argc);
+			if (a == "-nlines" && hasvalue) O.nlines = (size_t)atoll(argv[++i]);
+			else if (a == "-nsamples" && hasvalue) O.nsamples = (size_t)atoll(argv[++i]);
+			else if (a == "-nlayers" && hasvalue) O.nlayers = (size_t)atoll(argv[++i]);
+			else if (a == "-nwindows" && hasvalue) O.nwindows = (size_t)atoll(argv[++i]);
+			else if (a == "-nrandom" && hasvalue) O.nrandom = (size_t)atoll(argv[++i]);
+			else if (a == "-repeats" && hasvalue) O.repeats = std::max((size_t)1, (size_t)atoll(argv[++i]));
+			else if (a == "-cachemb" && hasvalue) O.cachebytes = (size_t)atoll(argv[++i]) * 1048576;
+			else if (a == "-seed" && hasvalue) O.seed = (unsigned int)atoi(argv[++i]);
+			else if (a == "-nc" && hasvalue) O.ncpath = argv[++i];
+			else if (a == "-csv" && hasvalue) O.csvpath = argv[++i];
+			else if (a == "-json" && hasvalue) O.jsonpath = argv[++i];
+			else if (a == "-label" && hasvalue) O.label = argv[++i];
+			else if (a == "-keep") O.keep = true;
+			else if (a == "-bandmajor") O.bandmajor = true;
+			else if (a == "-quantize" && hasvalue) O.quantize = argv[++i];
+			else if (a == "-deflate" && hasvalue) O.deflate = atoi(argv[++i]);
+			else if (a == "-compresstrial") O.compresstrial = true;
+			else if (a == "-mpitest") mpitest = true;
+			else if (a == "-writeaseggdf" && hasvalue) aseggdfpath = argv[++i];
+			else if (a == "-compare" && i + 2 < argc) {
+				comparepaths.push_back(argv[++i]);
+				comparepaths.push_back(argv[++i]);
+			}
+			else if (a == "-hasvars" && i + 2 < argc) {
+				hasvars.push_back({ argv[i + 1], argv[i + 2] });
+				i += 2;
+			}
+			else if (a == "-novars" && i + 2 < argc) {
+				novars.push_back({ argv[i + 1], argv[i + 2] });
+				i += 2;
+			}
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+		}
+
+		if (mpitest) {
+#ifdef ENABLE_MPI
+			MPI_Init(&argc, &argv);
+			bool pass = test_mpi_linewriter(O);
+			MPI_Finalize();
+			glog.close();
+			return pass ? 0 : 1;
+#else
+			std::cout << "This program was not built with MPI support" << std::endl;
+			return 1;
+#endif
+		}
+
+		if (aseggdfpath.size() > 0) {
+			bool ok = write_synthetic_aseggdf(aseggdfpath, O);
+			glog.close();
+			return ok ? 0 : 1;
+		}
+
+		if (comparepaths.size() == 2) {
+			bool same = compare_netcdf(comparepaths[0], comparepaths[1]);
+			glog.close();
+			return same ? 0 : 1;
+		}
+
+		if (hasvars.size() > 0 || novars.size() > 0) {
+			bool pass = true;
+			for (const auto& [path, list] : hasvars) pass = check_variables(path, split_list(list), true) && pass;
+			for (const auto& [path, list] : novars) pass = check_variables(path, split_list(list), false) && pass;
+			glog.close();
+			return pass ? 0 : 1;
+		}
+
+		cBenchmark B(O);
+		B.run();
 		glog.close();
 	}
 	catch (NcException& e)
 	{
-		_GSTPRINT_		
+		_GSTPRINT_
 		glog.logmsg(e.what());
 		return 1;
 	}
@@ -390,5 +773,3 @@ int main(int argc, char** argv)
 
 	return 0;
 }
-
-
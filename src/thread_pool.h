@@ -0,0 +1,162 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _thread_pool_H
+#define _thread_pool_H
+
+#include <vector>
+#include <queue>
+#include <deque>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+//Fixed size pool of worker threads taking tasks from a single queue
+class cThreadPool {
+
+	std::vector<std::thread> Workers;
+	std::queue<std::function<void()>> Tasks;
+	std::mutex Mutex;
+	std::condition_variable Condition;
+	bool Stopping = false;
+
+	void work() {
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(Mutex);
+				Condition.wait(lock, [this]() { return Stopping || Tasks.size() > 0; });
+				if (Stopping && Tasks.size() == 0) return;
+				task = std::move(Tasks.front());
+				Tasks.pop();
+			}
+			task();
+		}
+	}
+
+public:
+
+	//nthreads = 0 for the number of hardware threads
+	cThreadPool(size_t nthreads = 0) {
+		if (nthreads == 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+		for (size_t i = 0; i < nthreads; i++) {
+			Workers.emplace_back([this]() { work(); });
+		}
+	}
+
+	~cThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			Stopping = true;
+		}
+		Condition.notify_all();
+		for (auto& w : Workers) w.join();
+	}
+
+	size_t size() const { return Workers.size(); }
+
+	//Queue a task, the future returns its result or rethrows its exception
+	template<typename F>
+	auto submit(F&& f) -> std::future<decltype(f())> {
+		typedef decltype(f()) R;
+		auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+		std::future<R> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			Tasks.emplace([task]() { (*task)(); });
+		}
+		Condition.notify_one();
+		return result;
+	}
+};
+
+//Runs a fixed set of tasks, each worker owning a deque of task indices that starts as one contiguous block of
+//the tasks. A worker takes from the front of its own deque and, once that is empty, steals from the back of the
+//others, so tasks of very uneven cost (e.g. grid tiles with very different numbers of points) still balance.
+class cWorkStealingPool {
+
+	struct sQueue {
+		std::deque<size_t> Tasks;
+		std::mutex Mutex;
+	};
+
+	size_t NumThreads;
+
+	static bool pop_front(sQueue& q, size_t& task) {
+		std::lock_guard<std::mutex> lock(q.Mutex);
+		if (q.Tasks.size() == 0) return false;
+		task = q.Tasks.front();
+		q.Tasks.pop_front();
+		return true;
+	}
+
+	static bool pop_back(sQueue& q, size_t& task) {
+		std::lock_guard<std::mutex> lock(q.Mutex);
+		if (q.Tasks.size() == 0) return false;
+		task = q.Tasks.back();
+		q.Tasks.pop_back();
+		return true;
+	}
+
+public:
+
+	//nthreads = 0 for the number of hardware threads
+	cWorkStealingPool(size_t nthreads = 0) {
+		if (nthreads == 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+		NumThreads = nthreads;
+	}
+
+	size_t size() const { return NumThreads; }
+
+	//Call f(taskindex, workerindex) for every taskindex in [0, ntasks) and wait for them all.
+	//The first exception thrown by a task stops the remaining tasks and is rethrown here.
+	template<typename F>
+	void run(const size_t ntasks, F&& f) {
+		const size_t nw = std::max((size_t)1, std::min(NumThreads, ntasks));
+		std::vector<sQueue> queues(nw);
+		for (size_t wi = 0; wi < nw; wi++) {
+			for (size_t ti = wi * ntasks / nw; ti < (wi + 1) * ntasks / nw; ti++) queues[wi].Tasks.push_back(ti);
+		}
+
+		std::atomic<bool> failed(false);
+		std::exception_ptr error;
+		std::mutex errormutex;
+		auto work = [&](const size_t wi) {
+			size_t task;
+			while (failed == false) {
+				bool found = pop_front(queues[wi], task);
+				for (size_t k = 1; found == false && k < nw; k++) {
+					found = pop_back(queues[(wi + k) % nw], task);
+				}
+				if (found == false) return;
+				try {
+					f(task, wi);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lock(errormutex);
+					if (error == nullptr) error = std::current_exception();
+					failed = true;
+				}
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (size_t wi = 1; wi < nw; wi++) workers.emplace_back(work, wi);
+		work(0);
+		for (auto& w : workers) w.join();
+		if (error) std::rethrow_exception(error);
+	}
+};
+
+#endif